@@ -0,0 +1,555 @@
+#pragma once
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+#include "Model.h"
+#include "Profiler.h"
+#include "SceneGraph.h"
+#include "Shader.h"
+#include "Simd.h"
+#include "Skeleton.h"
+#include "ThreadPool.h"
+#include "UniformBuffer.h"
+
+//Skeletal animation for models with bones (Model::skeleton): AnimationClip holds the keyframes of an
+//aiAnimation, an Animator plays one or two clips on one character and turns them into its bone
+//palette, BonePalettes puts the palettes of every character on the GPU for the SKINNED shaders, and
+//skinVertices is the CPU fallback for a skeleton or renderer those shaders can't handle.
+//
+//   std::vector<AnimationClip> clips = AnimationClip::load("resources/objects/guy/walk.fbx", guy.skeleton);
+//   std::vector<Animator> crowd(count, Animator(guy));
+//   crowd[i].play(clips[0]);
+//   ...
+//   Animator::updateAll(crowd, deltaTime);   // sampling, blending and palettes on the ThreadPool
+//   palettes.upload(crowd);                  // one buffer for all of them
+//   palettes.bind(i); guy.DrawSkinned(skinnedShader, transforms[i]);
+
+// the local transform of every node of a model, as translation, rotation and scale arrays
+struct Pose
+{
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+
+    // the nodes' own transformations, what every node without a track keeps
+    static Pose bind(const SceneGraph& nodes)
+    {
+        Pose pose;
+        pose.translations.resize(nodes.size());
+        pose.rotations.resize(nodes.size());
+        pose.scales.resize(nodes.size());
+        for (uint32_t node = 0; node < nodes.size(); node++)
+        {
+            const glm::mat4& local = nodes.local(node);
+            glm::vec3 scale(glm::length(glm::vec3(local[0])), glm::length(glm::vec3(local[1])), glm::length(glm::vec3(local[2])));
+            if (glm::determinant(glm::mat3(local)) < 0.0f)
+                scale.x = -scale.x;
+            glm::mat3 rotation(glm::vec3(local[0]) / scale.x, glm::vec3(local[1]) / scale.y, glm::vec3(local[2]) / scale.z);
+            pose.translations[node] = glm::vec3(local[3]);
+            pose.rotations[node] = glm::normalize(glm::quat_cast(rotation));
+            pose.scales[node] = scale;
+        }
+        return pose;
+    }
+};
+
+// normalized lerp along the shorter arc; between neighbouring keys it is as good as slerp and much cheaper
+inline glm::quat nlerp(const glm::quat& a, const glm::quat& b, float t)
+{
+    glm::quat to = glm::dot(a, b) < 0.0f ? -b : b;
+    return glm::normalize(a * (1.0f - t) + to * t);
+}
+
+// where an Animator stopped in each key array of a track last time
+struct KeyCursor
+{
+    uint32_t position = 0, rotation = 0, scale = 0;
+};
+
+//The keyframes of one animation. Each track drives a node of the model: its position, rotation and
+//scale keys sit in three pairs of arrays shared by all tracks (times and values apart, the tracks one
+//after the other), so sampling a clip walks a few flat arrays instead of a vector per channel.
+//
+//Sampling doesn't search for the keys around the time: every track has a KeyCursor where the last
+//sample stopped, and as playback moves forward that key or the next one or two is the one it needs.
+//A time before the cursor (the clip looped, or was seeked back) starts over from the first key.
+class AnimationClip
+{
+public:
+    struct Track
+    {
+        uint32_t node;
+        uint32_t firstPosition, positionCount;
+        uint32_t firstRotation, rotationCount;
+        uint32_t firstScale, scaleCount;
+    };
+
+    std::string name;
+    float duration = 0.0f;  // seconds
+    std::vector<Track> tracks;
+    std::vector<float> positionTimes, rotationTimes, scaleTimes;  // seconds
+    std::vector<glm::vec3> positions, scales;
+    std::vector<glm::quat> rotations;
+
+    AnimationClip() {}
+    // channels for nodes the skeleton doesn't name are left out
+    AnimationClip(const aiAnimation* animation, const Skeleton& skeleton)
+    {
+        name = animation->mName.C_Str();
+        double ticksPerSecond = animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+        duration = (float)(animation->mDuration / ticksPerSecond);
+        for (unsigned int c = 0; c < animation->mNumChannels; c++)
+        {
+            const aiNodeAnim* channel = animation->mChannels[c];
+            uint32_t node = skeleton.findNode(channel->mNodeName.C_Str());
+            if (node == SceneGraph::NO_PARENT)
+                continue;
+            addTrack(node);
+            for (unsigned int k = 0; k < channel->mNumPositionKeys; k++)
+            {
+                const aiVectorKey& key = channel->mPositionKeys[k];
+                addPosition((float)(key.mTime / ticksPerSecond), glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            for (unsigned int k = 0; k < channel->mNumRotationKeys; k++)
+            {
+                const aiQuatKey& key = channel->mRotationKeys[k];
+                addRotation((float)(key.mTime / ticksPerSecond), glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            for (unsigned int k = 0; k < channel->mNumScalingKeys; k++)
+            {
+                const aiVectorKey& key = channel->mScalingKeys[k];
+                addScale((float)(key.mTime / ticksPerSecond), glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+        }
+    }
+
+    // every animation in the file, bound to the nodes of a model loaded with skeleton (often the same file)
+    static std::vector<AnimationClip> load(const std::string& path, const Skeleton& skeleton)
+    {
+        PROFILE_ZONE("AnimationClip::load");
+        std::vector<AnimationClip> clips;
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, 0);
+        if (!scene)
+        {
+            std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << "\n";
+            return clips;
+        }
+        clips.reserve(scene->mNumAnimations);
+        for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+            clips.emplace_back(scene->mAnimations[i], skeleton);
+        if (clips.empty())
+            std::cout << "ERROR::ANIMATION::NO_ANIMATIONS " << path << std::endl;
+        return clips;
+    }
+
+    // starts the track of node; the keys added next belong to it, each kind in time order
+    void addTrack(uint32_t node)
+    {
+        tracks.push_back(Track{ node, (uint32_t)positions.size(), 0, (uint32_t)rotations.size(), 0, (uint32_t)scales.size(), 0 });
+    }
+    void addPosition(float time, const glm::vec3& value)
+    {
+        positionTimes.push_back(time);
+        positions.push_back(value);
+        tracks.back().positionCount++;
+    }
+    void addRotation(float time, const glm::quat& value)
+    {
+        rotationTimes.push_back(time);
+        rotations.push_back(value);
+        tracks.back().rotationCount++;
+    }
+    void addScale(float time, const glm::vec3& value)
+    {
+        scaleTimes.push_back(time);
+        scales.push_back(value);
+        tracks.back().scaleCount++;
+    }
+
+    // writes every track's value at time into pose, moving cursors (one per track) along
+    void sample(float time, KeyCursor* cursors, Pose& pose) const
+    {
+        for (size_t t = 0; t < tracks.size(); t++)
+        {
+            const Track& track = tracks[t];
+            KeyCursor& cursor = cursors[t];
+            if (track.positionCount > 0)
+                pose.translations[track.node] = sampleKeys(&positionTimes[track.firstPosition], &positions[track.firstPosition], track.positionCount, cursor.position, time,
+                    [](const glm::vec3& a, const glm::vec3& b, float f) { return glm::mix(a, b, f); });
+            if (track.rotationCount > 0)
+                pose.rotations[track.node] = sampleKeys(&rotationTimes[track.firstRotation], &rotations[track.firstRotation], track.rotationCount, cursor.rotation, time,
+                    [](const glm::quat& a, const glm::quat& b, float f) { return nlerp(a, b, f); });
+            if (track.scaleCount > 0)
+                pose.scales[track.node] = sampleKeys(&scaleTimes[track.firstScale], &scales[track.firstScale], track.scaleCount, cursor.scale, time,
+                    [](const glm::vec3& a, const glm::vec3& b, float f) { return glm::mix(a, b, f); });
+        }
+    }
+
+    // the last key at or before time, starting from cursor
+    static uint32_t seek(const float* times, uint32_t count, uint32_t cursor, float time)
+    {
+        if (cursor >= count || times[cursor] > time)
+            cursor = 0;
+        while (cursor + 1 < count && times[cursor + 1] <= time)
+            cursor++;
+        return cursor;
+    }
+
+private:
+    template <typename T, typename Mix>
+    static T sampleKeys(const float* times, const T* values, uint32_t count, uint32_t& cursor, float time, Mix mix)
+    {
+        cursor = seek(times, count, cursor, time);
+        if (cursor + 1 >= count || time <= times[cursor])
+            return values[cursor];
+        float f = (time - times[cursor]) / (times[cursor + 1] - times[cursor]);
+        return mix(values[cursor], values[cursor + 1], f);
+    }
+};
+
+//Plays animation on one character of a model: a clip, and optionally a second one mixed in by weight,
+//either held (blend(): walk and run by speed) or fading out after play() with a fade time. update()
+//samples the clips into poses, blends them, composes the node matrices down the model's hierarchy and
+//multiplies each bone's node matrix with its offset into the palette the shaders read.
+//
+//An Animator only reads the model (its nodes and skeleton), which has to outlive it; updates of
+//different Animators are independent, which is what updateAll() spreads over the ThreadPool.
+class Animator
+{
+public:
+    float speed = 1.0f;     // playback rate of both clips
+
+    explicit Animator(const Model& model) : nodes(&model.nodes), skeleton(&model.skeleton)
+    {
+        bindPose = Pose::bind(model.nodes);
+        layers[0].pose = bindPose;
+        layers[1].pose = bindPose;
+        worlds.resize(nodes->size());
+        palette.resize(skeleton->boneCount());
+        update(0.0f);
+    }
+
+    // switches to clip from the start; with a fade time the clip playing so far blends out over it
+    void play(const AnimationClip& clip, float fadeSeconds = 0.0f)
+    {
+        if (fadeSeconds > 0.0f && layers[0].clip)
+        {
+            std::swap(layers[0], layers[1]);
+            weight = 1.0f;
+            fadeRate = 1.0f / fadeSeconds;
+        }
+        else
+        {
+            start(layers[1], nullptr);
+            weight = 0.0f;
+            fadeRate = 0.0f;
+        }
+        start(layers[0], &clip);
+    }
+    // mixes clip into the played one at weight: 0 shows only the played clip, 1 only this one
+    void blend(const AnimationClip* clip, float blendWeight)
+    {
+        if (layers[1].clip != clip)
+            start(layers[1], clip);
+        weight = clip ? glm::clamp(blendWeight, 0.0f, 1.0f) : 0.0f;
+        fadeRate = 0.0f;
+    }
+    // jumps to time seconds into the played clip (and the blended one)
+    void seek(float time)
+    {
+        layers[0].time = wrap(layers[0], time);
+        layers[1].time = wrap(layers[1], time);
+    }
+    float time() const
+    {
+        return layers[0].time;
+    }
+
+    // advances the clips by deltaTime and recomputes the palette
+    void update(float deltaTime)
+    {
+        advance(layers[0], deltaTime);
+        if (fadeRate > 0.0f)
+        {
+            weight -= deltaTime * fadeRate;
+            if (weight <= 0.0f)
+                blend(nullptr, 0.0f);
+        }
+        if (weight > 0.0f)
+            advance(layers[1], deltaTime);
+        if (layers[0].clip)
+            layers[0].clip->sample(layers[0].time, layers[0].cursors.data(), layers[0].pose);
+        if (weight > 0.0f && layers[1].clip)
+            layers[1].clip->sample(layers[1].time, layers[1].cursors.data(), layers[1].pose);
+
+        // local matrices straight into world ones: parents come first in the SceneGraph's arrays
+        const Pose& a = layers[0].pose;
+        const Pose& b = layers[1].pose;
+        for (uint32_t node = 0; node < worlds.size(); node++)
+        {
+            glm::vec3 translation = a.translations[node], scale = a.scales[node];
+            glm::quat rotation = a.rotations[node];
+            if (weight > 0.0f)
+            {
+                translation = glm::mix(translation, b.translations[node], weight);
+                rotation = nlerp(rotation, b.rotations[node], weight);
+                scale = glm::mix(scale, b.scales[node], weight);
+            }
+            glm::mat3 r = glm::mat3_cast(rotation);
+            glm::mat4 local(glm::vec4(r[0] * scale.x, 0.0f), glm::vec4(r[1] * scale.y, 0.0f), glm::vec4(r[2] * scale.z, 0.0f), glm::vec4(translation, 1.0f));
+            uint32_t parent = nodes->parent(node);
+            if (parent == SceneGraph::NO_PARENT)
+                worlds[node] = local;
+            else
+                SceneGraph::multiply(worlds[parent], local, worlds[node]);
+        }
+        for (uint32_t bone = 0; bone < palette.size(); bone++)
+            SceneGraph::multiply(worlds[skeleton->boneNodes[bone]], skeleton->offsets[bone], palette[bone]);
+    }
+
+    // per bone, model space after the pose times the bone's offset; what Vertex::m_BoneIDs index
+    const std::vector<glm::mat4>& bones() const
+    {
+        return palette;
+    }
+    // the animated model-space matrix of every node
+    const glm::mat4& world(uint32_t node) const
+    {
+        return worlds[node];
+    }
+
+    // updates every animator, spread over pool (nullptr: on this thread)
+    static void updateAll(std::vector<Animator>& animators, float deltaTime, ThreadPool* pool = &ThreadPool::shared())
+    {
+        PROFILE_ZONE("Animator::updateAll");
+        auto body = [&animators, deltaTime](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                animators[i].update(deltaTime);
+        };
+        if (pool)
+            pool->parallelFor(animators.size(), body, 16);
+        else
+            body(0, animators.size());
+    }
+
+private:
+    struct Layer
+    {
+        const AnimationClip* clip = nullptr;
+        float time = 0.0f;
+        std::vector<KeyCursor> cursors;     // one per track of clip
+        Pose pose;                          // the bind pose where clip has no track
+    };
+
+    const SceneGraph* nodes;
+    const Skeleton* skeleton;
+    Pose bindPose;
+    Layer layers[2];
+    float weight = 0.0f;        // of layers[1]
+    float fadeRate = 0.0f;      // weight lost per second while play() fades the previous clip out
+    std::vector<glm::mat4> worlds, palette;
+
+    void start(Layer& layer, const AnimationClip* clip)
+    {
+        // a track of the previous clip may have moved a node this one leaves alone
+        if (layer.clip)
+            for (const AnimationClip::Track& track : layer.clip->tracks)
+            {
+                layer.pose.translations[track.node] = bindPose.translations[track.node];
+                layer.pose.rotations[track.node] = bindPose.rotations[track.node];
+                layer.pose.scales[track.node] = bindPose.scales[track.node];
+            }
+        layer.clip = clip;
+        layer.time = 0.0f;
+        layer.cursors.assign(clip ? clip->tracks.size() : 0, KeyCursor());
+    }
+    static float wrap(const Layer& layer, float time)
+    {
+        if (!layer.clip || layer.clip->duration <= 0.0f)
+            return 0.0f;
+        time = std::fmod(time, layer.clip->duration);
+        return time < 0.0f ? time + layer.clip->duration : time;
+    }
+    void advance(Layer& layer, float deltaTime)
+    {
+        layer.time = wrap(layer, layer.time + deltaTime * speed);
+    }
+};
+
+// the texture unit of the palettes for instanced draws, below the ones LightClusterBuffers takes
+enum BoneTextureUnit
+{
+    BONE_PALETTES_UNIT = 12     // samplerBuffer bonePalettes
+};
+
+//The palettes of every Animator in one GL buffer, uploaded once per frame. Palette i starts at
+//i * stride, a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, so the same buffer serves both ways
+//the SKINNED shader reads bones:
+//   bind(i)              a range of it as the "Bones" uniform block, for one character per draw; the
+//                        block holds MAX_BONES matrices, larger skeletons need skinVertices
+//   bindInstanced(s, i)  all of it as an RGBA32F texture buffer, for a SKINNED | INSTANCED draw whose
+//                        instance j is character i + j: a crowd of one model in one draw call
+//upload() and the binds on the GL thread.
+class BonePalettes
+{
+public:
+    size_t stride = 0;  // bytes from one palette to the next
+
+    BonePalettes()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        uniformAlignment = (size_t)std::max(alignment, 16);
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        glGenBuffers(1, &buffer);
+        glGenTextures(1, &texture);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    ~BonePalettes()
+    {
+        glDeleteTextures(1, &texture);
+        glDeleteBuffers(1, &buffer);
+    }
+    BonePalettes(const BonePalettes&) = delete;
+    BonePalettes& operator=(const BonePalettes&) = delete;
+
+    // replaces the buffer's contents with the animators' palettes, written straight into the mapped buffer
+    void upload(const std::vector<Animator>& animators)
+    {
+        PROFILE_ZONE("BonePalettes::upload");
+        size_t bones = 1;
+        for (const Animator& animator : animators)
+            bones = std::max(bones, animator.bones().size());
+        stride = (bones * sizeof(glm::mat4) + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+        count = animators.size();
+        // the last palette's uniform range still has to lie inside the buffer
+        size_t blockBytes = MAX_BONES * sizeof(glm::mat4);
+        size_t bytes = std::max<size_t>(count * stride + (blockBytes > stride ? blockBytes - stride : 0), 16);
+        if (count * stride / 16 > (size_t)maxTexels)
+            std::cout << "ERROR::BONE_PALETTES::TEXTURE_BUFFER_TOO_SMALL " << count << " palettes need " << count * stride / 16 << " texels" << std::endl;
+
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)bytes, NULL, GL_STREAM_DRAW);    // orphans last frame's storage
+        if (count > 0)
+        {
+            unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            for (size_t i = 0; i < count; i++)
+                std::memcpy(mapped + i * stride, animators[i].bones().data(), animators[i].bones().size() * sizeof(glm::mat4));
+            glUnmapBuffer(GL_TEXTURE_BUFFER);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        uploadedBytes = bytes;
+    }
+    size_t bytes() const
+    {
+        return uploadedBytes;
+    }
+
+    // the "Bones" block of the next draws reads palette index
+    void bind(size_t index) const
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, BONES_BLOCK_BINDING, buffer, (GLintptr)(index * stride), (GLsizeiptr)(MAX_BONES * sizeof(glm::mat4)));
+    }
+    // instance j of the next instanced draws with shader (in use) reads palette first + j
+    void bindInstanced(Shader& shader, size_t first) const
+    {
+        glActiveTexture(GL_TEXTURE0 + BONE_PALETTES_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("bonePalettes", BONE_PALETTES_UNIT);
+        shader.setInt("paletteBase", (int)first);
+        shader.setInt("paletteTexels", (int)(stride / 16));
+    }
+
+private:
+    GLuint buffer = 0, texture = 0;
+    GLint maxTexels = 65536;
+    size_t uniformAlignment = 256;
+    size_t count = 0, uploadedBytes = 0;
+};
+
+// Skins count bind-pose vertices with palette on the CPU, writing the moved Position and Normal to out
+// (its other members are left as they are: copy the vertices in once). The fallback where the SKINNED
+// shader can't be used, e.g. a skeleton over MAX_BONES; Mesh::updateVertices then uploads out.
+// Per vertex the four weighted bones are summed into one matrix and applied to both, a column pair per
+// AVX register (a column per SSE one).
+inline void skinVertices(const Vertex* vertices, size_t count, const glm::mat4* palette, Vertex* out)
+{
+    const float* bones = &palette[0][0][0];
+    for (size_t v = 0; v < count; v++)
+    {
+        const Vertex& vertex = vertices[v];
+        float position[4], normal[4];
+#if defined(SIMD_AVX)
+        __m256 lo = _mm256_setzero_ps(), hi = _mm256_setzero_ps();   // columns 0-1 and 2-3 of the blended matrix
+        for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+        {
+            __m256 w = _mm256_set1_ps(vertex.m_Weights[i]);
+            const float* bone = bones + 16 * vertex.m_BoneIDs[i];
+            lo = _mm256_add_ps(lo, _mm256_mul_ps(w, _mm256_loadu_ps(bone)));
+            hi = _mm256_add_ps(hi, _mm256_mul_ps(w, _mm256_loadu_ps(bone + 8)));
+        }
+        const glm::vec3& p = vertex.Position;
+        const glm::vec3& n = vertex.Normal;
+        __m256 sp = _mm256_add_ps(_mm256_mul_ps(lo, _mm256_setr_ps(p.x, p.x, p.x, p.x, p.y, p.y, p.y, p.y)),
+            _mm256_mul_ps(hi, _mm256_setr_ps(p.z, p.z, p.z, p.z, 1.0f, 1.0f, 1.0f, 1.0f)));
+        __m256 sn = _mm256_add_ps(_mm256_mul_ps(lo, _mm256_setr_ps(n.x, n.x, n.x, n.x, n.y, n.y, n.y, n.y)),
+            _mm256_mul_ps(hi, _mm256_setr_ps(n.z, n.z, n.z, n.z, 0.0f, 0.0f, 0.0f, 0.0f)));
+        _mm_storeu_ps(position, _mm_add_ps(_mm256_castps256_ps128(sp), _mm256_extractf128_ps(sp, 1)));
+        _mm_storeu_ps(normal, _mm_add_ps(_mm256_castps256_ps128(sn), _mm256_extractf128_ps(sn, 1)));
+#elif defined(SIMD_SSE)
+        __m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+        for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+        {
+            __m128 w = _mm_set1_ps(vertex.m_Weights[i]);
+            const float* bone = bones + 16 * vertex.m_BoneIDs[i];
+            c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(bone)));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(bone + 4)));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(bone + 8)));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(bone + 12)));
+        }
+        const glm::vec3& p = vertex.Position;
+        const glm::vec3& n = vertex.Normal;
+        __m128 sp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y))), _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p.z)), c3));
+        __m128 sn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n.x)), _mm_mul_ps(c1, _mm_set1_ps(n.y))), _mm_mul_ps(c2, _mm_set1_ps(n.z)));
+        _mm_storeu_ps(position, sp);
+        _mm_storeu_ps(normal, sn);
+#else
+        glm::mat4 skin(0.0f);
+        for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+            skin += palette[vertex.m_BoneIDs[i]] * vertex.m_Weights[i];
+        glm::vec4 sp = skin * glm::vec4(vertex.Position, 1.0f);
+        glm::vec3 sn = glm::mat3(skin) * vertex.Normal;
+        position[0] = sp.x; position[1] = sp.y; position[2] = sp.z;
+        normal[0] = sn.x; normal[1] = sn.y; normal[2] = sn.z;
+#endif
+        out[v].Position = glm::vec3(position[0], position[1], position[2]);
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+        out[v].Normal = glm::vec3(normal[0] * inverse, normal[1] * inverse, normal[2] * inverse);
+    }
+}
+
+#endif
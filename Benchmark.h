@@ -0,0 +1,2595 @@
+#pragma once
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Micro-benchmarks, started from the command line with: RollingBall --bench <name>
+// GL benchmarks create their own offscreen context: EGL on Linux (works under Mesa llvmpipe,
+// run with EGL_PLATFORM=surfaceless on a machine without a display), a hidden GLFW window elsewhere.
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef _WIN32
+#undef APIENTRY    // windows.h defines it again
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#undef near        // minwindef.h leaves these empty macros behind, which erase any parameter named near or far
+#undef far
+#else
+#include <sys/resource.h>
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Mesh.h"
+#include "Animation.h"
+#include "Broadphase.h"
+#include "Bvh.h"
+#include "Frustum.h"
+#include "FramePipeline.h"
+#include "GpuProfiler.h"
+#include "InstanceBuffer.h"
+#include "Model.h"
+#include "ModelLoader.h"
+#include "ModelBatch.h"
+#include "Physics.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "Shader.h"
+#include "ShaderCache.h"
+#include "ShaderLibrary.h"
+#include "TextureCache.h"
+#include "TextureBaker.h"
+#include "TextureLoader.h"
+#include "UniformBuffer.h"
+
+class BenchmarkContext
+{
+public:
+    bool create(int width = 64, int height = 64)
+    {
+#ifdef __linux__
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        if (getPlatformDisplay && clientExtensions && std::strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        else
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+        {
+            std::cout << "ERROR::BENCHMARK::EGL_INITIALIZE_FAILED" << std::endl;
+            return false;
+        }
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cout << "ERROR::BENCHMARK::EGL_NO_CONFIG" << std::endl;
+            return false;
+        }
+        const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+        eglBindAPI(EGL_OPENGL_API);
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context))
+        {
+            std::cout << "ERROR::BENCHMARK::EGL_CONTEXT_FAILED" << std::endl;
+            return false;
+        }
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+#else
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(width, height, "Rolling Ball 3D benchmark", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+#endif
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+        std::cout << "Renderer: " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")" << std::endl;
+        return true;
+    }
+
+    // the GL function loader of the context, for entry points glad doesn't know (ProgramBinaryCache::init)
+    static GLADloadproc loader()
+    {
+#ifdef __linux__
+        return (GLADloadproc)eglGetProcAddress;
+#else
+        return (GLADloadproc)glfwGetProcAddress;
+#endif
+    }
+
+    ~BenchmarkContext()
+    {
+        destroy();
+    }
+
+    // benchmarks declare the context first so it outlives every GL object they create
+    void destroy()
+    {
+#ifdef __linux__
+        if (display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            if (surface != EGL_NO_SURFACE)
+                eglDestroySurface(display, surface);
+            eglTerminate(display);
+            display = EGL_NO_DISPLAY;
+        }
+#else
+        glfwTerminate();
+#endif
+    }
+
+private:
+#ifdef __linux__
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+#else
+    GLFWwindow* window = NULL;
+#endif
+};
+
+// wall clock stopwatch for the benchmark loops
+struct BenchmarkTimer
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double elapsedMs() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// resident memory of the process in MiB: the high-water mark and the current value
+inline double peakResidentMiB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;   // kilobytes on Linux
+#endif
+}
+
+inline double currentResidentMiB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize / (1024.0 * 1024.0);
+#else
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * 4096.0 / (1024.0 * 1024.0);
+#endif
+}
+
+// Uniform update cost for a frame of the point light demo. First the per-frame state (camera,
+// directional light, 4 point lights, shininess) the way it used to go out, 36 uniforms by name
+// on the pre-UBO shader kept in second-demo, against the two Frame/Lights uniform buffer uploads that
+// replaced them. Then every cube sets its model matrix and material on top of those uploads, once
+// through glGetUniformLocation with a freshly built string (the old Shader path), once through the
+// cached table and once through handles.
+// ------------------------------------------------------------------------
+inline int benchmarkUniforms()
+{
+    const int FRAMES = 2000;
+    const int CUBES = 10;
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+
+    Shader shader("./shaders/lightingVertex.vert", "./shaders/lightingFragment.frag");
+    shader.use();
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    UniformBuffer<LightsUBO> lightUniforms(LIGHTS_BLOCK_BINDING);
+
+    const glm::mat4 matrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    const glm::vec3 vector(0.5f, 1.0f, 2.0f);
+    const int drawsPerRun = FRAMES * CUBES;
+
+    // 0. per-frame state before the uniform buffers: every camera and light uniform by name, every frame
+    Shader plainShader("./second-demo/shaders/lightingVertex.vert", "./second-demo/shaders/lightingFragment.frag");
+    plainShader.use();
+    std::vector<std::string> vec3Names = { "viewPos", "dirLight.direction", "dirLight.ambient", "dirLight.diffuse", "dirLight.specular" };
+    std::vector<std::string> floatNames = { "material.shininess" };
+    for (int i = 0; i < 4; i++)
+    {
+        std::string light = "pointLights[" + std::to_string(i) + "].";
+        for (const char* member : { "position", "ambient", "diffuse", "specular" })
+            vec3Names.push_back(light + member);
+        for (const char* member : { "constant", "linear", "quadratic" })
+            floatNames.push_back(light + member);
+    }
+    BenchmarkTimer frameByName;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(plainShader.ID, std::string("projection").c_str()), 1, GL_FALSE, &matrix[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(plainShader.ID, std::string("view").c_str()), 1, GL_FALSE, &matrix[0][0]);
+        for (const std::string& name : vec3Names)
+            glUniform3fv(glGetUniformLocation(plainShader.ID, std::string(name).c_str()), 1, &vector[0]);
+        for (const std::string& name : floatNames)
+            glUniform1f(glGetUniformLocation(plainShader.ID, std::string(name).c_str()), 1.0f);
+    }
+    glFinish();
+    double frameByNameMs = frameByName.elapsedMs();
+
+    // and after: the same state in two uniform buffer uploads
+    shader.use();
+    BenchmarkTimer frameBuffers;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        frameUniforms.data.view = matrix;
+        frameUniforms.update();
+        lightUniforms.update();
+    }
+    glFinish();
+    double frameBuffersMs = frameBuffers.elapsedMs();
+
+    // 1. old path: a name string and a glGetUniformLocation for every single upload
+    BenchmarkTimer byName;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        frameUniforms.data.view = matrix;
+        frameUniforms.update();
+        lightUniforms.update();
+        for (int cube = 0; cube < CUBES; cube++)
+        {
+            glUniformMatrix4fv(glGetUniformLocation(shader.ID, std::string("model").c_str()), 1, GL_FALSE, &matrix[0][0]);
+            glUniform1i(glGetUniformLocation(shader.ID, std::string("material.diffuse").c_str()), 0);
+            glUniform1i(glGetUniformLocation(shader.ID, std::string("material.specular").c_str()), 1);
+            glUniform1f(glGetUniformLocation(shader.ID, std::string("material.shininess").c_str()), 32.0f);
+        }
+    }
+    glFinish();
+    double byNameMs = byName.elapsedMs();
+
+    // 2. Shader::setX, which now resolves through the location table built at link time
+    BenchmarkTimer cached;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        frameUniforms.data.view = matrix;
+        frameUniforms.update();
+        lightUniforms.update();
+        for (int cube = 0; cube < CUBES; cube++)
+        {
+            shader.setMat4("model", matrix);
+            shader.setInt("material.diffuse", 0);
+            shader.setInt("material.specular", 1);
+            shader.setFloat("material.shininess", 32.0f);
+        }
+    }
+    glFinish();
+    double cachedMs = cached.elapsedMs();
+
+    // 3. handles resolved once, no strings in the loop
+    UniformHandle<glm::mat4> model = shader.uniform<glm::mat4>("model");
+    UniformHandle<int> diffuse = shader.uniform<int>("material.diffuse");
+    UniformHandle<int> specular = shader.uniform<int>("material.specular");
+    UniformHandle<float> shininess = shader.uniform<float>("material.shininess");
+    BenchmarkTimer handles;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        frameUniforms.data.view = matrix;
+        frameUniforms.update();
+        lightUniforms.update();
+        for (int cube = 0; cube < CUBES; cube++)
+        {
+            model.set(matrix);
+            diffuse.set(0);
+            specular.set(1);
+            shininess.set(32.0f);
+        }
+    }
+    glFinish();
+    double handlesMs = handles.elapsedMs();
+
+    size_t frameUniformCount = 2 + vec3Names.size() + floatNames.size();
+    std::cout << "per-frame state, " << frameUniformCount << " uniforms by name: " << frameByNameMs * 1e6 / FRAMES << " ns/frame" << std::endl;
+    std::cout << "per-frame state, 2 uniform buffer uploads: " << frameBuffersMs * 1e6 / FRAMES << " ns/frame" << std::endl;
+    std::cout << "frames: " << FRAMES << ", draws: " << drawsPerRun << ", uniform buffer uploads per frame: 2" << std::endl;
+    std::cout << "glGetUniformLocation: " << byNameMs * 1e6 / drawsPerRun << " ns/draw" << std::endl;
+    std::cout << "cached setX:          " << cachedMs * 1e6 / drawsPerRun << " ns/draw" << std::endl;
+    std::cout << "UniformHandle:        " << handlesMs * 1e6 / drawsPerRun << " ns/draw" << std::endl;
+
+    glDeleteProgram(plainShader.ID);
+    glDeleteProgram(shader.ID);
+    return 0;
+}
+
+// Load-time cost of resolving material texture references for a synthetic scene: several models with
+// thousands of materials each, all drawing from one pool of image files. The old path scanned a
+// per-model list with strcmp and decoded shared files once per model; the TextureCache hashes the
+// path and shares textures between models. File loading is stubbed out so only the lookup is timed.
+// ------------------------------------------------------------------------
+static unsigned int benchmarkTextureCount = 0;
+static unsigned int benchmarkFakeLoad(const std::string&, bool) { return ++benchmarkTextureCount; }
+static void benchmarkFakeDelete(unsigned int) {}
+
+inline int benchmarkTextureCache()
+{
+    const int MODELS = 8;
+    const int REFERENCES_PER_MODEL = 4000;
+    const int DISTINCT_FILES = 1000;
+
+    std::vector<std::string> references;
+    references.reserve(REFERENCES_PER_MODEL);
+    for (int i = 0; i < REFERENCES_PER_MODEL; i++)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "textures/material_%04d_diffuse.png", (i * 7919) % DISTINCT_FILES);
+        references.push_back(name);
+    }
+
+    // 1. old path: linear strcmp scan over the textures this model already loaded
+    benchmarkTextureCount = 0;
+    BenchmarkTimer linear;
+    for (int model = 0; model < MODELS; model++)
+    {
+        std::vector<std::string> texturesLoaded;
+        for (const std::string& reference : references)
+        {
+            bool skip = false;
+            for (unsigned int j = 0; j < texturesLoaded.size(); j++)
+            {
+                if (std::strcmp(texturesLoaded[j].data(), reference.c_str()) == 0)
+                {
+                    skip = true;
+                    break;
+                }
+            }
+            if (!skip)
+            {
+                benchmarkFakeLoad(reference, false);
+                texturesLoaded.push_back(reference);
+            }
+        }
+    }
+    double linearMs = linear.elapsedMs();
+    unsigned int linearLoads = benchmarkTextureCount;
+
+    // 2. TextureCache, shared by all models
+    TextureCache& cache = TextureCache::instance();
+    cache.clear();
+    cache.setLoader(benchmarkFakeLoad, benchmarkFakeDelete);
+    benchmarkTextureCount = 0;
+    std::vector<unsigned int> acquired;
+    acquired.reserve(MODELS * REFERENCES_PER_MODEL);
+    BenchmarkTimer hashed;
+    for (int model = 0; model < MODELS; model++)
+        for (const std::string& reference : references)
+            acquired.push_back(cache.acquire("models/scene/" + reference));
+    double hashedMs = hashed.elapsedMs();
+    unsigned int hashedLoads = benchmarkTextureCount;
+    for (unsigned int id : acquired)
+        cache.release(id);
+    cache.clear();
+    cache.setLoader(NULL, NULL);
+
+    std::cout << MODELS << " models x " << REFERENCES_PER_MODEL << " material references, " << DISTINCT_FILES << " distinct files" << std::endl;
+    std::cout << "linear scan:  " << linearMs << " ms, " << linearLoads << " decodes" << std::endl;
+    std::cout << "TextureCache: " << hashedMs << " ms, " << hashedLoads << " decodes, " << cache.size() << " left after release" << std::endl;
+    return 0;
+}
+
+// Cold-start texture loading time against the number of decode threads. Every image the app ships
+// is loaded a few times as separate textures, first synchronously through TextureFromFile and then
+// through TextureLoader pools of growing size; the time runs until the last texture is uploaded.
+// ------------------------------------------------------------------------
+inline int benchmarkTextureDecode()
+{
+    const int REPEAT = 4;
+    const char* files[] = {
+        "./models/backpack/ao.jpg", "./models/beach-ball/Beach_Ball_diffuse.jpg", "./textures/container.jpg",
+        "./textures/container2.png", "./textures/container2_specular.png", "./textures/awesomeface.png" };
+    const int FILE_COUNT = sizeof(files) / sizeof(files[0]);
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    stbi_set_flip_vertically_on_load(true);
+    TextureBaker::instance().enabled = false;   // always the decode, see "texture-bake" for baked textures
+
+    std::vector<unsigned int> textures;
+    BenchmarkTimer synchronous;
+    for (int r = 0; r < REPEAT; r++)
+        for (int f = 0; f < FILE_COUNT; f++)
+            textures.push_back(TextureFromFile(files[f], "."));
+    glFinish();
+    std::cout << FILE_COUNT * REPEAT << " textures" << std::endl;
+    std::cout << "TextureFromFile:     " << synchronous.elapsedMs() << " ms" << std::endl;
+    glDeleteTextures((GLsizei)textures.size(), textures.data());
+
+    unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= std::max(8u, hardwareThreads); threads *= 2)
+    {
+        textures.clear();
+        BenchmarkTimer timer;
+        TextureLoader loader(threads);
+        for (int r = 0; r < REPEAT; r++)
+            for (int f = 0; f < FILE_COUNT; f++)
+                textures.push_back(loader.load(files[f]));
+        double returnedMs = timer.elapsedMs();
+        loader.finish();
+        glFinish();
+        std::cout << "TextureLoader " << threads << " thread(s): " << timer.elapsedMs() << " ms (load() returned after " << returnedMs << " ms)" << std::endl;
+        for (unsigned int id : textures)
+            loader.unload(id);
+    }
+    return 0;
+}
+
+// a UV sphere with every Vertex attribute filled in, for the geometry benchmarks
+inline void makeBenchmarkSphere(unsigned int rings, unsigned int segments, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+    vertices.clear();
+    indices.clear();
+    for (unsigned int r = 0; r <= rings; r++)
+    {
+        float v = (float)r / rings;
+        float phi = v * glm::pi<float>();
+        for (unsigned int s = 0; s <= segments; s++)
+        {
+            float u = (float)s / segments;
+            float theta = u * 2.0f * glm::pi<float>();
+            Vertex vertex;
+            vertex.Normal = glm::vec3(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+            vertex.Position = vertex.Normal;
+            vertex.TexCoords = glm::vec2(u, v);
+            vertex.Tangent = glm::vec3(-std::sin(theta), 0.0f, std::cos(theta));
+            vertex.Bitangent = glm::cross(vertex.Normal, vertex.Tangent);
+            for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+            {
+                vertex.m_BoneIDs[i] = (int)((r + i) % 64);
+                vertex.m_Weights[i] = i == 0 ? 1.0f : 0.0f;
+            }
+            vertices.push_back(vertex);
+        }
+    }
+    for (unsigned int r = 0; r < rings; r++)
+    {
+        for (unsigned int s = 0; s < segments; s++)
+        {
+            unsigned int a = r * (segments + 1) + s, b = a + segments + 1;
+            indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+}
+
+// Memory and throughput of the vertex layouts: the same 1M vertex sphere uploaded as the full Vertex
+// struct and as compact layouts for different attribute sets, then drawn repeatedly.
+// ------------------------------------------------------------------------
+inline int benchmarkVertexFormats()
+{
+    const int FRAMES = 20;
+    BenchmarkContext context;
+    if (!context.create(256, 256))
+        return -1;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(999, 999, vertices, indices);
+
+    Shader shader("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.update();
+    shader.use();
+    shader.setMat4("model", glm::mat4(1.0f));
+    glEnable(GL_DEPTH_TEST);
+
+    struct Case { const char* name; VertexFormat format; };
+    std::vector<Case> cases(4);
+    cases[0].name = "full Vertex               ";
+    cases[1].name = "compact, all attributes   ";
+    cases[1].format.layout = VERTEX_LAYOUT_COMPACT;
+    cases[2].name = "compact, lighting shader  ";
+    cases[2].format.layout = VERTEX_LAYOUT_COMPACT;
+    cases[2].format.attributes = (1u << ATTRIB_POSITION) | (1u << ATTRIB_NORMAL) | (1u << ATTRIB_TEXCOORDS);
+    cases[3].name = "compact, modelLoading.vert";
+    cases[3].format = VertexFormat::forShader(shader);
+
+    std::cout << vertices.size() << " vertices, " << indices.size() / 3 << " triangles" << std::endl;
+    for (const Case& c : cases)
+    {
+        BenchmarkTimer upload;
+        Mesh mesh(vertices, indices, std::vector<Texture>(), c.format);
+        glFinish();
+        double uploadMs = upload.elapsedMs();
+
+        BenchmarkTimer draw;
+        for (int frame = 0; frame < FRAMES; frame++)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            mesh.Draw(shader);
+        }
+        glFinish();
+        double drawMs = draw.elapsedMs() / FRAMES;
+
+        std::cout << c.name << ": " << c.format.stride() << " bytes/vertex, "
+            << vertices.size() * c.format.stride() / (1024.0 * 1024.0) << " MiB vertex buffer, "
+            << "setup " << uploadMs << " ms, draw " << drawMs << " ms/frame" << std::endl;
+    }
+    glDeleteProgram(shader.ID);
+    return 0;
+}
+
+// Load time and memory of Model construction. Peak RSS is a process-wide high-water mark, so run
+// once per configuration: "--bench model-load [path] [--compact] [--free]".
+// ------------------------------------------------------------------------
+inline int benchmarkModelLoad(const std::vector<std::string>& args)
+{
+    std::string path = "./models/backpack/backpack.obj";
+    VertexFormat format;
+    bool keepGeometry = true;
+    for (const std::string& arg : args)
+    {
+        if (arg == "--compact")
+            format.layout = VERTEX_LAYOUT_COMPACT;
+        else if (arg == "--free")
+            keepGeometry = false;
+        else
+            path = arg;
+    }
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    TextureCache::instance().setLoader(benchmarkFakeLoad, benchmarkFakeDelete);   // geometry only
+    ModelCache::instance().enabled = false;     // always the import, see "model-cache" for warm starts
+
+    double residentBefore = currentResidentMiB();
+    BenchmarkTimer load;
+    Model model(path, false, format, keepGeometry);
+    glFinish();
+    double loadMs = load.elapsedMs();
+
+    size_t vertexCount = 0, gpuBytes = 0;
+    for (const Mesh& mesh : model.meshes)
+    {
+        vertexCount += mesh.vertexCount;
+        gpuBytes += mesh.gpuBytes();
+    }
+    std::cout << path << ": " << model.meshes.size() << " meshes, " << vertexCount << " vertices, "
+        << gpuBytes / (1024.0 * 1024.0) << " MiB on the GPU" << std::endl;
+    std::cout << "load " << loadMs << " ms, peak RSS " << peakResidentMiB() << " MiB, RSS after load "
+        << currentResidentMiB() << " MiB (" << residentBefore << " MiB before)" << std::endl;
+    TextureCache::instance().setLoader(NULL, NULL);
+    return 0;
+}
+
+// Submission cost of a scene made of many small meshes: "--bench batch [model path]". 4000 spheres
+// spread over 20 materials and 50 model transforms, drawn once mesh by mesh (a glDrawElements, a VAO
+// switch and a texture rebind each) and once through a ModelBatch (one multi-draw per material and
+// transform). Then a model with node transforms (2CylinderEngine.glb by default) goes through a batch,
+// whose depth has to match Model::Draw(shader, transform) before and after setTransform moves it.
+// ------------------------------------------------------------------------
+inline int benchmarkBatch(const std::vector<std::string>& args)
+{
+    std::string path = args.size() > 0 ? args[0] : "./assimp-5.0.1/assimp-5.0.1/test/models/glTF2/2CylinderEngine-glTF-Binary/2CylinderEngine.glb";
+    const int FRAMES = 50;
+    const int MESHES = 4000;
+    const int MATERIALS = 20;
+    const int MODELS = 50;
+    BenchmarkContext context;
+    if (!context.create(256, 256))
+        return -1;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(6, 8, vertices, indices);
+
+    Shader shader("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 30.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.update();
+    shader.use();
+    VertexFormat format = VertexFormat::forShader(shader);
+
+    std::vector<unsigned int> textureIds(MATERIALS);
+    glGenTextures(MATERIALS, textureIds.data());
+    for (int m = 0; m < MATERIALS; m++)
+    {
+        const unsigned char color[4] = { (unsigned char)(m * 12), 128, 255, 255 };
+        glBindTexture(GL_TEXTURE_2D, textureIds[m]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, color);
+    }
+
+    // one mesh list per model, each mesh with its own GL buffers like Model::processMesh creates them
+    std::vector<std::vector<Mesh>> models(MODELS);
+    std::vector<glm::mat4> transforms(MODELS);
+    for (int i = 0; i < MODELS; i++)
+    {
+        models[i].reserve(MESHES / MODELS);
+        transforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3((i % 10) * 2.0f - 9.0f, (i / 10) * 2.0f - 4.0f, 0.0f));
+    }
+    for (int i = 0; i < MESHES; i++)
+    {
+        Texture texture;
+        texture.id = textureIds[i % MATERIALS];
+        texture.type = "texture_diffuse";
+        models[i % MODELS].emplace_back(vertices, indices, std::vector<Texture>(1, texture), format);
+    }
+
+    UniformHandle<glm::mat4> modelUniform = shader.uniform<glm::mat4>("model");
+    glEnable(GL_DEPTH_TEST);
+
+    // 1. every mesh on its own
+    BenchmarkTimer perMesh;
+    double perMeshSubmitMs = 0.0;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        BenchmarkTimer submit;
+        for (int i = 0; i < MODELS; i++)
+        {
+            modelUniform.set(transforms[i]);
+            for (Mesh& mesh : models[i])
+                mesh.Draw(shader);
+        }
+        perMeshSubmitMs += submit.elapsedMs();
+    }
+    glFinish();
+    double perMeshMs = perMesh.elapsedMs();
+
+    // 2. one arena, grouped by material
+    BenchmarkTimer build;
+    ModelBatch batch(format);
+    for (int i = 0; i < MODELS; i++)
+        batch.add(models[i], transforms[i]);
+    batch.build();
+    glFinish();
+    double buildMs = build.elapsedMs();
+
+    BenchmarkTimer batched;
+    double batchedSubmitMs = 0.0;
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        BenchmarkTimer submit;
+        batch.Draw(shader);
+        batchedSubmitMs += submit.elapsedMs();
+    }
+    glFinish();
+    double batchedMs = batched.elapsedMs();
+
+    std::cout << MESHES << " meshes, " << MATERIALS << " materials, " << MODELS << " transforms, " << FRAMES << " frames" << std::endl;
+    std::cout << "per mesh:   " << MESHES << " draw calls/frame, CPU submit " << perMeshSubmitMs / FRAMES
+        << " ms/frame, total " << perMeshMs / FRAMES << " ms/frame" << std::endl;
+    std::cout << "ModelBatch: " << batch.drawCalls << " draw calls/frame, " << batch.textureBinds << " material binds/frame, CPU submit "
+        << batchedSubmitMs / FRAMES << " ms/frame, total " << batchedMs / FRAMES << " ms/frame (build " << buildMs << " ms)" << std::endl;
+
+    // every mesh of a model where its node puts it
+    bool matched = true;
+    {
+        TextureCache::instance().setLoader(benchmarkFakeLoad, benchmarkFakeDelete);   // depth only
+        Model model(path, false, format);
+        TextureCache::instance().setLoader(NULL, NULL);
+        size_t placed = 0;
+        for (size_t i = 0; i < model.meshes.size(); i++)
+            placed += model.meshTransform(i) != glm::mat4(1.0f) ? 1 : 0;
+        BoundingBox bounds = model.bounds();
+        float radius = bounds.radius();
+        frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, radius * 0.1f, radius * 10.0f);
+        frameUniforms.data.view = glm::lookAt(bounds.center() + glm::vec3(0.0f, radius, radius * 3.0f), bounds.center(), glm::vec3(0.0f, 1.0f, 0.0f));
+        frameUniforms.update();
+
+        ModelBatch nodes(format);
+        glm::mat4 transform = glm::rotate(glm::mat4(1.0f), 0.4f, glm::vec3(0.0f, 1.0f, 0.0f));
+        unsigned int slot = nodes.add(model, transform);
+        nodes.build();
+        std::vector<float> drawn(256 * 256), batched(256 * 256);
+        float difference = 0.0f;
+        size_t covered = 0;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            if (pass == 1)
+            {
+                transform = glm::translate(glm::scale(transform, glm::vec3(1.0f, 0.5f, 1.0f)), glm::vec3(radius * 0.3f, 0.0f, 0.0f));
+                nodes.setTransform(slot, transform);
+            }
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            model.Draw(shader, transform);
+            glReadPixels(0, 0, 256, 256, GL_DEPTH_COMPONENT, GL_FLOAT, drawn.data());
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            nodes.Draw(shader);
+            glReadPixels(0, 0, 256, 256, GL_DEPTH_COMPONENT, GL_FLOAT, batched.data());
+            for (size_t i = 0; i < drawn.size(); i++)
+            {
+                difference = std::max(difference, std::fabs(drawn[i] - batched[i]));
+                covered += drawn[i] < 1.0f ? 1 : 0;
+            }
+        }
+        matched = covered > 0 && difference < 1e-5f;
+        std::cout << path << ": " << model.meshes.size() << " meshes, " << placed << " with a node transform, " << nodes.drawCalls
+            << " draw calls, largest depth difference to Model::Draw " << difference << (matched ? "" : " (ERROR)") << std::endl;
+    }
+
+    glDeleteTextures(MATERIALS, textureIds.data());
+    glDeleteProgram(shader.ID);
+    return matched ? 0 : 1;
+}
+
+// CPU frame time of drawing many copies of one mesh: a model uniform and a glDrawElements per object
+// against one glDrawElementsInstanced fed from an InstanceBuffer, with mat4 and with compact TRS
+// instances. The transforms are rebuilt and re-uploaded every frame, as for moving balls.
+// ------------------------------------------------------------------------
+inline int benchmarkInstancing()
+{
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(6, 8, vertices, indices);
+
+    ShaderLibrary shaders("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    Shader& perObject = shaders.get(ShaderVariant().with(SHADER_DIFFUSE_MAP));
+    Shader& instancedMatrix = shaders.get(ShaderVariant().with(SHADER_DIFFUSE_MAP | SHADER_INSTANCED));
+    Shader& instancedTRS = shaders.get(ShaderVariant().with(SHADER_DIFFUSE_MAP | SHADER_INSTANCED_TRS));
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 400.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.update();
+    Mesh mesh(vertices, indices, std::vector<Texture>(), VertexFormat::forShader(perObject));
+    InstanceBuffer instances;
+    UniformHandle<glm::mat4> modelUniform = perObject.uniform<glm::mat4>("model");
+    glEnable(GL_DEPTH_TEST);
+
+    const unsigned int counts[] = { 10, 1000, 100000 };
+    std::cout << indices.size() / 3 << " triangles per instance" << std::endl;
+    for (unsigned int count : counts)
+    {
+        const int FRAMES = count >= 100000 ? 5 : 50;
+        std::vector<glm::mat4> matrices(count);
+        std::vector<InstanceTRS> trs(count);
+        auto place = [count](unsigned int i, int frame) {
+            float side = std::ceil(std::sqrt((float)count));
+            return glm::vec3(std::fmod((float)i, side) * 2.5f - side, std::floor(i / side) * 2.5f - side, std::sin(frame * 0.1f + i));
+        };
+
+        // runs one untimed frame first, so shader compilation and buffer allocation are not measured
+        auto run = [FRAMES](Shader& shader, const std::function<void(int)>& drawFrame, double& cpuMs) {
+            shader.use();
+            drawFrame(-1);
+            glFinish();
+            cpuMs = 0.0;
+            BenchmarkTimer total;
+            for (int frame = 0; frame < FRAMES; frame++)
+            {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                BenchmarkTimer cpu;
+                drawFrame(frame);
+                cpuMs += cpu.elapsedMs();
+            }
+            glFinish();
+            return total.elapsedMs();
+        };
+
+        // 1. one draw per object
+        double loopCpuMs, matrixCpuMs, trsCpuMs;
+        double loopMs = run(perObject, [&](int frame) {
+            for (unsigned int i = 0; i < count; i++)
+            {
+                modelUniform.set(glm::translate(glm::mat4(1.0f), place(i, frame)));
+                mesh.Draw(perObject);
+            }
+        }, loopCpuMs);
+
+        // 2. instanced, a mat4 per instance
+        double matrixMs = run(instancedMatrix, [&](int frame) {
+            for (unsigned int i = 0; i < count; i++)
+                matrices[i] = glm::translate(glm::mat4(1.0f), place(i, frame));
+            instances.upload(matrices.data(), count);
+            instances.attach(mesh.VAO);
+            mesh.DrawInstanced(instancedMatrix, count);
+        }, matrixCpuMs);
+
+        // 3. instanced, position/scale/rotation per instance
+        double trsMs = run(instancedTRS, [&](int frame) {
+            for (unsigned int i = 0; i < count; i++)
+                trs[i].position = place(i, frame);
+            instances.upload(trs.data(), count);
+            instances.attach(mesh.VAO);
+            mesh.DrawInstanced(instancedTRS, count);
+        }, trsCpuMs);
+
+        std::cout << count << " instances, CPU ms/frame (total ms/frame with GPU):" << std::endl;
+        std::cout << "  draw per object:  " << loopCpuMs / FRAMES << " (" << loopMs / FRAMES << "), " << count << " draw calls" << std::endl;
+        std::cout << "  instanced mat4:   " << matrixCpuMs / FRAMES << " (" << matrixMs / FRAMES << "), 1 draw call, "
+            << count * sizeof(glm::mat4) / 1024.0 << " KiB/frame" << std::endl;
+        std::cout << "  instanced TRS:    " << trsCpuMs / FRAMES << " (" << trsMs / FRAMES << "), 1 draw call, "
+            << count * sizeof(InstanceTRS) / 1024.0 << " KiB/frame" << std::endl;
+    }
+    return 0;
+}
+
+// Submission cost of an unsorted frame: 5000 objects using 2 programs, 20 materials and 10 meshes,
+// submitted in random order. Drawn once directly (program, model matrix and Mesh::Draw per object)
+// and once through the RenderQueue, which sorts by key and skips binds of current state.
+// ------------------------------------------------------------------------
+inline int benchmarkRenderQueue()
+{
+    const int FRAMES = 50;
+    const int OBJECTS = 5000;
+    const int MATERIALS = 20;
+    const int MESHES = 10;
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(4, 6, vertices, indices);
+
+    Shader shaders[2] = {
+        Shader("./shaders/modelLoading.vert", "./shaders/modelLoading.frag"),
+        Shader("./shaders/modelLoading.vert", "./shaders/modelLoading.frag")
+    };
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 150.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.update();
+    VertexFormat format = VertexFormat::forShader(shaders[0]);
+
+    std::vector<unsigned int> textureIds(MATERIALS * 2);
+    glGenTextures((GLsizei)textureIds.size(), textureIds.data());
+    for (unsigned int id : textureIds)
+    {
+        const unsigned char color[4] = { (unsigned char)(id * 7), 128, 255, 255 };
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, color);
+    }
+    // every material is a diffuse and a specular map, and every (mesh, material) pair is its own Mesh sharing the geometry's VAO
+    std::vector<Mesh> geometry;
+    geometry.reserve(MESHES);
+    for (int g = 0; g < MESHES; g++)
+        geometry.emplace_back(vertices, indices, std::vector<Texture>(), format);
+    std::vector<Mesh> meshes;
+    meshes.reserve(MESHES * MATERIALS);
+    for (int g = 0; g < MESHES; g++)
+    {
+        for (int m = 0; m < MATERIALS; m++)
+        {
+            Mesh mesh = geometry[g];
+            Texture diffuse, specular;
+            diffuse.id = textureIds[m * 2];
+            diffuse.type = "texture_diffuse";
+            specular.id = textureIds[m * 2 + 1];
+            specular.type = "texture_specular";
+            mesh.textures = { diffuse, specular };
+            mesh.samplers = Mesh::samplerNames(mesh.textures);
+            meshes.push_back(mesh);
+        }
+    }
+
+    struct Object { int shader; int mesh; glm::mat4 model; };
+    std::vector<Object> objects(OBJECTS);
+    unsigned int seed = 12345;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+    for (Object& object : objects)
+    {
+        object.shader = random() % 2;
+        object.mesh = random() % (MESHES * MATERIALS);
+        object.model = glm::translate(glm::mat4(1.0f), glm::vec3(random() % 100 - 50.0f, random() % 100 - 50.0f, random() % 100 - 50.0f));
+    }
+    glEnable(GL_DEPTH_TEST);
+
+    // 1. straight through, in submission order
+    double directCpuMs = 0.0;
+    for (int frame = -1; frame < FRAMES; frame++)   // frame -1 warms up
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        BenchmarkTimer cpu;
+        for (const Object& object : objects)
+        {
+            Shader& shader = shaders[object.shader];
+            shader.use();
+            shader.setMat4("model", object.model);
+            meshes[object.mesh].Draw(shader);
+        }
+        if (frame >= 0)
+            directCpuMs += cpu.elapsedMs();
+        glFinish();
+    }
+
+    // 2. sorted render queue
+    RenderQueue queue;
+    double queueCpuMs = 0.0;
+    for (int frame = -1; frame < FRAMES; frame++)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        BenchmarkTimer cpu;
+        for (const Object& object : objects)
+            queue.submit(shaders[object.shader], meshes[object.mesh], object.model);
+        queue.flush(glm::vec3(0.0f, 0.0f, 150.0f));
+        if (frame >= 0)
+            queueCpuMs += cpu.elapsedMs();
+        glFinish();
+    }
+
+    const GLStateCache::Counters& counters = queue.state.counters;
+    std::cout << OBJECTS << " objects, 2 programs, " << MATERIALS << " materials, " << MESHES << " meshes, " << FRAMES << " frames" << std::endl;
+    std::cout << "direct:       CPU " << directCpuMs / FRAMES << " ms/frame, per frame " << OBJECTS << " program binds, "
+        << OBJECTS << " VAO binds, " << OBJECTS * 2 << " texture binds, " << OBJECTS * 2 << " sampler sets" << std::endl;
+    std::cout << "render queue: CPU " << queueCpuMs / FRAMES << " ms/frame, per frame "
+        << counters.programBinds << " program binds, " << counters.vertexArrayBinds << " VAO binds, "
+        << counters.textureBinds << " texture binds, " << counters.samplerSets << " sampler sets, "
+        << counters.avoided() << " binds avoided, " << queue.stats.drawCalls << " draw calls" << std::endl;
+
+    glDeleteTextures((GLsizei)textureIds.size(), textureIds.data());
+    glDeleteProgram(shaders[0].ID);
+    glDeleteProgram(shaders[1].ID);
+    return 0;
+}
+
+// Frustum culling of 100k bounding volumes spread around a camera that sees part of them: the
+// SIMD test against the scalar reference (they must agree), then a 100k instance set culled
+// before upload against drawing every instance.
+// ------------------------------------------------------------------------
+inline int benchmarkCulling()
+{
+    const int COUNT = 100000;
+    const int RUNS = 20;
+    BenchmarkContext context;
+    if (!context.create(256, 256))
+        return -1;
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 200.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(6, 8, vertices, indices);
+    BoundingBox bounds;
+    for (const Vertex& vertex : vertices)
+        bounds.expand(vertex.Position);
+
+    unsigned int seed = 7;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    std::vector<glm::mat4> transforms(COUNT);
+    for (glm::mat4& transform : transforms)
+    {
+        glm::vec3 position(random() * 300.0f - 150.0f, random() * 300.0f - 150.0f, random() * 300.0f - 150.0f);
+        transform = glm::rotate(glm::translate(glm::mat4(1.0f), position), random() * 6.28f, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    // 1. boxes moved into world space, then the frustum test
+    FrustumCuller culler;
+    BenchmarkTimer gather;
+    for (int run = 0; run < RUNS; run++)
+    {
+        culler.clear();
+        for (const glm::mat4& transform : transforms)
+            culler.addBox(bounds, transform);
+    }
+    double gatherMs = gather.elapsedMs() / RUNS;
+
+    BenchmarkTimer scalar;
+    for (int run = 0; run < RUNS; run++)
+        culler.cullScalar(frustum);
+    double scalarMs = scalar.elapsedMs() / RUNS;
+    std::vector<uint32_t> reference = culler.cullScalar(frustum);
+
+    BenchmarkTimer simd;
+    for (int run = 0; run < RUNS; run++)
+        culler.cull(frustum);
+    double simdMs = simd.elapsedMs() / RUNS;
+    bool agree = culler.cull(frustum) == reference;
+
+#if defined(FRUSTUM_SIMD_AVX)
+    const char* width = "AVX, 8 wide";
+#elif defined(FRUSTUM_SIMD_SSE)
+    const char* width = "SSE, 4 wide";
+#else
+    const char* width = "no SIMD";
+#endif
+    std::cout << COUNT << " boxes: " << culler.stats.visible << " visible, " << culler.stats.culled() << " culled" << std::endl;
+    std::cout << "world boxes " << gatherMs << " ms, scalar test " << scalarMs << " ms, SIMD test (" << width << ") " << simdMs
+        << " ms, results " << (agree ? "identical" : "DIFFER") << std::endl;
+
+    // 2. instanced: cull the instance spheres, upload only the survivors
+    ShaderLibrary shaders("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    Shader& shader = shaders.get(ShaderVariant().with(SHADER_DIFFUSE_MAP | SHADER_INSTANCED));
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    frameUniforms.data.projection = projection;
+    frameUniforms.data.view = view;
+    frameUniforms.update();
+    shader.use();
+    Mesh mesh(vertices, indices, std::vector<Texture>(), VertexFormat::forShader(shader));
+    InstanceBuffer instances;
+    std::vector<glm::mat4> visibleTransforms;
+    glEnable(GL_DEPTH_TEST);
+    const int FRAMES = 5;
+
+    auto drawFrames = [&](bool cullInstances, double& cullMs) {
+        cullMs = 0.0;
+        BenchmarkTimer total;
+        for (int frame = 0; frame < FRAMES; frame++)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            const glm::mat4* data = transforms.data();
+            unsigned int count = COUNT;
+            if (cullInstances)
+            {
+                BenchmarkTimer timer;
+                culler.clear();
+                culler.addInstances(bounds, transforms.data(), COUNT);
+                culler.cull(frustum);
+                culler.gatherVisible(transforms.data(), visibleTransforms);
+                data = visibleTransforms.data();
+                count = (unsigned int)visibleTransforms.size();
+                cullMs += timer.elapsedMs();
+            }
+            instances.upload(data, count);
+            instances.attach(mesh.VAO);
+            mesh.DrawInstanced(shader, count);
+        }
+        glFinish();
+        cullMs /= FRAMES;
+        return total.elapsedMs() / FRAMES;
+    };
+    double unusedMs, cullMs;
+    double allMs = drawFrames(false, unusedMs);
+    double culledMs = drawFrames(true, cullMs);
+    std::cout << COUNT << " instances: all drawn " << allMs << " ms/frame; culled to " << culler.stats.visible << " in "
+        << cullMs << " ms, " << culledMs << " ms/frame" << std::endl;
+
+    return 0;
+}
+
+// Headless physics throughput: "--bench physics [count] [steps]" drops count balls (100k by default)
+// onto the ground in a grid and steps the world, once with the ground only and once with
+// sphere-sphere contacts as well.
+// ------------------------------------------------------------------------
+inline int benchmarkPhysics(const std::vector<std::string>& args)
+{
+    unsigned int count = args.size() > 0 ? (unsigned int)std::stoul(args[0]) : 100000;
+    unsigned int steps = args.size() > 1 ? (unsigned int)std::stoul(args[1]) : 240;
+
+    for (int contacts = 0; contacts < 2; contacts++)
+    {
+        PhysicsWorld world;
+        world.sphereContacts = contacts != 0;
+        unsigned int side = (unsigned int)std::ceil(std::sqrt((float)count));
+        unsigned int seed = 99;
+        auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+        for (unsigned int i = 0; i < count; i++)
+        {
+            uint32_t body = world.addBody(glm::vec3((i % side) * 1.5f, 0.5f + random() * 4.0f, (i / side) * 1.5f), 0.5f);
+            world.applyImpulse(body, glm::vec3(random() * 2.0f - 1.0f, 0.0f, random() * 2.0f - 1.0f));
+        }
+        unsigned int contactPairs = 0;
+        BenchmarkTimer timer;
+        for (unsigned int s = 0; s < steps; s++)
+        {
+            world.update(world.fixedStep);
+            contactPairs += world.stats.contactPairs;
+        }
+        double ms = timer.elapsedMs();
+        std::cout << count << " balls, " << steps << " steps, " << (contacts ? "ground and sphere contacts" : "ground only") << " ("
+            << SimdFloat::WIDTH << " wide): " << ms / steps << " ms/step, " << steps * 1000.0 / ms << " steps/s, "
+            << count * (double)steps / (ms * 1000.0) << " M body-steps/s, " << contactPairs / steps << " contacts/step" << std::endl;
+    }
+    return 0;
+}
+
+// Broadphase stress test: "--bench broadphase [count] [steps]" moves count spheres (1M by default)
+// through a box at constant velocities and finds the overlapping pairs every step with BroadphaseGrid.
+// The pairs among the first 20k spheres are then found by brute force, which checks the grid after its
+// incremental updates and gives the all-pairs cost to extrapolate to the full count.
+// ------------------------------------------------------------------------
+inline int benchmarkBroadphase(const std::vector<std::string>& args)
+{
+    size_t count = args.size() > 0 ? (size_t)std::stoul(args[0]) : 1000000;
+    unsigned int steps = args.size() > 1 ? (unsigned int)std::stoul(args[1]) : 30;
+    const float radius = 0.5f, dt = 1.0f / 60.0f;
+    float side = std::cbrt(count * 8.0f);     // about one overlap per sphere
+
+    std::vector<float> x(count), y(count), z(count), radii(count, radius), vx(count), vy(count), vz(count);
+    unsigned int seed = 7;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    for (size_t i = 0; i < count; i++)
+    {
+        x[i] = random() * side; y[i] = random() * side; z[i] = random() * side;
+        vx[i] = random() * 2.0f - 1.0f; vy[i] = random() * 2.0f - 1.0f; vz[i] = random() * 2.0f - 1.0f;
+    }
+    auto move = [&](std::vector<float>& p, std::vector<float>& v, size_t i) {
+        p[i] += v[i] * dt;
+        if (p[i] < 0.0f || p[i] > side)
+            v[i] = -v[i];
+    };
+
+    BroadphaseGrid grid;
+    double updateMs = 0.0, pairMs = 0.0;
+    uint64_t pairs = 0, candidates = 0, moved = 0;
+    unsigned int rebuilds = 0;
+    for (unsigned int s = 0; s < steps; s++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            move(x, vx, i); move(y, vy, i); move(z, vz, i);
+        }
+        BenchmarkTimer timer;
+        grid.update(x.data(), y.data(), z.data(), radii.data(), count);
+        double afterUpdate = timer.elapsedMs();
+        grid.findPairs();
+        if (s > 0)    // the first update always sorts everything
+        {
+            updateMs += afterUpdate;
+            pairMs += timer.elapsedMs() - afterUpdate;
+            pairs += grid.stats.pairs;
+            candidates += grid.stats.candidates;
+            moved += grid.stats.moved;
+            rebuilds += grid.stats.rebuilt ? 1 : 0;
+        }
+    }
+    unsigned int timed = std::max(1u, steps - 1);
+    double gridMs = updateMs + pairMs;
+    std::cout << count << " spheres, " << timed << " steps, " << ThreadPool::shared().size() + 1 << " threads: update " << updateMs / timed
+        << " ms (" << 100.0 * moved / ((double)count * timed) << "% changed cells, " << rebuilds << " full sorts), pairs " << pairMs / timed
+        << " ms, " << pairs / timed << " pairs/step, " << candidates / timed << " tests/step, " << pairs / (gridMs * 1000.0) << " M pairs/s" << std::endl;
+
+    // brute-force reference on a prefix of the spheres, against the grid's pairs among them after the incremental updates
+    size_t reference = std::min<size_t>(count, 20000);
+    std::vector<uint64_t> gridPairs;
+    for (uint64_t pair : grid.pairs)
+        if (BroadphaseGrid::pairSecond(pair) < reference)
+            gridPairs.push_back(pair);
+
+    std::vector<uint64_t> brute;
+    BenchmarkTimer bruteTimer;
+    for (size_t a = 0; a < reference; a++)
+        for (size_t b = a + 1; b < reference; b++)
+        {
+            float dx = x[b] - x[a], dy = y[b] - y[a], dz = z[b] - z[a], reach = radii[a] + radii[b];
+            if (dx * dx + dy * dy + dz * dz < reach * reach)
+                brute.push_back((uint64_t)a << 32 | b);
+        }
+    double bruteMs = bruteTimer.elapsedMs();
+    double testsPerMs = reference * (reference - 1) / 2.0 / bruteMs;
+    double bruteFullMs = count * (count - 1.0) / 2.0 / testsPerMs;
+    std::cout << "first " << reference << " spheres: brute force " << bruteMs << " ms (" << brute.size() / (bruteMs * 1000.0) << " M pairs/s), "
+        << brute.size() << " pairs, grid pairs " << (brute == gridPairs ? "match" : "DIFFER") << std::endl;
+    std::cout << count << " spheres: brute force would take about " << bruteFullMs / 1000.0 << " s/step, "
+        << bruteFullMs / (gridMs / timed) << "x the grid" << std::endl;
+    return brute == gridPairs ? 0 : 1;
+}
+
+// Query throughput of a built MeshBvh: rays and sphere sweeps from around its bounds towards random
+// points inside, plus brute-force rays on a subset to check the hits and compare.
+// ------------------------------------------------------------------------
+inline bool benchmarkBvhQueries(const std::string& name, const MeshBvh& bvh)
+{
+    const int RAYS = 100000, SWEEPS = 100000, BRUTE_FORCE_RAYS = 200;
+    BoundingBox bounds(glm::vec3(bvh.nodes[0].min[0], bvh.nodes[0].min[1], bvh.nodes[0].min[2]), glm::vec3(bvh.nodes[0].max[0], bvh.nodes[0].max[1], bvh.nodes[0].max[2]));
+    std::cout << name << ": " << bvh.triangles.size() << " triangles, built in " << bvh.stats.buildMs << " ms on " << ThreadPool::shared().size() + 1
+        << " threads, " << bvh.stats.nodes << " nodes, " << bvh.stats.leaves << " leaves, depth " << bvh.stats.depth << ", SAH cost " << bvh.stats.sahCost << std::endl;
+
+    unsigned int seed = 5;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    auto inside = [&]() { return bounds.min + (bounds.max - bounds.min) * glm::vec3(random(), random(), random()); };
+    auto around = [&]() {
+        glm::vec3 direction = glm::normalize(glm::vec3(random() - 0.5f, random() - 0.5f, random() - 0.5f) + glm::vec3(1e-4f));
+        return bounds.center() + direction * bounds.radius() * 2.0f;
+    };
+    std::vector<glm::vec3> origins(RAYS), targets(RAYS);
+    for (int i = 0; i < RAYS; i++)
+    {
+        origins[i] = around();
+        targets[i] = inside();
+    }
+
+    RayHit hit;
+    int hits = 0;
+    BenchmarkTimer rayTimer;
+    for (int i = 0; i < RAYS; i++)
+        hits += bvh.raycast(origins[i], targets[i] - origins[i], FLT_MAX, hit) ? 1 : 0;
+    double rayMs = rayTimer.elapsedMs();
+
+    int mismatches = 0;
+    BenchmarkTimer bruteTimer;
+    for (int i = 0; i < BRUTE_FORCE_RAYS; i++)
+    {
+        RayHit reference;
+        bool found = bvh.raycastBruteForce(origins[i], targets[i] - origins[i], FLT_MAX, reference);
+        if (found != bvh.raycast(origins[i], targets[i] - origins[i], FLT_MAX, hit) || (found && hit.distance != reference.distance))
+            mismatches++;
+    }
+    double bruteMs = bruteTimer.elapsedMs();
+
+    float sphereRadius = bounds.radius() * 0.005f;
+    SphereContact contact;
+    int touches = 0;
+    BenchmarkTimer sweepTimer;
+    for (int i = 0; i < SWEEPS; i++)
+        touches += bvh.sphereSweep(origins[i], sphereRadius, targets[i] - origins[i], contact) ? 1 : 0;
+    double sweepMs = sweepTimer.elapsedMs();
+
+    std::cout << "  rays: " << RAYS / (rayMs * 1000.0) << " M/s (" << hits << " hits), brute force " << BRUTE_FORCE_RAYS / (bruteMs * 1000.0)
+        << " M/s, " << mismatches << " of " << BRUTE_FORCE_RAYS << " differ" << std::endl;
+    std::cout << "  sphere sweeps (radius " << sphereRadius << "): " << SWEEPS / (sweepMs * 1000.0) << " M/s (" << touches << " touch)" << std::endl;
+    return mismatches == 0;
+}
+
+// Build time and query throughput of MeshBvh: "--bench bvh [model path] [terrain side]" over the
+// triangles of a model (the backpack by default) and over a procedural height field of side x side
+// vertices (708, about a million triangles), then checks a sphere sweep starting beside a triangle's edge.
+// ------------------------------------------------------------------------
+inline int benchmarkBvh(const std::vector<std::string>& args)
+{
+    std::string path = args.size() > 0 ? args[0] : "./models/backpack/backpack.obj";
+    unsigned int side = args.size() > 1 ? (unsigned int)std::stoul(args[1]) : 708;
+    bool matched = true;
+    {
+        BenchmarkContext context;
+        if (!context.create())
+            return -1;
+        TextureCache::instance().setLoader(benchmarkFakeLoad, benchmarkFakeDelete);   // geometry only
+        Model model(path);
+        TextureCache::instance().setLoader(NULL, NULL);
+        MeshBvh bvh;
+        bvh.addMeshes(model.meshes, model.nodes, model.meshNodes);
+        bvh.build();
+        if (!bvh.nodes.empty())
+            matched = benchmarkBvhQueries(path, bvh) && matched;
+    }
+
+    // rolling hills with some noise, one unit between vertices
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    positions.reserve((size_t)side * side);
+    unsigned int seed = 11;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    for (unsigned int z = 0; z < side; z++)
+        for (unsigned int x = 0; x < side; x++)
+            positions.push_back(glm::vec3((float)x, 8.0f * std::sin(x * 0.05f) * std::cos(z * 0.043f) + 0.3f * random(), (float)z));
+    indices.reserve((size_t)(side - 1) * (side - 1) * 6);
+    for (unsigned int z = 0; z + 1 < side; z++)
+        for (unsigned int x = 0; x + 1 < side; x++)
+        {
+            unsigned int corner = z * side + x;
+            unsigned int quad[6] = { corner, corner + side, corner + 1, corner + 1, corner + side, corner + side + 1 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    MeshBvh terrain;
+    terrain.addTriangles(positions.data(), indices.data(), indices.size());
+    terrain.build();
+    matched = benchmarkBvhQueries("terrain " + std::to_string(side) + "x" + std::to_string(side), terrain) && matched;
+
+    // a sphere within its radius of a triangle's plane but beside its long edge, sinking and moving away
+    // from it: it never touches, and must not report a hit before the sweep starts
+    glm::vec3 corners[3] = { glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+    unsigned int triangle[3] = { 0, 1, 2 };
+    MeshBvh single;
+    single.addTriangles(corners, triangle, 3);
+    single.build();
+    SphereContact leaving, approaching;
+    bool away = single.sphereSweep(glm::vec3(1.2f, 0.3f, 1.2f), 0.5f, glm::vec3(1.0f, -0.2f, 1.0f), leaving);
+    bool towards = single.sphereSweep(glm::vec3(1.2f, 0.3f, 1.2f), 0.5f, glm::vec3(-1.0f, -0.2f, -1.0f), approaching) && approaching.time >= 0.0f;
+    std::cout << "sphere beside an edge: moving away " << (away ? "TOUCHES at t = " + std::to_string(leaving.time) : "misses")
+        << ", moving towards it " << (towards ? "touches" : "MISSES") << std::endl;
+    matched = !away && towards && matched;
+    return matched ? 0 : 1;
+}
+
+// Frame pipeline scaling: "--bench pipeline [balls] [frames]" runs a scene of bouncing balls (20k by
+// default) through FramePipeline: physics with sphere contacts, a transform per ball and frustum
+// culling on the pool, instanced drawing of the visible balls on this thread, glFinish standing in
+// for the buffer swap. It runs serially first, then pipelined on 1, 2, 4... threads up to the
+// hardware's, and reports the stage times and the frame time of each.
+// ------------------------------------------------------------------------
+struct BenchmarkFrame
+{
+    std::vector<glm::mat4> transforms;
+    std::vector<glm::mat4> visible;
+};
+
+inline int benchmarkPipeline(const std::vector<std::string>& args)
+{
+    unsigned int count = args.size() > 0 ? (unsigned int)std::stoul(args[0]) : 20000;
+    int frames = args.size() > 1 ? std::stoi(args[1]) : 60;
+    const int CULL_CHUNKS = 64;
+    BenchmarkContext context;
+    if (!context.create(128, 128))
+        return -1;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(3, 4, vertices, indices);    // light to draw, so the CPU stages stand out
+    ShaderLibrary shaders("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    Shader& shader = shaders.get(ShaderVariant().with(SHADER_DIFFUSE_MAP | SHADER_INSTANCED));
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 60.0f, 160.0f), glm::vec3(0.0f, 0.0f, 60.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.update();
+    Frustum frustum = Frustum::fromMatrix(frameUniforms.data.projection * frameUniforms.data.view);
+    Mesh mesh(vertices, indices, std::vector<Texture>(), VertexFormat::forShader(shader));
+    InstanceBuffer instances;
+    glEnable(GL_DEPTH_TEST);
+    shader.use();
+
+    unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> threadCounts{ 1 };
+    for (unsigned int t = 2; t <= std::max(2u, hardwareThreads); t *= 2)
+        threadCounts.push_back(t);
+    std::cout << count << " balls, " << frames << " frames, " << hardwareThreads << " hardware threads" << std::endl;
+    for (int configuration = -1; configuration < (int)threadCounts.size(); configuration++)
+    {
+        bool pipelined = configuration >= 0;
+        unsigned int threads = pipelined ? threadCounts[configuration] : 1;
+        ThreadPool pool(ThreadPool::Workers{ threads - 1 });
+        PhysicsWorld world(&pool);
+        unsigned int side = (unsigned int)std::ceil(std::sqrt((float)count));
+        unsigned int seed = 3;
+        auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+        for (unsigned int i = 0; i < count; i++)
+        {
+            uint32_t body = world.addBody(glm::vec3((i % side) * 1.2f - side * 0.6f, 0.5f + random() * 8.0f, (i / side) * 1.2f), 0.5f);
+            world.applyImpulse(body, glm::vec3(random() * 2.0f - 1.0f, 0.0f, random() * 2.0f - 1.0f));
+        }
+
+        FramePipeline<BenchmarkFrame> pipeline(&pool);
+        pipeline.pipelined = pipelined;
+        pipeline.simulate = [&](BenchmarkFrame&) { world.update(1.0f / 60.0f); };
+        pipeline.transforms = [&](BenchmarkFrame& frame) {
+            frame.transforms.resize(count);
+            pool.parallelFor(count, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    frame.transforms[i] = world.transform((uint32_t)i);
+            }, 1024);
+        };
+        std::vector<FrustumCuller> cullers(CULL_CHUNKS);
+        std::vector<std::vector<glm::mat4>> chunkVisible(CULL_CHUNKS);
+        pipeline.cull = [&](BenchmarkFrame& frame) {
+            pool.parallelFor(CULL_CHUNKS, [&](size_t first, size_t last) {
+                for (size_t c = first; c < last; c++)
+                {
+                    size_t begin = count * c / CULL_CHUNKS, end = count * (c + 1) / CULL_CHUNKS;
+                    cullers[c].clear();
+                    for (size_t i = begin; i < end; i++)
+                        cullers[c].addSphere(glm::vec3(frame.transforms[i][3]), 0.5f);
+                    cullers[c].cull(frustum);
+                    cullers[c].gatherVisible(frame.transforms.data() + begin, chunkVisible[c]);   // data(): no element to index without balls
+                }
+            }, 1);
+            frame.visible.clear();
+            for (const std::vector<glm::mat4>& visible : chunkVisible)
+                frame.visible.insert(frame.visible.end(), visible.begin(), visible.end());
+        };
+
+        FramePipeline<BenchmarkFrame>::Timings sum;
+        double submitMs = 0.0;
+        size_t drawn = 0;
+        pipeline.start();
+        BenchmarkTimer total;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            BenchmarkFrame& ready = pipeline.wait();
+            pipeline.start();
+            BenchmarkTimer submit;
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            instances.upload(ready.visible.data(), (unsigned int)ready.visible.size());
+            instances.attach(mesh.VAO);
+            mesh.DrawInstanced(shader, (unsigned int)ready.visible.size());
+            glFinish();
+            submitMs += submit.elapsedMs();
+            drawn += ready.visible.size();
+            const FramePipeline<BenchmarkFrame>::Timings& t = pipeline.lastTimings();
+            sum.simulate += t.simulate; sum.transforms += t.transforms; sum.cull += t.cull; sum.wait += t.wait;
+        }
+        double frameMs = total.elapsedMs() / frames;
+        pipeline.wait();
+        std::cout << (pipelined ? "pipelined, " : "serial,    ") << threads << " thread" << (threads > 1 ? "s: " : ":  ")
+            << "simulate " << sum.simulate / frames << " ms, transforms " << sum.transforms / frames << " ms, cull " << sum.cull / frames
+            << " ms, submit " << submitMs / frames << " ms, waiting " << sum.wait / frames << " ms -> " << frameMs << " ms/frame ("
+            << drawn / frames << " drawn, " << pool.steals() << " steals)" << std::endl;
+    }
+    return 0;
+}
+
+// GPU time of the demos' two fragment shaders on the same 100 spheres filling a 512x512 target: the
+// lighting shader (a directional light and a loop over 4 point lights) against the model shader's
+// single texture fetch. Each pass is a GpuProfiler scope; the depth buffer is cleared between them
+// so both shade every pixel they cover. On a software rasterizer the scopes are timed between glFinish()
+// calls (see GpuProfiler), which the output says.
+// ------------------------------------------------------------------------
+inline int benchmarkGpuPasses(const std::vector<std::string>& args)
+{
+    int frames = args.size() > 0 ? std::stoi(args[0]) : 100;
+    const int SPHERES = 100;
+    BenchmarkContext context;
+    if (!context.create(512, 512))
+        return -1;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(16, 24, vertices, indices);
+    Mesh mesh(vertices, indices, std::vector<Texture>(), VertexFormat());
+
+    Shader lighting("./shaders/lightingVertex.vert", "./shaders/lightingFragment.frag");
+    Shader plain("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    UniformBuffer<LightsUBO> lightUniforms(LIGHTS_BLOCK_BINDING);
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 12.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.data.viewPos = glm::vec3(0.0f, 0.0f, 12.0f);
+    frameUniforms.update();
+    lightUniforms.data.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+    lightUniforms.data.dirLight.ambient = glm::vec3(0.05f);
+    lightUniforms.data.dirLight.diffuse = glm::vec3(0.4f);
+    lightUniforms.data.dirLight.specular = glm::vec3(0.5f);
+    for (int i = 0; i < NR_POINT_LIGHTS; i++)
+    {
+        PointLightUBO& light = lightUniforms.data.pointLights[i];
+        light.position = glm::vec3(i % 2 ? 3.0f : -3.0f, i / 2 ? 3.0f : -3.0f, 4.0f);
+        light.ambient = glm::vec3(0.05f);
+        light.diffuse = glm::vec3(0.8f);
+        light.specular = glm::vec3(1.0f);
+        light.constant = 1.0f;
+        light.linear = 0.09f;
+        light.quadratic = 0.032f;
+    }
+    lightUniforms.update();
+
+    // a 64x64 texture behind every sampler, so both shaders really fetch
+    std::vector<unsigned char> pixels(64 * 64 * 4);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = (unsigned char)(i * 37);
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 64, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    lighting.use();
+    lighting.setInt("material.diffuse", 0);
+    lighting.setInt("material.specular", 0);
+    lighting.setFloat("material.shininess", 32.0f);
+    plain.use();
+    plain.setInt("texture_diffuse1", 0);
+
+    std::vector<glm::mat4> transforms(SPHERES);
+    for (int i = 0; i < SPHERES; i++)
+        transforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3((i % 10) * 1.0f - 4.5f, (i / 10) * 1.0f - 4.5f, 0.0f));
+    glEnable(GL_DEPTH_TEST);
+    auto drawSpheres = [&](Shader& shader) {
+        shader.use();
+        for (const glm::mat4& transform : transforms)
+        {
+            shader.setMat4("model", transform);
+            mesh.Draw(shader);
+        }
+    };
+
+    GpuProfiler& gpu = GpuProfiler::instance();
+    for (int frame = 0; frame < frames + GpuProfiler::FRAMES_IN_FLIGHT; frame++)
+    {
+        if (frame == GpuProfiler::FRAMES_IN_FLIGHT)
+            gpu.resetTotals();     // the first frames warm up
+        gpu.beginFrame();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        {
+            GpuProfileZone zone("lighting (directional + 4 point lights)");
+            drawSpheres(lighting);
+        }
+        glClear(GL_DEPTH_BUFFER_BIT);
+        {
+            GpuProfileZone zone("modelLoading (1 texture fetch)");
+            drawSpheres(plain);
+        }
+        gpu.endFrame();
+    }
+    gpu.finish();
+
+    std::cout << SPHERES << " spheres of " << indices.size() / 3 << " triangles, 512x512, " << frames << " frames, timed with "
+        << gpu.timing() << ", " << gpu.stalls << " stalls reading the queries, " << gpu.rejected << " frames rejected" << std::endl;
+    for (const auto& total : gpu.totals())
+        std::cout << total.first << ": " << total.second.ms / total.second.calls << " ms/frame" << std::endl;
+
+    gpu.destroy();
+    glDeleteTextures(1, &texture);
+    glDeleteProgram(lighting.ID);
+    glDeleteProgram(plain.ID);
+    return 0;
+}
+
+// Startup cost of building the app's programs (the model shaders, the instanced variants and the
+// lighting demo's two), cold and warm: compiled one after the other with an empty ProgramBinaryCache,
+// compiled with every program started before the first is waited for (parallel on drivers with
+// KHR_parallel_shader_compile), and loaded from the cache. Mesa's own shader cache is pointed into the
+// benchmark's directory and wiped before every cold build, so that cold really compiles (switching it
+// off would also switch off program binaries on Mesa). Finally one cache entry is corrupted to check
+// the silent fallback.
+// ------------------------------------------------------------------------
+inline int benchmarkShaderCache(const std::vector<std::string>& args)
+{
+    int rounds = args.size() > 0 ? std::stoi(args[0]) : 5;
+    const std::string directory = "./shader-cache-benchmark", driverCache = directory + "/mesa";
+    std::error_code error;
+    std::filesystem::create_directories(driverCache, error);     // Mesa won't create it
+#ifdef _WIN32
+    _putenv_s("MESA_SHADER_CACHE_DIR", driverCache.c_str());
+#else
+    setenv("MESA_SHADER_CACHE_DIR", driverCache.c_str(), 1);
+#endif
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    ProgramBinaryCache& cache = ProgramBinaryCache::instance();
+    if (!cache.init(BenchmarkContext::loader(), directory))
+    {
+        std::cout << "ERROR::BENCHMARK::NO_PROGRAM_BINARIES" << std::endl;
+        return -1;
+    }
+    struct Program
+    {
+        const char* vertex;
+        const char* fragment;
+        std::string defines;
+    };
+    const Program programs[] = {
+        { "./shaders/modelLoading.vert", "./shaders/modelLoading.frag", "" },
+        { "./shaders/modelLoading.vert", "./shaders/modelLoading.frag", ShaderVariant().with(SHADER_DIFFUSE_MAP | SHADER_INSTANCED).defines() },
+        { "./shaders/modelLoading.vert", "./shaders/modelLoading.frag", ShaderVariant().with(SHADER_DIFFUSE_MAP | SHADER_INSTANCED_TRS).defines() },
+        { "./shaders/lightingVertex.vert", "./shaders/lightingFragment.frag", "" },
+        { "./shaders/lightCubeVertex.vert", "./shaders/lightCubeFragment.frag", "" }
+    };
+    const int PROGRAMS = sizeof(programs) / sizeof(programs[0]);
+
+    // builds every program once and returns the milliseconds until all are usable
+    auto build = [&](bool deferred) {
+        std::vector<Shader> shaders;
+        shaders.reserve(PROGRAMS);
+        BenchmarkTimer timer;
+        for (const Program& program : programs)
+        {
+            if (deferred)
+                shaders.emplace_back(Shader::Deferred(), program.vertex, program.fragment, nullptr, program.defines);
+            else
+                shaders.emplace_back(program.vertex, program.fragment, nullptr, program.defines);
+        }
+        for (Shader& shader : shaders)
+            shader.finish();
+        double ms = timer.elapsedMs();
+        for (Shader& shader : shaders)
+            glDeleteProgram(shader.ID);
+        return ms;
+    };
+
+    auto coldStart = [&]() {
+        cache.clear();
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(driverCache, error))
+        {
+            if (entry.is_regular_file(error))
+                std::filesystem::remove(entry.path(), error);     // files only, Mesa keeps the directories open
+        }
+    };
+
+    double serialMs = 0.0, parallelMs = 0.0, warmMs = 0.0;
+    for (int round = 0; round < rounds; round++)
+    {
+        coldStart();
+        serialMs += build(false);
+        coldStart();
+        parallelMs += build(true);
+        warmMs += build(false);     // everything was stored by the build before
+    }
+    ProgramBinaryCache::Stats stats = cache.stats;
+
+    // a damaged entry is recompiled without complaint and rewritten
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        if (entry.path().extension() != ".glbin")
+            continue;
+        std::ofstream(entry.path(), std::ios::binary | std::ios::in | std::ios::out).write("garbage!", 8);
+        break;
+    }
+    cache.stats = ProgramBinaryCache::Stats();
+    build(false);
+
+    std::cout << PROGRAMS << " programs, " << rounds << " rounds, parallel compile "
+        << (cache.parallelCompile() ? "available" : "not available") << std::endl;
+    std::cout << "cold, one after the other: " << serialMs / rounds << " ms" << std::endl;
+    std::cout << "cold, started together:    " << parallelMs / rounds << " ms" << std::endl;
+    std::cout << "warm, program binaries:    " << warmMs / rounds << " ms (" << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.stored << " stored)" << std::endl;
+    std::cout << "after corrupting one entry: " << cache.stats.hits << " hits, " << cache.stats.misses + cache.stats.rejected
+        << " recompiled, " << cache.stats.stored << " rewritten" << std::endl;
+    std::filesystem::remove_all(directory, error);
+    return 0;
+}
+
+// GPU time of the lit model shader against the number of lights it is built for: the same 100
+// spheres filling a 512x512 target, drawn with ShaderLibrary variants for the directional light plus
+// 0, 1, 2 and 4 point lights, and an unlit one. Every variant is compiled lazily by its first get(),
+// whose time is printed too. Each pass is timed between two glFinish() calls: a software rasterizer
+// such as llvmpipe shades the tiles of several passes together, so timer queries can't split them.
+// ------------------------------------------------------------------------
+inline int benchmarkShaderVariants(const std::vector<std::string>& args)
+{
+    int frames = args.size() > 0 ? std::stoi(args[0]) : 50;
+    const int SPHERES = 100;
+    BenchmarkContext context;
+    if (!context.create(512, 512))
+        return -1;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(16, 24, vertices, indices);
+
+    // a 64x64 texture behind both maps
+    std::vector<unsigned char> pixels(64 * 64 * 4);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = (unsigned char)(i * 37);
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 64, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    std::vector<Texture> textures = { { texture, "texture_diffuse", "" }, { texture, "texture_specular", "" } };
+    Mesh mesh(vertices, indices, textures, VertexFormat());
+
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    UniformBuffer<LightsUBO> lightUniforms(LIGHTS_BLOCK_BINDING);
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 12.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.data.viewPos = glm::vec3(0.0f, 0.0f, 12.0f);
+    frameUniforms.update();
+    lightUniforms.data.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+    lightUniforms.data.dirLight.ambient = glm::vec3(0.05f);
+    lightUniforms.data.dirLight.diffuse = glm::vec3(0.4f);
+    lightUniforms.data.dirLight.specular = glm::vec3(0.5f);
+    for (int i = 0; i < NR_POINT_LIGHTS; i++)
+    {
+        PointLightUBO& light = lightUniforms.data.pointLights[i];
+        light.position = glm::vec3(i % 2 ? 3.0f : -3.0f, i / 2 ? 3.0f : -3.0f, 4.0f);
+        light.ambient = glm::vec3(0.05f);
+        light.diffuse = glm::vec3(0.8f);
+        light.specular = glm::vec3(1.0f);
+        light.constant = 1.0f;
+        light.linear = 0.09f;
+        light.quadratic = 0.032f;
+    }
+    lightUniforms.update();
+
+    struct Pass
+    {
+        const char* name;
+        ShaderVariant variant;
+        Shader* shader;
+        double compileMs;
+        double ms;
+    };
+    ShaderVariant material = ShaderVariant::forMesh(mesh);
+    Pass passes[] = {
+        { "unlit", material, nullptr, 0.0, 0.0 },
+        { "directional", material.withLights(0, true), nullptr, 0.0, 0.0 },
+        { "directional + 1 point light", material.withLights(1, true), nullptr, 0.0, 0.0 },
+        { "directional + 2 point lights", material.withLights(2, true), nullptr, 0.0, 0.0 },
+        { "directional + 4 point lights", material.withLights(4, true), nullptr, 0.0, 0.0 }
+    };
+    const int PASSES = sizeof(passes) / sizeof(passes[0]);
+    ShaderLibrary library("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    for (Pass& pass : passes)
+    {
+        BenchmarkTimer timer;
+        pass.shader = &library.get(pass.variant);
+        pass.compileMs = timer.elapsedMs();
+    }
+    const int LOOKUPS = 100000;
+    BenchmarkTimer lookup;
+    for (int i = 0; i < LOOKUPS; i++)
+        library.get(passes[i % PASSES].variant);
+    double lookupNs = lookup.elapsedMs() * 1e6 / LOOKUPS;
+
+    std::vector<glm::mat4> transforms(SPHERES);
+    for (int i = 0; i < SPHERES; i++)
+        transforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3((i % 10) * 1.0f - 4.5f, (i / 10) * 1.0f - 4.5f, 0.0f));
+    glEnable(GL_DEPTH_TEST);
+
+    for (int frame = -1; frame < frames; frame++)   // frame -1 warms up
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        for (Pass& pass : passes)
+        {
+            glFinish();
+            BenchmarkTimer timer;
+            pass.shader->use();
+            for (const glm::mat4& transform : transforms)
+            {
+                pass.shader->setModel(transform);
+                mesh.Draw(*pass.shader);
+            }
+            glFinish();
+            if (frame >= 0)
+                pass.ms += timer.elapsedMs();
+            glClear(GL_DEPTH_BUFFER_BIT);   // the next pass shades every pixel again
+        }
+    }
+
+    std::cout << SPHERES << " spheres of " << indices.size() / 3 << " triangles, 512x512, " << frames << " frames, "
+        << library.compiled << " variants compiled, get() of a built one " << lookupNs << " ns" << std::endl;
+    for (const Pass& pass : passes)
+        std::cout << pass.name << ": " << pass.ms / frames << " ms/frame (compiled in " << pass.compileMs << " ms)" << std::endl;
+
+    glDeleteTextures(1, &texture);
+    return 0;
+}
+
+// Cold against warm start of a Model: "--bench model-cache [path] [--compact] [--free] [rounds]".
+// Cold clears the ModelCache and runs the assimp import, which also writes the .rbmesh entry; warm
+// maps that entry and uploads it, best of the rounds. Both end with glFinish, so the uploads count.
+// The meshes of both loads are compared, and a damaged entry is checked to fall back to the import.
+// Any file assimp reads will do, e.g. the X, FBX and glTF test models under assimp-5.0.1/test/models.
+// ------------------------------------------------------------------------
+inline int benchmarkModelCache(const std::vector<std::string>& args)
+{
+    std::string path = "./models/backpack/backpack.obj";
+    VertexFormat format;
+    bool keepGeometry = true;
+    int rounds = 5;
+    for (const std::string& arg : args)
+    {
+        if (arg == "--compact")
+            format.layout = VERTEX_LAYOUT_COMPACT;
+        else if (arg == "--free")
+            keepGeometry = false;
+        else if (!arg.empty() && std::isdigit((unsigned char)arg[0]))
+            rounds = std::stoi(arg);
+        else
+            path = arg;
+    }
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    TextureCache::instance().setLoader(benchmarkFakeLoad, benchmarkFakeDelete);   // geometry only
+    const std::string directory = "./model-cache-benchmark";
+    ModelCache& cache = ModelCache::instance();
+    cache.setDirectory(directory);
+    cache.clear();
+
+    struct Summary
+    {
+        size_t meshes = 0, vertices = 0, indices = 0, gpuBytes = 0, cpuVertices = 0;
+        bool operator==(const Summary& other) const
+        {
+            return meshes == other.meshes && vertices == other.vertices && indices == other.indices && gpuBytes == other.gpuBytes && cpuVertices == other.cpuVertices;
+        }
+    };
+    auto load = [&](Summary& summary) {
+        BenchmarkTimer timer;
+        Model model(path, false, format, keepGeometry);
+        glFinish();
+        double ms = timer.elapsedMs();
+        summary = Summary();
+        summary.meshes = model.meshes.size();
+        for (const Mesh& mesh : model.meshes)
+        {
+            summary.vertices += mesh.vertexCount;
+            summary.indices += mesh.indexCount;
+            summary.gpuBytes += mesh.gpuBytes();
+            summary.cpuVertices += mesh.vertices.size();
+        }
+        return ms;
+    };
+
+    Summary cold, warm;
+    double coldMs = load(cold);
+    if (cache.stats.stored == 0)
+    {
+        std::cout << "ERROR::BENCHMARK::MODEL_NOT_CACHED " << path << std::endl;
+        TextureCache::instance().setLoader(NULL, NULL);
+        return -1;
+    }
+    std::error_code error;
+    uintmax_t entryBytes = std::filesystem::file_size(cache.path(path), error);
+    double warmMs = 1e30;
+    for (int i = 0; i < rounds; i++)
+        warmMs = std::min(warmMs, load(warm));
+    unsigned int hits = cache.stats.hits;
+
+    // a truncated entry must be a miss that imports again and rewrites it
+    std::filesystem::resize_file(cache.path(path), entryBytes / 2, error);
+    Summary repaired;
+    load(repaired);
+    bool fallback = cache.stats.hits == hits && repaired == cold && std::filesystem::file_size(cache.path(path), error) == entryBytes;
+
+    std::cout << path << ": " << cold.meshes << " meshes, " << cold.vertices << " vertices, " << cold.indices / 3 << " triangles, "
+        << entryBytes / (1024.0 * 1024.0) << " MiB entry" << std::endl;
+    std::cout << "cold (import + store) " << coldMs << " ms, warm (mapped) " << warmMs << " ms, " << coldMs / warmMs << "x" << std::endl;
+    std::cout << "warm loads " << (warm == cold ? "match" : "DIFFER FROM") << " the import, damaged entry "
+        << (fallback ? "falls back and is rewritten" : "NOT HANDLED") << std::endl;
+
+    cache.setDirectory("./model-cache");
+    std::filesystem::remove_all(directory, error);
+    TextureCache::instance().setLoader(NULL, NULL);
+    return warm == cold && fallback ? 0 : 1;
+}
+
+// Texture startup before and after baking: "--bench texture-bake [--uncompressed]". Every image the
+// app ships is loaded the old way (stb_image decode, glTexImage2D, glGenerateMipmap) and from its
+// .rbtex bake (hash the source for the key, map the file, upload the stored levels), each upload timed
+// up to glFinish. The bake itself (decode, mip chain, block compression) is the one-off first-run cost.
+// Level 0 is read back from the driver and compared with the source, and the block encoder is timed
+// alone with SimdFloat and with ScalarFloat on one thread.
+// ------------------------------------------------------------------------
+inline int benchmarkTextureBake(const std::vector<std::string>& args)
+{
+    const char* files[] = {
+        "./models/backpack/ao.jpg", "./models/beach-ball/Beach_Ball_diffuse.jpg", "./textures/container.jpg",
+        "./textures/container2.png", "./textures/container2_specular.png", "./textures/awesomeface.png" };
+    const char* FORMAT_NAMES[] = { "uncompressed", "BC1", "", "BC3", "BC4", "BC5" };
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    TextureBaker& baker = TextureBaker::instance();
+    const std::string directory = "./texture-cache-benchmark";
+    baker.setDirectory(directory);
+    baker.compress = std::find(args.begin(), args.end(), "--uncompressed") == args.end();
+    baker.init();
+    baker.setFlipVertically(true);
+    baker.clear();
+
+    double totals[5] = {};     // decode, upload before; bake; load, upload after
+    size_t vramBefore = 0, vramAfter = 0;
+    bool matched = true;
+    for (const char* path : files)
+    {
+        // before: decode and upload as TextureLoader did
+        BenchmarkTimer decode;
+        int width, height, components;
+        unsigned char* pixels = stbi_load(path, &width, &height, &components, 0);
+        double decodeMs = decode.elapsedMs();
+        if (!pixels)
+        {
+            std::cout << "ERROR::BENCHMARK::TEXTURE_NOT_FOUND " << path << std::endl;
+            return -1;
+        }
+        static const GLenum PIXEL_FORMATS[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        BenchmarkTimer upload;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, PIXEL_FORMATS[components - 1], width, height, 0, PIXEL_FORMATS[components - 1], GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFinish();
+        double uploadMs = upload.elapsedMs();
+        glDeleteTextures(1, &texture);
+        size_t before = (size_t)width * height * (components == 3 ? 4 : components) * 4 / 3;
+
+        // first run: bake and store
+        BenchmarkTimer bake;
+        BakedTexture baked;
+        baker.get(path, false, baked);
+        double bakeMs = bake.elapsedMs();
+
+        // later runs: map the bake and upload every level, smallest first
+        BenchmarkTimer load;
+        BakedTexture stored;
+        if (!baker.get(path, false, stored) || stored.file == nullptr)
+        {
+            std::cout << "ERROR::BENCHMARK::BAKE_NOT_STORED " << path << std::endl;
+            return -1;
+        }
+        double loadMs = load.elapsedMs();
+        BenchmarkTimer hash;    // the part of the load that reads the whole source image
+        uint64_t sourceKey = baker.key(path, false);
+        double hashMs = hash.elapsedMs();
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        BenchmarkTimer streamed;
+        for (unsigned int level = (unsigned int)stored.levels.size(); level-- > 0;)
+            stored.upload(level);
+        glFinish();
+        double streamedMs = streamed.elapsedMs();
+
+        // what the GPU samples at level 0 against the decoded image
+        std::vector<unsigned char> readback((size_t)width * height * 4);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, readback.data());
+        glDeleteTextures(1, &texture);
+        double squared = 0.0;
+        int channels = std::min(components, 3);
+        for (size_t i = 0; i < (size_t)width * height; i++)
+            for (int c = 0; c < channels; c++)
+            {
+                double d = (double)readback[i * 4 + c] - pixels[i * components + c];
+                squared += d * d;
+            }
+        double psnr = 10.0 * std::log10(255.0 * 255.0 / std::max(squared / ((double)width * height * channels), 1e-9));
+        matched = matched && psnr > 30.0;
+        stbi_image_free(pixels);
+
+        std::cout << path << " " << width << "x" << height << "x" << components << " -> " << FORMAT_NAMES[stored.format] << ", "
+            << stored.levels.size() << " levels, PSNR " << psnr << " dB" << std::endl;
+        std::cout << "  before: decode " << decodeMs << " ms, upload + glGenerateMipmap " << uploadMs << " ms, " << before / 1024.0 << " KiB" << std::endl;
+        std::cout << "  after:  load " << loadMs << " ms (hashing the source " << hashMs << " ms" << (sourceKey == 1 ? " " : "") << "), upload " << streamedMs << " ms, " << stored.gpuBytes() / 1024.0 << " KiB (bake " << bakeMs << " ms once)" << std::endl;
+        totals[0] += decodeMs; totals[1] += uploadMs; totals[2] += bakeMs; totals[3] += loadMs; totals[4] += streamedMs;
+        vramBefore += before;
+        vramAfter += stored.gpuBytes();
+    }
+    std::cout << "total before: decode " << totals[0] << " ms, upload " << totals[1] << " ms, " << vramBefore / (1024.0 * 1024.0) << " MiB" << std::endl;
+    std::cout << "total after:  load " << totals[3] << " ms, upload " << totals[4] << " ms, " << vramAfter / (1024.0 * 1024.0) << " MiB (bake " << totals[2] << " ms once)" << std::endl;
+
+    // a gamma image without EXT_texture_sRGB: an uncompressed sRGB bake under a key of its own, which uploads complete
+    if (baker.compress)
+    {
+        const char* path = files[1];
+        bool compressSrgb = baker.compressSrgb;
+        uint64_t srgbKey = baker.key(path, true);
+        baker.compressSrgb = false;
+        BakedTexture fallback;
+        bool baked = baker.bake(path, true, fallback);
+        uint64_t fallbackKey = baker.key(path, true);
+        baker.compressSrgb = compressSrgb;
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (unsigned int level = (unsigned int)fallback.levels.size(); level-- > 0;)
+            fallback.upload(level);
+        bool uploaded = glGetError() == GL_NO_ERROR;
+        glDeleteTextures(1, &texture);
+        bool fellBack = baked && uploaded && fallback.internalFormat() == GL_SRGB && srgbKey != fallbackKey;
+        matched = matched && fellBack;
+        std::cout << "gamma bake: " << (compressSrgb ? "EXT_texture_sRGB present" : "no EXT_texture_sRGB") << ", without it "
+            << FORMAT_NAMES[fallback.format] << " sRGB" << (fellBack ? "" : " (ERROR: not a separate, complete bake)") << std::endl;
+    }
+
+    // the encoder alone, one thread, on a 1024x1024 RGB image
+    if (baker.compress)
+    {
+        int width, height, components;
+        unsigned char* pixels = stbi_load("./models/beach-ball/Beach_Ball_diffuse.jpg", &width, &height, &components, 3);
+        if (pixels)
+        {
+            std::vector<unsigned char> blocks((size_t)((width + 3) / 4) * ((height + 3) / 4) * 8);
+            BenchmarkTimer simd;
+            TextureBaker::compressLevel<SimdFloat>(pixels, width, height, 3, TEXTURE_BC1, blocks.data(), nullptr);
+            double simdMs = simd.elapsedMs();
+            BenchmarkTimer scalar;
+            TextureBaker::compressLevel<ScalarFloat>(pixels, width, height, 3, TEXTURE_BC1, blocks.data(), nullptr);
+            double scalarMs = scalar.elapsedMs();
+            double megatexels = (double)width * height / 1e6;
+            std::cout << "BC1 encoder, 1 thread: " << SimdFloat::WIDTH << "-wide " << megatexels / (simdMs / 1000.0) << " Mtexel/s, scalar "
+                << megatexels / (scalarMs / 1000.0) << " Mtexel/s" << std::endl;
+            stbi_image_free(pixels);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+    baker.setDirectory("./texture-cache");
+    return matched ? 0 : 1;
+}
+
+// A Model streamed in by the ModelLoader against one constructed in place: "--bench model-stream [path]
+// [budget KiB]". The blocking load is a single frame that lasts the whole import and upload. Streaming
+// renders frames meanwhile, each a clear, a pump() and glFinish, until the model is resident; the
+// report has how many frames that took and how long the worst one was. Both loads run the import (the
+// ModelCache is off), and the streamed buffers are read back and compared with the blocking load's.
+// ------------------------------------------------------------------------
+inline int benchmarkModelStream(const std::vector<std::string>& args)
+{
+    std::string path = "./models/backpack/backpack.obj";
+    size_t budget = 1 << 20;
+    for (const std::string& arg : args)
+    {
+        if (!arg.empty() && std::isdigit((unsigned char)arg[0]))
+            budget = (size_t)std::stoul(arg) << 10;
+        else
+            path = arg;
+    }
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    TextureCache::instance().setLoader(benchmarkFakeLoad, benchmarkFakeDelete);   // geometry only
+    ModelCache::instance().enabled = false;
+    VertexFormat format;
+    format.layout = VERTEX_LAYOUT_COMPACT;
+
+    BenchmarkTimer stall;
+    Model blocking(path, false, format, false);
+    glFinish();
+    double stallMs = stall.elapsedMs();
+
+    ModelLoader loader;
+    loader.uploadBudget = budget;
+    BenchmarkTimer total;
+    ModelHandle handle = loader.load(path, false, format, false);
+    unsigned int importFrames = 0, uploadFrames = 0, ringFull = 0;
+    double worstMs = 0.0, uploadMs = 0.0;
+    size_t uploaded = 0;
+    while (loader.state(handle) == MODEL_QUEUED || loader.state(handle) == MODEL_CPU_READY)
+    {
+        BenchmarkTimer frame;
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        bool importing = loader.state(handle) == MODEL_QUEUED;
+        loader.pump();
+        glFinish();
+        double ms = frame.elapsedMs();
+        worstMs = std::max(worstMs, ms);
+        if (importing && loader.stats.uploadedBytes == 0)
+        {
+            importFrames++;
+            std::this_thread::yield();  // the import wants the cores more than an empty frame
+            continue;
+        }
+        uploadFrames++;
+        uploadMs += ms;
+        uploaded += loader.stats.uploadedBytes;
+        ringFull += loader.stats.ringFull ? 1 : 0;
+    }
+    double totalMs = total.elapsedMs();
+    Model* streamed = loader.model(handle);
+    if (loader.state(handle) != MODEL_GPU_RESIDENT || !streamed)
+    {
+        std::cout << "ERROR::BENCHMARK::MODEL_NOT_STREAMED " << path << std::endl;
+        loader.destroy();
+        ModelCache::instance().enabled = true;
+        TextureCache::instance().setLoader(NULL, NULL);
+        return -1;
+    }
+
+    // the same bytes in every buffer as the blocking load uploaded
+    bool same = streamed->meshes.size() == blocking.meshes.size();
+    std::vector<unsigned char> expected, actual;
+    auto readBuffer = [](unsigned int buffer, size_t bytes, std::vector<unsigned char>& data) {
+        data.resize(bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        if (bytes > 0)
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)bytes, data.data());
+    };
+    for (size_t i = 0; same && i < blocking.meshes.size(); i++)
+    {
+        const Mesh& a = blocking.meshes[i];
+        const Mesh& b = streamed->meshes[i];
+        same = a.vertexCount == b.vertexCount && a.indexCount == b.indexCount;
+        size_t vertexBytes = (size_t)a.vertexCount * format.stride(), indexBytes = (size_t)a.indexCount * sizeof(unsigned int);
+        readBuffer(a.vertexBuffer(), vertexBytes, expected);
+        readBuffer(b.vertexBuffer(), vertexBytes, actual);
+        same = same && expected == actual;
+        readBuffer(a.indexBuffer(), indexBytes, expected);
+        readBuffer(b.indexBuffer(), indexBytes, actual);
+        same = same && expected == actual;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    std::cout << path << ": " << blocking.meshes.size() << " meshes, " << uploaded / (1024.0 * 1024.0) << " MiB, budget "
+        << budget / 1024 << " KiB/frame" << std::endl;
+    std::cout << "blocking: one frame of " << stallMs << " ms" << std::endl;
+    std::cout << "streamed: resident after " << totalMs << " ms, " << importFrames << " frames importing, " << uploadFrames
+        << " uploading (" << (uploadFrames ? uploadMs / uploadFrames : 0.0) << " ms mean, " << ringFull << " with the ring full), worst frame "
+        << worstMs << " ms" << std::endl;
+    std::cout << "streamed buffers " << (same ? "match" : "DIFFER FROM") << " the blocking load" << std::endl;
+
+    loader.destroy();
+    ModelCache::instance().enabled = true;
+    TextureCache::instance().setLoader(NULL, NULL);
+    return same ? 0 : 1;
+}
+
+// Scene graph updates: "--bench scene-graph [nodes] [frames]" builds objects of 100 nodes each (100k
+// nodes by default, a ternary tree five levels deep per object) and times update() per frame with
+// every object moved, with 1% moved and with none. The full update is compared with the same pass
+// written with glm's operator* and with what rebuilding every matrix from its root costs (a product per
+// level per node), and its results are checked against the glm pass.
+// ------------------------------------------------------------------------
+inline int benchmarkSceneGraph(const std::vector<std::string>& args)
+{
+    uint32_t count = args.size() > 0 ? (uint32_t)std::stoul(args[0]) : 100000;
+    unsigned int frames = args.size() > 1 ? (unsigned int)std::stoul(args[1]) : 100;
+    const uint32_t OBJECT_NODES = 100;
+    uint32_t objects = std::max(1u, count / OBJECT_NODES);
+
+    unsigned int seed = 5;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    auto randomTransform = [&]() {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(random(), random(), random()) * 2.0f - 1.0f);
+        return glm::rotate(transform, random() * 6.2831853f, glm::normalize(glm::vec3(random(), random(), random()) + 0.1f));
+    };
+    SceneGraph scene;
+    scene.reserve((size_t)objects * OBJECT_NODES);
+    std::vector<uint32_t> roots(objects);
+    for (uint32_t o = 0; o < objects; o++)
+    {
+        roots[o] = scene.add(randomTransform());
+        for (uint32_t k = 1; k < OBJECT_NODES; k++)
+            scene.add(randomTransform(), roots[o] + (k - 1) / 3);
+    }
+    scene.update();
+
+    // moves the given share of objects every frame, a different set each time
+    auto run = [&](uint32_t moved, ThreadPool* pool) {
+        BenchmarkTimer timer;
+        for (unsigned int f = 0; f < frames; f++)
+        {
+            for (uint32_t i = 0; i < moved; i++)
+            {
+                uint32_t root = roots[(f * 7919u + i * (objects / std::max(moved, 1u))) % objects];
+                scene.setLocal(root, glm::rotate(scene.local(root), 0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+            }
+            scene.update(pool);
+        }
+        return timer.elapsedMs() / frames;
+    };
+    double allMs = run(objects, &ThreadPool::shared());
+    unsigned int allUpdated = scene.stats.updated;
+    double serialMs = run(objects, nullptr);
+    double someMs = run(std::max(1u, objects / 100), &ThreadPool::shared());
+    unsigned int someUpdated = scene.stats.updated;
+    double noneMs = run(0, &ThreadPool::shared());
+
+    // the same pass with glm, and every matrix rebuilt from its root
+    std::vector<glm::mat4> worlds(scene.size());
+    BenchmarkTimer glmTimer;
+    for (unsigned int f = 0; f < frames; f++)
+    {
+        for (uint32_t node = 0; node < scene.size(); node++)
+            worlds[node] = scene.parent(node) == SceneGraph::NO_PARENT ? scene.local(node) : worlds[scene.parent(node)] * scene.local(node);
+    }
+    double glmMs = glmTimer.elapsedMs() / frames;
+    glm::mat4 sink(0.0f);
+    BenchmarkTimer rebuildTimer;
+    for (unsigned int f = 0; f < frames; f++)
+    {
+        for (uint32_t node = 0; node < scene.size(); node++)
+        {
+            glm::mat4 world = scene.local(node);
+            for (uint32_t up = scene.parent(node); up != SceneGraph::NO_PARENT; up = scene.parent(up))
+                world = scene.local(up) * world;
+            sink += world;
+        }
+    }
+    double rebuildMs = rebuildTimer.elapsedMs() / frames;
+    float worst = 0.0f;
+    for (uint32_t node = 0; node < scene.size(); node++)
+    {
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                worst = std::max(worst, std::fabs(worlds[node][c][r] - scene.world(node)[c][r]));
+    }
+
+    std::cout << scene.size() << " nodes in " << objects << " objects, " << frames << " frames (" << ThreadPool::shared().size() + 1 << " threads)" << std::endl;
+    std::cout << "all moved:  " << allMs << " ms/frame (" << allUpdated << " nodes, " << allUpdated / (allMs * 1000.0) << " M nodes/s), "
+        << serialMs << " ms on one thread" << std::endl;
+    std::cout << "1% moved:   " << someMs << " ms/frame (" << someUpdated << " nodes)" << std::endl;
+    std::cout << "none moved: " << noneMs << " ms/frame" << std::endl;
+    std::cout << "glm operator* pass " << glmMs << " ms/frame, rebuilt from the roots " << rebuildMs << " ms/frame" << (sink[0][0] == 0.5f ? " " : "")
+        << std::endl;
+    std::cout << "largest difference to the glm pass: " << worst << std::endl;
+    return worst < 1e-3f ? 0 : 1;
+}
+
+// An animated model through assimp: "--bench skinned-model [path]" (the skinned X test model shipped
+// with assimp by default). Imports it, loads it again from its ModelCache entry and checks the skeleton
+// and the bone ids and weights of every vertex survive the round trip, that every vertex has weights
+// adding up to 1 on existing bones, and that the file's clips bind to its nodes. Then skins the bind
+// pose on the CPU, which has to leave a skinned mesh as it is in model space and put a rigid one where
+// its node does, and plays the first clip, timing the import, the cached load, the clips and the pose
+// updates. Files whose nodes aren't in the bind pose (assimp's glTF2 simple_skin) or whose bones name
+// frames that don't exist (X anim_test) fail that check.
+// ------------------------------------------------------------------------
+inline int benchmarkSkinnedModel(const std::vector<std::string>& args)
+{
+    std::string path = args.size() > 0 ? args[0] : "./assimp-5.0.1/assimp-5.0.1/test/models/X/BCN_Epileptic.X";
+    BenchmarkContext context;
+    if (!context.create())
+        return -1;
+    TextureCache::instance().setLoader(benchmarkFakeLoad, benchmarkFakeDelete);   // geometry only
+    ModelCache& cache = ModelCache::instance();
+    cache.setDirectory("./model-cache-benchmark");
+    cache.clear();
+
+    BenchmarkTimer importTimer;
+    Model imported(path);
+    double importMs = importTimer.elapsedMs();
+    BenchmarkTimer cachedTimer;
+    Model cached(path);
+    double cachedMs = cachedTimer.elapsedMs();
+    bool fromCache = cache.stats.hits == 1;
+    TextureCache::instance().setLoader(NULL, NULL);
+    const Skeleton& skeleton = imported.skeleton;
+    if (imported.meshes.empty() || skeleton.empty())
+    {
+        std::cout << "ERROR::BENCHMARK::NOT_A_SKINNED_MODEL " << path << std::endl;
+        cache.clear();
+        return -1;
+    }
+
+    // the cache entry against the import, and the weights of every vertex
+    bool roundTrip = fromCache && cached.skeleton.nodeNames == skeleton.nodeNames && cached.skeleton.boneNames == skeleton.boneNames
+        && cached.skeleton.offsets == skeleton.offsets && cached.skeleton.boneNodes == skeleton.boneNodes
+        && cached.meshNodes == imported.meshNodes && cached.meshes.size() == imported.meshes.size();
+    size_t vertexCount = 0, badWeights = 0;
+    for (size_t m = 0; m < imported.meshes.size(); m++)
+    {
+        const std::vector<Vertex>& a = imported.meshes[m].vertices;
+        const std::vector<Vertex>& b = cached.meshes[m].vertices;
+        roundTrip = roundTrip && a.size() == b.size();
+        for (size_t v = 0; v < a.size(); v++)
+        {
+            float sum = 0.0f;
+            bool inRange = true;
+            for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+            {
+                sum += a[v].m_Weights[k];
+                inRange = inRange && a[v].m_BoneIDs[k] >= 0 && (uint32_t)a[v].m_BoneIDs[k] < skeleton.boneCount();
+                roundTrip = roundTrip && v < b.size() && a[v].m_BoneIDs[k] == b[v].m_BoneIDs[k] && a[v].m_Weights[k] == b[v].m_Weights[k];
+            }
+            badWeights += std::fabs(sum - 1.0f) > 1e-4f || !inRange ? 1 : 0;
+        }
+        vertexCount += a.size();
+    }
+
+    BenchmarkTimer clipTimer;
+    std::vector<AnimationClip> clips = AnimationClip::load(path, skeleton);
+    double clipMs = clipTimer.elapsedMs();
+    size_t tracks = 0;
+    for (const AnimationClip& clip : clips)
+        tracks += clip.tracks.size();
+
+    // the bind pose skinned on the CPU, against each mesh as it is (skinned) or placed by its node (rigid)
+    Animator animator(imported);
+    float bindDifference = 0.0f, extent = 0.0f;
+    std::vector<Vertex> skinned;
+    for (size_t m = 0; m < imported.meshes.size(); m++)
+    {
+        const std::vector<Vertex>& vertices = imported.meshes[m].vertices;
+        skinned.resize(vertices.size());
+        skinVertices(vertices.data(), vertices.size(), animator.bones().data(), skinned.data());
+        glm::mat4 placement = imported.meshTransform(m);
+        float asIs = 0.0f, placed = 0.0f;
+        for (size_t v = 0; v < vertices.size(); v++)
+        {
+            glm::vec3 moved = glm::vec3(placement * glm::vec4(vertices[v].Position, 1.0f));
+            asIs = std::max(asIs, glm::length(skinned[v].Position - vertices[v].Position));
+            placed = std::max(placed, glm::length(skinned[v].Position - moved));
+            extent = std::max(extent, glm::length(vertices[v].Position));
+        }
+        bindDifference = std::max(bindDifference, std::min(asIs, placed));
+    }
+
+    // the first clip played through, every palette finite
+    const int UPDATES = 1000;
+    bool finite = true;
+    double updateMs = 0.0;
+    if (!clips.empty())
+    {
+        animator.play(clips[0]);
+        float step = clips[0].duration > 0.0f ? clips[0].duration / UPDATES : 1.0f / 60.0f;
+        BenchmarkTimer updateTimer;
+        for (int i = 0; i < UPDATES; i++)
+            animator.update(step);
+        updateMs = updateTimer.elapsedMs();
+        for (const glm::mat4& bone : animator.bones())
+            for (int c = 0; c < 4; c++)
+                finite = finite && std::isfinite(bone[c].x) && std::isfinite(bone[c].y) && std::isfinite(bone[c].z) && std::isfinite(bone[c].w);
+    }
+    cache.clear();
+
+    bool bindMatches = bindDifference <= extent * 1e-4f;
+    std::cout << path << ": " << imported.meshes.size() << " meshes, " << vertexCount << " vertices, " << skeleton.nodeNames.size() << " nodes, "
+        << skeleton.boneCount() << " bones" << std::endl;
+    std::cout << "import " << importMs << " ms, cached load " << cachedMs << " ms, " << clips.size() << " clips with " << tracks << " tracks in "
+        << clipMs << " ms" << std::endl;
+    std::cout << "cache round trip " << (roundTrip ? "matches" : "DIFFERS") << ", " << badWeights << " vertices with weights not adding up to 1" << std::endl;
+    std::cout << "bind pose skinned: largest distance to the unskinned mesh " << bindDifference << " (model extent " << extent << ")" << std::endl;
+    if (!clips.empty())
+        std::cout << "\"" << clips[0].name << "\" (" << clips[0].duration << " s): " << updateMs * 1000.0 / UPDATES << " us per update, palette "
+            << (finite ? "finite" : "NOT FINITE") << std::endl;
+    return roundTrip && badWeights == 0 && tracks > 0 && bindMatches && finite ? 0 : 1;
+}
+
+// 1000 animated characters of a synthetic 64-bone model (a sphere skinned to a binary tree of bones)
+// playing a walk clip with a run clip blended in. Times the pose updates (sampling, blending, palettes)
+// on one thread and on the ThreadPool, the same with every character seeked to a random time each
+// frame (no cursor is any help then), the palette upload, drawing with a "Bones" block range per
+// character against one instanced draw reading the texture buffer, and skinning all vertices on the
+// CPU with skinVertices against a glm loop. The two draws must give the same depth image and the two
+// CPU skins the same vertices.
+// ------------------------------------------------------------------------
+inline int benchmarkSkinning(const std::vector<std::string>& args)
+{
+    unsigned int characters = args.size() > 0 ? (unsigned int)std::stoul(args[0]) : 1000;
+    uint32_t boneCount = args.size() > 1 ? (uint32_t)std::stoul(args[1]) : 64;
+    boneCount = std::min(std::max(boneCount, 1u), (uint32_t)MAX_BONES);
+    const int FRAMES = 60;
+    const float DT = 1.0f / 60.0f;
+    const int SIZE = 256;
+    BenchmarkContext context;
+    if (!context.create(SIZE, SIZE))
+        return -1;
+
+    unsigned int seed = 11;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+
+    ShaderLibrary shaders("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    Shader& single = shaders.get(ShaderVariant().with(SHADER_SKINNED));
+    Shader& instanced = shaders.get(ShaderVariant().with(SHADER_SKINNED | SHADER_INSTANCED));
+
+    // the model: a node per bone in a binary tree reaching up the sphere, each vertex on the bone of its ring and that bone's parent
+    Model model(Model::Deferred(), "synthetic/character", false, VertexFormat::forShader(single), true);
+    for (uint32_t bone = 0; bone < boneCount; bone++)
+    {
+        uint32_t parent = bone == 0 ? SceneGraph::NO_PARENT : (bone - 1) / 2;
+        model.nodes.add(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, bone == 0 ? -1.0f : 0.3f, 0.0f)), parent);
+        model.skeleton.nodeNames.push_back("bone" + std::to_string(bone));
+    }
+    model.nodes.update();
+    for (uint32_t bone = 0; bone < boneCount; bone++)
+        model.skeleton.addBone("bone" + std::to_string(bone), glm::inverse(model.nodes.world(bone)));
+    model.skeleton.resolve();
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    makeBenchmarkSphere(24, 32, vertices, indices);
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+        Vertex& vertex = vertices[v];
+        uint32_t bone = std::min((uint32_t)(v * boneCount / vertices.size()), boneCount - 1);
+        vertex.m_BoneIDs[0] = (int)bone;
+        vertex.m_BoneIDs[1] = bone == 0 ? 0 : (int)((bone - 1) / 2);
+        vertex.m_BoneIDs[2] = vertex.m_BoneIDs[3] = 0;
+        vertex.m_Weights[0] = 0.7f;
+        vertex.m_Weights[1] = 0.3f;
+        vertex.m_Weights[2] = vertex.m_Weights[3] = 0.0f;
+    }
+    model.meshes.reserve(1);
+    model.meshes.emplace_back(vertices, indices, std::vector<Texture>(), model.vertexFormat, true);
+    model.meshNodes.push_back(0);
+
+    // walk and run: a rotation track on every bone, 30 keys a second, and the root bobbing up and down
+    auto makeClip = [&](const char* name, float duration, float amplitude) {
+        AnimationClip clip;
+        clip.name = name;
+        clip.duration = duration;
+        for (uint32_t bone = 0; bone < boneCount; bone++)
+        {
+            clip.addTrack(bone);
+            int keys = (int)(duration * 30.0f) + 1;
+            for (int k = 0; k < keys; k++)
+            {
+                float time = duration * k / (keys - 1);
+                float angle = amplitude * std::sin(6.2831853f * time / duration + bone * 0.5f);
+                clip.addRotation(time, glm::angleAxis(angle, glm::normalize(glm::vec3(1.0f, 0.2f * (bone % 3), 0.5f))));
+                if (bone == 0)
+                    clip.addPosition(time, glm::vec3(0.0f, -1.0f + 0.1f * std::fabs(std::sin(6.2831853f * time / duration)), 0.0f));
+            }
+        }
+        return clip;
+    };
+    AnimationClip walk = makeClip("walk", 1.0f, 0.3f);
+    AnimationClip run = makeClip("run", 0.6f, 0.6f);
+
+    std::vector<Animator> crowd(characters, Animator(model));
+    for (unsigned int i = 0; i < characters; i++)
+    {
+        crowd[i].play(walk);
+        crowd[i].blend(&run, random());
+        crowd[i].seek(random());
+    }
+
+    auto runUpdates = [&](ThreadPool* pool, bool seekEveryFrame) {
+        BenchmarkTimer timer;
+        for (int frame = 0; frame < FRAMES; frame++)
+        {
+            if (seekEveryFrame)
+                for (Animator& animator : crowd)
+                    animator.seek(random());
+            Animator::updateAll(crowd, DT, pool);
+        }
+        return timer.elapsedMs() / FRAMES;
+    };
+    runUpdates(&ThreadPool::shared(), false);
+    double serialMs = runUpdates(nullptr, false);
+    double poolMs = runUpdates(&ThreadPool::shared(), false);
+    double seekMs = runUpdates(&ThreadPool::shared(), true);
+
+    // palettes and draws
+    BonePalettes palettes;
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    float side = std::ceil(std::sqrt((float)characters));
+    frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+    frameUniforms.data.view = glm::lookAt(glm::vec3(0.0f, 0.0f, side * 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.update();
+    std::vector<glm::mat4> transforms(characters);
+    for (unsigned int i = 0; i < characters; i++)
+        transforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3(std::fmod((float)i, side) * 2.5f - side * 1.25f, std::floor(i / side) * 2.5f - side * 1.25f, 0.0f));
+    glEnable(GL_DEPTH_TEST);
+    glViewport(0, 0, SIZE, SIZE);
+
+    palettes.upload(crowd);
+    glFinish();
+    BenchmarkTimer uploadTimer;
+    for (int frame = 0; frame < FRAMES; frame++)
+        palettes.upload(crowd);
+    glFinish();
+    double uploadMs = uploadTimer.elapsedMs() / FRAMES;
+
+    auto drawSingle = [&]() {
+        single.use();
+        for (unsigned int i = 0; i < characters; i++)
+        {
+            palettes.bind(i);
+            model.DrawSkinned(single, transforms[i]);
+        }
+    };
+    auto drawInstanced = [&]() {
+        instanced.use();
+        palettes.bindInstanced(instanced, 0);
+        model.DrawInstanced(instanced, transforms.data(), characters);
+    };
+    auto timeDraws = [&](const std::function<void()>& draw, std::vector<float>& depth) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw();
+        glFinish();
+        const int DRAW_FRAMES = 10;
+        BenchmarkTimer timer;
+        for (int frame = 0; frame < DRAW_FRAMES; frame++)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            draw();
+        }
+        glFinish();
+        double ms = timer.elapsedMs() / DRAW_FRAMES;
+        depth.resize(SIZE * SIZE);
+        glReadPixels(0, 0, SIZE, SIZE, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+        return ms;
+    };
+    std::vector<float> singleDepth, instancedDepth;
+    double singleMs = timeDraws(drawSingle, singleDepth);
+    double instancedMs = timeDraws(drawInstanced, instancedDepth);
+    float depthDifference = 0.0f;
+    unsigned int covered = 0;
+    for (size_t p = 0; p < singleDepth.size(); p++)
+    {
+        depthDifference = std::max(depthDifference, std::fabs(singleDepth[p] - instancedDepth[p]));
+        covered += singleDepth[p] < 1.0f ? 1 : 0;
+    }
+
+    // CPU skinning of every character
+    std::vector<std::vector<Vertex>> skinned(characters, vertices);
+    auto skinAll = [&](ThreadPool* pool) {
+        BenchmarkTimer timer;
+        auto body = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                skinVertices(vertices.data(), vertices.size(), crowd[i].bones().data(), skinned[i].data());
+        };
+        if (pool)
+            pool->parallelFor(characters, body, 16);
+        else
+            body(0, characters);
+        return timer.elapsedMs();
+    };
+    skinAll(nullptr);
+    double skinMs = skinAll(nullptr);
+    double skinPoolMs = skinAll(&ThreadPool::shared());
+    std::vector<Vertex> reference(vertices);
+    float skinDifference = 0.0f;
+    BenchmarkTimer glmTimer;
+    for (unsigned int i = 0; i < characters; i++)
+    {
+        const std::vector<glm::mat4>& bones = crowd[i].bones();
+        for (size_t v = 0; v < vertices.size(); v++)
+        {
+            const Vertex& vertex = vertices[v];
+            glm::mat4 skin(0.0f);
+            for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+                skin += bones[vertex.m_BoneIDs[k]] * vertex.m_Weights[k];
+            reference[v].Position = glm::vec3(skin * glm::vec4(vertex.Position, 1.0f));
+            reference[v].Normal = glm::normalize(glm::mat3(skin) * vertex.Normal);
+        }
+        for (size_t v = 0; v < vertices.size(); v++)
+            skinDifference = std::max(skinDifference, glm::length(reference[v].Position - skinned[i][v].Position));
+    }
+    double glmMs = glmTimer.elapsedMs();
+
+    size_t totalVertices = (size_t)characters * vertices.size();
+    std::cout << characters << " characters, " << boneCount << " bones, " << walk.tracks.size() + run.tracks.size() << " tracks in 2 clips, "
+        << vertices.size() << " vertices each (" << ThreadPool::shared().size() + 1 << " threads)" << std::endl;
+    std::cout << "pose update:       " << poolMs << " ms/frame on the pool, " << serialMs << " ms on one thread ("
+        << serialMs * 1000.0 / characters << " us per character)" << std::endl;
+    std::cout << "seek every frame:  " << seekMs << " ms/frame" << std::endl;
+    std::cout << "palette upload:    " << uploadMs << " ms/frame, " << palettes.bytes() / 1024.0 << " KiB (" << palettes.stride << " bytes per palette)" << std::endl;
+    std::cout << "draw, Bones block: " << singleMs << " ms/frame, " << characters << " draw calls" << std::endl;
+    std::cout << "draw, instanced:   " << instancedMs << " ms/frame, 1 draw call; " << covered << " pixels covered, largest depth difference "
+        << depthDifference << std::endl;
+    std::cout << "CPU skinning:      " << skinMs << " ms (" << totalVertices / (skinMs * 1000.0) << " M vertices/s), " << skinPoolMs
+        << " ms on the pool, glm loop " << glmMs << " ms; largest difference " << skinDifference << std::endl;
+    return depthDifference < 1e-5f && covered > 0 && skinDifference < 1e-3f ? 0 : 1;
+}
+
+// entry point for "--bench <name> [arguments]"
+inline int runBenchmark(const std::string& name, const std::vector<std::string>& args = std::vector<std::string>())
+{
+    if (name == "uniforms")
+        return benchmarkUniforms();
+    if (name == "textures")
+        return benchmarkTextureCache();
+    if (name == "texture-decode")
+        return benchmarkTextureDecode();
+    if (name == "vertex-formats")
+        return benchmarkVertexFormats();
+    if (name == "model-load")
+        return benchmarkModelLoad(args);
+    if (name == "batch")
+        return benchmarkBatch(args);
+    if (name == "instancing")
+        return benchmarkInstancing();
+    if (name == "render-queue")
+        return benchmarkRenderQueue();
+    if (name == "culling")
+        return benchmarkCulling();
+    if (name == "physics")
+        return benchmarkPhysics(args);
+    if (name == "broadphase")
+        return benchmarkBroadphase(args);
+    if (name == "bvh")
+        return benchmarkBvh(args);
+    if (name == "pipeline")
+        return benchmarkPipeline(args);
+    if (name == "gpu-passes")
+        return benchmarkGpuPasses(args);
+    if (name == "shader-cache")
+        return benchmarkShaderCache(args);
+    if (name == "shader-variants")
+        return benchmarkShaderVariants(args);
+    if (name == "model-cache")
+        return benchmarkModelCache(args);
+    if (name == "texture-bake")
+        return benchmarkTextureBake(args);
+    if (name == "model-stream")
+        return benchmarkModelStream(args);
+    if (name == "scene-graph")
+        return benchmarkSceneGraph(args);
+    if (name == "skinning")
+        return benchmarkSkinning(args);
+    if (name == "skinned-model")
+        return benchmarkSkinnedModel(args);
+
+    std::cout << "Unknown benchmark: " << name << "\nAvailable: uniforms, textures, texture-decode, vertex-formats, model-load, batch, instancing, render-queue, culling, physics, broadphase, bvh, pipeline, gpu-passes, shader-cache, shader-variants, model-cache, texture-bake, model-stream, scene-graph, skinning, skinned-model" << std::endl;
+    return -1;
+}
+
+#endif
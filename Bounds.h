@@ -0,0 +1,67 @@
+#pragma once
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Axis-aligned bounding box. A default constructed box is empty (min > max) and grows with expand().
+struct BoundingBox
+{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    BoundingBox() {}
+    BoundingBox(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    bool empty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void expand(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    glm::vec3 center() const
+    {
+        return (min + max) * 0.5f;
+    }
+    glm::vec3 extent() const
+    {
+        return (max - min) * 0.5f;
+    }
+    // radius of the bounding sphere around center()
+    float radius() const
+    {
+        return glm::length(extent());
+    }
+
+    // the box around this box after an affine transform (Arvo's method: the new extent is |M| * extent)
+    BoundingBox transformed(const glm::mat4& transform) const
+    {
+        glm::vec3 c = glm::vec3(transform * glm::vec4(center(), 1.0f));
+        glm::vec3 e = extent();
+        glm::vec3 newExtent(
+            std::fabs(transform[0][0]) * e.x + std::fabs(transform[1][0]) * e.y + std::fabs(transform[2][0]) * e.z,
+            std::fabs(transform[0][1]) * e.x + std::fabs(transform[1][1]) * e.y + std::fabs(transform[2][1]) * e.z,
+            std::fabs(transform[0][2]) * e.x + std::fabs(transform[1][2]) * e.y + std::fabs(transform[2][2]) * e.z);
+        return BoundingBox(c - newExtent, c + newExtent);
+    }
+};
+
+// largest factor by which the transform scales a length, for moving bounding spheres
+inline float maxScale(const glm::mat4& transform)
+{
+    float x = glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0]));
+    float y = glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1]));
+    float z = glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]));
+    return std::sqrt(std::max(x, std::max(y, z)));
+}
+
+#endif
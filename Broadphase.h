@@ -0,0 +1,246 @@
+#pragma once
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+//Finds the overlapping pairs among many spheres with a uniform grid. Every sphere sits in the cell
+//holding its center; cells are at least one diameter wide, so a sphere can only touch spheres in its
+//own cell and the 26 around it. Each cell visits itself and the 13 neighbours "after" it, which
+//reports every pair exactly once.
+//
+//The grid has no cell table: it is the list of (cell, body) entries sorted by cell key, with x, y, z
+//packed from most to least significant, and the positions copied into the same order. The 13 forward
+//neighbours of a cell are then 5 runs of consecutive keys (the rest of its own z column and 4 columns
+//of 3 cells), and because the keys of those runs only grow as the entries are walked in order, each
+//run is found by a cursor that moves forward through the list. Pair finding reads memory in 6
+//sequential streams instead of looking up cells at random.
+//
+//Between updates only the spheres that changed cells are taken out and merged back in; a full radix
+//sort runs when many moved. Pair finding and the exact sphere test run on the thread pool, and the
+//result is sorted, so the output doesn't depend on the thread count.
+class BroadphaseGrid
+{
+public:
+    // of the last update() / findPairs()
+    struct Stats
+    {
+        unsigned int moved = 0;         // spheres that changed cells
+        bool rebuilt = false;           // full sort instead of an incremental merge
+        uint64_t candidates = 0;        // sphere pairs tested
+        unsigned int pairs = 0;         // pairs that overlap
+    };
+    Stats stats;
+    float cellSize = 0.0f;                  // read when the number of spheres changes; 0 picks the largest diameter
+    float rebuildFraction = 0.125f;         // re-sort everything when more than this fraction moved
+    std::vector<uint64_t> pairs;            // overlapping pairs as (lower body << 32 | higher body), ascending
+
+    static uint32_t pairFirst(uint64_t pair) { return (uint32_t)(pair >> 32); }
+    static uint32_t pairSecond(uint64_t pair) { return (uint32_t)pair; }
+
+    // null runs the narrowphase on ThreadPool::shared(), created on first use
+    explicit BroadphaseGrid(ThreadPool* pool = nullptr) : pool(pool) {}
+
+    // files the spheres into the grid; the arrays hold count elements indexed by body.
+    // Cell coordinates must stay within +-2^20 cells of the origin.
+    void update(const float* x, const float* y, const float* z, const float* radius, size_t count)
+    {
+        PROFILE_ZONE("BroadphaseGrid::update");
+        stats = Stats();
+        if (bodyCell.empty() || count != bodyCell.size())
+        {
+            automaticCellSize = automaticCellSize || cellSize <= 0.0f;
+            if (automaticCellSize)
+            {
+                float largest = 0.0f;
+                for (size_t i = 0; i < count; i++)
+                    largest = std::max(largest, radius[i]);
+                cellSize = largest > 0.0f ? 2.0f * largest : 1.0f;
+            }
+            bodyCell.assign(count, ~0ull);
+            entries.clear();
+        }
+        float inverseCell = 1.0f / cellSize;
+
+        // which spheres left their cell
+        moved.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t cell = cellKey((int32_t)std::floor(x[i] * inverseCell), (int32_t)std::floor(y[i] * inverseCell), (int32_t)std::floor(z[i] * inverseCell));
+            if (cell != bodyCell[i])
+            {
+                bodyCell[i] = cell;
+                moved.push_back((uint32_t)i);
+            }
+        }
+        stats.moved = (unsigned int)moved.size();
+
+        if (entries.size() != count || moved.size() > count * rebuildFraction)
+            rebuild(count);
+        else if (!moved.empty())
+            merge();
+
+        sortedX.resize(count); sortedY.resize(count); sortedZ.resize(count); sortedRadius.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t body = entries[i].body;
+            sortedX[i] = x[body]; sortedY[i] = y[body]; sortedZ[i] = z[body]; sortedRadius[i] = radius[body];
+        }
+    }
+
+    // fills pairs with the overlapping spheres of the last update()
+    void findPairs()
+    {
+        PROFILE_ZONE("BroadphaseGrid::findPairs");
+        ThreadPool& workers = pool ? *pool : ThreadPool::shared();
+        size_t count = entries.size();
+        size_t chunks = std::max<size_t>(1, std::min<size_t>(count / 4096, (workers.size() + 1) * 8));
+        chunkPairs.resize(chunks);
+        std::vector<uint64_t> chunkCandidates(chunks, 0);
+        workers.parallelFor(chunks, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++)
+            {
+                chunkPairs[c].clear();
+                chunkCandidates[c] = findPairs(count * c / chunks, count * (c + 1) / chunks, chunkPairs[c]);
+            }
+        }, 1);
+
+        size_t total = 0;
+        for (size_t c = 0; c < chunks; c++)
+        {
+            total += chunkPairs[c].size();
+            stats.candidates += chunkCandidates[c];
+        }
+        pairs.clear();
+        pairs.reserve(total);
+        for (size_t c = 0; c < chunks; c++)
+            pairs.insert(pairs.end(), chunkPairs[c].begin(), chunkPairs[c].end());
+        std::sort(pairs.begin(), pairs.end());
+        stats.pairs = (unsigned int)pairs.size();
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t cell;
+        uint32_t body;
+    };
+
+    // 21 bits per axis, biased so that neighbouring cells differ by a constant in key space
+    static const int AXIS_BITS = 21;
+    static const int64_t AXIS_BIAS = 1 << 20;
+    static const uint64_t X_STEP = 1ull << (2 * AXIS_BITS), Y_STEP = 1ull << AXIS_BITS;
+
+    ThreadPool* pool;
+    bool automaticCellSize = false;
+    std::vector<uint64_t> bodyCell;         // cell of every body at the last update
+    std::vector<uint32_t> moved;
+    std::vector<Entry> entries, scratch;    // sorted by cell
+    std::vector<float> sortedX, sortedY, sortedZ, sortedRadius;    // in entry order
+    std::vector<std::vector<uint64_t>> chunkPairs;
+
+    static uint64_t cellKey(int32_t ix, int32_t iy, int32_t iz)
+    {
+        const uint64_t mask = (1ull << AXIS_BITS) - 1;
+        return ((uint64_t)(ix + AXIS_BIAS) & mask) * X_STEP + ((uint64_t)(iy + AXIS_BIAS) & mask) * Y_STEP + ((uint64_t)(iz + AXIS_BIAS) & mask);
+    }
+
+    // LSD radix sort of all bodies by cell, 11 bits per pass, skipping digits that are the same everywhere
+    void rebuild(size_t count)
+    {
+        stats.rebuilt = true;
+        entries.resize(count);
+        for (size_t i = 0; i < count; i++)
+            entries[i] = Entry{ bodyCell[i], (uint32_t)i };
+        scratch.resize(count);
+        for (int shift = 0; shift < 3 * AXIS_BITS; shift += 11)
+        {
+            uint32_t histogram[2048] = {};
+            for (const Entry& entry : entries)
+                histogram[(entry.cell >> shift) & 2047]++;
+            if (count == 0 || histogram[(entries[0].cell >> shift) & 2047] == count)
+                continue;
+            uint32_t sum = 0;
+            for (uint32_t& h : histogram)
+            {
+                uint32_t c = h;
+                h = sum;
+                sum += c;
+            }
+            for (const Entry& entry : entries)
+                scratch[histogram[(entry.cell >> shift) & 2047]++] = entry;
+            entries.swap(scratch);
+        }
+    }
+
+    // takes the moved bodies out of the sorted entries and merges them back in at their new cells
+    void merge()
+    {
+        std::vector<Entry> movedEntries(moved.size());
+        for (size_t i = 0; i < moved.size(); i++)
+            movedEntries[i] = Entry{ bodyCell[moved[i]], moved[i] };
+        auto byCell = [](const Entry& a, const Entry& b) { return a.cell < b.cell; };
+        std::sort(movedEntries.begin(), movedEntries.end(), byCell);
+
+        // an entry is stale when its body's cell changed since it was filed
+        scratch.clear();
+        for (const Entry& entry : entries)
+            if (entry.cell == bodyCell[entry.body])
+                scratch.push_back(entry);
+        entries.resize(scratch.size() + movedEntries.size());
+        std::merge(scratch.begin(), scratch.end(), movedEntries.begin(), movedEntries.end(), entries.begin(), byCell);
+    }
+
+    // pairs of the entries [begin, end) with the spheres in their own and the 13 following cells; returns the spheres tested
+    uint64_t findPairs(size_t begin, size_t end, std::vector<uint64_t>& out) const
+    {
+        // the z columns (x + 1, y - 1), (x + 1, y), (x + 1, y + 1) and (x, y + 1), each from z - 1 to z + 1
+        const uint64_t columns[4] = { X_STEP - Y_STEP - 1, X_STEP - 1, X_STEP + Y_STEP - 1, Y_STEP - 1 };
+        size_t cursor[4];
+        for (int c = 0; c < 4; c++)
+            cursor[c] = begin < end ? lowerBound(entries[begin].cell + columns[c]) : end;
+
+        uint64_t candidates = 0;
+        size_t count = entries.size();
+        for (size_t i = begin; i < end; i++)
+        {
+            uint64_t cell = entries[i].cell;
+            float ax = sortedX[i], ay = sortedY[i], az = sortedZ[i], ar = sortedRadius[i];
+            auto test = [&](size_t j) {
+                float dx = sortedX[j] - ax, dy = sortedY[j] - ay, dz = sortedZ[j] - az, reach = sortedRadius[j] + ar;
+                candidates++;
+                if (dx * dx + dy * dy + dz * dz < reach * reach)
+                {
+                    uint32_t a = entries[i].body, b = entries[j].body;
+                    out.push_back(a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a);
+                }
+            };
+            // the rest of this cell, then the next cell along z
+            for (size_t j = i + 1; j < count && entries[j].cell <= cell + 1; j++)
+                test(j);
+            for (int c = 0; c < 4; c++)
+            {
+                uint64_t first = cell + columns[c], last = first + 2;
+                size_t& j = cursor[c];
+                while (j < count && entries[j].cell < first)
+                    j++;
+                for (size_t k = j; k < count && entries[k].cell <= last; k++)
+                    test(k);
+            }
+        }
+        return candidates;
+    }
+
+    size_t lowerBound(uint64_t cell) const
+    {
+        return std::lower_bound(entries.begin(), entries.end(), cell, [](const Entry& entry, uint64_t key) { return entry.cell < key; }) - entries.begin();
+    }
+};
+
+#endif
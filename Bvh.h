@@ -0,0 +1,816 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "Bounds.h"
+#include "Mesh.h"
+#include "Profiler.h"
+#include "SceneGraph.h"
+#include "ThreadPool.h"
+
+// 32 bytes, two to a cache line. Interior nodes (count == 0) keep their children next to each other
+// at leftOrFirst and leftOrFirst + 1; leaves hold count triangles starting at leftOrFirst.
+struct BvhNode
+{
+    float min[3];
+    uint32_t leftOrFirst;
+    float max[3];
+    uint32_t count;
+
+    bool leaf() const
+    {
+        return count != 0;
+    }
+};
+
+struct BvhTriangle
+{
+    glm::vec3 v0, v1, v2;
+};
+
+struct RayHit
+{
+    float distance = FLT_MAX;       // along the normalized ray direction
+    uint32_t triangle = 0;          // index passed to addTriangles, counted over all calls
+    glm::vec3 normal;               // of the triangle, facing the ray origin
+};
+
+// where a moving sphere first touches the level, or a resting sphere overlaps it
+struct SphereContact
+{
+    float time = 1.0f;              // fraction of the sweep, 0 when already overlapping
+    float depth = 0.0f;             // penetration at time 0 for overlaps
+    uint32_t triangle = 0;
+    glm::vec3 point;                // on the triangle
+    glm::vec3 normal;               // from the triangle towards the sphere center
+};
+
+//Bounding volume hierarchy over static triangles, e.g. the meshes of a level model, for ball
+//contacts (sphereSweep, sphereOverlaps) and line-of-sight tests such as camera occlusion (raycast).
+//
+//build() splits nodes with the surface area heuristic evaluated at 16 bins per axis. The top of the
+//tree is built on the calling thread with the binning of large nodes spread over the pool; once
+//there are enough independent subtrees they are built in parallel and spliced into one flat node
+//array. Triangles are copied into leaf order, so a leaf reads its triangles from one contiguous run.
+class MeshBvh
+{
+public:
+    static const int BINS = 16;
+    static const unsigned int SAH_DEPTH = 40;     // deeper nodes are halved, so a tree is at most about 72 levels
+    unsigned int maxLeafTriangles = 8;
+    float traversalCost = 1.0f;     // relative to one triangle test, in the SAH
+
+    struct Stats
+    {
+        double buildMs = 0.0;
+        unsigned int nodes = 0;
+        unsigned int leaves = 0;
+        unsigned int depth = 0;
+        float sahCost = 0.0f;       // expected triangle and node tests of a random ray
+    };
+    Stats stats;
+
+    std::vector<BvhNode> nodes;             // nodes[0] is the root
+    std::vector<BvhTriangle> triangles;     // in leaf order after build()
+    std::vector<uint32_t> triangleIds;      // original index of each triangle
+
+    // adds triangles from a position array and a triangle list, moved by transform
+    void addTriangles(const glm::vec3* positions, const unsigned int* indices, size_t indexCount, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        triangles.reserve(triangles.size() + indexCount / 3);
+        for (size_t i = 0; i + 2 < indexCount; i += 3)
+        {
+            BvhTriangle triangle;
+            triangle.v0 = glm::vec3(transform * glm::vec4(positions[indices[i]], 1.0f));
+            triangle.v1 = glm::vec3(transform * glm::vec4(positions[indices[i + 1]], 1.0f));
+            triangle.v2 = glm::vec3(transform * glm::vec4(positions[indices[i + 2]], 1.0f));
+            triangles.push_back(triangle);
+        }
+    }
+    // the mesh must have been created with keepGeometry
+    bool addMesh(const Mesh& mesh, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        if (mesh.vertices.empty() && mesh.indexCount > 0)
+        {
+            std::cout << "ERROR::BVH::MESH_GEOMETRY_FREED" << std::endl;
+            return false;
+        }
+        triangles.reserve(triangles.size() + mesh.indices.size() / 3);
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            BvhTriangle triangle;
+            triangle.v0 = glm::vec3(transform * glm::vec4(mesh.vertices[mesh.indices[i]].Position, 1.0f));
+            triangle.v1 = glm::vec3(transform * glm::vec4(mesh.vertices[mesh.indices[i + 1]].Position, 1.0f));
+            triangle.v2 = glm::vec3(transform * glm::vec4(mesh.vertices[mesh.indices[i + 2]].Position, 1.0f));
+            triangles.push_back(triangle);
+        }
+        return true;
+    }
+    // every mesh at the same transform, for meshes that don't hang off a node hierarchy
+    bool addMeshes(const std::vector<Mesh>& meshes, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        bool added = true;
+        for (const Mesh& mesh : meshes)
+            added = addMesh(mesh, transform) && added;
+        return added;
+    }
+    // the meshes of a model where its nodes put them: meshes[i] at transform * nodes.world(meshNodes[i]),
+    // e.g. addMeshes(model.meshes, model.nodes, model.meshNodes)
+    bool addMeshes(const std::vector<Mesh>& meshes, const SceneGraph& nodes, const std::vector<uint32_t>& meshNodes, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        bool added = true;
+        for (size_t i = 0; i < meshes.size(); i++)
+            added = addMesh(meshes[i], transform * nodes.world(meshNodes[i])) && added;
+        return added;
+    }
+
+    void clear()
+    {
+        nodes.clear();
+        triangles.clear();
+        triangleIds.clear();
+    }
+
+    // builds the tree over every triangle added so far; null uses ThreadPool::shared()
+    void build(ThreadPool* pool = nullptr)
+    {
+        PROFILE_ZONE("MeshBvh::build");
+        auto start = std::chrono::steady_clock::now();
+        ThreadPool& workers = pool ? *pool : ThreadPool::shared();
+        size_t count = triangles.size();
+        stats = Stats();
+        nodes.clear();
+        triangleIds.resize(count);
+        if (count == 0)
+            return;
+
+        // per triangle bounds and centroid, the only inputs of the build
+        boxes.resize(count);
+        centroids.resize(count);
+        workers.parallelFor(count, [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                const BvhTriangle& t = triangles[i];
+                boxes[i] = BoundingBox(glm::min(t.v0, glm::min(t.v1, t.v2)), glm::max(t.v0, glm::max(t.v1, t.v2)));
+                centroids[i] = boxes[i].center();
+                triangleIds[i] = (uint32_t)i;
+            }
+        }, 4096);
+
+        // the top levels here, each split binned in parallel, until there are enough subtrees to go round
+        struct Task
+        {
+            uint32_t node, first, count, depth;
+        };
+        std::vector<Task> open{ Task{ 0, 0, (uint32_t)count, 0 } }, subtrees;
+        nodes.resize(1);
+        size_t wanted = (size_t)(workers.size() + 1) * 4;
+        size_t parallelMinimum = std::max<size_t>(4096, count / (wanted * 4));
+        for (size_t next = 0; next < open.size(); next++)    // breadth first, so the subtrees come out of similar size
+        {
+            Task task = open[next];
+            if (task.count <= parallelMinimum || open.size() - next + subtrees.size() >= wanted)
+            {
+                subtrees.push_back(task);
+                continue;
+            }
+            Split split = findSplit(nodes[task.node], task.first, task.count, task.depth, &workers);
+            if (split.axis < 0)
+                continue;    // made a leaf
+            uint32_t middle = partition(split, task.first, task.count);
+            uint32_t left = (uint32_t)nodes.size();
+            nodes.resize(nodes.size() + 2);
+            nodes[task.node].leftOrFirst = left;
+            nodes[task.node].count = 0;
+            open.push_back(Task{ left, task.first, middle - task.first, task.depth + 1 });
+            open.push_back(Task{ left + 1, middle, task.first + task.count - middle, task.depth + 1 });
+        }
+
+        // independent subtrees in parallel, then spliced in: local node 0 goes to the task's slot, the rest to the end
+        std::vector<std::vector<BvhNode>> built(subtrees.size());
+        workers.parallelFor(subtrees.size(), [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++)
+            {
+                built[s].resize(1);
+                buildSubtree(built[s], 0, subtrees[s].first, subtrees[s].count, subtrees[s].depth);
+            }
+        }, 1);
+        for (size_t s = 0; s < subtrees.size(); s++)
+        {
+            uint32_t base = (uint32_t)nodes.size() - 1;
+            for (BvhNode& node : built[s])
+                if (!node.leaf())
+                    node.leftOrFirst += base;
+            nodes[subtrees[s].node] = built[s][0];
+            nodes.insert(nodes.end(), built[s].begin() + 1, built[s].end());
+        }
+
+        // triangles into leaf order
+        std::vector<BvhTriangle> ordered(count);
+        for (size_t i = 0; i < count; i++)
+            ordered[i] = triangles[triangleIds[i]];
+        triangles.swap(ordered);
+        std::vector<BoundingBox>().swap(boxes);
+        std::vector<glm::vec3>().swap(centroids);
+
+        measure(0, 1, 1.0f / std::max(area(nodes[0]), FLT_MIN));
+        stats.nodes = (unsigned int)nodes.size();
+        stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // nearest triangle hit by the ray within maxDistance; direction need not be normalized
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit) const
+    {
+        if (nodes.empty())
+            return false;
+        float length = glm::length(direction);
+        if (length == 0.0f)
+            return false;
+        glm::vec3 dir = direction / length;
+        glm::vec3 inverse = safeInverse(dir);
+        float best = maxDistance;
+        uint32_t bestIndex = UINT32_MAX;
+
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BvhNode& node = nodes[stack[--top]];
+            if (rayBox(node, origin, inverse, 0.0f, best) == FLT_MAX)
+                continue;
+            if (node.leaf())
+            {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+                {
+                    float t;
+                    if (rayTriangle(triangles[i], origin, dir, t) && t < best)
+                    {
+                        best = t;
+                        bestIndex = i;
+                    }
+                }
+                continue;
+            }
+            // nearer child last, so it is popped first
+            float nearLeft = rayBox(nodes[node.leftOrFirst], origin, inverse, 0.0f, best);
+            float nearRight = rayBox(nodes[node.leftOrFirst + 1], origin, inverse, 0.0f, best);
+            uint32_t first = node.leftOrFirst, second = node.leftOrFirst + 1;
+            if (nearRight < nearLeft)
+                std::swap(first, second);
+            if (std::max(nearLeft, nearRight) != FLT_MAX)
+                stack[top++] = second;
+            if (std::min(nearLeft, nearRight) != FLT_MAX)
+                stack[top++] = first;
+        }
+        if (bestIndex == UINT32_MAX)
+            return false;
+        const BvhTriangle& t = triangles[bestIndex];
+        glm::vec3 normal = glm::normalize(glm::cross(t.v1 - t.v0, t.v2 - t.v0));
+        hit.distance = best;
+        hit.triangle = triangleIds[bestIndex];
+        hit.normal = glm::dot(normal, dir) > 0.0f ? -normal : normal;
+        return true;
+    }
+
+    // first contact of a sphere moving from center to center + displacement; an overlap at the start is a contact at time 0
+    bool sphereSweep(const glm::vec3& center, float radius, const glm::vec3& displacement, SphereContact& contact) const
+    {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverse = safeInverse(displacement);
+        float best = 1.0f;
+        uint32_t bestIndex = UINT32_MAX;
+
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BvhNode& node = nodes[stack[--top]];
+            if (rayBox(node, center, inverse, 0.0f, best, radius) == FLT_MAX)
+                continue;
+            if (node.leaf())
+            {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+                {
+                    float t;
+                    if (sweepTriangle(triangles[i], center, radius, displacement, best, t) && (bestIndex == UINT32_MAX || t < best))
+                    {
+                        best = t;
+                        bestIndex = i;
+                    }
+                }
+                continue;
+            }
+            float nearLeft = rayBox(nodes[node.leftOrFirst], center, inverse, 0.0f, best, radius);
+            float nearRight = rayBox(nodes[node.leftOrFirst + 1], center, inverse, 0.0f, best, radius);
+            uint32_t first = node.leftOrFirst, second = node.leftOrFirst + 1;
+            if (nearRight < nearLeft)
+                std::swap(first, second);
+            if (std::max(nearLeft, nearRight) != FLT_MAX)
+                stack[top++] = second;
+            if (std::min(nearLeft, nearRight) != FLT_MAX)
+                stack[top++] = first;
+        }
+        if (bestIndex == UINT32_MAX)
+            return false;
+        glm::vec3 at = center + displacement * best;
+        contact.time = best;
+        contact.triangle = triangleIds[bestIndex];
+        contact.point = closestPoint(triangles[bestIndex], at);
+        glm::vec3 away = at - contact.point;
+        float distance = glm::length(away);
+        contact.depth = std::max(0.0f, radius - distance);
+        contact.normal = distance > 0.0f ? away / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+        return true;
+    }
+
+    // every triangle the sphere overlaps, deepest first
+    void sphereOverlaps(const glm::vec3& center, float radius, std::vector<SphereContact>& contacts) const
+    {
+        contacts.clear();
+        if (nodes.empty())
+            return;
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BvhNode& node = nodes[stack[--top]];
+            if (!sphereBox(node, center, radius))
+                continue;
+            if (node.leaf())
+            {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+                {
+                    glm::vec3 point = closestPoint(triangles[i], center);
+                    glm::vec3 away = center - point;
+                    float distanceSquared = glm::dot(away, away);
+                    if (distanceSquared >= radius * radius)
+                        continue;
+                    SphereContact contact;
+                    float distance = std::sqrt(distanceSquared);
+                    contact.time = 0.0f;
+                    contact.depth = radius - distance;
+                    contact.triangle = triangleIds[i];
+                    contact.point = point;
+                    if (distance > 0.0f)
+                        contact.normal = away / distance;
+                    else
+                    {
+                        const BvhTriangle& t = triangles[i];
+                        contact.normal = glm::normalize(glm::cross(t.v1 - t.v0, t.v2 - t.v0));
+                    }
+                    contacts.push_back(contact);
+                }
+                continue;
+            }
+            stack[top++] = node.leftOrFirst + 1;
+            stack[top++] = node.leftOrFirst;
+        }
+        std::sort(contacts.begin(), contacts.end(), [](const SphereContact& a, const SphereContact& b) { return a.depth > b.depth; });
+    }
+
+    // the same queries without the tree, as references for the benchmarks
+    bool raycastBruteForce(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit) const
+    {
+        float length = glm::length(direction);
+        if (length == 0.0f)
+            return false;
+        glm::vec3 dir = direction / length;
+        bool found = false;
+        for (size_t i = 0; i < triangles.size(); i++)
+        {
+            float t;
+            if (rayTriangle(triangles[i], origin, dir, t) && t < maxDistance)
+            {
+                maxDistance = t;
+                found = true;
+                hit.distance = t;
+                hit.triangle = triangleIds.empty() ? (uint32_t)i : triangleIds[i];
+            }
+        }
+        return found;
+    }
+
+private:
+    struct Split
+    {
+        int axis = -1;
+        float position = 0.0f;      // bin boundary in centroid space
+        float cost = FLT_MAX;
+    };
+    struct Bin
+    {
+        BoundingBox box;
+        uint32_t count = 0;
+    };
+    struct BinSet
+    {
+        Bin bins[3][BINS];
+    };
+
+    static const int STACK_SIZE = 128;      // a traversal stack never holds more than depth + 1 nodes
+
+    std::vector<BoundingBox> boxes;         // per triangle during build()
+    std::vector<glm::vec3> centroids;
+
+    static float area(const BoundingBox& box)
+    {
+        glm::vec3 size = box.max - box.min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+    static float area(const BvhNode& node)
+    {
+        return area(BoundingBox(glm::vec3(node.min[0], node.min[1], node.min[2]), glm::vec3(node.max[0], node.max[1], node.max[2])));
+    }
+
+    // writes the node's bounds, then either picks the cheapest binned SAH split or turns the node into a leaf (axis -1)
+    Split findSplit(BvhNode& node, uint32_t first, uint32_t count, unsigned int depth, ThreadPool* pool)
+    {
+        BoundingBox bounds, centroidBounds;
+        Bin bins[3][BINS];
+        auto gather = [&](uint32_t begin, uint32_t end, BoundingBox& b, BoundingBox& c) {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t id = triangleIds[i];
+                b.expand(boxes[id].min); b.expand(boxes[id].max);
+                c.expand(centroids[id]);
+            }
+        };
+        size_t chunks = pool && count > 65536 ? (pool->size() + 1) * 4 : 1;
+        std::vector<BoundingBox> chunkBounds(chunks), chunkCentroids(chunks);
+        auto chunkRange = [&](size_t c, uint32_t& begin, uint32_t& end) {
+            begin = first + (uint32_t)(count * c / chunks);
+            end = first + (uint32_t)(count * (c + 1) / chunks);
+        };
+        if (chunks > 1)
+            pool->parallelFor(chunks, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++)
+                {
+                    uint32_t b, e;
+                    chunkRange(c, b, e);
+                    gather(b, e, chunkBounds[c], chunkCentroids[c]);
+                }
+            }, 1);
+        else
+            gather(first, first + count, chunkBounds[0], chunkCentroids[0]);
+        for (size_t c = 0; c < chunks; c++)
+        {
+            if (chunkBounds[c].empty())
+                continue;
+            bounds.expand(chunkBounds[c].min); bounds.expand(chunkBounds[c].max);
+            centroidBounds.expand(chunkCentroids[c].min); centroidBounds.expand(chunkCentroids[c].max);
+        }
+        for (int a = 0; a < 3; a++)
+        {
+            node.min[a] = bounds.min[a];
+            node.max[a] = bounds.max[a];
+        }
+        node.leftOrFirst = first;
+        node.count = count;
+
+        Split best;
+        if (count <= 2)
+            return best;
+        if (depth >= SAH_DEPTH)
+        {
+            best.axis = 3;
+            return best;
+        }
+
+        // bin the centroids along all three axes
+        glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+        glm::vec3 scale;
+        for (int a = 0; a < 3; a++)
+            scale[a] = extent[a] > 0.0f ? BINS * 0.9999f / extent[a] : 0.0f;
+        auto binRange = [&](uint32_t begin, uint32_t end, Bin (&into)[3][BINS]) {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t id = triangleIds[i];
+                for (int a = 0; a < 3; a++)
+                {
+                    Bin& bin = into[a][(int)((centroids[id][a] - centroidBounds.min[a]) * scale[a])];
+                    bin.count++;
+                    bin.box.expand(boxes[id].min); bin.box.expand(boxes[id].max);
+                }
+            }
+        };
+        if (chunks > 1)
+        {
+            std::vector<BinSet> chunkBins(chunks);
+            pool->parallelFor(chunks, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++)
+                {
+                    uint32_t b, e;
+                    chunkRange(c, b, e);
+                    binRange(b, e, chunkBins[c].bins);
+                }
+            }, 1);
+            for (size_t c = 0; c < chunks; c++)
+                for (int a = 0; a < 3; a++)
+                    for (int b = 0; b < BINS; b++)
+                    {
+                        const Bin& from = chunkBins[c].bins[a][b];
+                        bins[a][b].count += from.count;
+                        if (from.count)
+                        {
+                            bins[a][b].box.expand(from.box.min);
+                            bins[a][b].box.expand(from.box.max);
+                        }
+                    }
+        }
+        else
+            binRange(first, first + count, bins);
+
+        // sweep the bin boundaries: prefix areas and counts from the left, suffixes from the right
+        float parentArea = std::max(area(bounds), FLT_MIN);
+        for (int a = 0; a < 3; a++)
+        {
+            if (scale[a] == 0.0f)
+                continue;
+            float leftArea[BINS - 1];
+            uint32_t leftCount[BINS - 1];
+            BoundingBox box;
+            uint32_t sum = 0;
+            for (int b = 0; b < BINS - 1; b++)
+            {
+                sum += bins[a][b].count;
+                if (bins[a][b].count)
+                {
+                    box.expand(bins[a][b].box.min);
+                    box.expand(bins[a][b].box.max);
+                }
+                leftCount[b] = sum;
+                leftArea[b] = sum ? area(box) : 0.0f;
+            }
+            box = BoundingBox();
+            sum = 0;
+            for (int b = BINS - 1; b > 0; b--)
+            {
+                sum += bins[a][b].count;
+                if (bins[a][b].count)
+                {
+                    box.expand(bins[a][b].box.min);
+                    box.expand(bins[a][b].box.max);
+                }
+                if (leftCount[b - 1] == 0 || sum == 0)
+                    continue;
+                float cost = traversalCost + (leftArea[b - 1] * leftCount[b - 1] + area(box) * sum) / parentArea;
+                if (cost < best.cost)
+                {
+                    best.axis = a;
+                    best.position = centroidBounds.min[a] + b / scale[a];
+                    best.cost = cost;
+                }
+            }
+        }
+        // a leaf is cheaper, or every centroid is in one spot: keep small leaves, halve large ones
+        if (best.axis < 0 || (best.cost >= (float)count && count <= maxLeafTriangles))
+        {
+            if (count <= maxLeafTriangles)
+                return Split();
+            best.axis = 3;
+        }
+        return best;
+    }
+
+    // reorders triangleIds[first, first + count) by the split and returns where the right side starts
+    uint32_t partition(const Split& split, uint32_t first, uint32_t count)
+    {
+        uint32_t* begin = &triangleIds[first];
+        uint32_t* end = begin + count;
+        uint32_t* middle = split.axis == 3 ? begin + count / 2
+            : std::partition(begin, end, [&](uint32_t id) { return centroids[id][split.axis] < split.position; });
+        if (middle == begin || middle == end)
+            middle = begin + count / 2;
+        return (uint32_t)(middle - triangleIds.data());
+    }
+
+    void buildSubtree(std::vector<BvhNode>& local, uint32_t node, uint32_t first, uint32_t count, unsigned int depth)
+    {
+        Split split = findSplit(local[node], first, count, depth, nullptr);
+        if (split.axis < 0)
+            return;
+        uint32_t middle = partition(split, first, count);
+        uint32_t left = (uint32_t)local.size();
+        local.resize(local.size() + 2);
+        local[node].leftOrFirst = left;
+        local[node].count = 0;
+        buildSubtree(local, left, first, middle - first, depth + 1);
+        buildSubtree(local, left + 1, middle, first + count - middle, depth + 1);
+    }
+
+    // leaves, depth and SAH cost of the finished tree
+    void measure(uint32_t index, unsigned int depth, float inverseRootArea)
+    {
+        const BvhNode& node = nodes[index];
+        stats.depth = std::max(stats.depth, depth);
+        float probability = area(node) * inverseRootArea;
+        if (node.leaf())
+        {
+            stats.leaves++;
+            stats.sahCost += probability * node.count;
+            return;
+        }
+        stats.sahCost += probability * traversalCost;
+        measure(node.leftOrFirst, depth + 1, inverseRootArea);
+        measure(node.leftOrFirst + 1, depth + 1, inverseRootArea);
+    }
+
+    static glm::vec3 safeInverse(const glm::vec3& v)
+    {
+        glm::vec3 inverse;
+        for (int a = 0; a < 3; a++)
+            inverse[a] = std::fabs(v[a]) > 1e-20f ? 1.0f / v[a] : (v[a] < 0.0f ? -1e30f : 1e30f);
+        return inverse;
+    }
+
+    // entry distance of the ray into the node grown by margin, FLT_MAX when it misses [tNear, tFar]
+    static float rayBox(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverse, float tNear, float tFar, float margin = 0.0f)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            float t0 = (node.min[a] - margin - origin[a]) * inverse[a];
+            float t1 = (node.max[a] + margin - origin[a]) * inverse[a];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tNear = std::max(tNear, t0);
+            tFar = std::min(tFar, t1);
+            if (tNear > tFar)
+                return FLT_MAX;
+        }
+        return tNear;
+    }
+
+    static bool sphereBox(const BvhNode& node, const glm::vec3& center, float radius)
+    {
+        float distanceSquared = 0.0f;
+        for (int a = 0; a < 3; a++)
+        {
+            float d = std::max(node.min[a] - center[a], std::max(0.0f, center[a] - node.max[a]));
+            distanceSquared += d * d;
+        }
+        return distanceSquared <= radius * radius;
+    }
+
+    // Moller-Trumbore, both sides
+    static bool rayTriangle(const BvhTriangle& triangle, const glm::vec3& origin, const glm::vec3& direction, float& t)
+    {
+        glm::vec3 edge1 = triangle.v1 - triangle.v0, edge2 = triangle.v2 - triangle.v0;
+        glm::vec3 p = glm::cross(direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::fabs(determinant) < 1e-12f)
+            return false;
+        float inverse = 1.0f / determinant;
+        glm::vec3 s = origin - triangle.v0;
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(edge2, q) * inverse;
+        return t >= 0.0f;
+    }
+
+    // closest point of the triangle to p (Ericson, Real-Time Collision Detection 5.1.5)
+    static glm::vec3 closestPoint(const BvhTriangle& triangle, const glm::vec3& p)
+    {
+        const glm::vec3 &a = triangle.v0, &b = triangle.v1, &c = triangle.v2;
+        glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+        float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f)
+            return a;
+        glm::vec3 bp = p - b;
+        float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3)
+            return b;
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+            return a + ab * (d1 / (d1 - d3));
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6)
+            return c;
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+            return a + ac * (d2 / (d2 - d6));
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        float denominator = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denominator) + ac * (vc * denominator);
+    }
+
+    // earliest t in [0, limit] at which the moving sphere touches the triangle: the face, then its edges and corners
+    static bool sweepTriangle(const BvhTriangle& triangle, const glm::vec3& center, float radius, const glm::vec3& displacement, float limit, float& t)
+    {
+        glm::vec3 start = closestPoint(triangle, center) - center;
+        if (glm::dot(start, start) < radius * radius)
+        {
+            t = 0.0f;
+            return true;
+        }
+        glm::vec3 normal = glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0);
+        float normalLength = glm::length(normal);
+        if (normalLength == 0.0f)
+            return false;
+        normal /= normalLength;
+        float distance = glm::dot(normal, center - triangle.v0);
+        if (distance < 0.0f)
+        {
+            normal = -normal;
+            distance = -distance;
+        }
+        float approach = glm::dot(normal, displacement);
+        if (approach >= 0.0f)
+            return false;    // moving away from or along the plane; being clear now, it never touches
+        // the face: the sphere reaches the plane inside the triangle. Starting within the radius of the
+        // plane but beside the triangle it already crossed the plane, only an edge or a corner can follow
+        float faceTime = (radius - distance) / approach;
+        if (faceTime > limit)
+            return false;
+        if (faceTime >= 0.0f)
+        {
+            glm::vec3 onPlane = center + displacement * faceTime - normal * radius;
+            if (insideTriangle(triangle, onPlane))
+            {
+                t = faceTime;
+                return true;
+            }
+        }
+        // otherwise it first touches an edge or a corner, if anything
+        float best = limit;
+        bool found = false;
+        const glm::vec3* corners[3] = { &triangle.v0, &triangle.v1, &triangle.v2 };
+        for (int i = 0; i < 3; i++)
+        {
+            float time;
+            if (sweepPoint(*corners[i], center, radius, displacement, time) && time <= best)
+            {
+                best = time;
+                found = true;
+            }
+            if (sweepEdge(*corners[i], *corners[(i + 1) % 3], center, radius, displacement, time) && time <= best)
+            {
+                best = time;
+                found = true;
+            }
+        }
+        t = best;
+        return found;
+    }
+
+    static bool insideTriangle(const BvhTriangle& triangle, const glm::vec3& p)
+    {
+        glm::vec3 n = glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0);
+        return glm::dot(glm::cross(triangle.v1 - triangle.v0, p - triangle.v0), n) >= 0.0f
+            && glm::dot(glm::cross(triangle.v2 - triangle.v1, p - triangle.v1), n) >= 0.0f
+            && glm::dot(glm::cross(triangle.v0 - triangle.v2, p - triangle.v2), n) >= 0.0f;
+    }
+
+    // the sphere center as a ray against a sphere of the same radius around the point
+    static bool sweepPoint(const glm::vec3& point, const glm::vec3& center, float radius, const glm::vec3& displacement, float& t)
+    {
+        glm::vec3 m = center - point;
+        float a = glm::dot(displacement, displacement);
+        float b = glm::dot(m, displacement);
+        float c = glm::dot(m, m) - radius * radius;
+        float discriminant = b * b - a * c;
+        if (a == 0.0f || discriminant < 0.0f)
+            return false;
+        t = (-b - std::sqrt(discriminant)) / a;
+        return t >= 0.0f;
+    }
+
+    // the sphere center as a ray against the cylinder of the radius around the edge, between its ends
+    static bool sweepEdge(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& center, float radius, const glm::vec3& displacement, float& t)
+    {
+        glm::vec3 e = p1 - p0, m = center - p0;
+        float ee = glm::dot(e, e), ed = glm::dot(e, displacement), em = glm::dot(e, m);
+        float a = ee * glm::dot(displacement, displacement) - ed * ed;
+        float b = ee * glm::dot(displacement, m) - ed * em;
+        float c = ee * (glm::dot(m, m) - radius * radius) - em * em;
+        float discriminant = b * b - a * c;
+        if (a == 0.0f || ee == 0.0f || discriminant < 0.0f)
+            return false;
+        t = (-b - std::sqrt(discriminant)) / a;
+        float along = (em + t * ed) / ee;
+        return t >= 0.0f && along >= 0.0f && along <= 1.0f;
+    }
+};
+
+#endif
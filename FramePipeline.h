@@ -0,0 +1,129 @@
+#pragma once
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <chrono>
+#include <functional>
+
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+//Overlaps the CPU work of one frame with the GL submission of the one before it. A frame goes
+//through three stages, simulate, transforms and cull, which run one after the other as a task on
+//the pool (and can spread their own work over it with parallelFor); their output goes into a Frame
+//that the GL thread then submits. Two Frames take turns: while the GL thread draws frame N and
+//blocks in the buffer swap, the workers build frame N + 1. The price is one frame of latency.
+//
+//Every frame on the GL thread:
+//
+//   Frame& ready = pipeline.wait();   // frame N, built during the last frame's submission
+//   ...input: nothing of the scene is in use by the workers now
+//   pipeline.next() = this frame's input (time step, camera)
+//   pipeline.start();                 // frame N + 1 on the workers
+//   ...submit ready, swap buffers
+//
+//with one start() before the first wait(). With pipelined off, start() runs the stages right away
+//on the calling thread, the serial reference.
+template <typename Frame>
+class FramePipeline
+{
+public:
+    // milliseconds of the frame returned by the last wait()
+    struct Timings
+    {
+        double simulate = 0.0, transforms = 0.0, cull = 0.0;
+        double wait = 0.0;      // the GL thread blocked in wait() for the stages to finish
+    };
+
+    std::function<void(Frame&)> simulate, transforms, cull;
+    bool pipelined = true;
+
+    // null runs the stages on ThreadPool::shared(), created on first use
+    explicit FramePipeline(ThreadPool* pool = nullptr) : pool(pool) {}
+    ~FramePipeline()
+    {
+        threadPool().wait(group);   // the stages use the frames and callbacks
+    }
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    // the frame to fill with input before start()
+    Frame& next()
+    {
+        return frames[building];
+    }
+
+    void start()
+    {
+        int slot = building;
+        if (pipelined)
+            threadPool().run(group, [this, slot] { runStages(slot); });
+        else
+            runStages(slot);
+    }
+
+    // blocks until the frame of the last start() is built; it stays valid until the next wait()
+    Frame& wait()
+    {
+        PROFILE_ZONE("FramePipeline::wait");
+        auto begin = std::chrono::steady_clock::now();
+        threadPool().wait(group);
+        int slot = building;
+        timings[slot].wait = milliseconds(begin);
+        current = slot;
+        building = 1 - slot;
+        return frames[slot];
+    }
+
+    const Timings& lastTimings() const
+    {
+        return timings[current];
+    }
+
+private:
+    ThreadPool* pool;
+    ThreadPool::TaskGroup group;
+    Frame frames[2];
+    Timings timings[2];
+    int building = 0;
+    int current = 0;
+
+    ThreadPool& threadPool()
+    {
+        return pool ? *pool : ThreadPool::shared();
+    }
+
+    static double milliseconds(std::chrono::steady_clock::time_point since)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    void runStages(int slot)
+    {
+        Frame& frame = frames[slot];
+        Timings& t = timings[slot];
+        auto begin = std::chrono::steady_clock::now();
+        if (simulate)
+        {
+            PROFILE_ZONE("simulate");
+            simulate(frame);
+        }
+        t.simulate = milliseconds(begin);
+        begin = std::chrono::steady_clock::now();
+        if (transforms)
+        {
+            PROFILE_ZONE("transforms");
+            transforms(frame);
+        }
+        t.transforms = milliseconds(begin);
+        begin = std::chrono::steady_clock::now();
+        if (cull)
+        {
+            PROFILE_ZONE("cull");
+            cull(frame);
+        }
+        t.cull = milliseconds(begin);
+    }
+};
+
+#endif
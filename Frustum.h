@@ -0,0 +1,274 @@
+#pragma once
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SIMD_SSE
+#endif
+
+#include "Bounds.h"
+#include "InstanceBuffer.h"
+
+// The six planes of a view frustum, pointing inwards: a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them.
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann extraction from projection * view (world space planes) or projection * view * model (object space)
+    static Frustum fromMatrix(const glm::mat4& matrix)
+    {
+        glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+        glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+        glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+        glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+        Frustum frustum;
+        frustum.planes[0] = row3 + row0;    // left
+        frustum.planes[1] = row3 - row0;    // right
+        frustum.planes[2] = row3 + row1;    // bottom
+        frustum.planes[3] = row3 - row1;    // top
+        frustum.planes[4] = row3 + row2;    // near
+        frustum.planes[5] = row3 - row2;    // far
+        for (glm::vec4& plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    bool intersects(const glm::vec3& center, const glm::vec3& extent, float radius = 0.0f) const
+    {
+        for (const glm::vec4& plane : planes)
+        {
+            float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+            float reach = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z + radius;
+            if (distance + reach < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+//Frustum culling over many bounding volumes at once. Volumes are collected in world space as
+//structure-of-arrays (center, box extent, sphere radius), so cull() tests 8 (AVX) or 4 (SSE)
+//volumes per instruction against each plane. A volume is a box (radius 0), a sphere (extent 0)
+//or both. Boxes come from Mesh::bounds moved by the model matrix, spheres are used for instances,
+//where rebuilding a box per instance would cost more than the test saves.
+class FrustumCuller
+{
+public:
+    struct Stats
+    {
+        unsigned int tested = 0;
+        unsigned int visible = 0;
+
+        unsigned int culled() const
+        {
+            return tested - visible;
+        }
+    };
+    Stats stats;    // of the last cull()
+
+    void clear()
+    {
+        centerX.clear(); centerY.clear(); centerZ.clear();
+        extentX.clear(); extentY.clear(); extentZ.clear();
+        radius.clear();
+    }
+
+    size_t size() const
+    {
+        return centerX.size();
+    }
+
+    // returns the index that cull() reports for this volume
+    uint32_t addBox(const BoundingBox& bounds, const glm::mat4& transform)
+    {
+        BoundingBox world = bounds.transformed(transform);
+        return add(world.center(), world.extent(), 0.0f);
+    }
+    uint32_t addSphere(const glm::vec3& center, float sphereRadius)
+    {
+        return add(center, glm::vec3(0.0f), sphereRadius);
+    }
+
+    // one bounding sphere per instance of a mesh (or model) with the given object space bounds
+    void addInstances(const BoundingBox& bounds, const glm::mat4* transforms, unsigned int count)
+    {
+        glm::vec3 center = bounds.center();
+        float localRadius = bounds.radius();
+        reserveMore(count);
+        for (unsigned int i = 0; i < count; i++)
+            addSphere(glm::vec3(transforms[i] * glm::vec4(center, 1.0f)), localRadius * maxScale(transforms[i]));
+    }
+    void addInstances(const BoundingBox& bounds, const InstanceTRS* transforms, unsigned int count)
+    {
+        glm::vec3 center = bounds.center();
+        float localRadius = bounds.radius();
+        reserveMore(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const InstanceTRS& t = transforms[i];
+            glm::vec3 q(t.rotation), v = center * t.scale;
+            glm::vec3 rotated = v + 2.0f * glm::cross(q, glm::cross(q, v) + t.rotation.w * v);
+            addSphere(rotated + t.position, localRadius * t.scale);
+        }
+    }
+
+    // indices of the volumes that touch the frustum, in ascending order
+    const std::vector<uint32_t>& cull(const Frustum& frustum)
+    {
+        visible.clear();
+        visible.reserve(size());
+        size_t i = 0;
+#if defined(FRUSTUM_SIMD_AVX)
+        i = cullAVX(frustum);
+#elif defined(FRUSTUM_SIMD_SSE)
+        i = cullSSE(frustum);
+#endif
+        for (; i < size(); i++)
+            if (intersects(frustum, i))
+                visible.push_back((uint32_t)i);
+        stats.tested = (unsigned int)size();
+        stats.visible = (unsigned int)visible.size();
+        return visible;
+    }
+
+    // the same test one volume at a time, as a reference for cull()
+    const std::vector<uint32_t>& cullScalar(const Frustum& frustum)
+    {
+        visible.clear();
+        for (size_t i = 0; i < size(); i++)
+            if (intersects(frustum, i))
+                visible.push_back((uint32_t)i);
+        stats.tested = (unsigned int)size();
+        stats.visible = (unsigned int)visible.size();
+        return visible;
+    }
+
+    // copies the items whose volumes survived the last cull, e.g. instance transforms for InstanceBuffer::upload
+    template <typename T>
+    void gatherVisible(const T* items, std::vector<T>& out) const
+    {
+        out.resize(visible.size());
+        for (size_t i = 0; i < visible.size(); i++)
+            out[i] = items[visible[i]];
+    }
+
+private:
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<float> radius;
+    std::vector<uint32_t> visible;
+
+    uint32_t add(const glm::vec3& center, const glm::vec3& extent, float sphereRadius)
+    {
+        centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+        extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+        radius.push_back(sphereRadius);
+        return (uint32_t)size() - 1;
+    }
+
+    void reserveMore(size_t count)
+    {
+        size_t capacity = size() + count;
+        centerX.reserve(capacity); centerY.reserve(capacity); centerZ.reserve(capacity);
+        extentX.reserve(capacity); extentY.reserve(capacity); extentZ.reserve(capacity);
+        radius.reserve(capacity);
+    }
+
+    bool intersects(const Frustum& frustum, size_t i) const
+    {
+        return frustum.intersects(glm::vec3(centerX[i], centerY[i], centerZ[i]), glm::vec3(extentX[i], extentY[i], extentZ[i]), radius[i]);
+    }
+
+#if defined(FRUSTUM_SIMD_AVX)
+    // returns how many volumes it handled, the scalar loop takes the rest
+    size_t cullAVX(const Frustum& frustum)
+    {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        __m256 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            px[p] = _mm256_set1_ps(plane.x); py[p] = _mm256_set1_ps(plane.y); pz[p] = _mm256_set1_ps(plane.z); pw[p] = _mm256_set1_ps(plane.w);
+            ax[p] = _mm256_andnot_ps(signMask, px[p]); ay[p] = _mm256_andnot_ps(signMask, py[p]); az[p] = _mm256_andnot_ps(signMask, pz[p]);
+        }
+        size_t count = size() & ~(size_t)7;
+        for (size_t i = 0; i < count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+            __m256 r = _mm256_loadu_ps(&radius[i]);
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++)    // same operation order as Frustum::intersects, so both give identical results
+            {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], cx), _mm256_mul_ps(py[p], cy)), _mm256_mul_ps(pz[p], cz)), pw[p]);
+                __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez)), r);
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            unsigned int mask = ~(unsigned int)_mm256_movemask_ps(outside) & 0xFF;
+            while (mask)
+            {
+                unsigned int bit = lowestBit(mask);
+                visible.push_back((uint32_t)(i + bit));
+                mask &= mask - 1;
+            }
+        }
+        return count;
+    }
+#elif defined(FRUSTUM_SIMD_SSE)
+    size_t cullSSE(const Frustum& frustum)
+    {
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        __m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            px[p] = _mm_set1_ps(plane.x); py[p] = _mm_set1_ps(plane.y); pz[p] = _mm_set1_ps(plane.z); pw[p] = _mm_set1_ps(plane.w);
+            ax[p] = _mm_andnot_ps(signMask, px[p]); ay[p] = _mm_andnot_ps(signMask, py[p]); az[p] = _mm_andnot_ps(signMask, pz[p]);
+        }
+        size_t count = size() & ~(size_t)3;
+        for (size_t i = 0; i < count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+            __m128 r = _mm_loadu_ps(&radius[i]);
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++)    // same operation order as Frustum::intersects, so both give identical results
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)), _mm_mul_ps(pz[p], cz)), pw[p]);
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez)), r);
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+            }
+            unsigned int mask = ~(unsigned int)_mm_movemask_ps(outside) & 0xF;
+            while (mask)
+            {
+                unsigned int bit = lowestBit(mask);
+                visible.push_back((uint32_t)(i + bit));
+                mask &= mask - 1;
+            }
+        }
+        return count;
+    }
+#endif
+
+    static unsigned int lowestBit(unsigned int mask)
+    {
+        unsigned int bit = 0;
+        while (!(mask & 1u))
+        {
+            mask >>= 1;
+            bit++;
+        }
+        return bit;
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+#pragma once
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+//A shadow of the GL bindings the renderer changes most: program, VAO, texture units and sampler
+//uniforms. Every setter compares against the shadow and only calls GL when the value changes.
+//The shadow is only right while all binds go through it, so invalidate() it after code that
+//talks to GL directly (Mesh::Draw, ModelBatch::Draw, ...).
+class GLStateCache
+{
+public:
+    static const unsigned int MAX_TEXTURE_UNITS = 16;
+
+    // binds issued and binds skipped because the state was already current
+    struct Counters
+    {
+        unsigned int programBinds = 0, programBindsAvoided = 0;
+        unsigned int vertexArrayBinds = 0, vertexArrayBindsAvoided = 0;
+        unsigned int textureBinds = 0, textureBindsAvoided = 0;
+        unsigned int samplerSets = 0, samplerSetsAvoided = 0;
+
+        unsigned int avoided() const
+        {
+            return programBindsAvoided + vertexArrayBindsAvoided + textureBindsAvoided + samplerSetsAvoided;
+        }
+    };
+    Counters counters;
+
+    GLStateCache()
+    {
+        invalidate();
+    }
+
+    // forget everything, the next setter of each kind always reaches GL
+    void invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+            textures[i] = UNKNOWN;
+        samplers.clear();
+    }
+
+    void resetCounters()
+    {
+        counters = Counters();
+    }
+
+    void useProgram(GLuint id)
+    {
+        if (program == id)
+        {
+            counters.programBindsAvoided++;
+            return;
+        }
+        glUseProgram(id);
+        program = id;
+        counters.programBinds++;
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (vertexArray == id)
+        {
+            counters.vertexArrayBindsAvoided++;
+            return;
+        }
+        glBindVertexArray(id);
+        vertexArray = id;
+        counters.vertexArrayBinds++;
+    }
+
+    void bindTexture(GLuint unit, GLuint id)
+    {
+        if (unit >= MAX_TEXTURE_UNITS)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+            glBindTexture(GL_TEXTURE_2D, id);
+            counters.textureBinds++;
+            return;
+        }
+        if (textures[unit] == id)
+        {
+            counters.textureBindsAvoided++;
+            return;
+        }
+        if (activeUnit != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+        }
+        glBindTexture(GL_TEXTURE_2D, id);
+        textures[unit] = id;
+        counters.textureBinds++;
+    }
+
+    // sampler uniforms are program state, so they stay set across program switches
+    void setSampler(GLint location, GLint unit)
+    {
+        if (location < 0)
+            return;
+        int64_t key = ((int64_t)program << 32) | (uint32_t)location;
+        auto it = samplers.find(key);
+        if (it != samplers.end() && it->second == unit)
+        {
+            counters.samplerSetsAvoided++;
+            return;
+        }
+        glUniform1i(location, unit);
+        samplers[key] = unit;
+        counters.samplerSets++;
+    }
+
+private:
+    static const GLuint UNKNOWN = ~0u;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS];
+    std::unordered_map<int64_t, GLint> samplers;    // (program, location) -> unit
+};
+
+#endif
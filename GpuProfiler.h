@@ -0,0 +1,381 @@
+#pragma once
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Profiler.h"
+
+//GPU time of named scopes (passes, Model::Draw, the render queue) from GL_TIME_ELAPSED queries.
+//Elapsed-time queries can't nest, so the scopes of a frame are cut into segments where any scope
+//begins or ends, one query per segment, each charged to the innermost open scope; a scope's time is
+//the sum of the segments from its begin to its end.
+//
+//Software rasterizers (Mesa llvmpipe and softpipe, SwiftShader) don't charge the rendering to the
+//queries: llvmpipe reports a few percent of what a pass takes between two glFinish() calls, and its
+//first result is garbage. On those the profiler doesn't query at all but brackets every segment with
+//glFinish() and reads the CPU clock, cpuBracketed() says so and reports should label the numbers as
+//such. It serializes the CPU with the rasterizer, so the frame itself gets slower. With real queries
+//the first frame is thrown away, and so is any frame whose queries add up to more than the wall time
+//between its beginFrame() and the read, which no correct result can; both count in rejected.
+//
+//The queries of a frame are read FRAMES_IN_FLIGHT frames later, when the GPU is long done with them,
+//so reading never stalls; a frame whose results still aren't there when its slot comes around again
+//is waited for and counted in stalls. Builds with PROFILER_ENABLED add every scope to the Profiler
+//timeline on a "GPU" track, placed from a GL_TIMESTAMP taken at the start of the frame.
+//
+//   GPU_BEGIN_FRAME();
+//   { GPU_ZONE("opaque"); ...draws... }
+//   GPU_END_FRAME();
+//
+//The macros compile out without PROFILER_ENABLED; benchmarks that report GPU time use the class directly.
+class GpuProfiler
+{
+public:
+    static const int FRAMES_IN_FLIGHT = 4;
+    static const unsigned int MAX_SEGMENTS = 512;   // per frame, scopes that don't fit any more are dropped
+
+    // a scope of a collected frame
+    struct Result
+    {
+        const char* name;
+        uint32_t depth;
+        double beginMs;     // GPU time spent in the frame's scopes before this one began
+        double ms;
+    };
+
+    // per scope name over the frames collected since resetTotals()
+    struct Total
+    {
+        unsigned int calls = 0;
+        double ms = 0.0;
+    };
+
+    unsigned int stalls = 0;     // frames that had to be waited for
+    unsigned int rejected = 0;   // frames whose query results were dropped, see above
+    // called with every frame that comes back: its number (see lastFrameIndex()) and scopes
+    std::function<void(long long, const std::vector<Result>&)> onCollect;
+
+    static GpuProfiler& instance()
+    {
+        static GpuProfiler profiler;
+        return profiler;
+    }
+
+    // starts recording the scopes of a frame, collecting the oldest frame in flight first
+    void beginFrame()
+    {
+        if (queries[0].empty())
+            create();
+        Frame& frame = frames[current];
+        if (frame.pending)
+            collect(frame);
+        frame.scopes.clear();
+        frame.segmentScopes.clear();
+        frame.segmentNs.clear();
+        frame.index = frameCount++;
+        frame.cpuStart = Profiler::instance().now();
+        glQueryCounter(startQueries[current], GL_TIMESTAMP);
+        if (framesSinceCalibration++ % 60 == 0)
+            calibrate();
+        recording = true;
+    }
+
+    void endFrame()
+    {
+        while (!open.empty())
+            end();
+        if (!recording)
+            return;
+        recording = false;
+        frames[current].pending = !frames[current].scopes.empty();
+        current = (current + 1) % FRAMES_IN_FLIGHT;
+    }
+
+    void begin(const char* name)
+    {
+        if (!recording)
+            return;
+        Frame& frame = frames[current];
+        if (frame.segmentScopes.size() + 2 > MAX_SEGMENTS)
+        {
+            open.push_back(DROPPED);
+            return;
+        }
+        closeSegment();
+        Scope scope;
+        scope.name = name;
+        scope.depth = (uint32_t)open.size();
+        scope.firstSegment = scope.endSegment = (unsigned int)frame.segmentScopes.size();
+        open.push_back((unsigned int)frame.scopes.size());
+        frame.scopes.push_back(scope);
+        openSegment(open.back());
+    }
+
+    void end()
+    {
+        if (open.empty())
+            return;
+        unsigned int scope = open.back();
+        open.pop_back();
+        if (!recording || scope == DROPPED)
+            return;
+        closeSegment();
+        Frame& frame = frames[current];
+        frame.scopes[scope].endSegment = (unsigned int)frame.segmentScopes.size();
+        for (auto it = open.rbegin(); it != open.rend(); ++it)
+        {
+            if (*it != DROPPED)
+            {
+                openSegment(*it);   // back to the enclosing scope
+                break;
+            }
+        }
+    }
+
+    // scopes of the most recent frame whose results came back, in the order they began
+    const std::vector<Result>& lastFrame() const
+    {
+        return results;
+    }
+    // which frame lastFrame() is, counting the beginFrame() calls from 0; -1 before the first came back
+    long long lastFrameIndex() const
+    {
+        return resultsIndex;
+    }
+
+    const std::map<std::string, Total>& totals() const
+    {
+        return sums;
+    }
+    void resetTotals()
+    {
+        sums.clear();
+    }
+
+    // waits for every frame in flight, e.g. before reading totals() at the end of a benchmark
+    void finish()
+    {
+        for (int i = 1; i <= FRAMES_IN_FLIGHT; i++)
+        {
+            Frame& frame = frames[(current + i) % FRAMES_IN_FLIGHT];
+            if (frame.pending)
+                collect(frame);
+        }
+    }
+
+    // true when scopes are timed with glFinish() and the CPU clock instead of GL_TIME_ELAPSED queries;
+    // decided from GL_RENDERER at the first beginFrame()
+    bool cpuBracketed() const
+    {
+        return bracketed;
+    }
+    // what the results measure, for reports
+    const char* timing() const
+    {
+        return bracketed ? "glFinish-bracketed CPU time" : "GL_TIME_ELAPSED queries";
+    }
+
+    // deletes the queries; call while the GL context is still current
+    void destroy()
+    {
+        for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+        {
+            if (!queries[i].empty())
+            {
+                glDeleteQueries((GLsizei)queries[i].size(), queries[i].data());
+                glDeleteQueries(1, &startQueries[i]);
+            }
+            queries[i].clear();
+            frames[i] = Frame();
+        }
+        collected = 0;
+        open.clear();
+        recording = false;
+        segmentOpen = false;
+    }
+
+private:
+    static constexpr unsigned int DROPPED = ~0u;
+
+    struct Scope
+    {
+        const char* name;
+        uint32_t depth;
+        unsigned int firstSegment, endSegment;     // the segments [first, end) ran inside the scope
+    };
+    struct Frame
+    {
+        std::vector<Scope> scopes;
+        std::vector<unsigned int> segmentScopes;    // the scope each segment was charged to
+        std::vector<GLuint64> segmentNs;            // bracketed: the measured time of each segment
+        long long index = 0;
+        uint64_t cpuStart = 0;      // Profiler::now() at beginFrame(): the wall-time check, and the timeline without timestamps
+        bool pending = false;       // recorded and not collected yet
+    };
+
+    std::vector<GLuint> queries[FRAMES_IN_FLIGHT];     // one per segment
+    GLuint startQueries[FRAMES_IN_FLIGHT] = {};         // GL_TIMESTAMP at the start of the frame
+    Frame frames[FRAMES_IN_FLIGHT];
+    int current = 0;
+    bool recording = false;
+    bool segmentOpen = false;
+    std::vector<unsigned int> open;     // scopes begun and not ended
+    std::vector<Result> results;
+    long long resultsIndex = -1;
+    long long frameCount = 0;
+    std::map<std::string, Total> sums;
+    bool timestamps = false;
+    bool bracketed = false;             // glFinish() and the CPU clock instead of queries
+    uint64_t segmentStart = 0;          // bracketed: Profiler::now() when the open segment began
+    unsigned int collected = 0;         // frames read since create()
+    int64_t gpuToCpu = 0;               // added to a GPU timestamp gives Profiler::now() time
+    unsigned int framesSinceCalibration = 0;
+
+    GpuProfiler() = default;
+
+    void create()
+    {
+        const char* renderer = (const char*)glGetString(GL_RENDERER);
+        bracketed = renderer && (std::strstr(renderer, "llvmpipe") || std::strstr(renderer, "softpipe") || std::strstr(renderer, "SwiftShader"));
+        GLint bits = 0;
+        glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+        timestamps = bits != 0;     // only for placing the frame on the timeline
+        for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+        {
+            queries[i].resize(MAX_SEGMENTS);
+            glGenQueries((GLsizei)queries[i].size(), queries[i].data());
+            glGenQueries(1, &startQueries[i]);
+        }
+    }
+
+    void calibrate()
+    {
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuToCpu = (int64_t)Profiler::instance().now() - (int64_t)gpuNow;
+    }
+
+    void openSegment(unsigned int scope)
+    {
+        Frame& frame = frames[current];
+        if (bracketed)
+        {
+            glFinish();     // whatever was submitted before the segment isn't charged to it
+            segmentStart = Profiler::instance().now();
+        }
+        else
+            glBeginQuery(GL_TIME_ELAPSED, queries[current][frame.segmentScopes.size()]);
+        frame.segmentScopes.push_back(scope);
+        segmentOpen = true;
+    }
+
+    void closeSegment()
+    {
+        if (!segmentOpen)
+            return;
+        if (bracketed)
+        {
+            glFinish();
+            frames[current].segmentNs.push_back(Profiler::instance().now() - segmentStart);
+        }
+        else
+            glEndQuery(GL_TIME_ELAPSED);
+        segmentOpen = false;
+    }
+
+    void collect(Frame& frame)
+    {
+        int slot = (int)(&frame - frames);
+        const std::vector<GLuint>& slotQueries = queries[slot];
+        size_t segments = frame.segmentScopes.size();
+        if (!bracketed)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(slotQueries[segments - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                stalls++;
+        }
+
+        // time before each segment, so a scope takes prefix[end] - prefix[first]
+        std::vector<GLuint64> prefix(segments + 1, 0);
+        for (size_t i = 0; i < segments; i++)
+        {
+            GLuint64 elapsed = 0;
+            if (bracketed)
+                elapsed = i < frame.segmentNs.size() ? frame.segmentNs[i] : 0;
+            else
+                glGetQueryObjectui64v(slotQueries[i], GL_QUERY_RESULT, &elapsed);
+            prefix[i + 1] = prefix[i] + elapsed;
+        }
+        // the GPU finished the frame by now, so its queries can't add up to more than the time since it began
+        bool first = collected++ == 0;
+        if (!bracketed && (first || prefix[segments] > Profiler::instance().now() - frame.cpuStart))
+        {
+            rejected++;
+            frame.pending = false;
+            return;
+        }
+#ifdef PROFILER_ENABLED
+        GLuint64 gpuStart = 0;
+        bool placed = timestamps && !bracketed;
+        if (placed)
+            glGetQueryObjectui64v(startQueries[slot], GL_QUERY_RESULT, &gpuStart);
+        uint64_t timelineStart = (uint64_t)std::max<int64_t>(0, placed ? (int64_t)gpuStart + gpuToCpu : (int64_t)frame.cpuStart);
+#endif
+
+        results.clear();
+        resultsIndex = frame.index;
+        for (const Scope& scope : frame.scopes)
+        {
+            GLuint64 begin = prefix[scope.firstSegment], end = prefix[scope.endSegment];
+            results.push_back(Result{ scope.name, scope.depth, begin / 1e6, (end - begin) / 1e6 });
+            Total& total = sums[scope.name];
+            total.calls++;
+            total.ms += (end - begin) / 1e6;
+#ifdef PROFILER_ENABLED
+            Profiler::instance().recordZone("GPU", scope.name, timelineStart + begin, timelineStart + end, scope.depth);
+#endif
+        }
+        frame.pending = false;
+        if (onCollect)
+            onCollect(resultsIndex, results);
+    }
+};
+
+// times the enclosing scope on the GPU, see GPU_ZONE
+class GpuProfileZone
+{
+public:
+    explicit GpuProfileZone(const char* name)
+    {
+        GpuProfiler::instance().begin(name);
+    }
+    ~GpuProfileZone()
+    {
+        GpuProfiler::instance().end();
+    }
+    GpuProfileZone(const GpuProfileZone&) = delete;
+    GpuProfileZone& operator=(const GpuProfileZone&) = delete;
+};
+
+#ifdef PROFILER_ENABLED
+#define GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+#define GPU_BEGIN_FRAME() GpuProfiler::instance().beginFrame()
+#define GPU_END_FRAME() GpuProfiler::instance().endFrame()
+#else
+#define GPU_ZONE(name) do {} while (0)
+#define GPU_BEGIN_FRAME() do {} while (0)
+#define GPU_END_FRAME() do {} while (0)
+#endif
+
+#endif
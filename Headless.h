@@ -0,0 +1,529 @@
+#pragma once
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// Reproducible frame benchmark of the real scene, started with:
+//
+//   RollingBall --headless [--frames N] [--scene ball|balls] [--balls N] [--warmup N]
+//               [--width W] [--height H] [--output report.json] [--trace trace.json]
+//               [--lights N] [--lighting clustered|flat]
+//
+// Renders into an offscreen framebuffer of the benchmark context (EGL, so it runs under Mesa llvmpipe
+// with EGL_PLATFORM=surfaceless), with a fixed time step and scripted camera and ball input instead of
+// glfwGetTime and the keyboard: two runs of the same build draw exactly the same frames. Writes a JSON
+// report of the CPU frame time percentiles, draw calls, state changes and GL time per frame and per
+// pass (GpuProfiler.h). Builds with PROFILER_ENABLED can also write the profiler's Chrome trace.
+//
+// gl_timing says how the GL times were taken. Software rasterizers don't charge their work to timer
+// queries, so there the profiler brackets every pass with glFinish() and the CPU clock, which also
+// puts those waits into cpu_frame_ms; gl_rejected counts query frames dropped as implausible.
+//
+// --lights scatters that many moving point lights over the scene and shades the balls with them
+// through LightClusters.h; --lighting flat puts them all in one cluster, every fragment then loops
+// over every visible light, the reference for what the clustering saves.
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "Bounds.h"
+#include "FramePipeline.h"
+#include "Frustum.h"
+#include "GpuProfiler.h"
+#include "LightClusters.h"
+#include "Model.h"
+#include "Physics.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "Shader.h"
+#include "ShaderCache.h"
+#include "ShaderLibrary.h"
+#include "TextureLoader.h"
+#include "UniformBuffer.h"
+
+struct HeadlessOptions
+{
+    int frames = 600;
+    int warmup = 30;                // frames run before measuring, not in the report
+    std::string scene = "ball";     // "ball": the game, "balls": the game's ball among many others
+    unsigned int balls = 1000;      // of the "balls" scene
+    int width = 800, height = 600;
+    std::string output = "headless.json";   // "-" writes the report to stdout
+    std::string trace;              // Chrome trace of the run, needs PROFILER_ENABLED
+    unsigned int lights = 0;        // point lights, 0 draws the balls unlit
+    std::string lighting = "clustered";     // "clustered" or "flat" (a single cluster)
+};
+
+// parses the arguments after --headless; false on anything it doesn't know
+inline bool parseHeadlessOptions(const std::vector<std::string>& args, HeadlessOptions& options)
+{
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        const std::string& name = args[i];
+        if (i + 1 >= args.size())
+        {
+            std::cout << "ERROR::HEADLESS::MISSING_VALUE " << name << std::endl;
+            return false;
+        }
+        const std::string& value = args[++i];
+        if (name == "--frames")
+            options.frames = std::max(1, std::stoi(value));
+        else if (name == "--warmup")
+            options.warmup = std::max(0, std::stoi(value));
+        else if (name == "--scene")
+            options.scene = value;
+        else if (name == "--balls")
+            options.balls = std::max(1u, (unsigned int)std::stoul(value));
+        else if (name == "--width")
+            options.width = std::max(1, std::stoi(value));
+        else if (name == "--height")
+            options.height = std::max(1, std::stoi(value));
+        else if (name == "--output")
+            options.output = value;
+        else if (name == "--trace")
+            options.trace = value;
+        else if (name == "--lights")
+            options.lights = (unsigned int)std::stoul(value);
+        else if (name == "--lighting")
+            options.lighting = value;
+        else
+        {
+            std::cout << "ERROR::HEADLESS::UNKNOWN_OPTION " << name << std::endl;
+            return false;
+        }
+    }
+    if (options.scene != "ball" && options.scene != "balls")
+    {
+        std::cout << "ERROR::HEADLESS::UNKNOWN_SCENE " << options.scene << " (ball, balls)" << std::endl;
+        return false;
+    }
+    if (options.lighting != "clustered" && options.lighting != "flat")
+    {
+        std::cout << "ERROR::HEADLESS::UNKNOWN_LIGHTING " << options.lighting << " (clustered, flat)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//Color and depth renderbuffers to draw into instead of a window's default framebuffer
+class OffscreenTarget
+{
+public:
+    bool create(int width, int height)
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenRenderbuffers(2, renderbuffers);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+            return false;
+        }
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    ~OffscreenTarget()
+    {
+        if (FBO)
+        {
+            glDeleteFramebuffers(1, &FBO);
+            glDeleteRenderbuffers(2, renderbuffers);
+        }
+    }
+
+private:
+    unsigned int FBO = 0;
+    unsigned int renderbuffers[2] = { 0, 0 };
+};
+
+// mean, percentiles and maximum of a list of frame times
+struct FrameTimeSummary
+{
+    double mean = 0.0, p50 = 0.0, p90 = 0.0, p99 = 0.0, max = 0.0;
+
+    explicit FrameTimeSummary(std::vector<double> values)
+    {
+        values.erase(std::remove_if(values.begin(), values.end(), [](double v) { return v < 0.0; }), values.end());
+        if (values.empty())
+            return;
+        std::sort(values.begin(), values.end());
+        for (double v : values)
+            mean += v;
+        mean /= values.size();
+        auto percentile = [&](double p) { return values[std::min(values.size() - 1, (size_t)std::ceil(p * values.size()) - 1)]; };
+        p50 = percentile(0.50);
+        p90 = percentile(0.90);
+        p99 = percentile(0.99);
+        max = values.back();
+    }
+
+    void writeJson(std::ostream& out) const
+    {
+        out << "{ \"mean\": " << mean << ", \"p50\": " << p50 << ", \"p90\": " << p90 << ", \"p99\": " << p99 << ", \"max\": " << max << " }";
+    }
+};
+
+//The input of the scripted run, a function of the frame number only: the ball is pushed around a
+//square (forward, right, back, left, two seconds each) and jumps every three seconds, the camera
+//circles it slowly at a fixed distance.
+struct HeadlessScript
+{
+    static const int FPS = 60;
+
+    static glm::vec3 push(int frame)
+    {
+        static const glm::vec3 directions[4] = {
+            glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(-1.0f, 0.0f, 0.0f) };
+        return directions[(frame / (2 * FPS)) % 4];
+    }
+
+    static bool jump(int frame)
+    {
+        return frame % (3 * FPS) == 3 * FPS / 2;
+    }
+
+    static glm::vec3 cameraOffset(int frame)
+    {
+        float angle = 0.3f * frame / FPS;
+        return glm::vec3(std::sin(angle) * 3.0f, 1.2f, std::cos(angle) * 3.0f);
+    }
+};
+
+// What the workers prepare for a headless frame, like FrameData in main.cpp but for several balls
+struct HeadlessFrame
+{
+    FrameUBO camera;
+    std::vector<glm::mat4> meshModels;  // ball * meshes per ball + mesh, from the scene graph
+    std::vector<uint32_t> visible;      // ball * meshes per ball + mesh
+    int index = 0;
+    std::vector<ClusterLight> lights;   // where the lights are this frame
+    LightClusterGrid clusters;
+};
+
+// runs the scripted scene and writes the report; returns the process exit code
+inline int runHeadless(const HeadlessOptions& options)
+{
+    const float BALL_SCALE = 0.03f;     // as in main.cpp
+    const float BALL_PUSH = 4.0f;
+    const float BALL_JUMP = 3.0f;
+    const float FIXED_DELTA = 1.0f / HeadlessScript::FPS;
+    const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+
+    PROFILE_THREAD("main");
+    BenchmarkContext context;
+    if (!context.create(64, 64))
+        return -1;
+    OffscreenTarget target;
+    if (!target.create(options.width, options.height))
+        return -1;
+    ProgramBinaryCache::instance().init(BenchmarkContext::loader());
+    TextureBaker::instance().setFlipVertically(true);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    ShaderLibrary shaders("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    bool lit = options.lights > 0;
+    Shader& shader = shaders.get(ShaderVariant().with(lit ? SHADER_DIFFUSE_MAP | SHADER_CLUSTERED : SHADER_DIFFUSE_MAP));
+    Model ourModel("./models/beach-ball/beachBall.obj", false, VertexFormat::forShader(shader), false);
+    TextureLoader::instance().finish();     // every run draws the same frames, textures included
+    uint32_t meshCount = (uint32_t)ourModel.meshes.size();
+
+    BoundingBox ballBounds = ourModel.bounds();
+    float ballRadius = ballBounds.empty() ? 0.5f : ballBounds.extent().y * BALL_SCALE;
+
+    // body 0 is the player's ball at the origin; the "balls" scene scatters the rest around it, a fixed seed so every run starts alike
+    PhysicsWorld physics;
+    physics.groundHeight = -ballRadius;
+    uint32_t ball = physics.addBody(glm::vec3(0.0f), ballRadius);
+    unsigned int count = options.scene == "balls" ? options.balls : 1;
+    unsigned int side = (unsigned int)std::ceil(std::sqrt((float)count));
+    unsigned int seed = 7;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    for (unsigned int i = 1; i < count; i++)
+    {
+        glm::vec3 position((i % side) * 3.0f * ballRadius - side * 1.5f * ballRadius, random() * 4.0f * ballRadius, -(float)(i / side + 1) * 3.0f * ballRadius);
+        uint32_t body = physics.addBody(position, ballRadius);
+        physics.applyImpulse(body, glm::vec3(random() * 2.0f - 1.0f, 0.0f, random() * 2.0f - 1.0f));
+    }
+
+    // each ball in the scene graph: a node that follows its body, a pivot that scales the model down and centers
+    // it on the body, and the model's own nodes below that
+    SceneGraph scene;
+    std::vector<uint32_t> ballNodes(count), modelNodes(count);
+    glm::mat4 pivot = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(BALL_SCALE)), -ballBounds.center());
+    for (uint32_t b = 0; b < count; b++)
+    {
+        ballNodes[b] = scene.add(glm::mat4(1.0f));
+        modelNodes[b] = scene.attach(ourModel.nodes, scene.add(pivot, ballNodes[b]));
+    }
+
+    // lights over the area of the balls, each circling its own spot; the radius shrinks as they get denser
+    std::vector<ClusterLight> lightBase(options.lights);
+    std::vector<float> lightPhase(options.lights);
+    float areaWidth = std::max(side * 3.0f * ballRadius, 4.0f), areaDepth = std::max((side + 1) * 3.0f * ballRadius, 4.0f);
+    float lightRadius = std::min(std::max(2.0f * std::sqrt(areaWidth * areaDepth / std::max(1u, options.lights)), 0.25f), 3.0f);
+    for (unsigned int i = 0; i < options.lights; i++)
+    {
+        ClusterLight& light = lightBase[i];
+        light.position = glm::vec3((random() - 0.5f) * areaWidth, random() * 2.0f * ballRadius + 0.1f, -random() * areaDepth + 1.0f);
+        light.radius = lightRadius;
+        light.color = glm::vec3(0.3f + random(), 0.3f + random(), 0.3f + random());
+        lightPhase[i] = random() * 6.2831853f;
+    }
+    LightClusterBuilder clusterBuilder = options.lighting == "flat" ? LightClusterBuilder(1, 1, 1) : LightClusterBuilder();
+    LightClusterBuffers clusterBuffers;
+    clusterBuilder.maxReferences = (unsigned int)clusterBuffers.maxTexels;
+    if (lit)
+        LightClusterBuffers::setSamplers(shader);
+
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+    RenderQueue renderQueue;
+    FrustumCuller culler;
+
+    FramePipeline<HeadlessFrame> pipeline;
+    pipeline.simulate = [&](HeadlessFrame&) {
+        physics.update(FIXED_DELTA);
+    };
+    pipeline.transforms = [&](HeadlessFrame& frame) {
+        for (uint32_t b = 0; b < count; b++)
+            scene.setLocal(ballNodes[b], physics.transform(b));
+        scene.update();
+        frame.meshModels.resize(count * meshCount);
+        for (uint32_t b = 0; b < count; b++)
+        {
+            for (uint32_t m = 0; m < meshCount; m++)
+                frame.meshModels[b * meshCount + m] = scene.world(modelNodes[b] + ourModel.meshNodes[m]);
+        }
+    };
+    pipeline.cull = [&](HeadlessFrame& frame) {
+        Frustum frustum = Frustum::fromMatrix(frame.camera.projection * frame.camera.view);
+        culler.clear();
+        for (uint32_t index = 0; index < count * meshCount; index++)
+            culler.addBox(ourModel.meshes[index % meshCount].bounds, frame.meshModels[index]);
+        frame.visible = culler.cull(frustum);
+
+        if (!lit)
+            return;
+        float time = (float)frame.index / HeadlessScript::FPS;
+        frame.lights.resize(lightBase.size());
+        for (size_t i = 0; i < lightBase.size(); i++)
+        {
+            frame.lights[i] = lightBase[i];
+            frame.lights[i].position += glm::vec3(std::sin(time + lightPhase[i]), 0.0f, std::cos(time + lightPhase[i])) * (0.5f * lightRadius);
+        }
+        clusterBuilder.build(frame.lights, frame.camera.view, frame.camera.projection, NEAR_PLANE, FAR_PLANE,
+            glm::vec2((float)options.width, (float)options.height), frame.clusters);
+    };
+    auto cameraState = [&](int frame) {
+        glm::vec3 target = physics.position(ball);
+        FrameUBO state;
+        state.projection = glm::perspective(glm::radians(45.0f), (float)options.width / (float)options.height, NEAR_PLANE, FAR_PLANE);
+        state.viewPos = target + HeadlessScript::cameraOffset(frame);
+        state.view = glm::lookAt(state.viewPos, target, glm::vec3(0.0f, 1.0f, 0.0f));
+        return state;
+    };
+
+    // the swap chain of a window holds the CPU back once it is two frames ahead of the GPU; fences do it here
+    GLsync inFlight[2] = { 0, 0 };
+    int total = options.warmup + options.frames;
+    std::vector<double> cpuMs, submitMs, gpuMs;
+    cpuMs.reserve(options.frames);
+    submitMs.reserve(options.frames);
+    unsigned long long drawCalls = 0, visibleMeshes = 0;
+    GLStateCache::Counters binds;
+    FramePipeline<HeadlessFrame>::Timings stageSum;
+    LightClusterGrid::Stats lightSum;
+    double lightUploadMs = 0.0;
+
+    // GL time of the frame and of its passes, read back a few frames late by the GPU profiler
+    GpuProfiler& gpuProfiler = GpuProfiler::instance();
+    std::map<std::string, double> passMs;
+    gpuProfiler.onCollect = [&](long long frame, const std::vector<GpuProfiler::Result>& scopes) {
+        if (frame < options.warmup)
+            return;
+        for (const GpuProfiler::Result& scope : scopes)
+        {
+            if (scope.depth == 0)
+                gpuMs.push_back(scope.ms);
+            else
+                passMs[scope.name] += scope.ms;
+        }
+    };
+
+    pipeline.next().camera = cameraState(0);
+    pipeline.next().index = 0;
+    pipeline.start();
+    BenchmarkTimer run;
+    for (int frame = 0; frame < total; frame++)
+    {
+        PROFILE_ZONE("frame");
+        BenchmarkTimer frameTimer;
+        HeadlessFrame& ready = pipeline.wait();
+        if (inFlight[frame % 2])
+        {
+            PROFILE_ZONE("glClientWaitSync");
+            glClientWaitSync(inFlight[frame % 2], GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+            glDeleteSync(inFlight[frame % 2]);
+        }
+
+        // scripted input while the workers are idle
+        bool grounded = physics.grounded(ball);
+        physics.setForce(ball, HeadlessScript::push(frame) * BALL_PUSH);
+        if (HeadlessScript::jump(frame) && grounded)
+            physics.applyImpulse(ball, glm::vec3(0.0f, BALL_JUMP, 0.0f));
+        TextureLoader::instance().pump();
+        pipeline.next().camera = cameraState(frame + 1);
+        pipeline.next().index = frame + 1;
+        pipeline.start();
+
+        BenchmarkTimer submit;
+        gpuProfiler.beginFrame();
+        {
+            GpuProfileZone frameZone("frame");
+            {
+                GpuProfileZone clearZone("clear");
+                glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            }
+            frameUniforms.data = ready.camera;
+            frameUniforms.update();
+            BenchmarkTimer upload;
+            if (lit)
+            {
+                GpuProfileZone lightsZone("lights");
+                clusterBuffers.upload(ready.lights, ready.clusters);
+                clusterBuffers.bind();
+                renderQueue.state.invalidate();     // bind() switched texture units
+            }
+            if (frame >= options.warmup)
+                lightUploadMs += upload.elapsedMs();
+            GpuProfileZone ballsZone("balls");
+            for (uint32_t index : ready.visible)
+                renderQueue.submit(shader, ourModel.meshes[index % meshCount], ready.meshModels[index]);
+            renderQueue.state.resetCounters();
+            renderQueue.flush(ready.camera.viewPos);
+        }
+        gpuProfiler.endFrame();
+        inFlight[frame % 2] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+
+        if (frame < options.warmup)
+            continue;
+        submitMs.push_back(submit.elapsedMs());
+        cpuMs.push_back(frameTimer.elapsedMs());
+        const GLStateCache::Counters& counters = renderQueue.state.counters;
+        drawCalls += renderQueue.stats.drawCalls;
+        visibleMeshes += ready.visible.size();
+        binds.programBinds += counters.programBinds;
+        binds.vertexArrayBinds += counters.vertexArrayBinds;
+        binds.textureBinds += counters.textureBinds;
+        binds.samplerSets += counters.samplerSets;
+        binds.programBindsAvoided += counters.programBindsAvoided;
+        binds.vertexArrayBindsAvoided += counters.vertexArrayBindsAvoided;
+        binds.textureBindsAvoided += counters.textureBindsAvoided;
+        binds.samplerSetsAvoided += counters.samplerSetsAvoided;
+        const FramePipeline<HeadlessFrame>::Timings& t = pipeline.lastTimings();
+        stageSum.simulate += t.simulate; stageSum.transforms += t.transforms; stageSum.cull += t.cull; stageSum.wait += t.wait;
+        const LightClusterGrid::Stats& clusterStats = ready.clusters.stats;
+        lightSum.visible += clusterStats.visible;
+        lightSum.references += clusterStats.references;
+        lightSum.maxPerCluster = std::max(lightSum.maxPerCluster, clusterStats.maxPerCluster);
+        lightSum.dropped += clusterStats.dropped;
+        lightSum.ms += clusterStats.ms;
+    }
+    pipeline.wait();
+    gpuProfiler.finish();
+    gpuProfiler.onCollect = nullptr;
+    for (GLsync fence : inFlight)
+    {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    double runMs = run.elapsedMs();
+
+    FrameTimeSummary cpu(cpuMs), gpu(gpuMs), submitted(submitMs);
+    glm::vec3 end = physics.position(ball);
+    double frames = options.frames;
+
+    std::ofstream file;
+    if (options.output != "-")
+    {
+        file.open(options.output);
+        if (!file)
+        {
+            std::cout << "ERROR::HEADLESS::OUTPUT_NOT_WRITABLE " << options.output << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& out = options.output == "-" ? std::cout : file;
+    out << "{\n";
+    out << "  \"scene\": \"" << options.scene << "\",\n";
+    out << "  \"balls\": " << count << ",\n";
+    out << "  \"frames\": " << options.frames << ",\n";
+    out << "  \"warmup\": " << options.warmup << ",\n";
+    out << "  \"width\": " << options.width << ",\n";
+    out << "  \"height\": " << options.height << ",\n";
+    out << "  \"renderer\": \"" << glGetString(GL_RENDERER) << "\",\n";
+    out << "  \"cpu_frame_ms\": "; cpu.writeJson(out); out << ",\n";
+    out << "  \"cpu_submit_ms\": "; submitted.writeJson(out); out << ",\n";
+    out << "  \"gl_time_ms\": "; gpu.writeJson(out); out << ",\n";
+    out << "  \"gl_pass_ms\": {";
+    for (auto it = passMs.begin(); it != passMs.end(); ++it)
+        out << (it == passMs.begin() ? " \"" : ", \"") << it->first << "\": " << it->second / std::max<size_t>(1, gpuMs.size());
+    out << " },\n";
+    out << "  \"gl_timing\": \"" << gpuProfiler.timing() << "\",\n";
+    out << "  \"gl_rejected\": " << gpuProfiler.rejected << ",\n";
+    out << "  \"gl_stalls\": " << gpuProfiler.stalls << ",\n";
+    out << "  \"stage_ms\": { \"simulate\": " << stageSum.simulate / frames << ", \"transforms\": " << stageSum.transforms / frames
+        << ", \"cull\": " << stageSum.cull / frames << ", \"wait\": " << stageSum.wait / frames << " },\n";
+    out << "  \"per_frame\": { \"visible_meshes\": " << visibleMeshes / frames << ", \"draw_calls\": " << drawCalls / frames
+        << ", \"program_binds\": " << binds.programBinds / frames << ", \"vertex_array_binds\": " << binds.vertexArrayBinds / frames
+        << ", \"texture_binds\": " << binds.textureBinds / frames << ", \"sampler_sets\": " << binds.samplerSets / frames
+        << ", \"binds_avoided\": " << binds.avoided() / frames << " },\n";
+    if (lit)
+    {
+        out << "  \"lights\": { \"count\": " << options.lights << ", \"lighting\": \"" << options.lighting << "\", \"clusters\": ["
+            << clusterBuilder.tilesX << ", " << clusterBuilder.tilesY << ", " << clusterBuilder.slices << "], \"radius\": " << lightRadius
+            << ", \"visible\": " << lightSum.visible / frames << ", \"lights_per_cluster\": " << lightSum.references / frames / clusterBuilder.clusterCount()
+            << ", \"max_per_cluster\": " << lightSum.maxPerCluster << ", \"dropped\": " << lightSum.dropped / frames
+            << ", \"bin_ms\": " << lightSum.ms / frames << ", \"upload_ms\": " << lightUploadMs / frames << " },\n";
+    }
+    out << "  \"ball_end_position\": [" << end.x << ", " << end.y << ", " << end.z << "],\n";   // the same on every run of a build
+    out << "  \"wall_ms\": " << runMs << "\n";
+    out << "}" << std::endl;
+
+    if (!options.trace.empty())
+    {
+#ifdef PROFILER_ENABLED
+        Profiler::instance().writeChromeTrace(options.trace);
+        Profiler::instance().printSummary(options.output == "-" ? std::cerr : std::cout);
+#else
+        std::cout << "ERROR::HEADLESS::PROFILER_DISABLED build with PROFILER_ENABLED defined to write " << options.trace << std::endl;
+#endif
+    }
+    if (options.output != "-")
+        std::cout << options.frames << " frames of \"" << options.scene << "\": CPU p50 " << cpu.p50 << " ms, p99 " << cpu.p99
+            << " ms, GL p50 " << gpu.p50 << " ms, " << drawCalls / frames << " draw calls/frame -> " << options.output << std::endl;
+    gpuProfiler.destroy();
+    return 0;
+}
+
+#endif
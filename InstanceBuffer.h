@@ -0,0 +1,121 @@
+#pragma once
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+
+#include "Mesh.h"
+
+// Compact per-instance transform: 32 bytes instead of the 64 of a mat4. Uniform scale only.
+struct InstanceTRS
+{
+    glm::vec3 position;
+    float scale = 1.0f;
+    glm::vec4 rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);   // unit quaternion, x y z w
+};
+
+enum InstanceLayout
+{
+    INSTANCE_LAYOUT_MATRIX, // mat4 at locations 7-10, read by the INSTANCED variant of shaders/modelLoading.vert
+    INSTANCE_LAYOUT_TRS     // InstanceTRS at locations 7-8, read by its INSTANCED_TRS variant
+};
+
+//Streams an array of per-instance transforms into a vertex buffer that advances once per instance
+//(glVertexAttribDivisor 1), so one glDrawElementsInstanced draws every copy of a mesh.
+//The buffer is orphaned on each upload, the driver hands out fresh storage instead of waiting for
+//the draws of the previous frame that still read the old contents. It is only created by the first
+//upload, so an owner that never draws instanced (most Models) costs no GL object.
+class InstanceBuffer
+{
+public:
+    unsigned int VBO = 0;       // 0 until the first upload
+    InstanceLayout layout = INSTANCE_LAYOUT_MATRIX;
+    unsigned int count = 0;     // instances in the last upload
+
+    InstanceBuffer() = default;
+    ~InstanceBuffer()
+    {
+        if (VBO)
+            glDeleteBuffers(1, &VBO);
+    }
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    void upload(const glm::mat4* transforms, unsigned int instanceCount)
+    {
+        write(transforms, instanceCount, sizeof(glm::mat4));
+        layout = INSTANCE_LAYOUT_MATRIX;
+    }
+    void upload(const InstanceTRS* transforms, unsigned int instanceCount)
+    {
+        write(transforms, instanceCount, sizeof(InstanceTRS));
+        layout = INSTANCE_LAYOUT_TRS;
+    }
+
+    // points the instance attributes of the VAO at this buffer; cheap once the VAO is set up for the current layout.
+    // A VAO should be fed by one InstanceBuffer only, the attachment is remembered here and not re-checked.
+    void attach(unsigned int VAO)
+    {
+        if (!VBO)
+            return;
+        auto it = attached.find(VAO);
+        if (it != attached.end() && it->second == layout)
+            return;
+        attached[VAO] = layout;
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        if (layout == INSTANCE_LAYOUT_MATRIX)
+        {
+            for (GLuint column = 0; column < 4; column++)
+            {
+                glEnableVertexAttribArray(ATTRIB_INSTANCE + column);
+                glVertexAttribPointer(ATTRIB_INSTANCE + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+                glVertexAttribDivisor(ATTRIB_INSTANCE + column, 1);
+            }
+        }
+        else
+        {
+            glEnableVertexAttribArray(ATTRIB_INSTANCE);
+            glVertexAttribPointer(ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTRS), (void*)offsetof(InstanceTRS, position));
+            glVertexAttribDivisor(ATTRIB_INSTANCE, 1);
+            glEnableVertexAttribArray(ATTRIB_INSTANCE + 1);
+            glVertexAttribPointer(ATTRIB_INSTANCE + 1, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTRS), (void*)offsetof(InstanceTRS, rotation));
+            glVertexAttribDivisor(ATTRIB_INSTANCE + 1, 1);
+            for (GLuint column = 2; column < 4; column++)
+                glDisableVertexAttribArray(ATTRIB_INSTANCE + column);
+        }
+        glBindVertexArray(0);
+    }
+
+private:
+    GLsizeiptr capacity = 0;
+    std::unordered_map<unsigned int, InstanceLayout> attached;  // VAO -> layout its pointers were set up for
+
+    void write(const void* data, unsigned int instanceCount, size_t instanceSize)
+    {
+        count = instanceCount;
+        GLsizeiptr bytes = (GLsizeiptr)instanceCount * instanceSize;
+        if (!VBO)
+            glGenBuffers(1, &VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        if (bytes > capacity)
+        {
+            capacity = bytes + bytes / 2;   // grow with headroom so a slowly growing count doesn't reallocate every frame
+            glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+        }
+        if (bytes > 0)
+        {
+            void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            std::memcpy(mapped, data, bytes);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+    }
+};
+
+#endif
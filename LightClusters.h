@@ -0,0 +1,351 @@
+#pragma once
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "Profiler.h"
+#include "Shader.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "UniformBuffer.h"
+
+// a point light with a finite range; 32 bytes, two RGBA32F texels of the light buffer
+struct ClusterLight
+{
+    glm::vec3 position;     // world space
+    float radius;           // no light beyond this distance
+    glm::vec3 color;        // premultiplied by the intensity
+    float padding = 0.0f;
+};
+static_assert(sizeof(ClusterLight) == 32, "ClusterLight must be two vec4 texels");
+
+// texture units the light lists are bound to, above the ones meshes use for their maps
+enum ClusterTextureUnit
+{
+    CLUSTER_LIGHTS_UNIT = 13,   // samplerBuffer clusterLights
+    CLUSTER_RANGES_UNIT = 14,   // usamplerBuffer clusterRanges
+    CLUSTER_INDICES_UNIT = 15   // usamplerBuffer clusterIndices
+};
+
+// The lights of one frame sorted into clusters, what LightClusterBuilder makes on a worker and
+// LightClusterBuffers uploads. Cluster (x, y, slice) is ranges[(slice * tilesY + y) * tilesX + x]:
+// the first of its entries in indices and how many there are.
+struct LightClusterGrid
+{
+    struct Stats
+    {
+        unsigned int lights = 0, visible = 0;   // visible: touch at least one cluster
+        unsigned int references = 0;            // entries in indices
+        unsigned int maxPerCluster = 0;
+        unsigned int dropped = 0;               // references over the buffer's capacity, not shaded
+        double ms = 0.0;                        // build time
+    };
+
+    ClustersUBO uniforms;
+    std::vector<glm::uvec2> ranges;
+    std::vector<uint32_t> indices;
+    Stats stats;
+};
+
+//Clustered forward shading: the view frustum is cut into tilesX x tilesY screen tiles and slices
+//exponentially spaced in depth (froxels), and every frame each light is listed in the clusters its
+//sphere touches. The fragment shader (the CLUSTERED variant of shaders/modelLoading.frag) looks up
+//its own cluster and shades with that list only, so the cost per fragment follows the lights near
+//it instead of the lights in the scene.
+//
+//build() runs on any thread, e.g. in FramePipeline's cull stage:
+//  1. view space bounds of every light, SimdFloat::WIDTH lights at a time: depth range and a
+//     conservative screen rectangle from the corners of the sphere's view space box
+//  2. the visible lights bucketed by the slices they span
+//  3. per slice on the pool: count the lights of each cluster, then after one prefix sum fill the
+//     lists; slices own disjoint clusters, so the workers never write to the same place
+//The projection has to be a symmetric perspective one (glm::perspective).
+class LightClusterBuilder
+{
+public:
+    unsigned int tilesX, tilesY, slices;
+    unsigned int maxReferences = 65536;     // capacity of the index buffer: the least GL_MAX_TEXTURE_BUFFER_SIZE GL allows,
+                                            // raise it to LightClusterBuffers::maxTexels
+
+    // 1 x 1 x 1 puts every visible light into one list, plain forward shading over all lights
+    explicit LightClusterBuilder(unsigned int tilesX = 16, unsigned int tilesY = 9, unsigned int slices = 24, ThreadPool* pool = nullptr)
+        : tilesX(std::max(1u, tilesX)), tilesY(std::max(1u, tilesY)), slices(std::max(1u, slices)), pool(pool)
+    {
+    }
+
+    size_t clusterCount() const
+    {
+        return (size_t)tilesX * tilesY * slices;
+    }
+
+    void build(const std::vector<ClusterLight>& lights, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane,
+        const glm::vec2& viewport, LightClusterGrid& grid)
+    {
+        PROFILE_ZONE("LightClusterBuilder::build");
+        auto start = std::chrono::steady_clock::now();
+        size_t count = lights.size();
+        grid.stats = LightClusterGrid::Stats();
+        grid.stats.lights = (unsigned int)count;
+
+        float sliceScale = slices / std::log(farPlane / nearPlane);
+        float sliceBias = -std::log(nearPlane) * sliceScale;
+        grid.uniforms.dims = glm::uvec4(tilesX, tilesY, slices, (unsigned int)count);
+        grid.uniforms.params = glm::vec4(viewport.x / tilesX, viewport.y / tilesY, sliceScale, sliceBias);
+
+        // 1. bounds, in blocks on the pool
+        posX.resize(count); posY.resize(count); posZ.resize(count); radius.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            posX[i] = lights[i].position.x; posY[i] = lights[i].position.y; posZ[i] = lights[i].position.z;
+            radius[i] = lights[i].radius;
+        }
+        bounds.resize(count);
+        boxNear.resize(count); boxFar.resize(count);
+        boxMinX.resize(count); boxMaxX.resize(count); boxMinY.resize(count); boxMaxY.resize(count);
+        Camera camera{ view, projection[0][0], projection[1][1], nearPlane, farPlane };
+        size_t blocks = (count + BLOCK - 1) / BLOCK;
+        threadPool().parallelFor(blocks, [&](size_t first, size_t last) {
+            size_t end = std::min(count, last * BLOCK);
+            size_t i = first * BLOCK;
+            for (; i + SimdFloat::WIDTH <= end; i += SimdFloat::WIDTH)
+                viewBounds<SimdFloat>(i, camera);
+            for (; i < end; i++)
+                viewBounds<ScalarFloat>(i, camera);
+            for (i = first * BLOCK; i < end; i++)
+                clusterBounds(i, sliceScale, sliceBias);
+        }, 1);
+
+        // 2. buckets per slice
+        sliceLights.resize(slices);
+        for (std::vector<uint32_t>& bucket : sliceLights)
+            bucket.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            const Bounds& b = bounds[i];
+            if (!b.visible)
+                continue;
+            grid.stats.visible++;
+            for (unsigned int s = b.slice0; s <= b.slice1; s++)
+                sliceLights[s].push_back((uint32_t)i);
+        }
+
+        // 3. count, prefix sum, fill
+        size_t clusters = clusterCount(), perSlice = (size_t)tilesX * tilesY;
+        counts.assign(clusters, 0);
+        threadPool().parallelFor(slices, [&](size_t first, size_t last) {
+            for (size_t s = first; s < last; s++)
+            {
+                uint32_t* sliceCounts = &counts[s * perSlice];
+                for (uint32_t light : sliceLights[s])
+                {
+                    const Bounds& b = bounds[light];
+                    for (unsigned int y = b.y0; y <= b.y1; y++)
+                        for (unsigned int x = b.x0; x <= b.x1; x++)
+                            sliceCounts[y * tilesX + x]++;
+                }
+            }
+        }, 1);
+
+        grid.ranges.resize(clusters);
+        uint32_t offset = 0;
+        for (size_t c = 0; c < clusters; c++)
+        {
+            uint32_t kept = std::min(counts[c], maxReferences - offset);
+            grid.stats.dropped += counts[c] - kept;
+            grid.stats.maxPerCluster = std::max(grid.stats.maxPerCluster, counts[c]);
+            grid.ranges[c] = glm::uvec2(offset, kept);
+            offset += kept;
+        }
+        grid.stats.references = offset;
+        grid.indices.resize(offset);
+
+        threadPool().parallelFor(slices, [&](size_t first, size_t last) {
+            for (size_t s = first; s < last; s++)
+            {
+                uint32_t* cursor = &counts[s * perSlice];     // reused: entries written so far
+                std::fill(cursor, cursor + perSlice, 0u);
+                const glm::uvec2* sliceRanges = &grid.ranges[s * perSlice];
+                for (uint32_t light : sliceLights[s])
+                {
+                    const Bounds& b = bounds[light];
+                    for (unsigned int y = b.y0; y <= b.y1; y++)
+                    {
+                        for (unsigned int x = b.x0; x <= b.x1; x++)
+                        {
+                            unsigned int tile = y * tilesX + x;
+                            if (cursor[tile] < sliceRanges[tile].y)
+                                grid.indices[sliceRanges[tile].x + cursor[tile]++] = light;
+                        }
+                    }
+                }
+            }
+        }, 1);
+        grid.stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    struct Camera
+    {
+        glm::mat4 view;
+        float scaleX, scaleY;   // projection[0][0], projection[1][1]
+        float nearPlane, farPlane;
+    };
+    // the clusters a light touches, inclusive ranges
+    struct Bounds
+    {
+        uint16_t x0, x1, y0, y1, slice0, slice1;
+        bool visible;
+    };
+    static const size_t BLOCK = 1024;   // lights per parallel task, a multiple of any SIMD width
+
+    ThreadPool* pool;
+    std::vector<float> posX, posY, posZ, radius;
+    std::vector<float> boxNear, boxFar, boxMinX, boxMaxX, boxMinY, boxMaxY;    // view depth and NDC rectangle per light
+    std::vector<Bounds> bounds;
+    std::vector<std::vector<uint32_t>> sliceLights;
+    std::vector<uint32_t> counts;
+
+    ThreadPool& threadPool()
+    {
+        return pool ? *pool : ThreadPool::shared();
+    }
+
+    // view space depth range and NDC rectangle of the lights [i, i + Float::WIDTH); an empty depth range means culled
+    template <typename Float>
+    void viewBounds(size_t i, const Camera& camera)
+    {
+        const glm::mat4& m = camera.view;
+        Float x = Float::load(&posX[i]), y = Float::load(&posY[i]), z = Float::load(&posZ[i]), r = Float::load(&radius[i]);
+        Float vx = Float(m[0][0]) * x + Float(m[1][0]) * y + Float(m[2][0]) * z + Float(m[3][0]);
+        Float vy = Float(m[0][1]) * x + Float(m[1][1]) * y + Float(m[2][1]) * z + Float(m[3][1]);
+        Float depth = Float(0.0f) - (Float(m[0][2]) * x + Float(m[1][2]) * y + Float(m[2][2]) * z + Float(m[3][2]));
+        Float zNear = max(depth - r, Float(camera.nearPlane));
+        Float zFar = min(depth + r, Float(camera.farPlane));
+        // x / z over the corners of the box around the sphere, between zNear and zFar
+        Float inverseNear = Float(1.0f) / zNear, inverseFar = Float(1.0f) / zFar;
+        Float left = vx - r, right = vx + r, bottom = vy - r, top = vy + r;
+        Float sx(camera.scaleX), sy(camera.scaleY);
+        (sx * min(left * inverseNear, left * inverseFar)).store(&boxMinX[i]);
+        (sx * max(right * inverseNear, right * inverseFar)).store(&boxMaxX[i]);
+        (sy * min(bottom * inverseNear, bottom * inverseFar)).store(&boxMinY[i]);
+        (sy * max(top * inverseNear, top * inverseFar)).store(&boxMaxY[i]);
+        zNear.store(&boxNear[i]);
+        zFar.store(&boxFar[i]);
+    }
+
+    void clusterBounds(size_t i, float sliceScale, float sliceBias)
+    {
+        Bounds& b = bounds[i];
+        b.visible = boxNear[i] < boxFar[i] && boxMinX[i] < 1.0f && boxMaxX[i] > -1.0f && boxMinY[i] < 1.0f && boxMaxY[i] > -1.0f;
+        if (!b.visible)
+            return;
+        auto tile = [](float ndc, unsigned int tiles) {
+            int t = (int)std::floor((ndc * 0.5f + 0.5f) * tiles);
+            return (uint16_t)std::min(std::max(t, 0), (int)tiles - 1);
+        };
+        auto slice = [&](float depth) {
+            int s = (int)std::floor(std::log(depth) * sliceScale + sliceBias);
+            return (uint16_t)std::min(std::max(s, 0), (int)slices - 1);
+        };
+        b.x0 = tile(boxMinX[i], tilesX); b.x1 = tile(boxMaxX[i], tilesX);
+        b.y0 = tile(boxMinY[i], tilesY); b.y1 = tile(boxMaxY[i], tilesY);
+        b.slice0 = slice(boxNear[i]); b.slice1 = slice(boxFar[i]);
+    }
+};
+
+//The GL side: the lights, the cluster ranges and the index lists in three texture buffers (GL 3.3
+//has no storage buffers) and the grid parameters in the "Clusters" uniform block. upload() and
+//bind() on the GL thread; bind() changes texture units behind a GLStateCache, invalidate() it after.
+class LightClusterBuffers
+{
+public:
+    GLint maxTexels = 65536;    // GL_MAX_TEXTURE_BUFFER_SIZE, the most lights * 2, clusters or references
+
+    LightClusterBuffers() : uniforms(CLUSTERS_BLOCK_BINDING)
+    {
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        for (int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    ~LightClusterBuffers()
+    {
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(3, buffers);
+    }
+    LightClusterBuffers(const LightClusterBuffers&) = delete;
+    LightClusterBuffers& operator=(const LightClusterBuffers&) = delete;
+
+    // points the program's samplers at the cluster units; once per program, it stays in use afterwards
+    static void setSamplers(Shader& shader)
+    {
+        shader.use();
+        shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+        shader.setInt("clusterRanges", CLUSTER_RANGES_UNIT);
+        shader.setInt("clusterIndices", CLUSTER_INDICES_UNIT);
+    }
+
+    // replaces the buffers' contents with a frame's lights and grid; what doesn't fit into a texture buffer is
+    // left out (a builder whose maxReferences is above maxTexels)
+    void upload(const std::vector<ClusterLight>& lights, const LightClusterGrid& grid)
+    {
+        PROFILE_ZONE("LightClusterBuffers::upload");
+        size_t texels = (size_t)maxTexels;
+        if ((lights.size() * 2 > texels || grid.ranges.size() > texels || grid.indices.size() > texels) && !overflowReported)
+        {
+            overflowReported = true;
+            std::cout << "ERROR::LIGHT_CLUSTERS::OVER_TEXTURE_BUFFER_SIZE " << maxTexels << std::endl;
+        }
+        fill(buffers[0], lights.data(), std::min(lights.size(), texels / 2) * sizeof(ClusterLight));
+        fill(buffers[1], grid.ranges.data(), std::min(grid.ranges.size(), texels) * sizeof(glm::uvec2));
+        fill(buffers[2], grid.indices.data(), std::min(grid.indices.size(), texels) * sizeof(uint32_t));
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        uniforms.data = grid.uniforms;
+        uniforms.update();
+    }
+
+    void bind() const
+    {
+        const GLuint units[3] = { CLUSTER_LIGHTS_UNIT, CLUSTER_RANGES_UNIT, CLUSTER_INDICES_UNIT };
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    GLuint buffers[3];
+    GLuint textures[3];
+    UniformBuffer<ClustersUBO> uniforms;
+    bool overflowReported = false;
+
+    static void fill(GLuint buffer, const void* data, size_t bytes)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)std::max<size_t>(bytes, 16), NULL, GL_STREAM_DRAW);    // orphans last frame's storage
+        if (bytes > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr)bytes, data);
+    }
+};
+
+#endif
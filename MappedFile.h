@@ -0,0 +1,109 @@
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#undef APIENTRY    // windows.h defines it again
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#undef near        // minwindef.h leaves these empty macros behind, which erase any parameter named near or far
+#undef far
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <string>
+
+// A read-only view of a whole file through the page cache: nothing is copied until a page is touched,
+// and glBufferData can read the vertices straight out of it.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile()
+    {
+        close();
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        bytes = mapping ? (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        length_ = (size_t)length.QuadPart;
+#else
+        descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0)
+            return false;
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+        {
+            close();
+            return false;
+        }
+        void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        bytes = view == MAP_FAILED ? nullptr : (const unsigned char*)view;
+        length_ = (size_t)status.st_size;
+#endif
+        if (!bytes)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes)
+            munmap((void*)bytes, length_);
+        if (descriptor >= 0)
+            ::close(descriptor);
+        descriptor = -1;
+#endif
+        bytes = nullptr;
+        length_ = 0;
+    }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length_; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length_ = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int descriptor = -1;
+#endif
+};
+
+#endif
@@ -5,6 +5,9 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -13,6 +16,7 @@
 //What we eventually want is to transform that data to a format 
 //that OpenGL understands so that we can render the objects.
 
+#include "Bounds.h"
 #include "Shader.h"
 #define MAX_BONE_INFLUENCE 4
 struct Vertex
@@ -37,6 +41,75 @@ struct Vertex
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// fixed attribute locations shared by every vertex layout and the shaders
+enum VertexAttribute
+{
+    ATTRIB_POSITION = 0,
+    ATTRIB_NORMAL = 1,
+    ATTRIB_TEXCOORDS = 2,
+    ATTRIB_TANGENT = 3,
+    ATTRIB_BITANGENT = 4,
+    ATTRIB_BONE_IDS = 5,
+    ATTRIB_WEIGHTS = 6,
+    ATTRIB_INSTANCE = 7     // first of the per-instance locations (7-10), see InstanceBuffer
+};
+const unsigned int ALL_VERTEX_ATTRIBUTES = (1u << 7) - 1;
+
+enum VertexLayout
+{
+    VERTEX_LAYOUT_FULL,     // the Vertex struct as is: 88 bytes of floats and ints
+    VERTEX_LAYOUT_COMPACT   // quantized, only the attributes in the mask, at most 36 bytes
+};
+
+// How a mesh stores its vertices on the GPU. The compact layout packs
+//   position  -> 3 floats
+//   normal    -> GL_INT_2_10_10_10_REV, normalized
+//   texCoords -> 2 half floats (precise to ~1/2048 in [0,1])
+//   tangent   -> GL_INT_2_10_10_10_REV, w holds the handedness of the bitangent
+//   bitangent -> not stored, the shader rebuilds it as cross(normal, tangent.xyz) * tangent.w
+//   bone ids  -> 4 unsigned shorts (glVertexAttribIPointer), a skeleton can have more than 256 bones
+//   weights   -> 4 unsigned normalized bytes
+// and leaves out every attribute the mask doesn't ask for.
+struct VertexFormat
+{
+    VertexLayout layout = VERTEX_LAYOUT_FULL;
+    unsigned int attributes = ALL_VERTEX_ATTRIBUTES;   // bit per VertexAttribute
+
+    // the smallest format that still feeds every attribute the shader reads. The compact layout has no
+    // bitangent at location 4: a shader asking for it gets the tangent, whose w it rebuilds the bitangent from
+    static VertexFormat forShader(const Shader& shader)
+    {
+        VertexFormat format;
+        format.layout = VERTEX_LAYOUT_COMPACT;
+        format.attributes = (shader.activeAttributes & ALL_VERTEX_ATTRIBUTES) | (1u << ATTRIB_POSITION);
+        if (format.has(ATTRIB_BITANGENT))
+        {
+            std::cout << "ERROR::VERTEX_FORMAT::BITANGENT_NOT_STORED rebuild it as cross(normal, tangent.xyz) * tangent.w" << std::endl;
+            format.attributes = (format.attributes & ~(1u << ATTRIB_BITANGENT)) | (1u << ATTRIB_TANGENT);
+        }
+        return format;
+    }
+
+    bool has(VertexAttribute attribute) const
+    {
+        return (attributes & (1u << attribute)) != 0;
+    }
+
+    // bytes per vertex on the GPU
+    unsigned int stride() const
+    {
+        if (layout == VERTEX_LAYOUT_FULL)
+            return sizeof(Vertex);
+        unsigned int bytes = 3 * sizeof(float);
+        if (has(ATTRIB_NORMAL)) bytes += 4;
+        if (has(ATTRIB_TEXCOORDS)) bytes += 4;
+        if (has(ATTRIB_TANGENT)) bytes += 4;
+        if (has(ATTRIB_BONE_IDS)) bytes += 8;
+        if (has(ATTRIB_WEIGHTS)) bytes += 4;
+        return bytes;
+    }
+};
+
 struct Texture {
     unsigned int id;
     std::string type; //We store the id of the texture and its type e.g. a diffuse or specular texture.
@@ -49,33 +122,127 @@ public:
     std::vector<Vertex>       vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture>      textures;
+    std::vector<std::string>  samplers;     // sampler uniform name per texture, built once instead of every Draw
     unsigned int VAO;
+    VertexFormat format;
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    BoundingBox bounds;     // object space, for culling
 
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+    // the vectors are taken by value and moved into the members, so callers that std::move them in copy nothing.
+    // without keepGeometry the CPU copies of vertices and indices are freed once they are on the GPU.
+    // an empty bounds is computed from the vertices; loaders that already know the box pass it in.
+    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, VertexFormat format = VertexFormat(), bool keepGeometry = true,
+        BoundingBox bounds = BoundingBox())
     {//Constructor for mesh
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        samplers = samplerNames(this->textures);
+        this->format = format;
+        vertexCount = (unsigned int)this->vertices.size();
+        indexCount = (unsigned int)this->indices.size();
+        this->bounds = bounds;
+        if (this->bounds.empty())
+            for (const Vertex& vertex : this->vertices)
+                this->bounds.expand(vertex.Position);
 
         setupMesh();
+        if (!keepGeometry)
+        {
+            std::vector<Vertex>().swap(this->vertices);
+            std::vector<unsigned int>().swap(this->indices);
+        }
+    }
+
+    // vertices already packed in format (e.g. mapped from a ModelCache entry) go to the GPU as they are.
+    // the mesh keeps no CPU geometry; a caller that wants it fills vertices and indices afterwards.
+    // null arrays leave the buffers allocated but unfilled, for a caller that copies the data in itself (ModelLoader).
+    Mesh(const void* packedVertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, std::vector<Texture> textures,
+        VertexFormat format, BoundingBox bounds)
+    {
+        this->textures = std::move(textures);
+        samplers = samplerNames(this->textures);
+        this->format = format;
+        this->vertexCount = vertexCount;
+        this->indexCount = indexCount;
+        this->bounds = bounds;
+        setupBuffers(packedVertices, indices);
     }
 
+    // GPU memory taken by the vertex and index buffers
+    size_t gpuBytes() const
+    {
+        return (size_t)vertexCount * format.stride() + (size_t)indexCount * sizeof(unsigned int);
+    }
+
+
+    // replaces the vertices on the GPU, e.g. with ones skinned on the CPU (skinVertices in Animation.h); same count as before
+    void updateVertices(const std::vector<Vertex>& newVertices)
+    {
+        if (newVertices.size() != vertexCount || vertexCount == 0)
+            return;
+        GLsizeiptr bytes = (GLsizeiptr)vertexCount * format.stride();
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        packVertices(newVertices, format, mapped);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 
     // render the mesh
     void Draw(Shader &shader)
     {
-        
-        // bind appropriate textures
+        bindTextures(textures, samplers, shader);
+
+        // draw mesh
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // render instanceCount copies in one call; the VAO must have instance attributes attached (InstanceBuffer::attach)
+    void DrawInstanced(Shader &shader, unsigned int instanceCount)
+    {
+        bindTextures(textures, samplers, shader);
+
+        glBindVertexArray(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, instanceCount);
+        glBindVertexArray(0);
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // binds each texture to its own unit and points the matching sampler (texture_diffuseN, ...) at it
+    static void bindTextures(const std::vector<Texture>& textures, const std::vector<std::string>& samplers, Shader& shader)
+    {
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+            // now set the sampler to the correct texture unit
+            glUniform1i(shader.getUniformLocation(samplers[i]), i);
+            // and finally bind the texture
+            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
+    // the sampler uniform each texture feeds: its type plus a per-type counter, e.g. texture_diffuse1, texture_diffuse2
+    static std::vector<std::string> samplerNames(const std::vector<Texture>& textures)
+    {
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr = 1;
         unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
+        std::vector<std::string> names;
+        names.reserve(textures.size());
+        for (const Texture& texture : textures)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             std::string number;
-            std::string name = textures[i].type;
+            const std::string& name = texture.type;
             if (name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if (name == "texture_specular")
@@ -84,26 +251,76 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to string
             else if (name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            names.push_back(name + number);
         }
+        return names;
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    // the GL buffers holding this mesh, e.g. for copying it into a shared ModelBatch arena
+    unsigned int vertexBuffer() const { return VBO; }
+    unsigned int indexBuffer() const { return EBO; }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // quantizes vertices into format, writing format.stride() bytes per vertex to dst
+    static void packVertices(const std::vector<Vertex>& vertices, const VertexFormat& format, unsigned char* dst)
+    {
+        if (format.layout == VERTEX_LAYOUT_FULL)
+        {
+            if (!vertices.empty())
+                std::memcpy(dst, vertices.data(), vertices.size() * sizeof(Vertex));
+            return;
+        }
+        for (const Vertex& vertex : vertices)
+        {
+            std::memcpy(dst, &vertex.Position, 3 * sizeof(float));
+            dst += 3 * sizeof(float);
+            if (format.has(ATTRIB_NORMAL))
+                dst = write32(dst, glm::packSnorm3x10_1x2(glm::vec4(vertex.Normal, 0.0f)));
+            if (format.has(ATTRIB_TEXCOORDS))
+                dst = write32(dst, glm::packHalf2x16(vertex.TexCoords));
+            if (format.has(ATTRIB_TANGENT))
+            {
+                float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+                dst = write32(dst, glm::packSnorm3x10_1x2(glm::vec4(vertex.Tangent, handedness)));
+            }
+            if (format.has(ATTRIB_BONE_IDS))
+            {
+                std::uint16_t ids[MAX_BONE_INFLUENCE];
+                for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+                    ids[i] = (std::uint16_t)glm::clamp(vertex.m_BoneIDs[i], 0, 0xFFFF);
+                std::memcpy(dst, ids, sizeof(ids));
+                dst += sizeof(ids);
+            }
+            if (format.has(ATTRIB_WEIGHTS))
+            {
+                for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+                    *dst++ = (unsigned char)(glm::clamp(vertex.m_Weights[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    // sets up the attribute pointers of the bound VAO for vertices stored in the given format
+    static void setupAttributes(const VertexFormat& format)
+    {
+        if (format.layout == VERTEX_LAYOUT_FULL)
+            setupFullAttributes();
+        else
+            setupCompactAttributes(format);
     }
 private:
     //  render data
     unsigned int VBO, EBO;
 
     void setupMesh()
+    {
+        if (format.layout == VERTEX_LAYOUT_FULL)
+            setupBuffers(vertices.data(), indices.data());
+        else
+            setupBuffers(nullptr, indices.data());
+    }
+
+    // packed: vertexCount vertices already in format; without them the vertices member is quantized into the buffer,
+    // and with no vertices member either the buffer is only allocated
+    void setupBuffers(const void* packed, const unsigned int* indexData)
     {
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
@@ -112,12 +329,30 @@ private:
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        GLsizeiptr bytes = (GLsizeiptr)vertexCount * format.stride();
+        if (packed || vertices.empty())
+            glBufferData(GL_ARRAY_BUFFER, bytes, packed, GL_STATIC_DRAW);
+        else
+        {   // quantize straight into the mapped buffer, no staging copy
+            glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+            if (bytes > 0)
+            {
+                unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+                packVertices(vertices, format, mapped);
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+            }
+        }
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-            &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexCount * sizeof(unsigned int),
+            indexData, GL_STATIC_DRAW);
 
+        setupAttributes(format);
+        glBindVertexArray(0);
+    }
+
+    static void setupFullAttributes()
+    {
         // set the vertex attribute pointers
         // vertex Positions
         glEnableVertexAttribArray(0);
@@ -141,7 +376,52 @@ private:
         // weights
         glEnableVertexAttribArray(6);
         glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+    }
+
+    // attribute pointers for VERTEX_LAYOUT_COMPACT, in the same order packVertices writes them
+    static void setupCompactAttributes(const VertexFormat& format)
+    {
+        GLsizei stride = format.stride();
+        size_t offset = 0;
+        glEnableVertexAttribArray(ATTRIB_POSITION);
+        glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+        offset += 3 * sizeof(float);
+        if (format.has(ATTRIB_NORMAL))
+        {
+            glEnableVertexAttribArray(ATTRIB_NORMAL);
+            glVertexAttribPointer(ATTRIB_NORMAL, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offset);
+            offset += 4;
+        }
+        if (format.has(ATTRIB_TEXCOORDS))
+        {
+            glEnableVertexAttribArray(ATTRIB_TEXCOORDS);
+            glVertexAttribPointer(ATTRIB_TEXCOORDS, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offset);
+            offset += 4;
+        }
+        if (format.has(ATTRIB_TANGENT))
+        {
+            glEnableVertexAttribArray(ATTRIB_TANGENT);
+            glVertexAttribPointer(ATTRIB_TANGENT, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offset);
+            offset += 4;
+        }
+        if (format.has(ATTRIB_BONE_IDS))
+        {
+            glEnableVertexAttribArray(ATTRIB_BONE_IDS);
+            glVertexAttribIPointer(ATTRIB_BONE_IDS, 4, GL_UNSIGNED_SHORT, stride, (void*)offset);
+            offset += 8;
+        }
+        if (format.has(ATTRIB_WEIGHTS))
+        {
+            glEnableVertexAttribArray(ATTRIB_WEIGHTS);
+            glVertexAttribPointer(ATTRIB_WEIGHTS, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offset);
+            offset += 4;
+        }
+    }
+
+    static unsigned char* write32(unsigned char* dst, std::uint32_t value)
+    {
+        std::memcpy(dst, &value, sizeof(value));
+        return dst + sizeof(value);
     }
 };
 
@@ -12,7 +12,6 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include "stb_image.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -21,117 +20,428 @@
 
 #include "Shader.h"
 #include "Mesh.h"
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma = false);
+#include "GpuProfiler.h"
+#include "InstanceBuffer.h"
+#include "ModelCache.h"
+#include "Profiler.h"
+#include "SceneGraph.h"
+#include "Skeleton.h"
+#include "TextureCache.h"
+
+// A model read into memory with nothing on the GPU yet, what Model::import produces on a worker thread
+// for the ModelLoader: the vertices already packed in the model's VertexFormat, the textures named but not acquired.
+struct ModelData
+{
+	struct MeshData
+	{
+		const unsigned char* vertices = nullptr;	// vertexCount * format.stride() bytes, in packed or in the mapped cache entry
+		const unsigned int* indices = nullptr;
+		unsigned int vertexCount = 0, indexCount = 0;
+		std::vector<unsigned char> packed;			// storage of an import; empty when the mesh is mapped from the cache
+		std::vector<unsigned int> indexStorage;
+		std::vector<Vertex> fullVertices;			// the CPU copy, only with keepGeometry
+		std::vector<Texture> textures;
+		BoundingBox bounds;
+		uint32_t node = 0;	// the node of nodes it hangs off
+
+		size_t bytes(const VertexFormat& format) const
+		{
+			return (size_t)vertexCount * format.stride() + (size_t)indexCount * sizeof(unsigned int);
+		}
+	};
+	std::vector<MeshData> meshes;
+	SceneGraph nodes;	// the aiNode hierarchy
+	Skeleton skeleton;	// node names and bones
+	MappedFile file;	// the ModelCache entry the pointers point into, if the model came from there
+};
+
 class Model
 {
 public:
 	std::vector<Mesh> meshes;
-	std::vector<Texture> textures_loaded;
+	std::vector<Texture> textures_loaded; //One entry per reference this model holds in the TextureCache
 	std::string directory;
 	bool gammaCorrection;
+	VertexFormat vertexFormat; //GPU vertex layout of every mesh, see VertexFormat::forShader
+	bool keepGeometry; //Keep Mesh::vertices/indices on the CPU after upload (collision, picking); false frees them
+	SceneGraph nodes; //The aiNode hierarchy, one node per aiNode with its mTransformation
+	std::vector<uint32_t> meshNodes; //The node each mesh hangs off: meshes[i] sits at nodes.world(meshNodes[i]) in model space
+	Skeleton skeleton; //The names of nodes and the bones Vertex::m_BoneIDs refer to, empty for a model without bones
 
-	Model(std::string const& path, bool gamma = false) : gammaCorrection(gamma) {
+	Model(std::string const& path, bool gamma = false, VertexFormat format = VertexFormat(), bool keepCpuGeometry = true)
+		: gammaCorrection(gamma), vertexFormat(format), keepGeometry(keepCpuGeometry) {
 		loadModel(path);
 	}
+	// an empty model whose meshes are added later, as the ModelLoader uploads them
+	struct Deferred {};
+	Model(Deferred, std::string const& path, bool gamma = false, VertexFormat format = VertexFormat(), bool keepCpuGeometry = true)
+		: directory(directoryOf(path)), gammaCorrection(gamma), vertexFormat(format), keepGeometry(keepCpuGeometry) {
+	}
+	~Model()
+	{
+		for (const Texture& texture : textures_loaded)
+			TextureCache::instance().release(texture.id);
+	}
+	Model(const Model&) = delete; //Copies would release the cached textures twice
+	Model& operator=(const Model&) = delete;
+
+	// textures are decoded in the background; until this returns true some of them still show the placeholder
+	bool texturesReady() const
+	{
+		for (const Texture& texture : textures_loaded)
+			if (TextureLoader::instance().isPending(texture.id))
+				return false;
+		return true;
+	}
+	// where a mesh sits in model space, see meshNodes
+	const glm::mat4& meshTransform(size_t mesh) const
+	{
+		return nodes.world(meshNodes[mesh]);
+	}
+	// the box around every mesh where its node puts it, in model space
+	BoundingBox bounds() const
+	{
+		BoundingBox box;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].bounds.empty())
+				continue;
+			BoundingBox placed = meshes[i].bounds.transformed(meshTransform(i));
+			box.expand(placed.min);
+			box.expand(placed.max);
+		}
+		return box;
+	}
+	// fetches the textures named by type and path from the TextureCache, filling in their ids
+	void acquireTextures(std::vector<Texture>& textures)
+	{
+		for (Texture& texture : textures)
+		{
+			texture.id = TextureCache::instance().acquire(this->directory + '/' + texture.path, gammaCorrection);
+			textures_loaded.push_back(texture);
+		}
+	}
+
+	// reads the model into data without touching GL, so it can run on any thread: from the ModelCache when
+	// its entry is current, otherwise through assimp, writing the entry for the next time. false when the import fails.
+	static bool import(std::string const& path, const VertexFormat& format, bool keepGeometry, ModelData& data)
+	{
+		PROFILE_ZONE("Model::import");
+		data.meshes.clear();
+		ModelCache& cache = ModelCache::instance();
+		uint64_t cacheKey = cache.key(path, IMPORT_FLAGS, format, keepGeometry);
+		std::vector<CachedMesh> cached;
+		if (cache.load(path, cacheKey, format, data.file, cached, data.nodes, data.skeleton))
+		{
+			data.meshes.resize(cached.size());
+			for (size_t i = 0; i < cached.size(); i++)
+			{
+				ModelData::MeshData& mesh = data.meshes[i];
+				mesh.vertices = cached[i].vertices;
+				mesh.indices = cached[i].indices;
+				mesh.vertexCount = cached[i].vertexCount;
+				mesh.indexCount = cached[i].indexCount;
+				if (keepGeometry && cached[i].fullVertices)
+					mesh.fullVertices.assign(cached[i].fullVertices, cached[i].fullVertices + cached[i].vertexCount);
+				mesh.textures = std::move(cached[i].textures);
+				mesh.bounds = cached[i].bounds;
+				mesh.node = cached[i].node;
+			}
+			return true;
+		}
+
+		Assimp::Importer importer;
+		const aiScene* scene = importScene(importer, path);
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+		{
+			std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << "\n";
+			return false;
+		}
+		ModelCache::Writer writer(format);
+		data.meshes.reserve(scene->mNumMeshes);
+		data.skeleton.clear();
+		importNode(scene->mRootNode, scene, hasBones(scene), format, keepGeometry, data, cacheKey ? &writer : nullptr, SceneGraph::NO_PARENT);
+		data.skeleton.resolve();
+		writer.setSkeleton(data.skeleton);
+		cache.store(path, cacheKey, writer);
+		return true;
+	}
+	// draws every mesh with the "model" uniform the caller set, not where its node puts it: for models whose
+	// meshes all sit at the root (meshTransform is the identity); Draw(shader, transform) places the others
 	void Draw(Shader &shader)
 	{
+		GPU_ZONE("Model::Draw");
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shader);
+	}
+	// draws every mesh at transform * its node's world matrix, setting the "model" uniform (Shader::setModel) per mesh
+	void Draw(Shader &shader, const glm::mat4& transform)
+	{
+		GPU_ZONE("Model::Draw");
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			shader.setModel(transform * meshTransform(i));
+			meshes[i].Draw(shader);
+		}
+	}
+	// draws a skinned model with a SHADER_SKINNED variant, the character's palette bound (BonePalettes::bind):
+	// the bones already place every mesh (see readBones), so all of them are drawn at transform
+	void DrawSkinned(Shader &shader, const glm::mat4& transform)
+	{
+		GPU_ZONE("Model::DrawSkinned");
+		shader.setModel(transform);
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
+	// draws the model once per transform with one glDrawElementsInstanced per mesh, each mesh at
+	// transform * its node's world matrix through the shader's meshTransform uniform.
+	// The shader has to read the instance attributes: a SHADER_INSTANCED variant for matrices,
+	// SHADER_INSTANCED_TRS for InstanceTRS (see ShaderLibrary).
+	void DrawInstanced(Shader &shader, const glm::mat4* transforms, unsigned int count)
+	{
+		instances.upload(transforms, count);
+		drawInstances(shader);
+	}
+	void DrawInstanced(Shader &shader, const InstanceTRS* transforms, unsigned int count)
+	{
+		instances.upload(transforms, count);
+		drawInstances(shader);
+	}
 
 private:
+	InstanceBuffer instances; //Per-instance transforms of the last DrawInstanced, shared by every mesh
 
+	void drawInstances(Shader &shader)
+	{
+		if (instances.count == 0)
+			return;
+		GLint normalLocation = shader.getUniformLocation("meshNormalMatrix");
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			shader.setMat4("meshTransform", meshTransform(i));
+			if (normalLocation >= 0)
+			{
+				glm::mat3 normal = normalMatrix(meshTransform(i));
+				glUniformMatrix3fv(normalLocation, 1, GL_FALSE, &normal[0][0]);
+			}
+			instances.attach(meshes[i].VAO);
+			meshes[i].DrawInstanced(shader, instances.count);
+		}
+		shader.setMat4("meshTransform", glm::mat4(1.0f));	// for other meshes drawn with the shader
+		shader.setMat3("meshNormalMatrix", glm::mat3(1.0f));
+	}
+
+	// the post-process steps importScene runs, part of the ModelCache key
+	static const unsigned int IMPORT_FLAGS = aiProcess_FlipUVs | aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_GenBoundingBoxes;
 
 	void loadModel(std::string const &path)
 	{
+		PROFILE_ZONE("Model::loadModel");
+		// retrieve the directory path of the filepath
+		directory = directoryOf(path);
+
+		// a current .rbmesh entry skips assimp altogether
+		ModelCache& cache = ModelCache::instance();
+		uint64_t cacheKey = cache.key(path, IMPORT_FLAGS, vertexFormat, keepGeometry);
+		if (loadCached(path, cacheKey))
+			return;
+
 		// read file via ASSIMP
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		const aiScene* scene = importScene(importer, path);
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
 			std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << "\n";
 			return;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		// process ASSIMP's root node recursively, collecting the meshes for the cache on the way
+		ModelCache::Writer writer(vertexFormat);
+		meshes.reserve(scene->mNumMeshes);
+		processNode(scene->mRootNode, scene, hasBones(scene), cacheKey ? &writer : nullptr, SceneGraph::NO_PARENT);
+		nodes.update();
+		skeleton.resolve();
+		writer.setSkeleton(skeleton);
+		cache.store(path, cacheKey, writer);
+	}
+	// builds the meshes from a mapped cache entry: the vertex and index arrays are uploaded straight out of the mapping
+	bool loadCached(std::string const &path, uint64_t cacheKey)
+	{
+		MappedFile file;
+		std::vector<CachedMesh> cached;
+		if (!ModelCache::instance().load(path, cacheKey, vertexFormat, file, cached, nodes, skeleton))
+			return false;
+		nodes.update();
+		meshes.reserve(cached.size());
+		for (CachedMesh& entry : cached)
+		{
+			acquireTextures(entry.textures);
+			meshes.emplace_back(entry.vertices, entry.vertexCount, entry.indices, entry.indexCount, std::move(entry.textures), vertexFormat, entry.bounds);
+			meshNodes.push_back(entry.node);
+			if (keepGeometry && entry.fullVertices)
+			{
+				meshes.back().vertices.assign(entry.fullVertices, entry.fullVertices + entry.vertexCount);
+				meshes.back().indices.assign(entry.indices, entry.indices + entry.indexCount);
+			}
+		}
+		return true;
+	}
+	static std::string directoryOf(std::string const& path)
+	{
+		return path.substr(0, path.find_last_of('/'));
+	}
+	// assimp's matrices are row-major, glm's column-major
+	static glm::mat4 toMat4(const aiMatrix4x4& m)
+	{
+		return glm::mat4(m.a1, m.b1, m.c1, m.d1, m.a2, m.b2, m.c2, m.d2, m.a3, m.b3, m.c3, m.d3, m.a4, m.b4, m.c4, m.d4);
+	}
+	// reads the file, then runs the post-process steps one by one, in the order ReadFile would run them, so each gets a profiler zone
+	static const aiScene* importScene(Assimp::Importer& importer, std::string const& path)
+	{
+		static const struct { unsigned int flag; const char* name; } steps[] = {
+			{ aiProcess_FlipUVs, "aiProcess_FlipUVs" },
+			{ aiProcess_Triangulate, "aiProcess_Triangulate" },
+			{ aiProcess_GenSmoothNormals, "aiProcess_GenSmoothNormals" },
+			{ aiProcess_CalcTangentSpace, "aiProcess_CalcTangentSpace" },
+			{ aiProcess_GenBoundingBoxes, "aiProcess_GenBoundingBoxes" }
+		};
+		const aiScene* scene;
+		{
+			PROFILE_ZONE("Assimp::Importer::ReadFile");
+			scene = importer.ReadFile(path, 0);
+		}
+		for (const auto& step : steps)
+		{
+			if (!scene)
+				break;
+			PROFILE_ZONE(step.name);
+			scene = importer.ApplyPostProcessing(step.flag);
+		}
+		return scene;
 	}
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode* node, const aiScene* scene)
+	// the node itself goes into nodes below parent, keeping its transformation relative to the parent node
+	void processNode(aiNode* node, const aiScene* scene, bool skinned, ModelCache::Writer* writer, uint32_t parent)
 	{
+		uint32_t index = nodes.add(toMat4(node->mTransformation), parent);
+		skeleton.nodeNames.push_back(node->mName.C_Str());
+		if (writer)
+			writer->addNode(toMat4(node->mTransformation), parent);
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			meshes.emplace_back(processMesh(mesh, scene, skinned, writer, index, node));
+			meshNodes.push_back(index);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, skinned, writer, index);
 		}
 
 	}
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+	Mesh processMesh(aiMesh* mesh, const aiScene* scene, bool skinned, ModelCache::Writer* writer, uint32_t node, const aiNode* meshNode)
 	{
-		// data to fill
 		std::vector<Vertex> vertices;
 		std::vector<unsigned int> indices;
 		std::vector<Texture> textures;
+		BoundingBox bounds = readMesh(mesh, scene, skinned, meshNode, vertices, indices, textures, skeleton);
+		if (writer)
+			writer->add(vertices, indices, textures, bounds, keepGeometry, node);
+		acquireTextures(textures);
 
-		// walk through each of the mesh's vertices
+		// return a mesh object created from the extracted mesh data, moving (not copying) the arrays into it
+		return Mesh(std::move(vertices), std::move(indices), std::move(textures), vertexFormat, keepGeometry, bounds);
+	}
+	// the same walk as processNode for import(), collecting packed meshes instead of creating GL ones
+	static void importNode(aiNode* node, const aiScene* scene, bool skinned, const VertexFormat& format, bool keepGeometry, ModelData& data, ModelCache::Writer* writer,
+		uint32_t parent)
+	{
+		uint32_t index = data.nodes.add(toMat4(node->mTransformation), parent);
+		data.skeleton.nodeNames.push_back(node->mName.C_Str());
+		if (writer)
+			writer->addNode(toMat4(node->mTransformation), parent);
+		for (unsigned int i = 0; i < node->mNumMeshes; i++)
+		{
+			data.meshes.emplace_back();
+			ModelData::MeshData& mesh = data.meshes.back();
+			mesh.node = index;
+			std::vector<Vertex> vertices;
+			mesh.bounds = readMesh(scene->mMeshes[node->mMeshes[i]], scene, skinned, node, vertices, mesh.indexStorage, mesh.textures, data.skeleton);
+			if (writer)
+				writer->add(vertices, mesh.indexStorage, mesh.textures, mesh.bounds, keepGeometry, index);
+			mesh.vertexCount = (unsigned int)vertices.size();
+			mesh.indexCount = (unsigned int)mesh.indexStorage.size();
+			mesh.packed.resize((size_t)mesh.vertexCount * format.stride());
+			Mesh::packVertices(vertices, format, mesh.packed.data());
+			mesh.vertices = mesh.packed.data();
+			mesh.indices = mesh.indexStorage.data();
+			if (keepGeometry)
+				mesh.fullVertices = std::move(vertices);
+		}
+		for (unsigned int i = 0; i < node->mNumChildren; i++)
+			importNode(node->mChildren[i], scene, skinned, format, keepGeometry, data, writer, index);
+	}
+	// converts one assimp mesh into vertices, indices and the textures its material names, adding its bones to skeleton when the
+	// model is skinned; returns its bounds
+	static BoundingBox readMesh(aiMesh* mesh, const aiScene* scene, bool skinned, const aiNode* node, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+		std::vector<Texture>& textures, Skeleton& skeleton)
+	{
+		// data to fill, sized up front so no vector ever grows; value-initialized vertices start out zeroed
+		vertices.assign(mesh->mNumVertices, Vertex());
+		indices.clear();
+		textures.clear();
+
+		// walk through each of the mesh's vertices, writing straight into the final array.
+		// assimp's vector classes don't convert to glm, so the components are copied one by one.
+		const bool hasNormals = mesh->HasNormals();
+		const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr; // does the mesh contain texture coordinates?
+		const bool hasTangents = hasTexCoords && mesh->HasTangentsAndBitangents();
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 		{
-			Vertex vertex;
-			glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
+			Vertex& vertex = vertices[i];
 			// positions
-			vector.x = mesh->mVertices[i].x;
-			vector.y = mesh->mVertices[i].y;
-			vector.z = mesh->mVertices[i].z;
-			vertex.Position = vector;
+			const aiVector3D& position = mesh->mVertices[i];
+			vertex.Position = glm::vec3(position.x, position.y, position.z);
 			// normals
-			if (mesh->HasNormals())
+			if (hasNormals)
 			{
-				vector.x = mesh->mNormals[i].x;
-				vector.y = mesh->mNormals[i].y;
-				vector.z = mesh->mNormals[i].z;
-				vertex.Normal = vector;
+				const aiVector3D& normal = mesh->mNormals[i];
+				vertex.Normal = glm::vec3(normal.x, normal.y, normal.z);
 			}
 			// texture coordinates
-			if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+			if (hasTexCoords)
 			{
-				glm::vec2 vec;
 				// a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
 				// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-				vec.x = mesh->mTextureCoords[0][i].x;
-				vec.y = mesh->mTextureCoords[0][i].y;
-				vertex.TexCoords = vec;
+				const aiVector3D& texCoords = mesh->mTextureCoords[0][i];
+				vertex.TexCoords = glm::vec2(texCoords.x, texCoords.y);
+			}
+			if (hasTangents)
+			{
 				// tangent
-				vector.x = mesh->mTangents[i].x;
-				vector.y = mesh->mTangents[i].y;
-				vector.z = mesh->mTangents[i].z;
-				vertex.Tangent = vector;
+				const aiVector3D& tangent = mesh->mTangents[i];
+				vertex.Tangent = glm::vec3(tangent.x, tangent.y, tangent.z);
 				// bitangent
-				vector.x = mesh->mBitangents[i].x;
-				vector.y = mesh->mBitangents[i].y;
-				vector.z = mesh->mBitangents[i].z;
-				vertex.Bitangent = vector;
+				const aiVector3D& bitangent = mesh->mBitangents[i];
+				vertex.Bitangent = glm::vec3(bitangent.x, bitangent.y, bitangent.z);
 			}
-			else
-				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-
-			vertices.push_back(vertex);
 		}
+		if (skinned)
+			readBones(mesh, node, vertices, skeleton);
+		// count first so the index array is allocated exactly once
+		size_t indexCount = 0;
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+			indexCount += mesh->mFaces[i].mNumIndices;
+		indices.reserve(indexCount);
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
-			for (unsigned int j = 0; j < face.mNumIndices; j++)
-				indices.push_back(face.mIndices[j]);
+			const aiFace& face = mesh->mFaces[i];
+			indices.insert(indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
 		}
 		// process materials
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -155,82 +465,90 @@ private:
 		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// bounding box from aiProcess_GenBoundingBoxes, so the mesh doesn't have to walk its vertices again
+		return BoundingBox(glm::vec3(mesh->mAABB.mMin.x, mesh->mAABB.mMin.y, mesh->mAABB.mMin.z), glm::vec3(mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z));
 	}
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-// the required info is returned as a Texture struct.
-	std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
+	// whether any mesh of the scene has bones, which makes every mesh of the model skinned
+	static bool hasBones(const aiScene* scene)
 	{
-		std::vector<Texture> textures;
-		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+			if (scene->mMeshes[i]->HasBones())
+				return true;
+		return false;
+	}
+	// the node's transformation relative to the root, from the file
+	static glm::mat4 worldOf(const aiNode* node)
+	{
+		glm::mat4 world(1.0f);
+		for (; node; node = node->mParent)
+			world = toMat4(node->mTransformation) * world;
+		return world;
+	}
+	// each aiBone lists the vertices it moves and by how much; a vertex keeps its MAX_BONE_INFLUENCE strongest bones,
+	// their weights normalized to add up to 1. The bones of a mesh place it in model space, its own node doesn't move it;
+	// vertices no bone moves get a bone following that node from where they are in the bind pose. A mesh without bones
+	// follows its node as a bone of its own, where a static draw puts it.
+	static void readBones(aiMesh* mesh, const aiNode* node, std::vector<Vertex>& vertices, Skeleton& skeleton)
+	{
+		for (unsigned int b = 0; b < mesh->mNumBones; b++)
 		{
-			aiString str;
-			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
+			const aiBone* bone = mesh->mBones[b];
+			int id = (int)skeleton.addBone(bone->mName.C_Str(), toMat4(bone->mOffsetMatrix));
+			for (unsigned int w = 0; w < bone->mNumWeights; w++)
 			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+				const aiVertexWeight& weight = bone->mWeights[w];
+				if (weight.mVertexId >= vertices.size() || weight.mWeight <= 0.0f)
+					continue;
+				// the empty slot or, with all four taken, the weakest one if this bone is stronger
+				Vertex& vertex = vertices[weight.mVertexId];
+				int slot = 0;
+				for (int i = 1; i < MAX_BONE_INFLUENCE; i++)
+					if (vertex.m_Weights[i] < vertex.m_Weights[slot])
+						slot = i;
+				if (weight.mWeight > vertex.m_Weights[slot])
 				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
+					vertex.m_BoneIDs[slot] = id;
+					vertex.m_Weights[slot] = weight.mWeight;
 				}
 			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+		}
+		int rigid = -1;
+		for (Vertex& vertex : vertices)
+		{
+			float sum = 0.0f;
+			for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+				sum += vertex.m_Weights[i];
+			if (sum > 0.0f)
+			{
+				for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+					vertex.m_Weights[i] /= sum;
+				continue;
 			}
+			if (rigid < 0)
+				rigid = (int)skeleton.addBone(node->mName.C_Str(), mesh->HasBones() ? glm::inverse(worldOf(node)) : glm::mat4(1.0f));
+			vertex.m_BoneIDs[0] = rigid;
+			vertex.m_Weights[0] = 1.0f;
 		}
-		return textures;
 	}
-};
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma)
-{
-	std::string filename = std::string(path);
-	filename = directory + '/' + filename;
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
+	// checks all material textures of a given type. They are only named here; acquireTextures later fetches them
+	// from the process-wide TextureCache, which loads each file only once no matter how many materials or models reference it.
+	// the required info is returned as a Texture struct.
+	static std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
 	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		std::vector<Texture> textures;
+		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+		{
+			aiString str;
+			mat->GetTexture(type, i, &str);
+			Texture texture;
+			texture.id = 0;
+			texture.type = typeName;
+			texture.path = str.C_Str();
+			textures.push_back(texture);
+		}
+		return textures;
 	}
-
-	return textureID;
-
-}
+};
 
 
 
@@ -0,0 +1,274 @@
+#pragma once
+#ifndef MODEL_BATCH_H
+#define MODEL_BATCH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+
+//Draws many meshes from one shared vertex buffer and one shared index buffer behind a single VAO.
+//Meshes are sub-allocated into the arena (copied GPU to GPU from their own buffers), grouped by
+//material, and every group is submitted with a single glMultiDrawElementsBaseVertex per transform
+//slot. Textures are bound once per material instead of once per mesh. A Model takes a slot per node
+//that holds meshes, so every mesh is drawn where its node puts it, as Model::Draw(shader, transform) does.
+//
+//Usage: add() every model, build() once, then Draw() each frame. The source meshes must stay alive
+//until build() has copied them; their own buffers are not touched afterwards.
+class ModelBatch
+{
+public:
+    unsigned int VAO = 0;
+    VertexFormat format;
+
+    unsigned int drawCalls = 0;     // glMultiDrawElementsBaseVertex calls in the last Draw
+    unsigned int textureBinds = 0;  // material switches in the last Draw
+
+    explicit ModelBatch(VertexFormat vertexFormat = VertexFormat()) : format(vertexFormat) {}
+    ~ModelBatch()
+    {
+        release();
+    }
+    ModelBatch(const ModelBatch&) = delete;
+    ModelBatch& operator=(const ModelBatch&) = delete;
+
+    // queues the meshes for the next build(), all at transform; returns the slot used with setTransform
+    unsigned int add(const std::vector<Mesh>& meshes, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        unsigned int slot = addSlot(transform, glm::mat4(1.0f));
+        slotCounts[slot] = 1;
+        for (const Mesh& mesh : meshes)
+            addEntry(mesh, slot);
+        return slot;
+    }
+    // the same for a model, every mesh at transform * its node's world matrix; meshes of one node share a slot
+    unsigned int add(const Model& model, const glm::mat4& transform = glm::mat4(1.0f))
+    {
+        unsigned int first = (unsigned int)transforms.size();
+        std::map<uint32_t, unsigned int> nodeSlots;
+        for (size_t i = 0; i < model.meshes.size(); i++)
+        {
+            auto it = nodeSlots.find(model.meshNodes[i]);
+            if (it == nodeSlots.end())
+                it = nodeSlots.emplace(model.meshNodes[i], addSlot(transform, model.meshTransform(i))).first;
+            addEntry(model.meshes[i], it->second);
+        }
+        if (nodeSlots.empty())
+            addSlot(transform, glm::mat4(1.0f));
+        slotCounts[first] = (unsigned int)transforms.size() - first;
+        return first;
+    }
+
+    // moves what add() put at slot: every slot of a model follows to transform * its node
+    void setTransform(unsigned int slot, const glm::mat4& transform)
+    {
+        for (unsigned int i = slot; i < slot + slotCounts[slot]; i++)
+            transforms[i] = transform * nodeTransforms[i];
+    }
+
+    // allocates the arena for everything added so far and copies the meshes into it
+    void build()
+    {
+        release();
+        GLsizeiptr stride = format.stride();
+        GLsizeiptr vertexBytes = 0, indexBytes = 0;
+        for (Entry& entry : entries)
+        {
+            entry.baseVertex = (GLint)(vertexBytes / stride);
+            entry.firstIndexByte = indexBytes;
+            vertexBytes += (GLsizeiptr)entry.mesh->vertexCount * stride;
+            indexBytes += (GLsizeiptr)entry.mesh->indexCount * sizeof(unsigned int);
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+        Mesh::setupAttributes(format);
+        glBindVertexArray(0);
+
+        // GPU to GPU copies, the CPU side of the meshes may already be freed
+        glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        for (const Entry& entry : entries)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, entry.mesh->vertexBuffer());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, (GLintptr)entry.baseVertex * stride, (GLsizeiptr)entry.mesh->vertexCount * stride);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        for (const Entry& entry : entries)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, entry.mesh->indexBuffer());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, entry.firstIndexByte, (GLsizeiptr)entry.mesh->indexCount * sizeof(unsigned int));
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        buildGroups();
+    }
+
+    void Draw(Shader& shader)
+    {
+        drawCalls = 0;
+        textureBinds = 0;
+        GLint modelLocation = shader.getUniformLocation("model");
+        GLint normalLocation = shader.getUniformLocation("normalMatrix");
+        glBindVertexArray(VAO);
+        const Material* boundMaterial = nullptr;
+        unsigned int boundSlot = ~0u;
+        for (const Group& group : groups)
+        {
+            if (group.material != boundMaterial)
+            {
+                Mesh::bindTextures(group.material->textures, group.material->samplers, shader);
+                boundMaterial = group.material;
+                textureBinds++;
+            }
+            if (group.slot != boundSlot)
+            {
+                glUniformMatrix4fv(modelLocation, 1, GL_FALSE, &transforms[group.slot][0][0]);
+                if (normalLocation >= 0)
+                {
+                    glm::mat3 normal = normalMatrix(transforms[group.slot]);
+                    glUniformMatrix3fv(normalLocation, 1, GL_FALSE, &normal[0][0]);
+                }
+                boundSlot = group.slot;
+            }
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, group.counts.data(), GL_UNSIGNED_INT, group.offsets.data(),
+                (GLsizei)group.counts.size(), group.baseVertices.data());
+            drawCalls++;
+        }
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    size_t meshCount() const
+    {
+        return entries.size();
+    }
+
+private:
+    struct Entry
+    {
+        const Mesh* mesh = nullptr;
+        unsigned int slot = 0;
+        GLint baseVertex = 0;
+        GLintptr firstIndexByte = 0;
+    };
+    struct Material
+    {
+        std::vector<Texture> textures;
+        std::vector<std::string> samplers;
+    };
+    // one multi-draw: every mesh of one material under one transform
+    struct Group
+    {
+        const Material* material = nullptr;
+        unsigned int slot = 0;
+        std::vector<GLsizei> counts;
+        std::vector<const void*> offsets;
+        std::vector<GLint> baseVertices;
+    };
+
+    unsigned int VBO = 0, EBO = 0;
+    std::vector<Entry> entries;
+    std::vector<glm::mat4> transforms;      // per slot, what Draw sets as "model"
+    std::vector<glm::mat4> nodeTransforms;  // per slot, where its meshes sit in their model
+    std::vector<unsigned int> slotCounts;   // per slot add() returned, how many slots from it on setTransform moves; 0 for the rest
+    std::vector<Material> materials;
+    std::vector<Group> groups;
+
+    unsigned int addSlot(const glm::mat4& transform, const glm::mat4& node)
+    {
+        transforms.push_back(transform * node);
+        nodeTransforms.push_back(node);
+        slotCounts.push_back(0);
+        return (unsigned int)transforms.size() - 1;
+    }
+    void addEntry(const Mesh& mesh, unsigned int slot)
+    {
+        if (mesh.format.layout != format.layout || mesh.format.attributes != format.attributes)
+        {
+            std::cout << "ERROR::MODEL_BATCH::VERTEX_FORMAT_MISMATCH" << std::endl;
+            return;
+        }
+        Entry entry;
+        entry.mesh = &mesh;
+        entry.slot = slot;
+        entries.push_back(entry);
+    }
+
+    void buildGroups()
+    {
+        // meshes with the same texture set share a material
+        std::map<std::vector<unsigned int>, size_t> materialIndex;
+        std::vector<size_t> entryMaterial(entries.size());
+        materials.clear();
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            std::vector<unsigned int> key;
+            for (const Texture& texture : entries[i].mesh->textures)
+                key.push_back(texture.id);
+            auto it = materialIndex.find(key);
+            if (it == materialIndex.end())
+            {
+                it = materialIndex.emplace(key, materials.size()).first;
+                Material material;
+                material.textures = entries[i].mesh->textures;
+                material.samplers = entries[i].mesh->samplers;
+                materials.push_back(material);
+            }
+            entryMaterial[i] = it->second;
+        }
+
+        // material-major order, so each material is bound once and only the transform changes inside it
+        std::map<std::pair<size_t, unsigned int>, size_t> groupIndex;
+        groups.clear();
+        std::vector<size_t> order(entries.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return entryMaterial[a] != entryMaterial[b] ? entryMaterial[a] < entryMaterial[b] : entries[a].slot < entries[b].slot;
+        });
+        for (size_t i : order)
+        {
+            const Entry& entry = entries[i];
+            std::pair<size_t, unsigned int> key(entryMaterial[i], entry.slot);
+            auto it = groupIndex.find(key);
+            if (it == groupIndex.end())
+            {
+                it = groupIndex.emplace(key, groups.size()).first;
+                Group group;
+                group.material = &materials[entryMaterial[i]];
+                group.slot = entry.slot;
+                groups.push_back(group);
+            }
+            Group& group = groups[it->second];
+            group.counts.push_back((GLsizei)entry.mesh->indexCount);
+            group.offsets.push_back((const void*)entry.firstIndexByte);
+            group.baseVertices.push_back(entry.baseVertex);
+        }
+    }
+
+    void release()
+    {
+        if (VAO)
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+            VAO = VBO = EBO = 0;
+        }
+    }
+};
+
+#endif
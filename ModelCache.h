@@ -0,0 +1,389 @@
+#pragma once
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Bounds.h"
+#include "MappedFile.h"
+#include "Mesh.h"
+#include "Profiler.h"
+#include "SceneGraph.h"
+#include "Skeleton.h"
+
+// One mesh of a cached model, pointing into the mapped file: the vertices are already in the
+// model's VertexFormat, so they go to glBufferData as they are.
+struct CachedMesh
+{
+    const unsigned char* vertices = nullptr;    // vertexCount * format.stride() bytes
+    const unsigned int* indices = nullptr;
+    const Vertex* fullVertices = nullptr;       // the CPU copy, only in entries written for keepGeometry
+    unsigned int vertexCount = 0, indexCount = 0;
+    uint32_t node = 0;                          // the node of the model's SceneGraph the mesh hangs off
+    BoundingBox bounds;
+    std::vector<Texture> textures;              // type and path; the ids are acquired by the Model
+};
+
+//On-disk cache of imported models, one .rbmesh file per source file. Model::loadModel writes it after
+//an assimp import, and later launches map it and upload the meshes without running assimp at all.
+//
+//An entry is keyed by a hash of the source file's contents, the assimp post-process flags, the vertex
+//format and whether the CPU geometry is kept; a file whose key, magic or version doesn't match is
+//ignored and rewritten after the next import. Only the source file itself is hashed, so an edited
+//.mtl needs the entry cleared (or the .obj touched in content) to be picked up.
+//
+//The file is a header, tables of MeshRecords, NodeRecords (the aiNode hierarchy), BoneRecords and
+//TextureRecords, a string table and then the vertex, index and full-vertex arrays, each aligned to 16 bytes.
+class ModelCache
+{
+    // the file layout, written and read as is
+    struct Header
+    {
+        char magic[4] = { 0, 0, 0, 0 };
+        uint32_t version = VERSION;
+        uint64_t key = 0;
+        uint32_t layout = 0, attributes = 0, stride = 0;
+        uint32_t meshCount = 0, nodeCount = 0, boneCount = 0, textureCount = 0, stringBytes = 0;
+        uint64_t vertexSection = 0, indexSection = 0, fullVertexSection = 0;
+        uint64_t fileBytes = 0;
+    };
+    struct MeshRecord
+    {
+        uint64_t vertexOffset, indexOffset, fullVertexOffset;   // within their sections
+        uint32_t vertexCount, indexCount;
+        uint32_t firstTexture, textureCount;
+        uint32_t node;
+        glm::vec3 boundsMin, boundsMax;
+    };
+    struct NodeRecord
+    {
+        uint32_t parent;    // SceneGraph::NO_PARENT for the root; always before the node itself
+        uint32_t nameOffset;
+        glm::mat4 local;
+    };
+    struct BoneRecord
+    {
+        uint32_t nameOffset, node;
+        glm::mat4 offset;
+    };
+    struct TextureRecord
+    {
+        uint32_t typeOffset, pathOffset;    // into the string table
+    };
+
+public:
+    static ModelCache& instance()
+    {
+        static ModelCache cache;
+        return cache;
+    }
+
+    // atomic, as the ModelLoader loads models on worker threads
+    struct Stats
+    {
+        std::atomic<unsigned int> hits{ 0 }, misses{ 0 }, stored{ 0 };
+    };
+    Stats stats;
+    bool enabled = true;
+
+    void setDirectory(const std::string& cacheDirectory)
+    {
+        directory = cacheDirectory;
+    }
+
+    // 0 when the source can't be read (the model then loads without the cache)
+    uint64_t key(const std::string& sourcePath, unsigned int importFlags, const VertexFormat& format, bool keepGeometry) const
+    {
+        if (!enabled)
+            return 0;
+        MappedFile source;
+        if (!source.open(sourcePath))
+            return 0;
+        uint64_t hash = 14695981039346656037ull;
+        const unsigned char* bytes = source.data();
+        for (size_t i = 0; i < source.size(); i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        uint32_t settings[4] = { importFlags, (uint32_t)format.layout, format.attributes, keepGeometry ? 1u : 0u };
+        for (uint32_t setting : settings)
+            hash = (hash ^ setting) * 1099511628211ull;
+        return hash == 0 ? 1 : hash;
+    }
+
+    // maps the entry for sourcePath, fills meshes with pointers into file, nodes with the hierarchy and skeleton with
+    // its names and bones; false on a miss
+    bool load(const std::string& sourcePath, uint64_t key, const VertexFormat& format, MappedFile& file, std::vector<CachedMesh>& meshes, SceneGraph& nodes,
+        Skeleton& skeleton)
+    {
+        PROFILE_ZONE("ModelCache::load");
+        meshes.clear();
+        nodes.clear();
+        skeleton.clear();
+        if (key == 0 || !file.open(path(sourcePath)) || !parse(file, key, format, meshes, nodes, skeleton))
+        {
+            file.close();
+            meshes.clear();
+            nodes.clear();
+            skeleton.clear();
+            stats.misses++;
+            return false;
+        }
+        stats.hits++;
+        return true;
+    }
+
+    // Collects the meshes of an import and writes them as one entry
+    class Writer
+    {
+    public:
+        explicit Writer(const VertexFormat& format) : format(format) {}
+
+        // a node of the hierarchy, in the order the model's SceneGraph adds them; returns its index
+        uint32_t addNode(const glm::mat4& local, uint32_t parent)
+        {
+            nodeRecords.push_back(NodeRecord{ parent, 0, local });
+            return (uint32_t)nodeRecords.size() - 1;
+        }
+
+        // the node names and bones, once the import has added every node and resolved the skeleton
+        void setSkeleton(const Skeleton& skeleton)
+        {
+            for (size_t node = 0; node < nodeRecords.size() && node < skeleton.nodeNames.size(); node++)
+                nodeRecords[node].nameOffset = addString(skeleton.nodeNames[node]);
+            boneRecords.clear();
+            for (uint32_t bone = 0; bone < skeleton.boneCount(); bone++)
+                boneRecords.push_back(BoneRecord{ addString(skeleton.boneNames[bone]), skeleton.boneNodes[bone], skeleton.offsets[bone] });
+        }
+
+        // packs the vertices into the format the model uploads, so a warm start has nothing left to convert
+        void add(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<Texture>& textures, const BoundingBox& bounds, bool keepGeometry,
+            uint32_t node)
+        {
+            MeshRecord record = {};
+            record.node = node;
+            record.vertexCount = (uint32_t)vertices.size();
+            record.indexCount = (uint32_t)indices.size();
+            record.firstTexture = (uint32_t)textureRecords.size();
+            record.textureCount = (uint32_t)textures.size();
+            record.boundsMin = bounds.min;
+            record.boundsMax = bounds.max;
+            record.vertexOffset = append(vertexData, nullptr, (size_t)record.vertexCount * format.stride());
+            Mesh::packVertices(vertices, format, vertexData.data() + record.vertexOffset);
+            record.indexOffset = append(indexData, indices.data(), indices.size() * sizeof(unsigned int));
+            record.fullVertexOffset = keepGeometry ? append(fullVertexData, vertices.data(), vertices.size() * sizeof(Vertex)) : 0;
+            records.push_back(record);
+            for (const Texture& texture : textures)
+            {
+                TextureRecord textureRecord;
+                textureRecord.typeOffset = addString(texture.type);
+                textureRecord.pathOffset = addString(texture.path);
+                textureRecords.push_back(textureRecord);
+            }
+        }
+
+    private:
+        friend class ModelCache;
+        VertexFormat format;
+        std::vector<MeshRecord> records;
+        std::vector<NodeRecord> nodeRecords;
+        std::vector<BoneRecord> boneRecords;
+        std::vector<TextureRecord> textureRecords;
+        std::vector<char> strings;
+        std::vector<unsigned char> vertexData, indexData, fullVertexData;
+
+        static uint64_t append(std::vector<unsigned char>& section, const void* data, size_t bytes)
+        {
+            size_t offset = alignUp(section.size());
+            section.resize(offset + bytes);
+            if (data && bytes)
+                std::memcpy(section.data() + offset, data, bytes);
+            return offset;
+        }
+        uint32_t addString(const std::string& text)
+        {
+            uint32_t offset = (uint32_t)strings.size();
+            strings.insert(strings.end(), text.c_str(), text.c_str() + text.size() + 1);
+            return offset;
+        }
+    };
+
+    void store(const std::string& sourcePath, uint64_t key, const Writer& writer)
+    {
+        PROFILE_ZONE("ModelCache::store");
+        if (key == 0)
+            return;
+        Header header;
+        std::memcpy(header.magic, MAGIC, 4);
+        header.key = key;
+        header.layout = (uint32_t)writer.format.layout;
+        header.attributes = writer.format.attributes;
+        header.stride = writer.format.stride();
+        header.meshCount = (uint32_t)writer.records.size();
+        header.nodeCount = (uint32_t)writer.nodeRecords.size();
+        header.boneCount = (uint32_t)writer.boneRecords.size();
+        header.textureCount = (uint32_t)writer.textureRecords.size();
+        header.stringBytes = (uint32_t)writer.strings.size();
+        uint64_t tables = sizeof(Header) + writer.records.size() * sizeof(MeshRecord) + writer.nodeRecords.size() * sizeof(NodeRecord)
+            + writer.boneRecords.size() * sizeof(BoneRecord) + writer.textureRecords.size() * sizeof(TextureRecord) + writer.strings.size();
+        header.vertexSection = alignUp(tables);
+        header.indexSection = alignUp(header.vertexSection + writer.vertexData.size());
+        header.fullVertexSection = alignUp(header.indexSection + writer.indexData.size());
+        header.fileBytes = header.fullVertexSection + writer.fullVertexData.size();
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        // written next to the final name and renamed, so a crash never leaves a truncated entry behind
+        std::string target = path(sourcePath), temporary = target + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write((const char*)&header, sizeof(header));
+            file.write((const char*)writer.records.data(), writer.records.size() * sizeof(MeshRecord));
+            file.write((const char*)writer.nodeRecords.data(), writer.nodeRecords.size() * sizeof(NodeRecord));
+            file.write((const char*)writer.boneRecords.data(), writer.boneRecords.size() * sizeof(BoneRecord));
+            file.write((const char*)writer.textureRecords.data(), writer.textureRecords.size() * sizeof(TextureRecord));
+            file.write(writer.strings.data(), writer.strings.size());
+            pad(file, header.vertexSection);
+            file.write((const char*)writer.vertexData.data(), writer.vertexData.size());
+            pad(file, header.indexSection);
+            file.write((const char*)writer.indexData.data(), writer.indexData.size());
+            pad(file, header.fullVertexSection);
+            file.write((const char*)writer.fullVertexData.data(), writer.fullVertexData.size());
+            if (!file)
+            {
+                std::cout << "ERROR::MODEL_CACHE::WRITE_FAILED " << temporary << std::endl;
+                return;
+            }
+        }
+        std::filesystem::rename(temporary, target, error);
+        if (!error)
+            stats.stored++;
+    }
+
+    // deletes every entry, e.g. to measure a cold start
+    void clear()
+    {
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        {
+            if (entry.path().extension() == ".rbmesh")
+                std::filesystem::remove(entry.path(), error);
+        }
+    }
+
+    // the entry of a source file: named by a hash of its path, the key inside says whether it is current
+    std::string path(const std::string& sourcePath) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : sourcePath)
+            hash = (hash ^ c) * 1099511628211ull;
+        std::string stem = std::filesystem::path(sourcePath).stem().string();
+        char name[32];
+        std::snprintf(name, sizeof(name), "-%016llx.rbmesh", (unsigned long long)hash);
+        return directory + "/" + stem + name;
+    }
+
+private:
+    static constexpr const char* MAGIC = "RBMS";
+    static const uint32_t VERSION = 4;
+
+    std::string directory = "./model-cache";
+
+    ModelCache() = default;
+
+    static uint64_t alignUp(uint64_t offset)
+    {
+        return (offset + 15) & ~(uint64_t)15;
+    }
+    static void pad(std::ofstream& file, uint64_t offset)
+    {
+        static const char zeros[16] = {};
+        uint64_t position = (uint64_t)file.tellp();
+        if (offset > position)
+            file.write(zeros, (std::streamsize)(offset - position));
+    }
+
+    // checks every size against the mapping before handing out a pointer, so a damaged file is only a miss
+    static bool parse(const MappedFile& file, uint64_t key, const VertexFormat& format, std::vector<CachedMesh>& meshes, SceneGraph& nodes, Skeleton& skeleton)
+    {
+        const unsigned char* base = file.data();
+        if (file.size() < sizeof(Header))
+            return false;
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION || header.key != key || header.fileBytes != file.size()
+            || header.layout != (uint32_t)format.layout || header.attributes != format.attributes || header.stride != format.stride())
+            return false;
+        uint64_t tables = sizeof(Header) + (uint64_t)header.meshCount * sizeof(MeshRecord) + (uint64_t)header.nodeCount * sizeof(NodeRecord)
+            + (uint64_t)header.boneCount * sizeof(BoneRecord) + (uint64_t)header.textureCount * sizeof(TextureRecord);
+        if (tables + header.stringBytes > header.vertexSection || header.vertexSection > header.indexSection
+            || header.indexSection > header.fullVertexSection || header.fullVertexSection > header.fileBytes)
+            return false;
+        const MeshRecord* records = (const MeshRecord*)(base + sizeof(Header));
+        const NodeRecord* nodeRecords = (const NodeRecord*)(records + header.meshCount);
+        const BoneRecord* boneRecords = (const BoneRecord*)(nodeRecords + header.nodeCount);
+        const TextureRecord* textures = (const TextureRecord*)(boneRecords + header.boneCount);
+        const char* strings = (const char*)(textures + header.textureCount);
+        if (header.stringBytes > 0 && strings[header.stringBytes - 1] != '\0')
+            return false;
+
+        nodes.reserve(header.nodeCount);
+        for (uint32_t i = 0; i < header.nodeCount; i++)
+        {
+            if ((nodeRecords[i].parent != SceneGraph::NO_PARENT && nodeRecords[i].parent >= i) || nodeRecords[i].nameOffset >= std::max(header.stringBytes, 1u))
+                return false;
+            nodes.add(nodeRecords[i].local, nodeRecords[i].parent);
+            skeleton.nodeNames.push_back(header.stringBytes > 0 ? strings + nodeRecords[i].nameOffset : "");
+        }
+        for (uint32_t i = 0; i < header.boneCount; i++)
+        {
+            if (boneRecords[i].nameOffset >= header.stringBytes || boneRecords[i].node >= header.nodeCount)
+                return false;
+            skeleton.boneNames.push_back(strings + boneRecords[i].nameOffset);
+            skeleton.offsets.push_back(boneRecords[i].offset);
+            skeleton.boneNodes.push_back(boneRecords[i].node);
+        }
+        meshes.resize(header.meshCount);
+        for (uint32_t i = 0; i < header.meshCount; i++)
+        {
+            const MeshRecord& record = records[i];
+            CachedMesh& mesh = meshes[i];
+            uint64_t vertexBytes = (uint64_t)record.vertexCount * header.stride, indexBytes = (uint64_t)record.indexCount * sizeof(unsigned int);
+            if (header.vertexSection + record.vertexOffset + vertexBytes > header.indexSection
+                || header.indexSection + record.indexOffset + indexBytes > header.fullVertexSection
+                || (uint64_t)record.firstTexture + record.textureCount > header.textureCount || record.node >= header.nodeCount)
+                return false;
+            mesh.vertices = base + header.vertexSection + record.vertexOffset;
+            mesh.indices = (const unsigned int*)(base + header.indexSection + record.indexOffset);
+            mesh.vertexCount = record.vertexCount;
+            mesh.indexCount = record.indexCount;
+            mesh.node = record.node;
+            if (header.fullVertexSection < header.fileBytes)
+            {
+                if (header.fullVertexSection + record.fullVertexOffset + (uint64_t)record.vertexCount * sizeof(Vertex) > header.fileBytes)
+                    return false;
+                mesh.fullVertices = (const Vertex*)(base + header.fullVertexSection + record.fullVertexOffset);
+            }
+            mesh.bounds = BoundingBox(record.boundsMin, record.boundsMax);
+            for (uint32_t t = record.firstTexture; t < record.firstTexture + record.textureCount; t++)
+            {
+                if (textures[t].typeOffset >= header.stringBytes || textures[t].pathOffset >= header.stringBytes)
+                    return false;
+                Texture texture;
+                texture.id = 0;
+                texture.type = strings + textures[t].typeOffset;
+                texture.path = strings + textures[t].pathOffset;
+                mesh.textures.push_back(texture);
+            }
+        }
+        return true;
+    }
+};
+
+#endif
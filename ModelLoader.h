@@ -0,0 +1,382 @@
+#pragma once
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Model.h"
+#include "ModelCache.h"
+#include "Profiler.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+// where an asset of the ModelLoader is
+enum ModelState
+{
+    MODEL_UNKNOWN,          // not a handle of the loader, or released
+    MODEL_QUEUED,           // waiting for or in its import on a worker
+    MODEL_CPU_READY,        // imported; its meshes are on their way to the GPU, model() has the ones that arrived
+    MODEL_GPU_RESIDENT,     // every mesh uploaded
+    MODEL_FAILED            // the import failed, see the ERROR:: output
+};
+
+typedef uint32_t ModelHandle;   // 0 is no model
+
+//Asynchronous model loading. load() returns a handle right away; the import (assimp, or the mapped
+//ModelCache entry) and the packing of the vertices into the model's VertexFormat run on worker
+//threads, and the GL thread copies the meshes into their buffers in pump(), which the render loop
+//calls once per frame. A model moves from MODEL_QUEUED to MODEL_CPU_READY when its import arrives
+//and to MODEL_GPU_RESIDENT with its last mesh; in between, model() already has the finished meshes.
+//
+//The copies go through a staging ring: one buffer that pump() writes with unsynchronized maps and
+//copies into the mesh buffers with glCopyBufferSubData. A fence after each pump's copies says when
+//that part of the ring may be written again, and pump() never waits for one: with the ring still in
+//use it leaves the rest for the next frame. At most uploadBudget bytes go through per pump(), large
+//meshes split over several, so streaming a model in costs each frame about the same.
+//
+//   ModelHandle ball = ModelLoader::instance().load("./models/beach-ball/beachBall.obj");
+//   ...every frame: ModelLoader::instance().pump();
+//   if (ModelLoader::instance().state(ball) == MODEL_GPU_RESIDENT) ...draw ModelLoader::instance().model(ball)
+//
+//The textures are acquired from the TextureCache as the import arrives and stream in through the
+//TextureLoader and its own budget.
+class ModelLoader
+{
+public:
+    size_t uploadBudget = 4 << 20;  // bytes of vertex and index data per pump()
+
+    // of the last pump()
+    struct Stats
+    {
+        size_t uploadedBytes = 0;
+        unsigned int copies = 0;        // glCopyBufferSubData calls
+        bool ringFull = false;          // stopped early because the GPU still reads the staging ring
+    };
+    Stats stats;
+
+    explicit ModelLoader(unsigned int threads = 0, size_t stagingBytes = 8 << 20)
+        : ringBytes((stagingBytes + 15) & ~(size_t)15)
+    {
+        // the singletons used by the workers and by the models, constructed first so that they outlive the loader at exit
+        ModelCache::instance();
+        TextureCache::instance();
+        pool.reset(new ThreadPool(threads));
+    }
+    ~ModelLoader()
+    {
+        pool->wait();
+    }
+    ModelLoader(const ModelLoader&) = delete;
+    ModelLoader& operator=(const ModelLoader&) = delete;
+
+    static ModelLoader& instance()
+    {
+        static ModelLoader loader;
+        return loader;
+    }
+
+    // GL thread: queues the import and returns its handle; the arguments are Model's
+    ModelHandle load(const std::string& path, bool gamma = false, VertexFormat format = VertexFormat(), bool keepCpuGeometry = true)
+    {
+        ModelHandle handle = ++lastHandle;
+        Asset& asset = assets[handle];
+        asset.path = path;
+        asset.gamma = gamma;
+        asset.format = format;
+        asset.keepGeometry = keepCpuGeometry;
+        pool->submit([this, handle, path, format, keepCpuGeometry]() {
+            PROFILE_ZONE("ModelLoader::import");
+            Imported result;
+            result.handle = handle;
+            result.data.reset(new ModelData());
+            if (!Model::import(path, format, keepCpuGeometry, *result.data))
+                result.data.reset();
+            imported.push(std::move(result));
+        });
+        return handle;
+    }
+
+    // GL thread: drops the model; an import still in flight for it is discarded on arrival
+    void release(ModelHandle handle)
+    {
+        uploading.erase(std::remove(uploading.begin(), uploading.end(), handle), uploading.end());
+        assets.erase(handle);
+    }
+
+    ModelState state(ModelHandle handle) const
+    {
+        auto it = assets.find(handle);
+        return it == assets.end() ? MODEL_UNKNOWN : it->second.state;
+    }
+
+    // the model with the meshes uploaded so far; null until its import arrived
+    Model* model(ModelHandle handle)
+    {
+        auto it = assets.find(handle);
+        return it == assets.end() ? nullptr : it->second.model.get();
+    }
+
+    // GL thread: takes the imports that arrived and copies up to uploadBudget bytes of their meshes;
+    // returns how many models became resident
+    unsigned int pump()
+    {
+        PROFILE_ZONE("ModelLoader::pump");
+        Imported result;
+        while (imported.pop(result))
+            arrive(result);
+
+        stats = Stats();
+        retire();
+        unsigned int resident = 0;
+        size_t spent = 0, staged = 0;
+        while (!uploading.empty() && spent < uploadBudget)
+        {
+            Asset& asset = assets[uploading.front()];
+            if (asset.nextMesh == asset.data->meshes.size())
+            {
+                asset.state = MODEL_GPU_RESIDENT;
+                asset.data.reset();     // unmaps the cache entry, or frees the import
+                uploading.pop_front();
+                resident++;
+                continue;
+            }
+            ModelData::MeshData& source = asset.data->meshes[asset.nextMesh];
+            if (!asset.mesh)
+                asset.mesh.reset(new Mesh(nullptr, source.vertexCount, nullptr, source.indexCount, source.textures, asset.format, source.bounds));
+            size_t vertexBytes = (size_t)source.vertexCount * asset.format.stride();
+            size_t totalBytes = source.bytes(asset.format);
+            if (asset.copied < totalBytes)
+            {
+                // the vertices first, then the indices, each in as many pieces as the budget and the ring allow
+                bool vertexPart = asset.copied < vertexBytes;
+                size_t partEnd = vertexPart ? vertexBytes : totalBytes;
+                size_t offset = 0, waste = 0;
+                size_t bytes = reserve(std::min(partEnd - asset.copied, uploadBudget - spent), offset, waste);
+                if (bytes == 0)
+                {
+                    stats.ringFull = true;
+                    break;
+                }
+                const unsigned char* data = vertexPart ? source.vertices + asset.copied
+                    : (const unsigned char*)source.indices + (asset.copied - vertexBytes);
+                copy(data, bytes, offset, vertexPart ? asset.mesh->vertexBuffer() : asset.mesh->indexBuffer(),
+                    vertexPart ? asset.copied : asset.copied - vertexBytes);
+                asset.copied += bytes;
+                spent += bytes;
+                staged += waste + alignUp(bytes);
+            }
+            if (asset.copied == totalBytes)
+            {
+                Mesh& mesh = *asset.mesh;
+                if (asset.keepGeometry)
+                {
+                    mesh.vertices = std::move(source.fullVertices);
+                    mesh.indices.assign(source.indices, source.indices + source.indexCount);
+                }
+                asset.model->meshes.push_back(std::move(mesh));
+                asset.model->meshNodes.push_back(source.node);
+                asset.mesh.reset();
+                asset.nextMesh++;
+                asset.copied = 0;
+            }
+        }
+        if (staged > 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            fences.push_back(Fence{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), staged });
+        }
+        stats.uploadedBytes = spent;
+        return resident;
+    }
+
+    // GL thread: blocks until every queued model is resident or failed
+    void finish()
+    {
+        while (!uploading.empty() || queuedCount() > 0)
+        {
+            if (pump() == 0 && stats.uploadedBytes == 0)
+                std::this_thread::yield();
+        }
+    }
+
+    // models still waiting for their import
+    size_t queuedCount() const
+    {
+        size_t count = 0;
+        for (const auto& entry : assets)
+            count += entry.second.state == MODEL_QUEUED ? 1 : 0;
+        return count;
+    }
+
+    // models imported but not yet resident
+    size_t uploadingCount() const
+    {
+        return uploading.size();
+    }
+
+    // drops every model and deletes the staging ring; call while the GL context is still current
+    void destroy()
+    {
+        pool->wait();
+        Imported result;
+        while (imported.pop(result))
+            ;
+        assets.clear();
+        uploading.clear();
+        for (const Fence& fence : fences)
+            glDeleteSync(fence.sync);
+        fences.clear();
+        if (ring)
+            glDeleteBuffers(1, &ring);
+        ring = 0;
+        head = used = 0;
+    }
+
+private:
+    struct Asset
+    {
+        ModelState state = MODEL_QUEUED;
+        std::string path;
+        bool gamma = false;
+        VertexFormat format;
+        bool keepGeometry = true;
+        std::unique_ptr<Model> model;
+        std::unique_ptr<ModelData> data;
+        std::unique_ptr<Mesh> mesh;     // the mesh being copied, moved into the model once complete
+        size_t nextMesh = 0;
+        size_t copied = 0;              // bytes of that mesh, vertices then indices
+    };
+    struct Imported
+    {
+        ModelHandle handle = 0;
+        std::unique_ptr<ModelData> data;    // null when the import failed
+    };
+    struct Fence
+    {
+        GLsync sync;
+        size_t bytes;   // of the ring, freed when the fence signals
+    };
+
+    std::unique_ptr<ThreadPool> pool;
+    MpscQueue<Imported> imported;
+    std::unordered_map<ModelHandle, Asset> assets;
+    std::deque<ModelHandle> uploading;     // imported, in the order they arrived; the front one is copied first
+    ModelHandle lastHandle = 0;
+
+    // the staging ring: [head - used, head) modulo ringBytes is still read by copies in flight
+    unsigned int ring = 0;
+    size_t ringBytes;
+    size_t head = 0, used = 0;
+    std::deque<Fence> fences;
+
+    static size_t alignUp(size_t bytes)
+    {
+        return (bytes + 15) & ~(size_t)15;
+    }
+
+    void arrive(Imported& result)
+    {
+        auto it = assets.find(result.handle);
+        if (it == assets.end())
+            return;     // released while importing
+        Asset& asset = it->second;
+        if (!result.data)
+        {
+            asset.state = MODEL_FAILED;
+            return;
+        }
+        asset.model.reset(new Model(Model::Deferred(), asset.path, asset.gamma, asset.format, asset.keepGeometry));
+        asset.model->nodes = result.data->nodes;
+        asset.model->nodes.update();
+        asset.model->skeleton = std::move(result.data->skeleton);
+        asset.model->meshes.reserve(result.data->meshes.size());
+        asset.model->meshNodes.reserve(result.data->meshes.size());
+        for (ModelData::MeshData& mesh : result.data->meshes)
+            asset.model->acquireTextures(mesh.textures);
+        asset.data = std::move(result.data);
+        asset.state = MODEL_CPU_READY;
+        uploading.push_back(result.handle);
+    }
+
+    // frees the parts of the ring whose copies the GPU has finished, oldest first
+    void retire()
+    {
+        while (!fences.empty())
+        {
+            GLenum status = glClientWaitSync(fences.front().sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(fences.front().sync);
+            used -= fences.front().bytes;
+            fences.pop_front();
+        }
+        if (used == 0)
+            head = 0;
+    }
+
+    // up to wanted bytes of free ring in one piece, 0 when it is all in use; waste is what was skipped at the end to wrap around
+    size_t reserve(size_t wanted, size_t& offset, size_t& waste)
+    {
+        if (!ring)
+        {
+            glGenBuffers(1, &ring);
+            glBindBuffer(GL_COPY_READ_BUFFER, ring);
+            glBufferData(GL_COPY_READ_BUFFER, (GLsizeiptr)ringBytes, NULL, GL_STREAM_DRAW);
+        }
+        waste = 0;
+        if (used == ringBytes || wanted == 0)
+            return 0;
+        size_t tail = (head + ringBytes - used) % ringBytes;
+        size_t free;
+        if (head >= tail)
+        {   // free are [head, ringBytes) and [0, tail): wrap when the start holds more than the end
+            free = ringBytes - head;
+            if (free < wanted && tail > free)
+            {
+                waste = free;
+                used += waste;
+                head = 0;
+                free = tail;
+            }
+        }
+        else
+            free = tail - head;
+        size_t bytes = std::min(wanted, free);
+        offset = head;
+        head = (head + alignUp(bytes)) % ringBytes;
+        used += alignUp(bytes);
+        return bytes;
+    }
+
+    // writes data into the ring at offset and has the GPU copy it to target at targetOffset
+    void copy(const void* data, size_t bytes, size_t offset, unsigned int target, size_t targetOffset)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, ring);
+        void* mapped = glMapBufferRange(GL_COPY_READ_BUFFER, (GLintptr)offset, (GLsizeiptr)bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (!mapped)
+        {
+            std::cout << "ERROR::MODEL_LOADER::STAGING_MAP_FAILED" << std::endl;
+            return;
+        }
+        std::memcpy(mapped, data, bytes);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)offset, (GLintptr)targetOffset, (GLsizeiptr)bytes);
+        stats.copies++;
+    }
+};
+
+#endif
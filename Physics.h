@@ -0,0 +1,314 @@
+#pragma once
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Broadphase.h"
+#include "Bvh.h"
+#include "Profiler.h"
+#include "Simd.h"
+
+//Rigid spheres on a ground plane, stepped at a fixed rate no matter how fast frames are rendered.
+//update() adds the frame time to an accumulator and runs as many fixed steps as fit; transform()
+//blends the last two steps by the leftover fraction so motion stays smooth between steps.
+//
+//Bodies live in structure-of-arrays form, and the per-body parts of a step (velocity, position,
+//ground contact, rolling, orientation) run SimdFloat::WIDTH bodies at a time. Spheres touching the
+//ground roll without slipping: their angular velocity follows from the velocity at the contact
+//point being zero. Sphere-sphere contacts come from a BroadphaseGrid that is updated every step, and
+//are resolved in its sorted pair order with an impulse and a positional correction. An optional
+//level MeshBvh adds static triangles, which push overlapping spheres out along the contact normal.
+class PhysicsWorld
+{
+public:
+    float fixedStep = 1.0f / 120.0f;
+    unsigned int maxStepsPerUpdate = 8;     // drop time instead of spiralling when a frame takes too long
+    glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+    float groundHeight = 0.0f;
+    float restitution = 0.4f;           // bounce, for the ground and between spheres
+    float rollingResistance = 0.3f;     // fraction of rolling speed lost per second on the ground
+    float airDrag = 0.05f;              // fraction of speed lost per second everywhere
+    bool sphereContacts = true;         // off leaves only the ground, e.g. for particles that may overlap
+    const MeshBvh* level = nullptr;     // static triangles to collide with besides the ground, e.g. a level model
+
+    // null runs the parallel parts on ThreadPool::shared(), created on first use
+    explicit PhysicsWorld(ThreadPool* pool = nullptr) : pool(pool), broadphase(pool) {}
+
+    // of the last update()
+    struct Stats
+    {
+        unsigned int steps = 0;
+        unsigned int contactPairs = 0;
+        unsigned int levelContacts = 0;
+    };
+    Stats stats;
+
+    uint32_t addBody(const glm::vec3& position, float radius, float mass = 1.0f)
+    {
+        uint32_t body = (uint32_t)size();
+        posX.push_back(position.x); posY.push_back(position.y); posZ.push_back(position.z);
+        velX.push_back(0.0f); velY.push_back(0.0f); velZ.push_back(0.0f);
+        spinX.push_back(0.0f); spinY.push_back(0.0f); spinZ.push_back(0.0f);
+        rotX.push_back(0.0f); rotY.push_back(0.0f); rotZ.push_back(0.0f); rotW.push_back(1.0f);
+        forceX.push_back(0.0f); forceY.push_back(0.0f); forceZ.push_back(0.0f);
+        radii.push_back(radius);
+        inverseMass.push_back(mass > 0.0f ? 1.0f / mass : 0.0f);
+        groundedMask.push_back(0.0f);
+        previousX.push_back(position.x); previousY.push_back(position.y); previousZ.push_back(position.z);
+        previousRotX.push_back(0.0f); previousRotY.push_back(0.0f); previousRotZ.push_back(0.0f); previousRotW.push_back(1.0f);
+        return body;
+    }
+
+    size_t size() const
+    {
+        return posX.size();
+    }
+
+    // a force that keeps acting every step until it is changed, e.g. from the keyboard
+    void setForce(uint32_t body, const glm::vec3& force)
+    {
+        forceX[body] = force.x; forceY[body] = force.y; forceZ[body] = force.z;
+    }
+    // an upward impulse also lifts the body off the ground until a step puts it back, so a jump asked
+    // for on every rendered frame between two steps is applied once
+    void applyImpulse(uint32_t body, const glm::vec3& impulse)
+    {
+        velX[body] += impulse.x * inverseMass[body];
+        velY[body] += impulse.y * inverseMass[body];
+        velZ[body] += impulse.z * inverseMass[body];
+        if (impulse.y > 0.0f)
+            groundedMask[body] = 0.0f;
+    }
+
+    bool grounded(uint32_t body) const
+    {
+        return groundedMask[body] != 0.0f;
+    }
+    glm::vec3 position(uint32_t body) const
+    {
+        return glm::vec3(posX[body], posY[body], posZ[body]);
+    }
+    glm::vec3 velocity(uint32_t body) const
+    {
+        return glm::vec3(velX[body], velY[body], velZ[body]);
+    }
+    glm::quat rotation(uint32_t body) const
+    {
+        return glm::quat(rotW[body], rotX[body], rotY[body], rotZ[body]);
+    }
+    float radius(uint32_t body) const
+    {
+        return radii[body];
+    }
+
+    // runs the fixed steps that fit into the elapsed time, returns how many ran
+    unsigned int update(float deltaTime)
+    {
+        PROFILE_ZONE("PhysicsWorld::update");
+        accumulator += deltaTime;
+        stats = Stats();
+        while (accumulator >= fixedStep && stats.steps < maxStepsPerUpdate)
+        {
+            step();
+            accumulator -= fixedStep;
+            stats.steps++;
+        }
+        if (stats.steps == maxStepsPerUpdate && accumulator >= fixedStep)
+            accumulator = 0.0f;
+        return stats.steps;
+    }
+
+    // how far the render time is between the last two steps, 0..1
+    float interpolation() const
+    {
+        return accumulator / fixedStep;
+    }
+
+    // world transform of the body for rendering, blended between the last two steps
+    glm::mat4 transform(uint32_t body) const
+    {
+        float alpha = interpolation();
+        glm::vec3 position = glm::mix(glm::vec3(previousX[body], previousY[body], previousZ[body]), this->position(body), alpha);
+        glm::quat from(previousRotW[body], previousRotX[body], previousRotY[body], previousRotZ[body]), to = rotation(body);
+        if (glm::dot(from, to) < 0.0f)
+            to = -to;
+        glm::quat rotation = glm::normalize(glm::quat(
+            from.w + (to.w - from.w) * alpha, from.x + (to.x - from.x) * alpha,
+            from.y + (to.y - from.y) * alpha, from.z + (to.z - from.z) * alpha));
+        return glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(rotation);
+    }
+
+    // one fixed step of fixedStep seconds
+    void step()
+    {
+        // bodies are independent here, so blocks of them integrate on the pool
+        size_t blocks = (size() + BLOCK - 1) / BLOCK;
+        threadPool().parallelFor(blocks, [this](size_t first, size_t last) {
+            size_t end = std::min(size(), last * BLOCK);
+            size_t i = first * BLOCK;
+            for (; i + SimdFloat::WIDTH <= end; i += SimdFloat::WIDTH)
+                integrate<SimdFloat>(i);
+            for (; i < end; i++)
+                integrate<ScalarFloat>(i);
+        }, 1);
+        if (sphereContacts)
+            collideSpheres();
+        if (level)
+            collideLevel();
+    }
+
+private:
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> velX, velY, velZ;
+    std::vector<float> spinX, spinY, spinZ;         // angular velocity, world space
+    std::vector<float> rotX, rotY, rotZ, rotW;      // orientation quaternion
+    std::vector<float> forceX, forceY, forceZ;
+    std::vector<float> radii, inverseMass;
+    std::vector<float> groundedMask;                // 1 while resting on the ground
+    std::vector<float> previousX, previousY, previousZ;                     // state of the step before, for transform()
+    std::vector<float> previousRotX, previousRotY, previousRotZ, previousRotW;
+    static const size_t BLOCK = 4096;               // bodies per parallel integration task, a multiple of any SIMD width
+    ThreadPool* pool;
+    BroadphaseGrid broadphase;
+    std::vector<SphereContact> contacts;
+
+    ThreadPool& threadPool()
+    {
+        return pool ? *pool : ThreadPool::shared();
+    }
+    float accumulator = 0.0f;
+
+    // velocity, position, ground contact, rolling and orientation for the bodies [i, i + Float::WIDTH)
+    template <typename Float>
+    void integrate(size_t i)
+    {
+        const Float dt(fixedStep), zero(0.0f), half(0.5f);
+        const Float damping(std::max(0.0f, 1.0f - airDrag * fixedStep));
+        const Float rolling(std::max(0.0f, 1.0f - rollingResistance * fixedStep));
+
+        Float invMass = Float::load(&inverseMass[i]);
+        Float vx = Float::load(&velX[i]), vy = Float::load(&velY[i]), vz = Float::load(&velZ[i]);
+        vx = (vx + (Float(gravity.x) + Float::load(&forceX[i]) * invMass) * dt) * damping;
+        vy = (vy + (Float(gravity.y) + Float::load(&forceY[i]) * invMass) * dt) * damping;
+        vz = (vz + (Float(gravity.z) + Float::load(&forceZ[i]) * invMass) * dt) * damping;
+
+        Float px = Float::load(&posX[i]), py = Float::load(&posY[i]), pz = Float::load(&posZ[i]);
+        px.store(&previousX[i]); py.store(&previousY[i]); pz.store(&previousZ[i]);
+        px = px + vx * dt;
+        py = py + vy * dt;
+        pz = pz + vz * dt;
+
+        // ground plane: push out, bounce the normal velocity, let slow impacts settle
+        Float r = Float::load(&radii[i]);
+        Float floor = Float(groundHeight) + r;
+        Float touching = py < floor + Float(1e-3f);
+        Float penetrating = py < floor;
+        py = select(penetrating, floor, py);
+        Float bounce = zero - vy * Float(restitution);
+        Float falling = penetrating & (vy < zero);
+        vy = select(falling, select(bounce > Float(0.5f), bounce, zero), vy);
+        vx = select(touching, vx * rolling, vx);
+        vz = select(touching, vz * rolling, vz);
+
+        // rolling without slipping: v + w x (-r up) = 0 gives w = (vz, 0, -vx) / r; airborne spin is kept
+        Float inverseRadius = Float(1.0f) / r;
+        Float wx = select(touching, vz * inverseRadius, Float::load(&spinX[i]));
+        Float wy = select(touching, zero, Float::load(&spinY[i]));
+        Float wz = select(touching, (zero - vx) * inverseRadius, Float::load(&spinZ[i]));
+
+        // q += dt/2 * (w, 0) * q, then renormalize
+        Float qx = Float::load(&rotX[i]), qy = Float::load(&rotY[i]), qz = Float::load(&rotZ[i]), qw = Float::load(&rotW[i]);
+        qx.store(&previousRotX[i]); qy.store(&previousRotY[i]); qz.store(&previousRotZ[i]); qw.store(&previousRotW[i]);
+        Float h = half * dt;
+        Float nx = qx + h * (wx * qw + wy * qz - wz * qy);
+        Float ny = qy + h * (wy * qw + wz * qx - wx * qz);
+        Float nz = qz + h * (wz * qw + wx * qy - wy * qx);
+        Float nw = qw - h * (wx * qx + wy * qy + wz * qz);
+        Float length = sqrt(nx * nx + ny * ny + nz * nz + nw * nw);
+        Float inverseLength = Float(1.0f) / length;
+
+        vx.store(&velX[i]); vy.store(&velY[i]); vz.store(&velZ[i]);
+        px.store(&posX[i]); py.store(&posY[i]); pz.store(&posZ[i]);
+        wx.store(&spinX[i]); wy.store(&spinY[i]); wz.store(&spinZ[i]);
+        (nx * inverseLength).store(&rotX[i]); (ny * inverseLength).store(&rotY[i]);
+        (nz * inverseLength).store(&rotZ[i]); (nw * inverseLength).store(&rotW[i]);
+        select(touching, Float(1.0f), zero).store(&groundedMask[i]);
+    }
+
+    void collideSpheres()
+    {
+        broadphase.update(posX.data(), posY.data(), posZ.data(), radii.data(), size());
+        broadphase.findPairs();
+        for (uint64_t pair : broadphase.pairs)
+            resolveContact(BroadphaseGrid::pairFirst(pair), BroadphaseGrid::pairSecond(pair));
+    }
+
+    // pushes each sphere out of the level triangles it overlaps, deepest first, and bounces its normal velocity
+    void collideLevel()
+    {
+        for (uint32_t body = 0; body < size(); body++)
+        {
+            if (inverseMass[body] == 0.0f)
+                continue;
+            for (int iteration = 0; iteration < 4; iteration++)
+            {
+                level->sphereOverlaps(position(body), radii[body], contacts);
+                if (contacts.empty())
+                    break;
+                const SphereContact& contact = contacts[0];
+                stats.levelContacts++;
+                posX[body] += contact.normal.x * contact.depth;
+                posY[body] += contact.normal.y * contact.depth;
+                posZ[body] += contact.normal.z * contact.depth;
+                float approach = velX[body] * contact.normal.x + velY[body] * contact.normal.y + velZ[body] * contact.normal.z;
+                if (approach < 0.0f)
+                {
+                    float bounce = -approach * restitution > 0.5f ? restitution : 0.0f;
+                    float change = -(1.0f + bounce) * approach;
+                    velX[body] += contact.normal.x * change;
+                    velY[body] += contact.normal.y * change;
+                    velZ[body] += contact.normal.z * change;
+                }
+                if (contact.normal.y > 0.7f)    // walkable slope: counts as ground for jumping
+                    groundedMask[body] = 1.0f;
+            }
+        }
+    }
+
+    // pushes two overlapping spheres apart and removes their approaching velocity
+    void resolveContact(uint32_t a, uint32_t b)
+    {
+        float dx = posX[b] - posX[a], dy = posY[b] - posY[a], dz = posZ[b] - posZ[a];
+        float reach = radii[a] + radii[b];
+        float distanceSquared = dx * dx + dy * dy + dz * dz;
+        if (distanceSquared >= reach * reach || distanceSquared == 0.0f)
+            return;
+        float totalInverseMass = inverseMass[a] + inverseMass[b];
+        if (totalInverseMass == 0.0f)
+            return;
+        stats.contactPairs++;
+        float distance = std::sqrt(distanceSquared);
+        float nx = dx / distance, ny = dy / distance, nz = dz / distance;
+
+        float correction = (reach - distance) / totalInverseMass;
+        posX[a] -= nx * correction * inverseMass[a]; posY[a] -= ny * correction * inverseMass[a]; posZ[a] -= nz * correction * inverseMass[a];
+        posX[b] += nx * correction * inverseMass[b]; posY[b] += ny * correction * inverseMass[b]; posZ[b] += nz * correction * inverseMass[b];
+
+        float approach = (velX[b] - velX[a]) * nx + (velY[b] - velY[a]) * ny + (velZ[b] - velZ[a]) * nz;
+        if (approach >= 0.0f)
+            return;
+        float impulse = -(1.0f + restitution) * approach / totalInverseMass;
+        velX[a] -= nx * impulse * inverseMass[a]; velY[a] -= ny * impulse * inverseMass[a]; velZ[a] -= nz * impulse * inverseMass[a];
+        velX[b] += nx * impulse * inverseMass[b]; velY[b] += ny * impulse * inverseMass[b]; velZ[b] += nz * impulse * inverseMass[b];
+    }
+};
+
+#endif
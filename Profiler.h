@@ -0,0 +1,280 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Scoped CPU profiler. PROFILE_ZONE("name") at the top of a block records when the block starts and
+//ends; zones nest, and every thread records into its own ring buffer, so recording takes no lock
+//and never waits for another thread (only the first zone of a thread registers its buffer). The
+//rings keep the last RING_SIZE zones of each thread; writeChromeTrace() exports them for
+//chrome://tracing or ui.perfetto.dev, printSummary() prints calls, total and self time per zone.
+//
+//Everything compiles out unless PROFILER_ENABLED is defined: the macros expand to nothing and the
+//class is never touched. Zone names must outlive the profiler, string literals in practice.
+class Profiler
+{
+public:
+    static const size_t RING_SIZE = 1 << 16;       // zones kept per thread
+    static const int MAX_DEPTH = 64;
+
+    struct Zone
+    {
+        const char* name;
+        uint64_t begin, end;    // nanoseconds since the profiler started
+        uint64_t self;          // end - begin minus the time spent in nested zones
+        uint32_t depth;
+    };
+
+    static Profiler& instance()
+    {
+        static Profiler* profiler = new Profiler();     // never destroyed: worker threads may still record at exit
+        return *profiler;
+    }
+
+    uint64_t now() const
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void beginZone()
+    {
+        Track& track = threadTrack();
+        uint32_t depth = track.depth++;
+        if (depth < MAX_DEPTH)
+        {
+            track.open[depth].begin = now();
+            track.open[depth].children = 0;
+        }
+    }
+
+    void endZone(const char* name)
+    {
+        uint64_t end = now();
+        Track& track = threadTrack();
+        uint32_t depth = --track.depth;
+        if (depth >= MAX_DEPTH)
+            return;
+        uint64_t begin = track.open[depth].begin, duration = end - begin;
+        if (depth > 0 && depth - 1 < MAX_DEPTH)
+            track.open[depth - 1].children += duration;
+        track.push(Zone{ name, begin, end, duration - std::min(duration, track.open[depth].children), depth });
+    }
+
+    // a zone measured elsewhere, e.g. on the GPU, on a track of its own; call from one thread per track
+    void recordZone(const std::string& trackName, const char* name, uint64_t begin, uint64_t end, uint32_t depth = 0)
+    {
+        Track& track = namedTrack(trackName);
+        track.push(Zone{ name, begin, end, end - begin, depth });
+    }
+
+    // names the calling thread in the trace
+    void setThreadName(const std::string& name)
+    {
+        Track& track = threadTrack();
+        std::lock_guard<std::mutex> lock(tracksMutex);
+        track.name = name;
+    }
+
+    // drops the recorded zones; no thread may be inside a zone
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(tracksMutex);
+        for (const std::unique_ptr<Track>& track : tracks)
+            track->head.store(0, std::memory_order_release);
+    }
+
+    // Chrome trace event format, complete ("X") events in microseconds; false if the file can't be written
+    bool writeChromeTrace(const std::string& path)
+    {
+        std::ofstream out(path);
+        if (!out)
+        {
+            std::cout << "ERROR::PROFILER::TRACE_NOT_WRITABLE " << path << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(tracksMutex);
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        char line[512];
+        for (size_t t = 0; t < tracks.size(); t++)
+        {
+            std::snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", (unsigned int)t, escaped(tracks[t]->name).c_str());
+            out << line;
+            first = false;
+            for (const Zone& zone : tracks[t]->snapshot())
+            {
+                std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    escaped(zone.name).c_str(), (unsigned int)t, zone.begin / 1000.0, (zone.end - zone.begin) / 1000.0);
+                out << line;
+            }
+        }
+        out << "\n]}\n";
+        return true;
+    }
+
+    // per zone name over all threads: calls, total, self, mean and longest time in milliseconds, by self time
+    void printSummary(std::ostream& out)
+    {
+        struct Row
+        {
+            std::string name;
+            uint64_t calls = 0, total = 0, self = 0, longest = 0;
+        };
+        std::unordered_map<std::string, Row> rows;
+        {
+            std::lock_guard<std::mutex> lock(tracksMutex);
+            for (const std::unique_ptr<Track>& track : tracks)
+            {
+                for (const Zone& zone : track->snapshot())
+                {
+                    Row& row = rows[zone.name];
+                    row.name = zone.name;
+                    row.calls++;
+                    row.total += zone.end - zone.begin;
+                    row.self += zone.self;
+                    row.longest = std::max(row.longest, zone.end - zone.begin);
+                }
+            }
+        }
+        std::vector<Row> sorted;
+        for (const auto& row : rows)
+            sorted.push_back(row.second);
+        std::sort(sorted.begin(), sorted.end(), [](const Row& a, const Row& b) { return a.self > b.self; });
+
+        char line[256];
+        std::snprintf(line, sizeof(line), "%-40s %10s %12s %12s %10s %10s\n", "zone", "calls", "total ms", "self ms", "mean ms", "max ms");
+        out << line;
+        for (const Row& row : sorted)
+        {
+            std::snprintf(line, sizeof(line), "%-40.40s %10llu %12.3f %12.3f %10.4f %10.4f\n", row.name.c_str(), (unsigned long long)row.calls,
+                row.total / 1e6, row.self / 1e6, row.total / 1e6 / row.calls, row.longest / 1e6);
+            out << line;
+        }
+    }
+
+private:
+    struct OpenZone
+    {
+        uint64_t begin, children;
+    };
+
+    // the zones of one thread; only that thread writes, exports read up to the published head
+    struct Track
+    {
+        std::string name;
+        std::vector<Zone> ring = std::vector<Zone>(RING_SIZE);
+        std::atomic<uint64_t> head{ 0 };
+        uint32_t depth = 0;
+        OpenZone open[MAX_DEPTH];
+
+        void push(const Zone& zone)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            ring[h % RING_SIZE] = zone;
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        // oldest first; exact when the thread isn't recording meanwhile
+        std::vector<Zone> snapshot() const
+        {
+            uint64_t h = head.load(std::memory_order_acquire);
+            uint64_t count = std::min<uint64_t>(h, RING_SIZE);
+            std::vector<Zone> zones;
+            zones.reserve((size_t)count);
+            for (uint64_t i = h - count; i < h; i++)
+                zones.push_back(ring[i % RING_SIZE]);
+            return zones;
+        }
+    };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::mutex tracksMutex;
+    std::vector<std::unique_ptr<Track>> tracks;     // never shrinks, so a thread's pointer stays valid after it exits
+    std::unordered_map<std::string, Track*> named;
+
+    Profiler() = default;
+
+    Track& threadTrack()
+    {
+        thread_local Track* track = nullptr;
+        if (!track)
+        {
+            std::unique_ptr<Track> created(new Track());
+            track = created.get();
+            std::lock_guard<std::mutex> lock(tracksMutex);
+            created->name = "thread " + std::to_string(tracks.size());
+            tracks.push_back(std::move(created));
+        }
+        return *track;
+    }
+
+    Track& namedTrack(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(tracksMutex);
+        auto it = named.find(name);
+        if (it != named.end())
+            return *it->second;
+        tracks.emplace_back(new Track());
+        tracks.back()->name = name;
+        named[name] = tracks.back().get();
+        return *tracks.back();
+    }
+
+    static std::string escaped(const std::string& text)
+    {
+        std::string out;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if ((unsigned char)c >= 0x20)
+                out += c;
+        }
+        return out;
+    }
+};
+
+// records the enclosing scope as a zone, see PROFILE_ZONE
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char* name) : name(name)
+    {
+        Profiler::instance().beginZone();
+    }
+    ~ProfileZone()
+    {
+        Profiler::instance().endZone(name);
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#ifdef PROFILER_ENABLED
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::instance().setThreadName(name)
+#else
+#define PROFILE_ZONE(name) do {} while (0)
+#define PROFILE_THREAD(name) do {} while (0)
+#endif
+
+#endif
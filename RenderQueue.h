@@ -0,0 +1,238 @@
+#pragma once
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "GpuProfiler.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Profiler.h"
+#include "Shader.h"
+
+//Collects the draws of a frame and submits them in an order that changes as little GL state as
+//possible. Every item gets a 64-bit sort key
+//
+//   63..56 program | 55..36 material (texture set) | 35..16 VAO | 15..0 view depth
+//
+//so a radix sort groups draws by program, then material, then mesh, and draws them front to back
+//inside a group (less overdraw). Submission goes through a GLStateCache that skips binds of state
+//that is already current; its counters tell how many were avoided.
+class RenderQueue
+{
+public:
+    // per flush; the bind counters are in state.counters
+    struct Stats
+    {
+        unsigned int items = 0;
+        unsigned int drawCalls = 0;
+        unsigned int transformSets = 0, transformSetsAvoided = 0;
+    };
+    Stats stats;
+    GLStateCache state;
+
+    void submit(Shader& shader, const Mesh& mesh, const glm::mat4& model)
+    {
+        transforms.push_back(model);
+        push(shader, mesh, (uint32_t)transforms.size() - 1);
+    }
+    // every mesh of the model shares one transform
+    void submit(Shader& shader, const Model& model, const glm::mat4& transform)
+    {
+        transforms.push_back(transform);
+        for (const Mesh& mesh : model.meshes)
+            push(shader, mesh, (uint32_t)transforms.size() - 1);
+    }
+
+    // sorts and draws everything submitted since the last flush, viewPos gives the depth order
+    void flush(const glm::vec3& viewPos)
+    {
+        PROFILE_ZONE("RenderQueue::flush");
+        GPU_ZONE("RenderQueue::flush");
+        stats = Stats();
+        stats.items = (unsigned int)items.size();
+        state.resetCounters();
+        state.invalidate();    // whatever ran since the last flush may have changed the bindings
+        if (items.empty())
+            return;
+
+        for (DrawItem& item : items)
+        {
+            glm::vec3 offset = glm::vec3(transforms[item.transform][3]) - viewPos;
+            item.key |= depthBits(glm::dot(offset, offset));
+        }
+        sortItems();
+
+        const Shader* boundShader = nullptr;
+        const Mesh* boundMaterial = nullptr;
+        uint32_t boundTransform = ~0u;
+        GLint modelLocation = -1, normalLocation = -1;
+        for (uint32_t index : order)
+        {
+            const DrawItem& item = items[index];
+            if (item.shader != boundShader)
+            {
+                state.useProgram(item.shader->ID);
+                modelLocation = item.shader->getUniformLocation("model");
+                normalLocation = item.shader->getUniformLocation("normalMatrix");
+                boundShader = item.shader;
+                boundMaterial = nullptr;
+                boundTransform = ~0u;
+            }
+            if (!boundMaterial || !sameMaterial(*boundMaterial, *item.mesh))
+            {
+                const Mesh& mesh = *item.mesh;
+                for (unsigned int i = 0; i < mesh.textures.size(); i++)
+                {
+                    state.setSampler(item.shader->getUniformLocation(mesh.samplers[i]), i);
+                    state.bindTexture(i, mesh.textures[i].id);
+                }
+                boundMaterial = item.mesh;
+            }
+            if (item.transform != boundTransform)
+            {
+                glUniformMatrix4fv(modelLocation, 1, GL_FALSE, &transforms[item.transform][0][0]);
+                if (normalLocation >= 0)
+                {
+                    glm::mat3 normal = normalMatrix(transforms[item.transform]);
+                    glUniformMatrix3fv(normalLocation, 1, GL_FALSE, &normal[0][0]);
+                }
+                boundTransform = item.transform;
+                stats.transformSets++;
+            }
+            else
+                stats.transformSetsAvoided++;
+            state.bindVertexArray(item.mesh->VAO);
+            glDrawElements(GL_TRIANGLES, item.mesh->indexCount, GL_UNSIGNED_INT, 0);
+            stats.drawCalls++;
+        }
+        state.bindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);   // leave unit 0 active, as Mesh::Draw does
+        state.invalidate();
+
+        items.clear();
+        transforms.clear();
+    }
+
+    size_t size() const
+    {
+        return items.size();
+    }
+
+private:
+    struct DrawItem
+    {
+        uint64_t key;
+        Shader* shader;
+        const Mesh* mesh;
+        uint32_t transform;
+    };
+
+    std::vector<DrawItem> items;
+    std::vector<glm::mat4> transforms;
+    std::vector<uint32_t> order, scratch;
+    std::vector<uint64_t> keys, keyScratch;
+    // dense ranks handed out on first sight and kept across frames, so the key bits stay stable
+    std::unordered_map<GLuint, uint32_t> programRanks, vertexArrayRanks;
+    std::unordered_map<uint64_t, uint32_t> materialRanks;
+
+    void push(Shader& shader, const Mesh& mesh, uint32_t transform)
+    {
+        DrawItem item;
+        item.key = ((uint64_t)rank(programRanks, shader.ID) & 0xFF) << 56
+            | ((uint64_t)rank(materialRanks, materialHash(mesh)) & 0xFFFFF) << 36
+            | ((uint64_t)rank(vertexArrayRanks, mesh.VAO) & 0xFFFFF) << 16;
+        item.shader = &shader;
+        item.mesh = &mesh;
+        item.transform = transform;
+        items.push_back(item);
+    }
+
+    template <typename Key>
+    static uint32_t rank(std::unordered_map<Key, uint32_t>& ranks, Key key)
+    {
+        return ranks.emplace(key, (uint32_t)ranks.size()).first->second;
+    }
+
+    // FNV-1a over the texture names; only used for ordering, binding compares the real texture lists
+    static uint64_t materialHash(const Mesh& mesh)
+    {
+        uint64_t hash = 1469598103934665603ull;
+        for (const Texture& texture : mesh.textures)
+        {
+            hash ^= texture.id;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static bool sameMaterial(const Mesh& a, const Mesh& b)
+    {
+        if (&a == &b)
+            return true;
+        if (a.textures.size() != b.textures.size())
+            return false;
+        for (size_t i = 0; i < a.textures.size(); i++)
+            if (a.textures[i].id != b.textures[i].id || a.samplers[i] != b.samplers[i])
+                return false;
+        return true;
+    }
+
+    // the top 16 bits of a positive float keep its order: sign is 0, then exponent, then mantissa
+    static uint64_t depthBits(float distanceSquared)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &distanceSquared, sizeof(bits));
+        return bits >> 16;
+    }
+
+    // LSD radix sort of the keys, 8 bits per pass. All eight histograms come from one read of the
+    // keys, and passes whose byte is the same for every key are skipped.
+    void sortItems()
+    {
+        size_t count = items.size();
+        keys.resize(count);
+        keyScratch.resize(count);
+        order.resize(count);
+        scratch.resize(count);
+        uint32_t histograms[8][256];
+        std::memset(histograms, 0, sizeof(histograms));
+        for (size_t i = 0; i < count; i++)
+        {
+            keys[i] = items[i].key;
+            order[i] = (uint32_t)i;
+            for (int pass = 0; pass < 8; pass++)
+                histograms[pass][(keys[i] >> (pass * 8)) & 0xFF]++;
+        }
+        for (int pass = 0; pass < 8; pass++)
+        {
+            uint32_t* histogram = histograms[pass];
+            if (histogram[(keys[0] >> (pass * 8)) & 0xFF] == count)
+                continue;
+            uint32_t sum = 0;
+            for (int digit = 0; digit < 256; digit++)
+            {
+                uint32_t c = histogram[digit];
+                histogram[digit] = sum;
+                sum += c;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t slot = histogram[(keys[i] >> (pass * 8)) & 0xFF]++;
+                keyScratch[slot] = keys[i];
+                scratch[slot] = order[i];
+            }
+            keys.swap(keyScratch);
+            order.swap(scratch);
+        }
+    }
+};
+
+#endif
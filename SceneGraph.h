@@ -0,0 +1,219 @@
+#pragma once
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Profiler.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+//A transform hierarchy in flat arrays: a parent index, a local and a world matrix per node. Nodes are
+//kept topologically sorted, every parent before its children (add() only takes a parent that already
+//exists), so world = world[parent] * local can be computed in one pass over the arrays.
+//
+//setLocal() only flags the node. update() walks the flags once, carrying a change down to every node
+//below it, and recomputes just those nodes; a scene where one ball moves pays for that ball's subtree.
+//The changed nodes are multiplied in array order, which is the order they depend on each other in.
+//With many of them and a ThreadPool they are grouped by depth instead: the nodes of one depth don't
+//depend on each other, so each group is a batch of independent products spread over the workers.
+//
+//   SceneGraph scene;
+//   uint32_t body = scene.add(glm::mat4(1.0f));
+//   uint32_t wheel = scene.add(glm::translate(glm::mat4(1.0f), offset), body);
+//   scene.setLocal(body, physics.transform(car));
+//   scene.update();
+//   draw(scene.world(wheel));
+class SceneGraph
+{
+public:
+    static const uint32_t NO_PARENT = ~0u;
+
+    struct Stats
+    {
+        unsigned int updated = 0;   // world matrices recomputed by the last update()
+    };
+    Stats stats;
+
+    // appends a node below parent (which must exist already, or NO_PARENT for a root) and returns its index
+    uint32_t add(const glm::mat4& local, uint32_t parent = NO_PARENT)
+    {
+        uint32_t node = (uint32_t)parents.size();
+        parents.push_back(parent);
+        depths.push_back(parent == NO_PARENT ? 0 : depths[parent] + 1);
+        locals.push_back(local);
+        worlds.push_back(local);
+        dirty.push_back(1);
+        return node;
+    }
+
+    // appends a copy of every node of other, its roots below parent; other's node i becomes the returned index + i
+    uint32_t attach(const SceneGraph& other, uint32_t parent = NO_PARENT)
+    {
+        uint32_t first = (uint32_t)parents.size();
+        reserve(parents.size() + other.size());
+        for (uint32_t node = 0; node < other.size(); node++)
+            add(other.locals[node], other.parents[node] == NO_PARENT ? parent : first + other.parents[node]);
+        return first;
+    }
+
+    void setLocal(uint32_t node, const glm::mat4& local)
+    {
+        locals[node] = local;
+        dirty[node] = 1;
+    }
+
+    const glm::mat4& local(uint32_t node) const
+    {
+        return locals[node];
+    }
+    // as of the last update()
+    const glm::mat4& world(uint32_t node) const
+    {
+        return worlds[node];
+    }
+    uint32_t parent(uint32_t node) const
+    {
+        return parents[node];
+    }
+    uint32_t depth(uint32_t node) const
+    {
+        return depths[node];
+    }
+    uint32_t size() const
+    {
+        return (uint32_t)parents.size();
+    }
+
+    void reserve(size_t nodes)
+    {
+        parents.reserve(nodes);
+        depths.reserve(nodes);
+        locals.reserve(nodes);
+        worlds.reserve(nodes);
+        dirty.reserve(nodes);
+    }
+    void clear()
+    {
+        parents.clear();
+        depths.clear();
+        locals.clear();
+        worlds.clear();
+        dirty.clear();
+    }
+
+    // recomputes the world matrix of every node whose local matrix, or an ancestor's, changed since the last update
+    void update(ThreadPool* pool = &ThreadPool::shared())
+    {
+        PROFILE_ZONE("SceneGraph::update");
+        // one pass in array order collects the changed subtrees: a parent's flag is final before its children read it
+        changed.assign(parents.size(), 0);
+        pending.clear();
+        uint32_t deepest = 0;
+        for (uint32_t node = 0; node < parents.size(); node++)
+        {
+            uint32_t parent = parents[node];
+            if (!dirty[node] && (parent == NO_PARENT || !changed[parent]))
+                continue;
+            changed[node] = 1;
+            dirty[node] = 0;
+            pending.push_back(node);
+            deepest = std::max(deepest, depths[node]);
+        }
+        stats.updated = (unsigned int)pending.size();
+        if (!pool || pool->size() == 0 || pending.size() < PARALLEL_NODES)
+        {
+            compute(pending.data(), pending.size());
+            return;
+        }
+
+        // by depth, a counting sort that keeps array order within a depth
+        levelStarts.assign(deepest + 2, 0);
+        for (uint32_t node : pending)
+            levelStarts[depths[node] + 1]++;
+        for (size_t level = 1; level < levelStarts.size(); level++)
+            levelStarts[level] += levelStarts[level - 1];
+        byDepth.resize(pending.size());
+        levelFill.assign(levelStarts.begin(), levelStarts.end() - 1);
+        for (uint32_t node : pending)
+            byDepth[levelFill[depths[node]]++] = node;
+        for (size_t level = 0; level + 1 < levelStarts.size(); level++)
+        {
+            const uint32_t* nodes = byDepth.data() + levelStarts[level];
+            size_t count = levelStarts[level + 1] - levelStarts[level];
+            if (count < PARALLEL_NODES)
+                compute(nodes, count);
+            else
+                pool->parallelFor(count, [this, nodes](size_t begin, size_t end) { compute(nodes + begin, end - begin); }, PARALLEL_NODES / 4);
+        }
+    }
+
+    // out = a * b, a column at a time in SSE registers (two with AVX); out must not be a or b
+    static void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+    {
+#if defined(SIMD_AVX)
+        const float* pa = &a[0][0];
+        const float* pb = &b[0][0];
+        float* po = &out[0][0];
+        // a's columns in both halves; each half of a b register is one column, vpermilps spreads one of its elements
+        __m256 a0 = _mm256_broadcast_ps((const __m128*)pa), a1 = _mm256_broadcast_ps((const __m128*)(pa + 4));
+        __m256 a2 = _mm256_broadcast_ps((const __m128*)(pa + 8)), a3 = _mm256_broadcast_ps((const __m128*)(pa + 12));
+        for (int j = 0; j < 16; j += 8)
+        {
+            __m256 columns = _mm256_loadu_ps(pb + j);
+            __m256 r = _mm256_mul_ps(a0, _mm256_permute_ps(columns, 0x00));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(columns, 0x55)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(columns, 0xAA)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(columns, 0xFF)));
+            _mm256_storeu_ps(po + j, r);
+        }
+#elif defined(SIMD_SSE)
+        const float* pa = &a[0][0];
+        const float* pb = &b[0][0];
+        float* po = &out[0][0];
+        __m128 a0 = _mm_loadu_ps(pa), a1 = _mm_loadu_ps(pa + 4), a2 = _mm_loadu_ps(pa + 8), a3 = _mm_loadu_ps(pa + 12);
+        for (int j = 0; j < 16; j += 4)
+        {
+            __m128 column = _mm_loadu_ps(pb + j);
+            __m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(column, column, 0x00));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(column, column, 0x55)));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(column, column, 0xAA)));
+            r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(column, column, 0xFF)));
+            _mm_storeu_ps(po + j, r);
+        }
+#else
+        out = a * b;
+#endif
+    }
+
+private:
+    static const size_t PARALLEL_NODES = 16384;    // fewer changed nodes (in all, or of one depth) are done on the calling thread
+
+    std::vector<uint32_t> parents, depths;
+    std::vector<glm::mat4> locals, worlds;
+    std::vector<uint8_t> dirty;                     // setLocal() since the last update()
+    // update() scratch
+    std::vector<uint8_t> changed;                   // the node or an ancestor was dirty
+    std::vector<uint32_t> pending;                  // the changed nodes in array order
+    std::vector<uint32_t> byDepth;                  // the same sorted by depth, depth d at [levelStarts[d], levelStarts[d + 1])
+    std::vector<size_t> levelStarts, levelFill;
+
+    // the world matrices of nodes, each one's parent already up to date
+    void compute(const uint32_t* nodes, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t node = nodes[i];
+            if (parents[node] == NO_PARENT)
+                worlds[node] = locals[node];
+            else
+                multiply(worlds[parents[node]], locals[node], worlds[node]);
+        }
+    }
+};
+
+#endif
@@ -2,17 +2,199 @@
 #define SHADER_H
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <unordered_map>
+
+#include "ShaderCache.h"
+#include "UniformBuffer.h"
+
+// A pre-resolved uniform location. Handles are fetched once from Shader::uniform<T>()
+// and then set every frame without any string building or location lookup.
+template <typename T>
+struct UniformHandle
+{
+	GLint location = -1;
+
+	bool valid() const { return location >= 0; }
+	void set(const T& value) const;
+};
+
+template <> inline void UniformHandle<bool>::set(const bool& value) const { glUniform1i(location, (int)value); }
+template <> inline void UniformHandle<int>::set(const int& value) const { glUniform1i(location, value); }
+template <> inline void UniformHandle<float>::set(const float& value) const { glUniform1f(location, value); }
+template <> inline void UniformHandle<glm::vec2>::set(const glm::vec2& value) const { glUniform2fv(location, 1, glm::value_ptr(value)); }
+template <> inline void UniformHandle<glm::vec3>::set(const glm::vec3& value) const { glUniform3fv(location, 1, glm::value_ptr(value)); }
+template <> inline void UniformHandle<glm::vec4>::set(const glm::vec4& value) const { glUniform4fv(location, 1, glm::value_ptr(value)); }
+template <> inline void UniformHandle<glm::mat2>::set(const glm::mat2& value) const { glUniformMatrix2fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+template <> inline void UniformHandle<glm::mat3>::set(const glm::mat3& value) const { glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+template <> inline void UniformHandle<glm::mat4>::set(const glm::mat4& value) const { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+
+// the matrix normals go through under model: the inverse transpose of its upper 3x3, right for any scale.
+// Computed once per draw on the CPU instead of once per vertex in the shader.
+inline glm::mat3 normalMatrix(const glm::mat4& model)
+{
+	return glm::transpose(glm::inverse(glm::mat3(model)));
+}
 
 class Shader
 {
 public:
 	unsigned int ID; //The program ID
+	unsigned int activeAttributes = 0; //Bit i is set when the vertex shader reads the attribute at location i
+
+	// tag for the constructor that only starts building the program, see finish()
+	struct Deferred {};
+
+	// defines ("#define NAME value" lines) go in front of every stage, right after its #version line
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& defines = "") {
+		start(vertexPath, fragmentPath, geometryPath, defines);
+		finish();
+	};
+	// starts compiling and linking and returns right away: with KHR_parallel_shader_compile the driver builds
+	// the program on its own threads while the caller starts more. Call finish() before using it.
+	Shader(Deferred, const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& defines = "") {
+		start(vertexPath, fragmentPath, geometryPath, defines);
+	};
+
+	// false while the driver is still compiling a deferred program; finish() would block
+	bool ready() const {
+		if (!pending || fromCache || !ProgramBinaryCache::instance().parallelCompile())
+			return true;
+		GLint done = GL_FALSE;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+		return done == GL_TRUE;
+	}
+
+	// waits for the program, reports errors, stores the binary and reflects uniforms and attributes; once
+	void finish() {
+		if (!pending)
+			return;
+		pending = false;
+		if (!fromCache)
+		{
+			static const char* stageNames[3] = { "VERTEX", "FRAGMENT", "GEOMETRY" };
+			for (int i = 0; i < 3; i++)
+			{
+				if (stages[i])
+					checkCompileErrors(stages[i], stageNames[i]);
+			}
+			checkCompileErrors(ID, "PROGRAM");
+			GLint linked = GL_FALSE;
+			glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+			if (linked)
+				ProgramBinaryCache::instance().store(cacheKey, ID);
+		}
+		reflectUniforms();
+		reflectAttributes();
+		bindUniformBlocks();
+		for (unsigned int& stage : stages)
+		{
+			if (stage)
+				glDeleteShader(stage);
+			stage = 0;
+		}
+	};
+	void use() {
+		glUseProgram(ID);
+	};
+
+	// looks the name up in the table built at link time; unknown names give -1, which GL silently ignores
+	GLint getUniformLocation(const std::string& name) const
+	{
+		auto it = uniformLocations.find(name);
+		return it != uniformLocations.end() ? it->second : -1;
+	}
+	// resolve a typed handle once (outside the render loop) and set it every frame
+	template <typename T>
+	UniformHandle<T> uniform(const std::string& name) const
+	{
+		UniformHandle<T> handle;
+		handle.location = getUniformLocation(name);
+		return handle;
+	}
+
+	void setBool(const std::string& name, bool value) const {
+		glUniform1i(getUniformLocation(name), (int)value);
+	};
+	void setInt(const std::string& name, int value) const {
+		glUniform1i(getUniformLocation(name), value);
+	};
+	void setFloat(const std::string& name, float value) const {
+		glUniform1f(getUniformLocation(name), value);
+	};
+	void setVec2(const std::string& name, const glm::vec2& value) const
+	{
+		glUniform2fv(getUniformLocation(name), 1, &value[0]);
+	}
+	void setVec2(const std::string& name, float x, float y) const
+	{
+		glUniform2f(getUniformLocation(name), x, y);
+	}
+	// ------------------------------------------------------------------------
+	void setVec3(const std::string& name, const glm::vec3& value) const
+	{
+		glUniform3fv(getUniformLocation(name), 1, &value[0]);
+	}
+	void setVec3(const std::string& name, float x, float y, float z) const
+	{
+		glUniform3f(getUniformLocation(name), x, y, z);
+	}
+	// ------------------------------------------------------------------------
+	void setVec4(const std::string& name, const glm::vec4& value) const
+	{
+		glUniform4fv(getUniformLocation(name), 1, &value[0]);
+	}
+	void setVec4(const std::string& name, float x, float y, float z, float w) const
+	{
+		glUniform4f(getUniformLocation(name), x, y, z, w);
+	}
+	// ------------------------------------------------------------------------
+	void setMat2(const std::string& name, const glm::mat2& mat) const
+	{
+		glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+	}
+	// ------------------------------------------------------------------------
+	void setMat3(const std::string& name, const glm::mat3& mat) const
+	{
+		glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+	}
+	// ------------------------------------------------------------------------
+	void setMat4(const std::string& name, const glm::mat4& mat) const
+	{
+		glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+	}
+	// ------------------------------------------------------------------------
+	// sets "model" and, when the program reads it, the "normalMatrix" that goes with it
+	void setModel(const glm::mat4& model) const
+	{
+		setMat4("model", model);
+		GLint location = getUniformLocation("normalMatrix");
+		if (location >= 0)
+		{
+			glm::mat3 normal = normalMatrix(model);
+			glUniformMatrix3fv(location, 1, GL_FALSE, &normal[0][0]);
+		}
+	}
+	~Shader();
+
+
 
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr) {
+private:
+	std::unordered_map<std::string, GLint> uniformLocations; //Every active uniform name -> location, filled once after linking
+	unsigned int stages[3] = { 0, 0, 0 }; //Vertex, fragment and geometry shader objects until finish()
+	uint64_t cacheKey = 0; //Of the program in the ProgramBinaryCache
+	bool pending = false; //start() ran, finish() didn't
+	bool fromCache = false; //Linked with glProgramBinary
+
+	// reads the sources and links the program from the binary cache, or starts compiling it
+	// ------------------------------------------------------------------------
+	void start(const char* vertexPath, const char* fragmentPath, const char* geometryPath, const std::string& defines)
+	{
 		std::string vertexCode;	//retrieve the vertex/fragment source code from filePath
 		std::string fragmentCode;
 		std::string geometryCode;
@@ -52,6 +234,21 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		if (!defines.empty())
+		{
+			vertexCode = withDefines(vertexCode, defines);
+			fragmentCode = withDefines(fragmentCode, defines);
+			if (geometryPath != nullptr)
+				geometryCode = withDefines(geometryCode, defines);
+		}
+
+		ID = glCreateProgram();
+		ProgramBinaryCache& cache = ProgramBinaryCache::instance();
+		cacheKey = cache.key(vertexCode, fragmentCode, geometryCode, defines);
+		pending = true;
+		fromCache = cache.load(cacheKey, ID);
+		if (fromCache)
+			return;	//Linked from the stored binary, nothing to compile
 
 		const char* vShaderCode = vertexCode.c_str();
 		const char* fShaderCode = fragmentCode.c_str();
@@ -63,100 +260,132 @@ public:
 														 //1st argument: Shader object will be attached
 														 //2nd: How many strings we are passing as source code.
 														 //3rd: Actual source code of the vertex
-		glCompileShader(vertex);
-
-		checkCompileErrors(vertex, "VERTEX");
+		glCompileShader(vertex);	//Errors are checked in finish(), asking now would wait for the compiler
 
 
 		fragment = glCreateShader(GL_FRAGMENT_SHADER);
 		glShaderSource(fragment, 1, &fShaderCode, NULL);
 		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
 
 		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
+		unsigned int geometry = 0;
 		if (geometryPath != nullptr)
 		{
 			const char* gShaderCode = geometryCode.c_str();
 			geometry = glCreateShader(GL_GEOMETRY_SHADER);
 			glShaderSource(geometry, 1, &gShaderCode, NULL);
 			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
 		}
 		//Now we create the program
 
-		ID = glCreateProgram();
 		glAttachShader(ID, vertex);    //We attach the shaders and then link them wth glLinkProgram
 		glAttachShader(ID, fragment);
 		if (geometryPath != nullptr)
 			glAttachShader(ID, geometry);
+		cache.prepare(ID);
 		glLinkProgram(ID);
+		stages[0] = vertex;
+		stages[1] = fragment;
+		stages[2] = geometry;
+	}
 
-		checkCompileErrors(ID, "PROGRAM");
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-		if (geometryPath != nullptr)
-			glDeleteShader(geometry);
-	};
-	void use() {
-		glUseProgram(ID);
-	};
 
-	void setBool(const std::string& name, bool value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-	};
-	void setInt(const std::string& name, int value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-	};
-	void setFloat(const std::string& name, float value) const {
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-	};
-	void setVec2(const std::string& name, const glm::vec2& value) const
-	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
-	}
-	void setVec2(const std::string& name, float x, float y) const
-	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
-	}
+	// inserts the defines after the #version line, which has to stay first; #line keeps the
+	// line numbers of compile errors pointing into the file
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string& name, const glm::vec3& value) const
+	static std::string withDefines(const std::string& source, const std::string& defines)
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
-	}
-	void setVec3(const std::string& name, float x, float y, float z) const
-	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
-	}
-	// ------------------------------------------------------------------------
-	void setVec4(const std::string& name, const glm::vec4& value) const
-	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
-	}
-	void setVec4(const std::string& name, float x, float y, float z, float w) const
-	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		std::string lines = defines.back() == '\n' ? defines : defines + '\n';
+		std::string::size_type version = source.find("#version");
+		if (version == std::string::npos)
+			return lines + source;
+		std::string::size_type lineEnd = source.find('\n', version);
+		if (lineEnd == std::string::npos)
+			return source + "\n" + lines;
+		int nextLine = 2 + (int)std::count(source.begin(), source.begin() + version, '\n');
+		return source.substr(0, lineEnd + 1) + lines + "#line " + std::to_string(nextLine) + "\n" + source.substr(lineEnd + 1);
 	}
+
+	// walks the active uniforms of the linked program and caches their locations.
+	// arrays are stored both under their base name and as "name[i]" for every element.
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string& name, const glm::mat2& mat) const
+	void reflectUniforms()
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::string name(maxLength > 0 ? maxLength : 1, '\0');
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, (GLuint)i, maxLength, &length, &size, &type, &name[0]);
+			std::string uniformName = name.substr(0, length);
+
+			std::string::size_type bracket = uniformName.size() > 3 ? uniformName.rfind("[0]") : std::string::npos;
+			bool isArray = bracket != std::string::npos && bracket + 3 == uniformName.size();
+			if (isArray)
+				uniformName.erase(bracket);
+
+			GLint location = glGetUniformLocation(ID, uniformName.c_str());
+			if (location < 0)
+				continue; //Members of uniform blocks have no location
+			uniformLocations[uniformName] = location;
+			if (isArray)
+			{
+				for (GLint element = 0; element < size; element++)
+				{
+					std::string elementName = uniformName + "[" + std::to_string(element) + "]";
+					uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+				}
+			}
+		}
 	}
+
+	// records which vertex attribute locations the linked program actually reads, so meshes can skip the rest
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string& name, const glm::mat3& mat) const
+	void reflectAttributes()
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		GLint count = 0;
+		glGetProgramiv(ID, GL_ACTIVE_ATTRIBUTES, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLchar attributeName[256];
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveAttrib(ID, (GLuint)i, sizeof(attributeName), NULL, &size, &type, attributeName);
+			GLint location = glGetAttribLocation(ID, attributeName);
+			if (location < 0)
+				continue; //Built-ins such as gl_VertexID
+			int slots = size;
+			if (type == GL_FLOAT_MAT4)
+				slots *= 4;
+			else if (type == GL_FLOAT_MAT3)
+				slots *= 3;
+			else if (type == GL_FLOAT_MAT2)
+				slots *= 2;
+			for (int slot = 0; slot < slots && location + slot < 32; slot++)
+				activeAttributes |= 1u << (location + slot);
+		}
 	}
+
+	// connects the shared uniform blocks (Frame, Lights) declared by this program to their fixed binding points
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string& name, const glm::mat4& mat) const
+	void bindUniformBlocks()
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		GLint count = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLchar blockName[256];
+			glGetActiveUniformBlockName(ID, (GLuint)i, sizeof(blockName), NULL, blockName);
+			GLint binding = uniformBlockBinding(blockName);
+			if (binding >= 0)
+				glUniformBlockBinding(ID, (GLuint)i, (GLuint)binding);
+		}
 	}
-	~Shader();
-
 
-
-private:
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(unsigned int shader, std::string type)
@@ -0,0 +1,237 @@
+#pragma once
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ARB_get_program_binary (core in GL 4.1) and KHR/ARB_parallel_shader_compile are newer than the
+// GL 3.3 core that glad was generated for, so their enums and entry points are declared here and
+// loaded by ProgramBinaryCache::init() through the same loader glad used.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRYP PFN_glGetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFN_glProgramBinary)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFN_glProgramParameteri)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFN_glMaxShaderCompilerThreads)(GLuint count);
+
+//On-disk cache of linked GL programs. A program is stored with glGetProgramBinary under a 64-bit key
+//hashed from its source text, its #defines and the driver (vendor, renderer, version), and the next
+//launch hands the stored binary to glProgramBinary instead of compiling. Anything that doesn't fit,
+//a missing or truncated file, a different key or format, a driver update that rejects the binary,
+//quietly falls back to compiling, and the fresh binary replaces the old file.
+//
+//Disabled until init() is called with the GL loader after context creation (main.cpp does); without
+//ARB_get_program_binary it stays disabled and Shader compiles as always. init() also turns on
+//parallel compilation when the driver has KHR_parallel_shader_compile, see Shader::Deferred.
+class ProgramBinaryCache
+{
+public:
+    static ProgramBinaryCache& instance()
+    {
+        static ProgramBinaryCache cache;
+        return cache;
+    }
+
+    struct Stats
+    {
+        unsigned int hits = 0, misses = 0, rejected = 0, stored = 0;
+    };
+    Stats stats;
+
+    // looks up the extensions and their entry points; false leaves the cache disabled
+    bool init(GLADloadproc loader, const std::string& cacheDirectory = "./shader-cache")
+    {
+        directory = cacheDirectory;
+        bool coreBinary = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1);
+        if (coreBinary || hasExtension("GL_ARB_get_program_binary"))
+        {
+            getProgramBinary = (PFN_glGetProgramBinary)loader("glGetProgramBinary");
+            programBinary = (PFN_glProgramBinary)loader("glProgramBinary");
+            programParameteri = (PFN_glProgramParameteri)loader("glProgramParameteri");
+        }
+        GLint formats = 0;
+        if (getProgramBinary && programBinary && programParameteri)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        enabled = formats > 0;
+
+        if (hasExtension("GL_KHR_parallel_shader_compile"))
+            maxCompilerThreads = (PFN_glMaxShaderCompilerThreads)loader("glMaxShaderCompilerThreadsKHR");
+        else if (hasExtension("GL_ARB_parallel_shader_compile"))
+            maxCompilerThreads = (PFN_glMaxShaderCompilerThreads)loader("glMaxShaderCompilerThreadsARB");
+        if (maxCompilerThreads)
+            maxCompilerThreads(0xFFFFFFFFu);    // as many as the driver likes
+
+        driver = std::string((const char*)glGetString(GL_VENDOR)) + '\n' + (const char*)glGetString(GL_RENDERER) + '\n' + (const char*)glGetString(GL_VERSION);
+        if (enabled)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+        }
+        return enabled;
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+    // the driver compiles and links on its own threads; GL_COMPLETION_STATUS_KHR tells when a program is done
+    bool parallelCompile() const
+    {
+        return maxCompilerThreads != nullptr;
+    }
+
+    // FNV-1a over the sources, the defines and the driver, with a separator so parts can't run together
+    uint64_t key(const std::string& vertex, const std::string& fragment, const std::string& geometry, const std::string& defines) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (const std::string* part : { &vertex, &fragment, &geometry, &defines, &driver })
+        {
+            for (unsigned char c : *part)
+                hash = (hash ^ c) * 1099511628211ull;
+            hash = (hash ^ 0xFF) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // before glLinkProgram, so the driver keeps a binary it can hand out
+    void prepare(GLuint program) const
+    {
+        if (enabled)
+            programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // links program from the stored binary; false (and a program to compile) on any mismatch
+    bool load(uint64_t key, GLuint program)
+    {
+        if (!enabled)
+            return false;
+        std::ifstream file(path(key), std::ios::binary);
+        Header header;
+        if (!file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION || header.key != key)
+        {
+            stats.misses++;
+            return false;
+        }
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size()))
+        {
+            stats.misses++;
+            return false;
+        }
+        programBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            stats.rejected++;     // e.g. written by another driver build with the same version string
+            return false;
+        }
+        stats.hits++;
+        return true;
+    }
+
+    // writes the binary of a freshly linked program
+    void store(uint64_t key, GLuint program)
+    {
+        if (!enabled)
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        Header header;
+        std::memcpy(header.magic, MAGIC, 4);
+        header.key = key;
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        getProgramBinary(program, length, &written, &header.format, binary.data());
+        header.length = (uint32_t)written;
+
+        // written next to the final name and renamed, so a crash never leaves a truncated entry behind
+        std::string target = path(key), temporary = target + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file.write((const char*)&header, sizeof(header)) || !file.write(binary.data(), written))
+                return;
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, target, error);
+        if (!error)
+            stats.stored++;
+    }
+
+    // deletes every stored program, e.g. to measure a cold start
+    void clear()
+    {
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        {
+            if (entry.path().extension() == ".glbin")
+                std::filesystem::remove(entry.path(), error);
+        }
+    }
+
+private:
+    static constexpr const char* MAGIC = "RBPB";
+    static const uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char magic[4] = { 0, 0, 0, 0 };
+        uint32_t version = VERSION;
+        uint64_t key = 0;
+        GLenum format = 0;
+        uint32_t length = 0;
+    };
+
+    bool enabled = false;
+    std::string directory;
+    std::string driver;
+    PFN_glGetProgramBinary getProgramBinary = nullptr;
+    PFN_glProgramBinary programBinary = nullptr;
+    PFN_glProgramParameteri programParameteri = nullptr;
+    PFN_glMaxShaderCompilerThreads maxCompilerThreads = nullptr;
+
+    ProgramBinaryCache() = default;
+
+    std::string path(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.glbin", (unsigned long long)key);
+        return directory + "/" + name;
+    }
+
+    static bool hasExtension(const char* name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i), name) == 0)
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#pragma once
+#ifndef SHADER_LIBRARY_H
+#define SHADER_LIBRARY_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.h"
+#include "Profiler.h"
+#include "Shader.h"
+#include "UniformBuffer.h"
+
+// features a variant can be built with, each one a #define in front of the shader sources
+enum ShaderFeature
+{
+    SHADER_DIFFUSE_MAP = 1 << 0,    // DIFFUSE_MAP: texture_diffuse1, otherwise a flat diffuseColor
+    SHADER_SPECULAR_MAP = 1 << 1,   // SPECULAR_MAP: texture_specular1, otherwise a flat specularColor
+    SHADER_DIR_LIGHT = 1 << 2,      // DIR_LIGHT: shaded by the directional light of the Lights block
+    SHADER_INSTANCED = 1 << 3,      // INSTANCED: a mat4 per instance, see InstanceBuffer
+    SHADER_INSTANCED_TRS = 1 << 4,  // INSTANCED_TRS: an InstanceTRS per instance
+    SHADER_SKINNED = 1 << 5,        // SKINNED: bone ids and weights blend the character's palette, see BonePalettes
+    SHADER_CLUSTERED = 1 << 6       // CLUSTERED: shaded by the lights of the fragment's cluster, see LightClusters.h
+};
+
+// One program of a ShaderLibrary: the features plus how many point lights it shades with. Variants
+// that differ only in what they skip are separate programs, so a mesh without a specular map or a
+// scene with one light pays nothing for the rest.
+struct ShaderVariant
+{
+    uint32_t features = 0;
+    uint32_t pointLights = 0;   // the first pointLights entries of the Lights block, at most NR_POINT_LIGHTS
+
+    bool has(ShaderFeature feature) const
+    {
+        return (features & feature) != 0;
+    }
+    bool lit() const
+    {
+        return pointLights > 0 || has(SHADER_DIR_LIGHT) || has(SHADER_CLUSTERED);
+    }
+
+    // the maps the mesh's material actually has
+    static ShaderVariant forMesh(const Mesh& mesh)
+    {
+        ShaderVariant variant;
+        for (const Texture& texture : mesh.textures)
+        {
+            if (texture.type == "texture_diffuse")
+                variant.features |= SHADER_DIFFUSE_MAP;
+            else if (texture.type == "texture_specular")
+                variant.features |= SHADER_SPECULAR_MAP;
+        }
+        return variant;
+    }
+
+    // the same variant shaded by the lights in use; the scene keeps its active point lights at the front of the block
+    ShaderVariant withLights(uint32_t activePointLights, bool dirLight) const
+    {
+        ShaderVariant variant = *this;
+        variant.pointLights = activePointLights < NR_POINT_LIGHTS ? activePointLights : NR_POINT_LIGHTS;
+        if (dirLight)
+            variant.features |= SHADER_DIR_LIGHT;
+        else
+            variant.features &= ~(uint32_t)SHADER_DIR_LIGHT;
+        return variant;
+    }
+    ShaderVariant with(uint32_t moreFeatures) const
+    {
+        ShaderVariant variant = *this;
+        variant.features |= moreFeatures;
+        return variant;
+    }
+
+    uint64_t key() const
+    {
+        return ((uint64_t)pointLights << 32) | features;
+    }
+
+    // the #define block handed to Shader
+    std::string defines() const
+    {
+        std::string text = "#define SHADER_VARIANT\n";
+        if (has(SHADER_DIFFUSE_MAP)) text += "#define DIFFUSE_MAP\n";
+        if (has(SHADER_SPECULAR_MAP)) text += "#define SPECULAR_MAP\n";
+        if (has(SHADER_DIR_LIGHT)) text += "#define DIR_LIGHT\n";
+        if (has(SHADER_INSTANCED_TRS)) text += "#define INSTANCED_TRS\n";
+        else if (has(SHADER_INSTANCED)) text += "#define INSTANCED\n";
+        if (has(SHADER_SKINNED)) text += "#define SKINNED\n";
+        if (has(SHADER_CLUSTERED)) text += "#define CLUSTERED\n";
+        text += "#define POINT_LIGHTS " + std::to_string(pointLights) + "\n";
+        if (lit()) text += "#define LIT\n";
+        return text;
+    }
+};
+
+//Builds the variants of one pair of shader files on demand. get() compiles a variant the first time
+//it is asked for and hands out the same Shader afterwards, so only the combinations a scene really
+//uses are ever compiled; with the ProgramBinaryCache initialized they load from disk on the next run.
+//Compiling in the middle of a frame stalls it, so a scene that knows its variants up front passes
+//them to prewarm(), which starts them all before waiting for any (parallel where the driver can).
+//
+//   ShaderLibrary models("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+//   Shader& shader = models.get(ShaderVariant::forMesh(mesh).withLights(2, true));
+//
+//The library owns the programs; Shader references stay valid until it is destroyed.
+class ShaderLibrary
+{
+public:
+    unsigned int compiled = 0;  // variants built so far
+
+    ShaderLibrary(const std::string& vertexPath, const std::string& fragmentPath, const std::string& geometryPath = "")
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath)
+    {
+    }
+    ~ShaderLibrary()
+    {
+        for (auto& entry : variants)
+            glDeleteProgram(entry.second->ID);
+    }
+    ShaderLibrary(const ShaderLibrary&) = delete;
+    ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+    Shader& get(const ShaderVariant& variant)
+    {
+        auto it = variants.find(variant.key());
+        if (it != variants.end())
+        {
+            it->second->finish();   // in case prewarm() is still running in the driver
+            return *it->second;
+        }
+        PROFILE_ZONE("ShaderLibrary::compile");
+        std::unique_ptr<Shader> shader(new Shader(vertexPath.c_str(), fragmentPath.c_str(), geometry(), variant.defines()));
+        compiled++;
+        Shader& result = *shader;
+        variants.emplace(variant.key(), std::move(shader));
+        return result;
+    }
+
+    // starts every variant that isn't built yet and then waits for all of them
+    void prewarm(const std::vector<ShaderVariant>& wanted)
+    {
+        PROFILE_ZONE("ShaderLibrary::prewarm");
+        std::vector<Shader*> started;
+        for (const ShaderVariant& variant : wanted)
+        {
+            if (variants.count(variant.key()))
+                continue;
+            std::unique_ptr<Shader> shader(new Shader(Shader::Deferred(), vertexPath.c_str(), fragmentPath.c_str(), geometry(), variant.defines()));
+            started.push_back(shader.get());
+            variants.emplace(variant.key(), std::move(shader));
+            compiled++;
+        }
+        for (Shader* shader : started)
+            shader->finish();
+    }
+
+    size_t size() const
+    {
+        return variants.size();
+    }
+
+private:
+    std::string vertexPath, fragmentPath, geometryPath;
+    std::unordered_map<uint64_t, std::unique_ptr<Shader>> variants;
+
+    const char* geometry() const
+    {
+        return geometryPath.empty() ? nullptr : geometryPath.c_str();
+    }
+};
+
+#endif
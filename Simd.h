@@ -0,0 +1,110 @@
+#pragma once
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE
+#endif
+
+// One float behind the SimdFloat interface, for the elements left over after a SIMD loop.
+struct ScalarFloat
+{
+    static const int WIDTH = 1;
+    float v;
+    ScalarFloat() {}
+    explicit ScalarFloat(float value) : v(value) {}
+
+    static ScalarFloat load(const float* p) { return ScalarFloat(*p); }
+    void store(float* p) const { *p = v; }
+
+    friend ScalarFloat operator+(ScalarFloat a, ScalarFloat b) { return ScalarFloat(a.v + b.v); }
+    friend ScalarFloat operator-(ScalarFloat a, ScalarFloat b) { return ScalarFloat(a.v - b.v); }
+    friend ScalarFloat operator*(ScalarFloat a, ScalarFloat b) { return ScalarFloat(a.v * b.v); }
+    friend ScalarFloat operator/(ScalarFloat a, ScalarFloat b) { return ScalarFloat(a.v / b.v); }
+    friend ScalarFloat operator<(ScalarFloat a, ScalarFloat b) { return mask(a.v < b.v); }
+    friend ScalarFloat operator>(ScalarFloat a, ScalarFloat b) { return mask(a.v > b.v); }
+    friend ScalarFloat operator&(ScalarFloat a, ScalarFloat b) { return fromBits(bits(a) & bits(b)); }
+    friend ScalarFloat operator|(ScalarFloat a, ScalarFloat b) { return fromBits(bits(a) | bits(b)); }
+    friend ScalarFloat min(ScalarFloat a, ScalarFloat b) { return ScalarFloat(a.v < b.v ? a.v : b.v); }
+    friend ScalarFloat max(ScalarFloat a, ScalarFloat b) { return ScalarFloat(a.v > b.v ? a.v : b.v); }
+    friend ScalarFloat sqrt(ScalarFloat a) { return ScalarFloat(std::sqrt(a.v)); }
+    friend ScalarFloat select(ScalarFloat mask, ScalarFloat a, ScalarFloat b) { return bits(mask) ? a : b; }
+    friend int movemask(ScalarFloat mask) { return bits(mask) ? 1 : 0; }
+
+private:
+    static uint32_t bits(ScalarFloat a) { uint32_t b; std::memcpy(&b, &a.v, sizeof(b)); return b; }
+    static ScalarFloat fromBits(uint32_t b) { ScalarFloat a; std::memcpy(&a.v, &b, sizeof(b)); return a; }
+    static ScalarFloat mask(bool set) { return fromBits(set ? ~0u : 0u); }
+};
+
+//The widest float vector the build targets: 8 lanes with AVX (/arch:AVX, -mavx), 4 with SSE2 (every
+//x64 build) and a single float elsewhere. Kernels over structure-of-arrays data are written once
+//against SimdFloat and loop in steps of SimdFloat::WIDTH, with a scalar loop for the remainder.
+//Comparisons return lane masks (all bits set or clear) to combine with select().
+#if defined(SIMD_AVX)
+struct SimdFloat
+{
+    static const int WIDTH = 8;
+    __m256 v;
+    SimdFloat() {}
+    SimdFloat(__m256 value) : v(value) {}
+    explicit SimdFloat(float value) : v(_mm256_set1_ps(value)) {}
+
+    static SimdFloat load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.v, b.v); }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.v, b.v); }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.v, b.v); }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a.v, b.v); }
+    friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a.v, b.v); }
+    friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a.v, b.v); }
+    friend SimdFloat min(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a.v, b.v); }
+    friend SimdFloat max(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a.v, b.v); }
+    friend SimdFloat sqrt(SimdFloat a) { return _mm256_sqrt_ps(a.v); }
+    // lanes of a where the mask is set, lanes of b elsewhere
+    friend SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+    // bit i set when lane i of the mask is set
+    friend int movemask(SimdFloat mask) { return _mm256_movemask_ps(mask.v); }
+};
+#elif defined(SIMD_SSE)
+struct SimdFloat
+{
+    static const int WIDTH = 4;
+    __m128 v;
+    SimdFloat() {}
+    SimdFloat(__m128 value) : v(value) {}
+    explicit SimdFloat(float value) : v(_mm_set1_ps(value)) {}
+
+    static SimdFloat load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.v, b.v); }
+    friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a.v, b.v); }
+    friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+    friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm_and_ps(a.v, b.v); }
+    friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm_or_ps(a.v, b.v); }
+    friend SimdFloat min(SimdFloat a, SimdFloat b) { return _mm_min_ps(a.v, b.v); }
+    friend SimdFloat max(SimdFloat a, SimdFloat b) { return _mm_max_ps(a.v, b.v); }
+    friend SimdFloat sqrt(SimdFloat a) { return _mm_sqrt_ps(a.v); }
+    friend SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+    friend int movemask(SimdFloat mask) { return _mm_movemask_ps(mask.v); }
+};
+#else
+typedef ScalarFloat SimdFloat;
+#endif
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SceneGraph.h"
+
+//The bones of a model and the names of its nodes, what an AnimationClip needs to drive the model's
+//SceneGraph. A bone follows one node: its palette matrix is the node's animated world matrix times
+//the bone's offset (the inverse bind matrix, from mesh space into the bone's space). Vertex::m_BoneIDs
+//index the bones, which are shared by every mesh of the model.
+//
+//Meshes without bones in a model that has some get a bone of their own, on their node with an identity
+//offset, so a skinned draw places every mesh of the model and animated nodes carry rigid parts along.
+//Vertices of a skinned mesh that no bone moves follow the mesh's node the same way, from their bind pose.
+struct Skeleton
+{
+    std::vector<std::string> nodeNames;     // one per node of the model's SceneGraph, for binding animation channels
+    std::vector<std::string> boneNames;     // the node each bone follows, by name
+    std::vector<glm::mat4> offsets;         // per bone, mesh space to bone space
+    std::vector<uint32_t> boneNodes;        // per bone, its node; filled by resolve()
+
+    uint32_t boneCount() const
+    {
+        return (uint32_t)offsets.size();
+    }
+    bool empty() const
+    {
+        return offsets.empty();
+    }
+
+    // the bone following node name with this offset, added if it doesn't exist yet
+    uint32_t addBone(const std::string& name, const glm::mat4& offset)
+    {
+        for (uint32_t bone = 0; bone < boneNames.size(); bone++)
+            if (boneNames[bone] == name && offsets[bone] == offset)
+                return bone;
+        boneNames.push_back(name);
+        offsets.push_back(offset);
+        return (uint32_t)offsets.size() - 1;
+    }
+
+    // SceneGraph::NO_PARENT when no node has that name
+    uint32_t findNode(const std::string& name) const
+    {
+        for (uint32_t node = 0; node < nodeNames.size(); node++)
+            if (nodeNames[node] == name)
+                return node;
+        return SceneGraph::NO_PARENT;
+    }
+
+    // looks up the node of every bone once all nodes are named; false if a bone names none of them
+    bool resolve()
+    {
+        boneNodes.resize(boneNames.size());
+        bool found = true;
+        for (size_t bone = 0; bone < boneNames.size(); bone++)
+        {
+            boneNodes[bone] = findNode(boneNames[bone]);
+            if (boneNodes[bone] == SceneGraph::NO_PARENT)
+            {
+                std::cout << "ERROR::SKELETON::BONE_WITHOUT_NODE " << boneNames[bone] << std::endl;
+                boneNodes[bone] = 0;
+                found = false;
+            }
+        }
+        return found;
+    }
+
+    void clear()
+    {
+        nodeNames.clear();
+        boneNames.clear();
+        offsets.clear();
+        boneNodes.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,815 @@
+#pragma once
+#ifndef TEXTURE_BAKER_H
+#define TEXTURE_BAKER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "Simd.h"
+#include "stb_image.h"
+#include "ThreadPool.h"
+
+// EXT_texture_compression_s3tc and EXT_texture_sRGB are extensions to the GL 3.3 core that glad was
+// generated for; the RGTC formats (BC4/BC5) are core since 3.0.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// how the levels of a baked texture are stored, and uploaded
+enum TextureBlockFormat
+{
+    TEXTURE_UNCOMPRESSED = 0,   // the decoded texels, 1 to 4 bytes each
+    TEXTURE_BC1 = 1,            // RGB, 8 bytes per 4x4 block
+    TEXTURE_BC3 = 3,            // RGBA, 16 bytes per block: a BC4 alpha block and a BC1 color block
+    TEXTURE_BC4 = 4,            // one channel, 8 bytes per block
+    TEXTURE_BC5 = 5             // two channels (RG, e.g. normal maps), two BC4 blocks
+};
+
+// Float::WIDTH 4x4 blocks side by side, one per lane: channel[c][i] holds texel i of every block
+template <typename Float>
+struct TexelBlocks
+{
+    alignas(32) float channel[4][16][Float::WIDTH];
+
+    Float load(int c, int i) const { return Float::load(channel[c][i]); }
+};
+
+//CPU block compression, Float::WIDTH blocks at a time with one block per SIMD lane, so every step of
+//the fit runs for 8 blocks with AVX and 4 with SSE (ScalarFloat encodes the blocks left over at the
+//end of a row). BC1 takes its endpoints from the principal axis of the block's colors, a few power
+//iterations on their covariance, refines them with one least-squares pass and then picks each
+//texel's index by projecting it onto the quantized endpoint line. BC4 uses the range of the values.
+//Only packing the bits is done lane by lane.
+class BlockEncoder
+{
+public:
+    // 8 bytes per block: two RGB565 endpoints and 2-bit indices, always the four-color mode
+    template <typename Float>
+    static void encodeBC1(const TexelBlocks<Float>& blocks, unsigned char* out, size_t outStride)
+    {
+        const int W = Float::WIDTH;
+        const Float zero(0.0f), one(1.0f), full(255.0f), epsilon(1e-6f), sixteenth(1.0f / 16.0f);
+        Float meanR(0.0f), meanG(0.0f), meanB(0.0f);
+        Float lowR(full), lowG(full), lowB(full), highR(zero), highG(zero), highB(zero);
+        for (int i = 0; i < 16; i++)
+        {
+            Float r = blocks.load(0, i), g = blocks.load(1, i), b = blocks.load(2, i);
+            meanR = meanR + r; meanG = meanG + g; meanB = meanB + b;
+            lowR = min(lowR, r); lowG = min(lowG, g); lowB = min(lowB, b);
+            highR = max(highR, r); highG = max(highG, g); highB = max(highB, b);
+        }
+        meanR = meanR * sixteenth; meanG = meanG * sixteenth; meanB = meanB * sixteenth;
+
+        // principal axis: power iterations on the covariance, starting along the box diagonal
+        Float rr(0.0f), rg(0.0f), rb(0.0f), gg(0.0f), gb(0.0f), bb(0.0f);
+        for (int i = 0; i < 16; i++)
+        {
+            Float r = blocks.load(0, i) - meanR, g = blocks.load(1, i) - meanG, b = blocks.load(2, i) - meanB;
+            rr = rr + r * r; rg = rg + r * g; rb = rb + r * b;
+            gg = gg + g * g; gb = gb + g * b; bb = bb + b * b;
+        }
+        Float axisR = highR - lowR, axisG = highG - lowG, axisB = highB - lowB;
+        for (int iteration = 0; iteration < 4; iteration++)
+        {
+            Float nr = rr * axisR + rg * axisG + rb * axisB;
+            Float ng = rg * axisR + gg * axisG + gb * axisB;
+            Float nb = rb * axisR + gb * axisG + bb * axisB;
+            Float length = sqrt(nr * nr + ng * ng + nb * nb);
+            Float valid = length > epsilon;     // a flat block keeps the diagonal
+            Float inverse = one / max(length, epsilon);
+            axisR = select(valid, nr * inverse, axisR);
+            axisG = select(valid, ng * inverse, axisG);
+            axisB = select(valid, nb * inverse, axisB);
+        }
+        Float inverse = one / max(sqrt(axisR * axisR + axisG * axisG + axisB * axisB), epsilon);
+        axisR = axisR * inverse; axisG = axisG * inverse; axisB = axisB * inverse;
+
+        // the extent of the colors along the axis gives the first endpoints
+        Float tMin(1e30f), tMax(-1e30f);
+        for (int i = 0; i < 16; i++)
+        {
+            Float t = (blocks.load(0, i) - meanR) * axisR + (blocks.load(1, i) - meanG) * axisG + (blocks.load(2, i) - meanB) * axisB;
+            tMin = min(tMin, t);
+            tMax = max(tMax, t);
+        }
+        Float c0[3] = { clamp(meanR + axisR * tMax, zero, full), clamp(meanG + axisG * tMax, zero, full), clamp(meanB + axisB * tMax, zero, full) };
+        Float c1[3] = { clamp(meanR + axisR * tMin, zero, full), clamp(meanG + axisG * tMin, zero, full), clamp(meanB + axisB * tMin, zero, full) };
+        refine(blocks, c0, c1);
+
+        // quantizing the endpoints is bit work, done lane by lane
+        alignas(32) float e[2][3][Float::WIDTH];
+        for (int c = 0; c < 3; c++)
+        {
+            c0[c].store(e[0][c]);
+            c1[c].store(e[1][c]);
+        }
+        uint16_t q0[Float::WIDTH], q1[Float::WIDTH];
+        for (int l = 0; l < W; l++)
+        {
+            q0[l] = pack565(e[0][0][l], e[0][1][l], e[0][2][l]);
+            q1[l] = pack565(e[1][0][l], e[1][1][l], e[1][2][l]);
+            if (q0[l] < q1[l])
+                std::swap(q0[l], q1[l]);    // color0 > color1 selects the four-color mode
+            unpack565(q0[l], e[0][0][l], e[0][1][l], e[0][2][l]);
+            unpack565(q1[l], e[1][0][l], e[1][1][l], e[1][2][l]);
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            c0[c] = Float::load(e[0][c]);
+            c1[c] = Float::load(e[1][c]);
+        }
+        alignas(32) float level[16][Float::WIDTH];
+        selectLevels(blocks, c0, c1, level);
+
+        static const uint32_t ORDER[4] = { 0, 2, 3, 1 };  // position on the line -> BC1 index
+        for (int l = 0; l < W; l++)
+        {
+            uint32_t indices = 0;
+            if (q0[l] != q1[l])     // equal endpoints: every index 0
+            {
+                for (int i = 0; i < 16; i++)
+                    indices |= ORDER[(int)level[i][l]] << (2 * i);
+            }
+            unsigned char* target = out + l * outStride;
+            write16(target, q0[l]);
+            write16(target + 2, q1[l]);
+            std::memcpy(target + 4, &indices, 4);
+        }
+    }
+
+    // 8 bytes per block: two 8-bit endpoints and 3-bit indices, always the eight-value mode
+    template <typename Float>
+    static void encodeBC4(const TexelBlocks<Float>& blocks, int channel, unsigned char* out, size_t outStride)
+    {
+        const int W = Float::WIDTH;
+        Float low(255.0f), high(0.0f);
+        for (int i = 0; i < 16; i++)
+        {
+            Float v = blocks.load(channel, i);
+            low = min(low, v);
+            high = max(high, v);
+        }
+        alignas(32) float lows[Float::WIDTH], highs[Float::WIDTH];
+        low.store(lows);
+        high.store(highs);
+        unsigned char a0[Float::WIDTH], a1[Float::WIDTH];
+        for (int l = 0; l < W; l++)
+        {
+            a0[l] = (unsigned char)(highs[l] + 0.5f);
+            a1[l] = (unsigned char)(lows[l] + 0.5f);
+            lows[l] = a1[l];
+            highs[l] = 7.0f / std::max(1, a0[l] - a1[l]);
+        }
+        Float origin = Float::load(lows), scale = Float::load(highs);
+        alignas(32) float level[16][Float::WIDTH];
+        for (int i = 0; i < 16; i++)
+            quantize((blocks.load(channel, i) - origin) * scale, 7).store(level[i]);
+
+        for (int l = 0; l < W; l++)
+        {
+            uint64_t bits = 0;
+            if (a0[l] > a1[l])
+            {
+                for (int i = 0; i < 16; i++)
+                {
+                    int position = (int)level[i][l];    // 0 = a1 ... 7 = a0
+                    uint64_t index = position == 7 ? 0 : position == 0 ? 1 : 8 - position;
+                    bits |= index << (3 * i);
+                }
+            }
+            unsigned char* target = out + l * outStride;
+            target[0] = a0[l];
+            target[1] = a1[l];
+            for (int i = 0; i < 6; i++)
+                target[2 + i] = (unsigned char)(bits >> (8 * i));
+        }
+    }
+
+    // 16 bytes per block: BC4 alpha, then BC1 color
+    template <typename Float>
+    static void encodeBC3(const TexelBlocks<Float>& blocks, unsigned char* out)
+    {
+        encodeBC4(blocks, 3, out, 16);
+        encodeBC1(blocks, out + 8, 16);
+    }
+
+    // 16 bytes per block: BC4 red, then BC4 green
+    template <typename Float>
+    static void encodeBC5(const TexelBlocks<Float>& blocks, unsigned char* out)
+    {
+        encodeBC4(blocks, 0, out, 16);
+        encodeBC4(blocks, 1, out + 8, 16);
+    }
+
+private:
+    template <typename Float>
+    static Float clamp(Float x, Float low, Float high)
+    {
+        return min(max(x, low), high);
+    }
+    // rounds t to the nearest of 0..steps by counting the midpoints below it, which also clamps
+    template <typename Float>
+    static Float quantize(Float t, int steps)
+    {
+        const Float one(1.0f), zero(0.0f);
+        Float sum(0.0f);
+        for (int s = 0; s < steps; s++)
+            sum = sum + select(t > Float(s + 0.5f), one, zero);
+        return sum;
+    }
+    // for every texel, the nearest of the four points from c0 (0) to c1 (3)
+    template <typename Float>
+    static void selectLevels(const TexelBlocks<Float>& blocks, const Float* c0, const Float* c1, float (*level)[Float::WIDTH])
+    {
+        Float dr = c1[0] - c0[0], dg = c1[1] - c0[1], db = c1[2] - c0[2];
+        Float scale = Float(3.0f) / max(dr * dr + dg * dg + db * db, Float(1e-6f));
+        dr = dr * scale; dg = dg * scale; db = db * scale;
+        for (int i = 0; i < 16; i++)
+        {
+            Float t = (blocks.load(0, i) - c0[0]) * dr + (blocks.load(1, i) - c0[1]) * dg + (blocks.load(2, i) - c0[2]) * db;
+            quantize(t, 3).store(level[i]);
+        }
+    }
+    // one least-squares pass: the endpoints that best fit the texels with the levels they picked
+    template <typename Float>
+    static void refine(const TexelBlocks<Float>& blocks, Float* c0, Float* c1)
+    {
+        const Float one(1.0f), third(1.0f / 3.0f), zero(0.0f), full(255.0f);
+        alignas(32) float level[16][Float::WIDTH];
+        selectLevels(blocks, c0, c1, level);
+        Float aa(0.0f), ab(0.0f), bb(0.0f);
+        Float ap[3] = { zero, zero, zero }, bp[3] = { zero, zero, zero };
+        for (int i = 0; i < 16; i++)
+        {
+            Float w = Float::load(level[i]) * third, v = one - w;
+            aa = aa + v * v;
+            ab = ab + v * w;
+            bb = bb + w * w;
+            for (int c = 0; c < 3; c++)
+            {
+                Float p = blocks.load(c, i);
+                ap[c] = ap[c] + v * p;
+                bp[c] = bp[c] + w * p;
+            }
+        }
+        Float determinant = aa * bb - ab * ab;
+        Float solvable = determinant * determinant > Float(1e-6f);  // all texels on one level keeps the old endpoints
+        Float inverse = one / select(solvable, determinant, one);
+        for (int c = 0; c < 3; c++)
+        {
+            c0[c] = select(solvable, clamp((bb * ap[c] - ab * bp[c]) * inverse, zero, full), c0[c]);
+            c1[c] = select(solvable, clamp((aa * bp[c] - ab * ap[c]) * inverse, zero, full), c1[c]);
+        }
+    }
+
+    static uint16_t pack565(float r, float g, float b)
+    {
+        unsigned int r5 = (unsigned int)(r * 31.0f / 255.0f + 0.5f);
+        unsigned int g6 = (unsigned int)(g * 63.0f / 255.0f + 0.5f);
+        unsigned int b5 = (unsigned int)(b * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)((r5 << 11) | (g6 << 5) | b5);
+    }
+    // the color the GPU decodes, with the high bits repeated into the low ones
+    static void unpack565(uint16_t packed, float& r, float& g, float& b)
+    {
+        unsigned int r5 = packed >> 11, g6 = (packed >> 5) & 63, b5 = packed & 31;
+        r = (float)((r5 << 3) | (r5 >> 2));
+        g = (float)((g6 << 2) | (g6 >> 4));
+        b = (float)((b5 << 3) | (b5 >> 2));
+    }
+    static void write16(unsigned char* out, uint16_t value)
+    {
+        out[0] = (unsigned char)value;
+        out[1] = (unsigned char)(value >> 8);
+    }
+};
+
+// One texture as the baker produced it or read it back: its mip chain, level 0 the full size. The
+// levels point into storage (baked in this process) or into the mapped .rbtex file.
+struct BakedTexture
+{
+    struct Level
+    {
+        unsigned int width = 0, height = 0;
+        const unsigned char* data = nullptr;
+        size_t bytes = 0;
+    };
+    TextureBlockFormat format = TEXTURE_UNCOMPRESSED;
+    int components = 0;
+    bool gamma = false;
+    std::vector<Level> levels;
+    std::vector<unsigned char> storage;
+    std::unique_ptr<MappedFile> file;
+
+    unsigned int width() const { return levels.empty() ? 0 : levels[0].width; }
+    unsigned int height() const { return levels.empty() ? 0 : levels[0].height; }
+
+    GLenum internalFormat() const
+    {
+        switch (format)
+        {
+        case TEXTURE_BC1: return gamma ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case TEXTURE_BC3: return gamma ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case TEXTURE_BC4: return GL_COMPRESSED_RED_RGTC1;
+        case TEXTURE_BC5: return GL_COMPRESSED_RG_RGTC2;
+        default: break;
+        }
+        // the same choice as TextureLoader makes for decoded images
+        if (components == 1) return GL_RED;
+        if (components == 2) return GL_RG;
+        if (components == 3) return gamma ? GL_SRGB : GL_RGB;
+        return gamma ? GL_SRGB_ALPHA : GL_RGBA;
+    }
+
+    // uploads one level into the bound GL_TEXTURE_2D
+    void upload(unsigned int level) const
+    {
+        const Level& l = levels[level];
+        if (format != TEXTURE_UNCOMPRESSED)
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat(), l.width, l.height, 0, (GLsizei)l.bytes, l.data);
+            return;
+        }
+        static const GLenum PIXEL_FORMATS[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat(), l.width, l.height, 0, PIXEL_FORMATS[components - 1], GL_UNSIGNED_BYTE, l.data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // video memory of the whole chain; drivers keep RGB8 as RGBA8
+    size_t gpuBytes() const
+    {
+        size_t total = 0;
+        for (const Level& level : levels)
+            total += format != TEXTURE_UNCOMPRESSED ? level.bytes : (size_t)level.width * level.height * (components == 3 ? 4 : components);
+        return total;
+    }
+};
+
+//Bakes image files into .rbtex textures: the decoded image, its whole mip chain built on the CPU, and
+//every level block-compressed (BC1 for RGB and opaque RGBA, BC3 for RGBA with alpha, BC4 for one
+//channel, BC5 for two) when the driver has S3TC; sRGB color images also need EXT_texture_sRGB and
+//are stored uncompressed without it. A baked file is what the GPU takes as is, so loading
+//it needs neither a JPEG/PNG decode nor glGenerateMipmap, and it takes a quarter to an eighth of the
+//memory. Like KTX2, the file stores the levels smallest first, so a loader streaming them in that
+//order reads the file front to back.
+//
+//TextureLoader bakes on first use: get() returns the stored file when it is current and otherwise
+//decodes and bakes on the worker, then writes the file for the next launch. Files are keyed by a
+//hash of the source image and the settings they were baked with (gamma, vertical flip, which formats are compressed).
+class TextureBaker
+{
+    struct Header
+    {
+        char magic[4] = { 0, 0, 0, 0 };
+        uint32_t version = VERSION;
+        uint64_t key = 0;
+        uint32_t format = 0, components = 0, gamma = 0, levelCount = 0;
+        uint64_t fileBytes = 0;
+    };
+    struct LevelRecord
+    {
+        uint64_t offset;    // from the start of the file
+        uint64_t bytes;
+        uint32_t width, height;
+    };
+
+public:
+    static TextureBaker& instance()
+    {
+        static TextureBaker baker;
+        return baker;
+    }
+
+    struct Stats
+    {
+        std::atomic<unsigned int> baked{ 0 }, hits{ 0 }, stored{ 0 };
+    };
+    Stats stats;
+    bool enabled = true;
+    bool compress = true;   // block compression; init() turns it off without S3TC
+    bool compressSrgb = true;   // the sRGB block formats for gamma textures; init() turns it off without EXT_texture_sRGB
+
+    // GL thread, once before the first bake: checks that the driver takes the compressed formats
+    void init()
+    {
+        if (initialized)
+            return;
+        initialized = true;
+        bool s3tc = false, srgb = false;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+            s3tc = s3tc || std::strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0;
+            srgb = srgb || std::strcmp(extension, "GL_EXT_texture_sRGB") == 0;
+        }
+        compress = compress && s3tc;
+        compressSrgb = compressSrgb && srgb;   // without it gamma textures stay uncompressed sRGB, which is core
+    }
+
+    // stb_image flips while decoding, so baked files depend on the setting; set it here instead of
+    // through stbi_set_flip_vertically_on_load directly
+    void setFlipVertically(bool flip)
+    {
+        flipVertically = flip;
+        stbi_set_flip_vertically_on_load(flip);
+    }
+
+    void setDirectory(const std::string& bakeDirectory)
+    {
+        directory = bakeDirectory;
+    }
+
+    // the stored bake of the image when it is current, otherwise a fresh one (which is stored); false when the image can't be read
+    bool get(const std::string& path, bool gamma, BakedTexture& texture)
+    {
+        uint64_t fileKey = key(path, gamma);
+        if (fileKey != 0 && load(path, gamma, fileKey, texture))
+            return true;
+        if (!bake(path, gamma, texture))
+            return false;
+        if (fileKey != 0)
+            store(path, gamma, fileKey, texture);
+        return true;
+    }
+
+    // decodes the image, builds the mip chain and compresses every level, in memory
+    bool bake(const std::string& path, bool gamma, BakedTexture& texture)
+    {
+        PROFILE_ZONE("TextureBaker::bake");
+        int width, height, components;
+        unsigned char* pixels;
+        {
+            PROFILE_ZONE("TextureBaker::decode");
+            pixels = stbi_load(path.c_str(), &width, &height, &components, 0);
+        }
+        if (!pixels)
+            return false;
+        bake(pixels, (unsigned int)width, (unsigned int)height, components, gamma, texture);
+        stbi_image_free(pixels);
+        stats.baked++;
+        return true;
+    }
+
+    // the same from decoded pixels
+    void bake(const unsigned char* pixels, unsigned int width, unsigned int height, int components, bool gamma, BakedTexture& texture,
+        ThreadPool* pool = &ThreadPool::shared())
+    {
+        TextureBlockFormat format = chooseFormat(pixels, (size_t)width * height, components, gamma);
+
+        // the mip chain, each level a box filter of the one above
+        std::vector<std::vector<unsigned char>> chain;
+        std::vector<glm::uvec2> sizes(1, glm::uvec2(width, height));
+        {
+            PROFILE_ZONE("TextureBaker::mips");
+            const unsigned char* above = pixels;
+            while (sizes.back().x > 1 || sizes.back().y > 1)
+            {
+                glm::uvec2 size = sizes.back();
+                glm::uvec2 next(std::max(1u, size.x / 2), std::max(1u, size.y / 2));
+                chain.emplace_back((size_t)next.x * next.y * components);
+                downsample(above, size.x, size.y, components, gamma, chain.back().data(), next.x, next.y, pool);
+                above = chain.back().data();
+                sizes.push_back(next);
+            }
+        }
+
+        // the file image: header, level table, then the levels smallest first
+        unsigned int levelCount = (unsigned int)sizes.size();
+        uint64_t offset = alignUp(sizeof(Header) + levelCount * sizeof(LevelRecord));
+        std::vector<LevelRecord> records(levelCount);
+        for (unsigned int level = levelCount; level-- > 0;)
+        {
+            LevelRecord& record = records[level];
+            record.width = sizes[level].x;
+            record.height = sizes[level].y;
+            record.bytes = levelBytes(format, components, record.width, record.height);
+            record.offset = offset;
+            offset = alignUp(offset + record.bytes);
+        }
+        Header header;
+        std::memcpy(header.magic, MAGIC, 4);
+        header.format = format;
+        header.components = (uint32_t)components;
+        header.gamma = gamma ? 1 : 0;
+        header.levelCount = levelCount;
+        header.fileBytes = offset;
+
+        texture.file.reset();
+        texture.storage.assign((size_t)offset, 0);
+        std::memcpy(texture.storage.data(), &header, sizeof(header));
+        std::memcpy(texture.storage.data() + sizeof(header), records.data(), records.size() * sizeof(LevelRecord));
+        {
+            PROFILE_ZONE("TextureBaker::compress");
+            for (unsigned int level = 0; level < levelCount; level++)
+            {
+                const unsigned char* source = level == 0 ? pixels : chain[level - 1].data();
+                unsigned char* target = texture.storage.data() + records[level].offset;
+                if (format == TEXTURE_UNCOMPRESSED)
+                    std::memcpy(target, source, (size_t)records[level].bytes);
+                else
+                    compressLevel<SimdFloat>(source, sizes[level].x, sizes[level].y, components, format, target, pool);
+            }
+        }
+        describe(texture);
+    }
+
+    // hash of the image file and the bake settings; 0 when the file can't be read
+    uint64_t key(const std::string& path, bool gamma) const
+    {
+        MappedFile source;
+        if (!source.open(path))
+            return 0;
+        uint64_t hash = 14695981039346656037ull;
+        const unsigned char* bytes = source.data();
+        for (size_t i = 0; i < source.size(); i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        uint32_t settings[4] = { gamma ? 1u : 0u, flipVertically ? 1u : 0u, compress ? 1u : 0u, compressSrgb ? 1u : 0u };
+        for (uint32_t setting : settings)
+            hash = (hash ^ setting) * 1099511628211ull;
+        return hash == 0 ? 1 : hash;
+    }
+
+    // maps the stored bake of the image; false when there is none or it doesn't match fileKey
+    bool load(const std::string& path, bool gamma, uint64_t fileKey, BakedTexture& texture)
+    {
+        PROFILE_ZONE("TextureBaker::load");
+        std::unique_ptr<MappedFile> file(new MappedFile());
+        if (!file->open(bakedPath(path, gamma)) || file->size() < sizeof(Header))
+            return false;
+        Header header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION || header.key != fileKey || header.fileBytes != file->size()
+            || sizeof(Header) + (uint64_t)header.levelCount * sizeof(LevelRecord) > header.fileBytes)
+            return false;
+        const LevelRecord* records = (const LevelRecord*)(file->data() + sizeof(Header));
+        for (uint32_t level = 0; level < header.levelCount; level++)
+        {
+            if (records[level].offset + records[level].bytes > header.fileBytes
+                || records[level].bytes != levelBytes((TextureBlockFormat)header.format, (int)header.components, records[level].width, records[level].height))
+                return false;
+        }
+        texture.storage.clear();
+        texture.file = std::move(file);
+        describe(texture);
+        stats.hits++;
+        return true;
+    }
+
+    void store(const std::string& path, bool gamma, uint64_t fileKey, BakedTexture& texture)
+    {
+        PROFILE_ZONE("TextureBaker::store");
+        if (texture.storage.empty())
+            return;
+        std::memcpy(texture.storage.data() + offsetof(Header, key), &fileKey, sizeof(fileKey));
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        // written next to the final name and renamed, so a crash never leaves a truncated file behind
+        std::string target = bakedPath(path, gamma), temporary = target + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file.write((const char*)texture.storage.data(), texture.storage.size()))
+            {
+                std::cout << "ERROR::TEXTURE_BAKER::WRITE_FAILED " << temporary << std::endl;
+                return;
+            }
+        }
+        std::filesystem::rename(temporary, target, error);
+        if (!error)
+            stats.stored++;
+    }
+
+    // deletes every baked file, e.g. to measure a cold start
+    void clear()
+    {
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        {
+            if (entry.path().extension() == ".rbtex")
+                std::filesystem::remove(entry.path(), error);
+        }
+    }
+
+    // where the bake of an image goes: named by a hash of its path, with sRGB and linear bakes side by
+    // side; the key inside says whether it is current
+    std::string bakedPath(const std::string& path, bool gamma) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : path)
+            hash = (hash ^ c) * 1099511628211ull;
+        std::string stem = std::filesystem::path(path).stem().string();
+        char name[40];
+        std::snprintf(name, sizeof(name), "-%016llx%s.rbtex", (unsigned long long)hash, gamma ? "-srgb" : "");
+        return directory + "/" + stem + name;
+    }
+
+    // compresses one level into format, a row of blocks per task; Float::WIDTH blocks go through the
+    // encoder together and the rest of the row one by one
+    template <typename Float>
+    static void compressLevel(const unsigned char* pixels, unsigned int width, unsigned int height, int components, TextureBlockFormat format,
+        unsigned char* out, ThreadPool* pool)
+    {
+        unsigned int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        size_t blockBytes = format == TEXTURE_BC1 || format == TEXTURE_BC4 ? 8 : 16;
+        auto rows = [=](size_t begin, size_t end) {
+            for (size_t by = begin; by < end; by++)
+            {
+                unsigned char* row = out + by * blocksX * blockBytes;
+                unsigned int bx = 0;
+                for (; bx + Float::WIDTH <= blocksX; bx += Float::WIDTH)
+                    encodeBlocks<Float>(pixels, width, height, components, format, bx, (unsigned int)by, row + bx * blockBytes);
+                for (; bx < blocksX; bx++)
+                    encodeBlocks<ScalarFloat>(pixels, width, height, components, format, bx, (unsigned int)by, row + bx * blockBytes);
+            }
+        };
+        if (pool && blocksY > 1)
+            pool->parallelFor(blocksY, rows, 4);
+        else
+            rows(0, blocksY);
+    }
+
+private:
+    static constexpr const char* MAGIC = "RBTX";
+    static const uint32_t VERSION = 1;
+
+    std::string directory = "./texture-cache";
+    bool flipVertically = false;
+    bool initialized = false;
+
+    TextureBaker() = default;
+
+    static uint64_t alignUp(uint64_t offset)
+    {
+        return (offset + 15) & ~(uint64_t)15;
+    }
+
+    TextureBlockFormat chooseFormat(const unsigned char* pixels, size_t texels, int components, bool gamma) const
+    {
+        if (!compress)
+            return TEXTURE_UNCOMPRESSED;
+        if (components == 1)
+            return TEXTURE_BC4;
+        if (components == 2)
+            return TEXTURE_BC5;
+        if (gamma && !compressSrgb)
+            return TEXTURE_UNCOMPRESSED;    // BC1 and BC3 would need the sRGB formats of EXT_texture_sRGB
+        if (components == 4)
+        {
+            for (size_t i = 0; i < texels; i++)
+                if (pixels[i * 4 + 3] != 255)
+                    return TEXTURE_BC3;
+        }
+        return TEXTURE_BC1;
+    }
+
+    static uint64_t levelBytes(TextureBlockFormat format, int components, unsigned int width, unsigned int height)
+    {
+        if (format == TEXTURE_UNCOMPRESSED)
+            return (uint64_t)width * height * components;
+        uint64_t blocks = (uint64_t)((width + 3) / 4) * ((height + 3) / 4);
+        return blocks * (format == TEXTURE_BC1 || format == TEXTURE_BC4 ? 8 : 16);
+    }
+
+    // fills the level table of texture from its file image, in storage or mapped
+    static void describe(BakedTexture& texture)
+    {
+        const unsigned char* base = texture.file ? texture.file->data() : texture.storage.data();
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        const LevelRecord* records = (const LevelRecord*)(base + sizeof(Header));
+        texture.format = (TextureBlockFormat)header.format;
+        texture.components = (int)header.components;
+        texture.gamma = header.gamma != 0;
+        texture.levels.resize(header.levelCount);
+        for (uint32_t level = 0; level < header.levelCount; level++)
+        {
+            BakedTexture::Level& target = texture.levels[level];
+            target.width = records[level].width;
+            target.height = records[level].height;
+            target.data = base + records[level].offset;
+            target.bytes = (size_t)records[level].bytes;
+        }
+    }
+
+    // Float::WIDTH blocks from block bx, by on: gathered as floats (texels past the edge repeat the
+    // last row or column, missing channels repeat the first, alpha is opaque) and encoded
+    template <typename Float>
+    static void encodeBlocks(const unsigned char* pixels, unsigned int width, unsigned int height, int components, TextureBlockFormat format,
+        unsigned int bx, unsigned int by, unsigned char* out)
+    {
+        TexelBlocks<Float> blocks;
+        for (int l = 0; l < Float::WIDTH; l++)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                unsigned int px = std::min((bx + l) * 4 + (i & 3), width - 1), py = std::min(by * 4 + (i >> 2), height - 1);
+                const unsigned char* texel = pixels + ((size_t)py * width + px) * components;
+                for (int c = 0; c < 4; c++)
+                    blocks.channel[c][i][l] = c < components ? texel[c] : (c == 3 ? 255.0f : texel[0]);
+            }
+        }
+        if (format == TEXTURE_BC1)
+            BlockEncoder::encodeBC1(blocks, out, 8);
+        else if (format == TEXTURE_BC3)
+            BlockEncoder::encodeBC3(blocks, out);
+        else if (format == TEXTURE_BC4)
+            BlockEncoder::encodeBC4(blocks, 0, out, 8);
+        else
+            BlockEncoder::encodeBC5(blocks, out);
+    }
+
+    // 2x2 box filter (a single row or column when the other side is already 1); sRGB colors are averaged in linear space
+    static void downsample(const unsigned char* source, unsigned int width, unsigned int height, int components, bool gamma,
+        unsigned char* target, unsigned int targetWidth, unsigned int targetHeight, ThreadPool* pool)
+    {
+        const float* toLinear = srgbToLinearTable();
+        const unsigned char* toSrgb = linearToSrgbTable();
+        int colorChannels = gamma && components >= 3 ? 3 : 0;
+        auto rows = [=](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++)
+            {
+                unsigned int y0 = std::min((unsigned int)y * 2, height - 1), y1 = std::min((unsigned int)y * 2 + 1, height - 1);
+                for (unsigned int x = 0; x < targetWidth; x++)
+                {
+                    unsigned int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                    const unsigned char* texels[4] = {
+                        source + ((size_t)y0 * width + x0) * components, source + ((size_t)y0 * width + x1) * components,
+                        source + ((size_t)y1 * width + x0) * components, source + ((size_t)y1 * width + x1) * components };
+                    unsigned char* out = target + ((size_t)y * targetWidth + x) * components;
+                    for (int c = 0; c < components; c++)
+                    {
+                        if (c < colorChannels)
+                        {
+                            float sum = toLinear[texels[0][c]] + toLinear[texels[1][c]] + toLinear[texels[2][c]] + toLinear[texels[3][c]];
+                            out[c] = toSrgb[(int)(sum * 0.25f * 4095.0f + 0.5f)];
+                        }
+                        else
+                            out[c] = (unsigned char)((texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c] + 2) / 4);
+                    }
+                }
+            }
+        };
+        if (pool && targetHeight > 1)
+            pool->parallelFor(targetHeight, rows, 16);
+        else
+            rows(0, targetHeight);
+    }
+
+    static const float* srgbToLinearTable()
+    {
+        static const std::vector<float> table = [] {
+            std::vector<float> values(256);
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+    // indexed by linear * 4095
+    static const unsigned char* linearToSrgbTable()
+    {
+        static const std::vector<unsigned char> table = [] {
+            std::vector<unsigned char> values(4096);
+            for (int i = 0; i < 4096; i++)
+            {
+                float c = i / 4095.0f;
+                float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+                values[i] = (unsigned char)(std::min(std::max(s, 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#pragma once
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include "Profiler.h"
+#include "stb_image.h"
+#include "TextureLoader.h"
+
+unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma = false);
+
+//Process-wide texture cache shared by every Model. Textures are keyed by their canonical absolute
+//path plus the gamma flag, so two models (or two materials) that reference the same image decode
+//and upload it only once. Entries are reference counted; the GL texture is deleted when the last
+//user releases it. Misses go through the asynchronous TextureLoader, so acquire() never blocks on a decode.
+class TextureCache
+{
+public:
+    typedef unsigned int (*LoadFunction)(const std::string& path, bool gamma);
+    typedef void (*DeleteFunction)(unsigned int id);
+
+    unsigned int hits = 0;      // acquire() calls answered from the cache
+    unsigned int misses = 0;    // acquire() calls that had to load the file
+
+    static TextureCache& instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // returns the GL texture for the file, loading it on first use. Every acquire needs a matching release.
+    unsigned int acquire(const std::string& path, bool gamma = false)
+    {
+        std::string& key = aliases[gamma ? path + "|srgb" : path];   //Skip canonicalization for paths seen before
+        if (key.empty())
+            key = makeKey(path, gamma);
+
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            it->second.refCount++;
+            hits++;
+            return it->second.id;
+        }
+        Entry entry;
+        entry.id = loadFunction(path, gamma);
+        entry.refCount = 1;
+        entries.emplace(key, entry);
+        keysById[entry.id] = key;
+        misses++;
+        return entry.id;
+    }
+
+    void release(unsigned int id)
+    {
+        auto key = keysById.find(id);
+        if (key == keysById.end())
+            return;
+        auto it = entries.find(key->second);
+        if (--it->second.refCount == 0)
+        {
+            deleteFunction(id);
+            entries.erase(it);
+            keysById.erase(key);
+        }
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+    // swaps the file loader, e.g. for benchmarks that should not touch the disk or GL. NULL restores the default.
+    void setLoader(LoadFunction load, DeleteFunction unload)
+    {
+        loadFunction = load ? load : loadFile;
+        deleteFunction = unload ? unload : deleteTexture;
+    }
+
+    void clear()
+    {
+        entries.clear();
+        keysById.clear();
+        aliases.clear();
+        hits = misses = 0;
+    }
+
+private:
+    struct Entry
+    {
+        unsigned int id;
+        unsigned int refCount;
+    };
+
+    std::unordered_map<std::string, Entry> entries;             // canonical key -> texture
+    std::unordered_map<unsigned int, std::string> keysById;     // texture -> canonical key, for release()
+    std::unordered_map<std::string, std::string> aliases;       // path as requested -> canonical key
+    LoadFunction loadFunction = loadFile;
+    DeleteFunction deleteFunction = deleteTexture;
+
+    TextureCache() {}
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    static std::string makeKey(const std::string& path, bool gamma)
+    {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(std::filesystem::absolute(path, error), error);
+        std::string key = error ? path : canonical.generic_string();
+#ifdef _WIN32
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+#endif
+        return key + (gamma ? "|srgb" : "|linear");
+    }
+
+    static unsigned int loadFile(const std::string& path, bool gamma)
+    {
+        return TextureLoader::instance().load(path, gamma);
+    }
+
+    static void deleteTexture(unsigned int id)
+    {
+        TextureLoader::instance().unload(id);
+    }
+};
+
+// synchronous load, for callers that need the pixels before the next frame
+unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma)
+{
+    PROFILE_ZONE("TextureFromFile");
+    std::string filename = std::string(path);
+    filename = directory + '/' + filename;
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    int width, height, nrComponents;
+    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    if (data)
+    {
+        GLenum format, internalFormat;
+        if (nrComponents == 1)
+            format = internalFormat = GL_RED;
+        else if (nrComponents == 2)
+            format = internalFormat = GL_RG;
+        else if (nrComponents == 3)
+        {
+            format = GL_RGB;
+            internalFormat = gamma ? GL_SRGB : GL_RGB;
+        }
+        else
+        {
+            format = GL_RGBA;
+            internalFormat = gamma ? GL_SRGB_ALPHA : GL_RGBA;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        stbi_image_free(data);
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        stbi_image_free(data);
+    }
+
+    return textureID;
+}
+
+#endif
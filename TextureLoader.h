@@ -0,0 +1,256 @@
+#pragma once
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Profiler.h"
+#include "stb_image.h"
+#include "TextureBaker.h"
+#include "ThreadPool.h"
+
+//Asynchronous texture loading. load() hands out a GL texture name right away (holding a 1x1 white
+//placeholder), the image file is decoded with stb_image on worker threads, and the decoded pixels
+//come back through a lock-free queue. Only the glTexImage2D upload runs on the GL thread, in pump(),
+//which the render loop calls once per frame.
+//
+//With the TextureBaker enabled (the default) the workers hand back baked textures instead: read from
+//the .rbtex file, or baked from the image on first use. Their mip levels are streamed smallest first,
+//uploadBudget bytes per pump(), so a texture shows a blurry version of itself after the first frame
+//instead of the placeholder, and no frame uploads a 4096x4096 texture and its mips at once.
+class TextureLoader
+{
+public:
+    size_t uploadBudget = 4 << 20;  // bytes of baked mip levels per pump(); at least one level is always uploaded
+
+    explicit TextureLoader(unsigned int threads = 0) : pool(threads) {}
+    ~TextureLoader()
+    {
+        pool.wait();
+        DecodedImage image;
+        while (decoded.pop(image))
+            stbi_image_free(image.data);
+    }
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    static TextureLoader& instance()
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    // GL thread: returns a texture that is usable immediately and gets its real contents once decoded
+    unsigned int load(const std::string& path, bool gamma = false)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        TextureBaker& baker = TextureBaker::instance();
+        baker.init();
+        bool bake = baker.enabled;
+        unsigned int ticket = ++lastTicket;
+        pending[textureID] = ticket;
+        pool.submit([this, path, gamma, textureID, ticket, bake]() {
+            PROFILE_ZONE("TextureLoader::decode");
+            DecodedImage image;
+            image.path = path;
+            image.gamma = gamma;
+            image.textureID = textureID;
+            image.ticket = ticket;
+            if (bake)
+                image.baked = TextureBaker::instance().get(path, gamma, image.texture);
+            else
+                image.data = stbi_load(path.c_str(), &image.width, &image.height, &image.components, 0);
+            decoded.push(std::move(image));
+        });
+        return textureID;
+    }
+
+    // GL thread: deletes the texture; a decode still in flight for it is dropped on arrival
+    void unload(unsigned int textureID)
+    {
+        pending.erase(textureID);
+        streaming.erase(std::remove_if(streaming.begin(), streaming.end(),
+            [textureID](const StreamingTexture& entry) { return entry.textureID == textureID; }), streaming.end());
+        glDeleteTextures(1, &textureID);
+    }
+
+    // GL thread: uploads up to maxUploads decoded images and streams baked mip levels; returns how many
+    // images were uploaded (for a baked texture, when its first levels were)
+    unsigned int pump(unsigned int maxUploads = ~0u)
+    {
+        PROFILE_ZONE("TextureLoader::pump");
+        unsigned int uploaded = 0;
+        DecodedImage image;
+        while (uploaded < maxUploads && decoded.pop(image))
+        {
+            auto it = pending.find(image.textureID);
+            if (it == pending.end() || it->second != image.ticket)
+            {   // unloaded while decoding (the name may even belong to a newer texture by now)
+                stbi_image_free(image.data);
+                continue;
+            }
+            pending.erase(it);
+            if (image.baked)
+                startStreaming(image);
+            else
+                upload(image);
+            stbi_image_free(image.data);
+            uploaded++;
+        }
+        streamLevels();
+        return uploaded;
+    }
+
+    // GL thread: blocks until every requested texture is uploaded, every mip level included
+    void finish()
+    {
+        while (!pending.empty() || !streaming.empty())
+        {
+            if (pump() == 0 && streaming.empty())
+                std::this_thread::yield();
+        }
+    }
+
+    bool isPending(unsigned int textureID) const
+    {
+        return pending.count(textureID) != 0;
+    }
+
+    size_t pendingCount() const
+    {
+        return pending.size();
+    }
+
+    // baked textures that still miss some of their larger mip levels
+    size_t streamingCount() const
+    {
+        return streaming.size();
+    }
+
+    unsigned int threadCount() const
+    {
+        return pool.size();
+    }
+
+private:
+    struct DecodedImage
+    {
+        std::string path;
+        unsigned char* data = nullptr;
+        int width = 0, height = 0, components = 0;
+        bool gamma = false;
+        unsigned int textureID = 0;
+        unsigned int ticket = 0;
+        bool baked = false;         // texture holds the result instead of data
+        BakedTexture texture;
+    };
+    struct StreamingTexture
+    {
+        unsigned int textureID;
+        BakedTexture texture;
+        unsigned int nextLevel;     // the largest level still to upload, counting down to 0
+    };
+
+    ThreadPool pool;
+    MpscQueue<DecodedImage> decoded;
+    std::vector<StreamingTexture> streaming;
+    std::unordered_map<unsigned int, unsigned int> pending;    // texture -> ticket of the decode it waits for
+    unsigned int lastTicket = 0;
+
+    void startStreaming(DecodedImage& image)
+    {
+        glBindTexture(GL_TEXTURE_2D, image.textureID);
+        unsigned int levels = (unsigned int)image.texture.levels.size();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels - 1);
+        // the smallest level right away, so the placeholder is gone after this frame
+        image.texture.upload(levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)levels - 1);
+        if (levels > 1)
+            streaming.push_back(StreamingTexture{ image.textureID, std::move(image.texture), levels - 2 });
+    }
+
+    // uploads the smallest missing levels across all streaming textures until uploadBudget is spent,
+    // lowering each texture's base level as its chain grows, so it is complete at every step
+    void streamLevels()
+    {
+        if (streaming.empty())
+            return;
+        PROFILE_ZONE("TextureLoader::streamLevels");
+        size_t spent = 0;
+        while (!streaming.empty())
+        {
+            size_t smallest = 0;
+            for (size_t i = 1; i < streaming.size(); i++)
+            {
+                if (streaming[i].texture.levels[streaming[i].nextLevel].bytes < streaming[smallest].texture.levels[streaming[smallest].nextLevel].bytes)
+                    smallest = i;
+            }
+            StreamingTexture& entry = streaming[smallest];
+            size_t bytes = entry.texture.levels[entry.nextLevel].bytes;
+            if (spent > 0 && spent + bytes > uploadBudget)
+                break;
+            spent += bytes;
+            glBindTexture(GL_TEXTURE_2D, entry.textureID);
+            entry.texture.upload(entry.nextLevel);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)entry.nextLevel);
+            if (entry.nextLevel-- == 0)
+            {
+                streaming[smallest] = std::move(streaming.back());
+                streaming.pop_back();
+            }
+        }
+    }
+
+    static void upload(const DecodedImage& image)
+    {
+        glBindTexture(GL_TEXTURE_2D, image.textureID);
+        if (!image.data)
+        {
+            std::cout << "Texture failed to load at path: " << image.path << std::endl;
+            return;
+        }
+        GLenum format, internalFormat;
+        if (image.components == 1)
+            format = internalFormat = GL_RED;
+        else if (image.components == 2)
+            format = internalFormat = GL_RG;
+        else if (image.components == 3)
+        {
+            format = GL_RGB;
+            internalFormat = image.gamma ? GL_SRGB : GL_RGB;
+        }
+        else
+        {
+            format = GL_RGBA;
+            internalFormat = image.gamma ? GL_SRGB_ALPHA : GL_RGBA;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // rows of RGB images are not 4-byte aligned
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+};
+
+#endif
@@ -0,0 +1,320 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Profiler.h"
+
+//A fixed set of worker threads that run submitted tasks. Used for work that must stay off the
+//GL thread (texture decoding, model import), for data-parallel loops via parallelFor and for
+//fork/join jobs via TaskGroup.
+//
+//Scheduling is work stealing: every worker has its own deque, a task submitted from a worker goes
+//to the back of that worker's deque and the worker takes its newest task first (still warm in its
+//cache). Tasks from other threads go to a shared injection deque. A worker with nothing left steals
+//the oldest task of another deque, which tends to be the largest piece of a split-up job. A thread
+//that waits for tasks (wait(), TaskGroup waits, parallelFor) runs queued tasks meanwhile instead of
+//blocking, so jobs can wait for jobs they spawned without tying up a worker.
+class ThreadPool
+{
+public:
+    // tasks that can be waited for together; run() adds to it, wait(group) returns once all finished
+    class TaskGroup
+    {
+    public:
+        bool done() const
+        {
+            return pending.load(std::memory_order_acquire) == 0;
+        }
+
+    private:
+        friend class ThreadPool;
+        std::atomic<size_t> pending{ 0 };
+    };
+
+    // exactly this many workers, zero included: then tasks only run on threads that wait for them
+    struct Workers
+    {
+        unsigned int count;
+    };
+
+    // 0 threads means one per hardware thread, minus the caller's
+    explicit ThreadPool(unsigned int threads = 0)
+    {
+        if (threads == 0)
+        {
+            unsigned int hardwareThreads = std::thread::hardware_concurrency();
+            threads = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+        start(threads);
+    }
+    explicit ThreadPool(Workers workers)
+    {
+        start(workers.count);
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeWorkers.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const
+    {
+        return (unsigned int)workers.size();
+    }
+
+    void submit(std::function<void()> task)
+    {
+        push(Task{ std::move(task), nullptr });
+    }
+    void run(TaskGroup& group, std::function<void()> task)
+    {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        push(Task{ std::move(task), &group });
+    }
+
+    // returns when every submitted task has finished, running tasks meanwhile
+    void wait()
+    {
+        waitUntil([this] { return unfinished.load(std::memory_order_acquire) == 0; });
+    }
+    void wait(TaskGroup& group)
+    {
+        waitUntil([&group] { return group.done(); });
+    }
+
+    // runs body(begin, end) over [0, count) in chunks on the workers and the calling thread, and returns when all are done
+    void parallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& body, size_t minChunk = 64)
+    {
+        if (count == 0)
+            return;
+        size_t chunk = std::max(minChunk, count / ((size() + 1) * 4) + 1);
+        size_t chunks = (count + chunk - 1) / chunk;
+        if (chunks == 1 || size() == 0)
+        {
+            body(0, count);
+            return;
+        }
+        // helpers claim chunks from a shared counter; those that only get to run after all chunks were claimed do nothing
+        std::atomic<size_t> next{ 0 };
+        auto claim = [&]() {
+            for (size_t c = next++; c < chunks; c = next++)
+                body(c * chunk, std::min(count, (c + 1) * chunk));
+        };
+        TaskGroup group;
+        size_t helpers = std::min<size_t>(size(), chunks - 1);
+        for (size_t i = 0; i < helpers; i++)
+            run(group, claim);
+        claim();
+        wait(group);
+    }
+
+    // tasks a worker took from another thread's deque, since the pool started
+    uint64_t steals() const
+    {
+        return stolen.load(std::memory_order_relaxed);
+    }
+
+    // a process-wide pool for systems that don't need their own
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    struct Task
+    {
+        std::function<void()> work;
+        TaskGroup* group;
+    };
+    struct Deque
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Deque>> deques;     // one per worker, then the injection deque
+    std::atomic<size_t> queued{ 0 };                // tasks waiting in any deque
+    std::atomic<size_t> unfinished{ 0 };            // tasks submitted and not finished
+    std::atomic<uint64_t> stolen{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wakeWorkers;
+    bool stopping = false;
+
+    // the pool and worker index of the calling thread, if it is a worker
+    struct ThreadSlot
+    {
+        const ThreadPool* pool;
+        unsigned int index;
+    };
+    static ThreadSlot& currentThread()
+    {
+        static thread_local ThreadSlot slot = { nullptr, 0 };
+        return slot;
+    }
+    unsigned int ownDeque() const
+    {
+        const ThreadSlot& slot = currentThread();
+        return slot.pool == this ? slot.index : size();
+    }
+
+    void start(unsigned int threads)
+    {
+        for (unsigned int i = 0; i <= threads; i++)
+            deques.emplace_back(new Deque());
+        for (unsigned int i = 0; i < threads; i++)
+            workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    void push(Task task)
+    {
+        unfinished.fetch_add(1, std::memory_order_relaxed);
+        Deque& deque = *deques[ownDeque()];
+        {
+            std::lock_guard<std::mutex> lock(deque.mutex);
+            deque.tasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);    // a worker between its check and its sleep can't miss this
+        }
+        wakeWorkers.notify_one();
+    }
+
+    // own deque newest first, then the injection deque and the other workers oldest first; false when all were empty
+    bool runOne(unsigned int self)
+    {
+        if (queued.load(std::memory_order_acquire) == 0)
+            return false;
+        Task task;
+        bool found = false;
+        unsigned int count = (unsigned int)deques.size();
+        for (unsigned int n = 0; n < count && !found; n++)
+        {
+            unsigned int victim = (self + n) % count;
+            Deque& deque = *deques[victim];
+            std::lock_guard<std::mutex> lock(deque.mutex);
+            if (deque.tasks.empty())
+                continue;
+            if (n == 0 && victim < size())
+            {
+                task = std::move(deque.tasks.back());
+                deque.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(deque.tasks.front());
+                deque.tasks.pop_front();
+                if (victim < size() && self < size())
+                    stolen.fetch_add(1, std::memory_order_relaxed);
+            }
+            found = true;
+        }
+        if (!found)
+            return false;
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        task.work();
+        if (task.group)
+            task.group->pending.fetch_sub(1, std::memory_order_release);
+        unfinished.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename Condition>
+    void waitUntil(Condition finished)
+    {
+        unsigned int self = ownDeque();
+        while (!finished())
+            if (!runOne(self))
+                std::this_thread::yield();
+    }
+
+    void workerLoop(unsigned int index)
+    {
+        currentThread() = ThreadSlot{ this, index };
+        PROFILE_THREAD("worker " + std::to_string(index));
+        for (;;)
+        {
+            if (runOne(index))
+                continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeWorkers.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+            if (stopping && queued.load(std::memory_order_acquire) == 0)
+                return;
+        }
+    }
+};
+
+// Multi-producer, single-consumer queue without locks: producers push with a CAS on the head,
+// the consumer takes the whole list at once with an exchange and restores FIFO order.
+template <typename T>
+class MpscQueue
+{
+public:
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value))
+            ;
+    }
+
+    void push(T value)
+    {
+        Node* node = new Node{ std::move(value), head.load(std::memory_order_relaxed) };
+        while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    // consumer thread only
+    bool pop(T& value)
+    {
+        if (!pending)
+        {
+            Node* list = head.exchange(nullptr, std::memory_order_acquire);
+            while (list)    // reverse the LIFO chain into arrival order
+            {
+                Node* next = list->next;
+                list->next = pending;
+                pending = list;
+                list = next;
+            }
+            if (!pending)
+                return false;
+        }
+        Node* node = pending;
+        pending = node->next;
+        value = std::move(node->value);
+        delete node;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        T value;
+        Node* next;
+    };
+    std::atomic<Node*> head{ nullptr };
+    Node* pending = nullptr;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <string>
+
+//Per-frame state that every program needs (camera matrices, lights) lives in uniform buffer objects
+//instead of plain uniforms. Each block is bound to a fixed binding point, uploaded once per frame
+//and read by every Shader that declares it, no matter how many programs are in use.
+
+#define NR_POINT_LIGHTS 4
+#define MAX_BONES 100   // matrices in the "Bones" block, as in modelLoading.vert
+
+// fixed binding points, Shader connects blocks with these names automatically after linking
+enum UniformBlockBinding
+{
+    FRAME_BLOCK_BINDING = 0,    // "Frame": projection, view, viewPos
+    LIGHTS_BLOCK_BINDING = 1,   // "Lights": dirLight, pointLights[NR_POINT_LIGHTS]
+    CLUSTERS_BLOCK_BINDING = 2, // "Clusters": the froxel grid of LightClusters.h
+    BONES_BLOCK_BINDING = 3     // "Bones": the palette of one skinned character, see BonePalettes
+};
+
+inline GLint uniformBlockBinding(const std::string& blockName)
+{
+    if (blockName == "Frame")
+        return FRAME_BLOCK_BINDING;
+    if (blockName == "Lights")
+        return LIGHTS_BLOCK_BINDING;
+    if (blockName == "Clusters")
+        return CLUSTERS_BLOCK_BINDING;
+    if (blockName == "Bones")
+        return BONES_BLOCK_BINDING;
+    return -1;
+}
+
+// The structs below mirror the std140 layout of the GLSL blocks: a vec3 takes 16 bytes unless a float
+// follows it, in which case the float fills the last 4 bytes. Keep both sides in sync.
+struct FrameUBO
+{
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPos;
+    float padding0;
+};
+
+struct DirLightUBO
+{
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+struct PointLightUBO
+{
+    glm::vec3 position;
+    float constant;
+    glm::vec3 ambient;
+    float linear;
+    glm::vec3 diffuse;
+    float quadratic;
+    glm::vec3 specular;
+    float padding0;
+};
+
+struct LightsUBO
+{
+    DirLightUBO dirLight;
+    PointLightUBO pointLights[NR_POINT_LIGHTS];
+};
+
+// how a fragment finds its cluster, see LightClusters.h
+struct ClustersUBO
+{
+    glm::uvec4 dims;    // tiles across, tiles down, depth slices, lights
+    glm::vec4 params;   // tile width and height in pixels, slice scale and bias: slice = log(depth) * scale + bias
+};
+
+static_assert(sizeof(FrameUBO) == 144, "FrameUBO must match the std140 Frame block");
+static_assert(sizeof(DirLightUBO) == 64, "DirLightUBO must match the std140 DirLight struct");
+static_assert(sizeof(PointLightUBO) == 64, "PointLightUBO must match the std140 PointLight struct");
+static_assert(sizeof(ClustersUBO) == 32, "ClustersUBO must match the std140 Clusters block");
+
+// Owns one uniform buffer bound to a fixed binding point. Edit 'data' freely during the frame
+// and call update() once; the whole block goes to the GPU in a single glBufferSubData.
+template <typename T>
+class UniformBuffer
+{
+public:
+    unsigned int ID;
+    GLuint binding;
+    T data;
+
+    UniformBuffer(GLuint bindingPoint) : binding(bindingPoint), data()
+    {
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+    }
+    ~UniformBuffer()
+    {
+        glDeleteBuffers(1, &ID);
+    }
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    void update()
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+};
+
+#endif
@@ -1,4 +1,5 @@
 #define STB_IMAGE_IMPLEMENTATION
+#include <cstdio>
 #include <iostream>
 
 #include <glad/glad.h>
@@ -8,8 +9,22 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "Shader.h"
+#include "ShaderCache.h"
+#include "ShaderLibrary.h"
+#include "UniformBuffer.h"
 #include "Camera.h"
 #include "Model.h"
+#include "ModelLoader.h"
+#include "Frustum.h"
+#include "FramePipeline.h"
+#include "GpuProfiler.h"
+#include "Physics.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "TextureBaker.h"
+#include "Benchmark.h"
+#include "Headless.h"
 #include "stb_image.h"
 
 using namespace std;
@@ -23,10 +38,13 @@ unsigned int loadTexture(const char* path);
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
-//Move and rotate control
-float moveX, moveY, moveZ = 0.0f;
-float rotateX, rotateY, rotateZ = 0.0f;
-float angleX, angleY, angleZ = 0.0f;
+//The ball is a rigid sphere in the physics world; the keys push it and it rolls on its own
+PhysicsWorld physics;
+uint32_t ball = 0;
+bool ballLoaded = false;            //The body exists once the ball's model is resident
+const float BALL_SCALE = 0.03f;     //The model is a bit too big for our scene
+const float BALL_PUSH = 4.0f;       //Force of the WASD keys
+const float BALL_JUMP = 3.0f;       //Upward speed given by SPACE
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -39,42 +57,19 @@ bool firstMouse = true;
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
 
-
-unsigned int loadTexture(char const* path)
+//What the worker threads prepare for a frame and the GL thread then draws, see FramePipeline.h
+struct FrameData
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    float deltaTime = 0.0f;
+    FrameUBO camera;                        //Camera of the frame, uploaded as it is
+    std::vector<glm::mat4> meshModels;      //Where each mesh of the ball is, from the scene graph
+    std::vector<uint32_t> visible;          //Meshes of the ball in view
+};
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
 
-    return textureID;
+unsigned int loadTexture(char const* path)
+{
+    return TextureLoader::instance().load(path);  //Decoded on a worker thread, uploaded by pump() in the render loop
 }
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height); //For resizing the window for any size the user wants
@@ -84,60 +79,24 @@ void processInput(GLFWwindow* window)   //
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true); //When ESC pressed, window should close
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-    {
-
-            moveY += 0.01f;
-        
-    }
-    else if ((glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_RELEASE) && moveY >= 0.0f) {
-        moveY -= 0.01f;
-    }
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
         camera.ProcessKeyboard(DOWN, deltaTime);
+    if (!ballLoaded)
+        return;
+    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && physics.grounded(ball))
+        physics.applyImpulse(ball, glm::vec3(0.0f, BALL_JUMP, 0.0f));   //Jump only from the ground
+
+    //Forces instead of fixed steps per frame, so the speed no longer depends on the frame rate
+    glm::vec3 push(0.0f);
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-    {
-        moveZ -= 0.001f;
-        if (angleZ < 0.5f)
-            angleZ -= 0.001f;
-        else if (angleX == 0.0f)
-            angleZ = 0.5f;
-        else
-            angleZ += 0.001f;
-    }
+        push.z -= 1.0f;
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-    {
-        moveZ += 0.001f;
-        if (angleZ < 0.5f)
-            angleZ += 0.001f;
-        else if (angleX == 0.0f)
-            angleZ = 0.5f;
-        else
-            angleZ -= 0.001f;
-
-    }
+        push.z += 1.0f;
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-    {
-        moveX += 0.001f;
-        if (angleX < 0.5f)
-            angleX -= 0.001f;
-        else if (angleX == 0.0f)
-            angleX = 0.5f;
-        else
-            angleX += 0.001f;
-
-    }
+        push.x += 1.0f;
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-    {
-        moveX -= 0.001f;
-        if (angleX < 0.5f)
-            angleX += 0.001f;
-        else if (angleX == 0.0f)
-            angleX = 0.0f;
-        else
-            angleX -= 0.001f;
-
-    }
+        push.x -= 1.0f;
+    physics.setForce(ball, push * BALL_PUSH);
 }
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
@@ -162,8 +121,19 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
     camera.ProcessMouseMovement(xoffset, yoffset);
 }
-int main() {
-    
+int main(int argc, char* argv[]) {
+
+    if (argc > 2 && std::string(argv[1]) == "--bench")
+        return runBenchmark(argv[2], std::vector<std::string>(argv + 3, argv + argc));   //Offscreen micro-benchmarks, see Benchmark.h
+    if (argc > 1 && std::string(argv[1]) == "--headless")
+    {
+        HeadlessOptions options;    //Scripted frames of the game without a window, see Headless.h
+        if (!parseHeadlessOptions(std::vector<std::string>(argv + 2, argv + argc), options))
+            return -1;
+        return runHeadless(options);
+    }
+
+    PROFILE_THREAD("main");
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);  //We tell that the major and minor version are v3.
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -202,71 +172,174 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
-    // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
-    stbi_set_flip_vertically_on_load(true);
+    ProgramBinaryCache::instance().init((GLADloadproc)glfwGetProcAddress);  //Programs linked on an earlier run load from ./shader-cache
+    // tell stb_image.h to flip loaded texture's on the y-axis (before loading model), through the baker so baked textures match
+    TextureBaker::instance().setFlipVertically(true);
 
     glEnable(GL_DEPTH_TEST); //We should enable the depth test from GLFW library, if we want to use the z-buffer (depth buffer)
     //Without a z-buffer, since OpenGL draws your cube with triangles, newly created triangles could be created on top of each other
     glDepthFunc(GL_LESS);
-    Shader shader("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");
+    ShaderLibrary shaders("./shaders/modelLoading.vert", "./shaders/modelLoading.frag");   //Builds the variants the meshes ask for
+    Shader& shader = shaders.get(ShaderVariant().with(SHADER_DIFFUSE_MAP));
 
     // load models
     // -----------
-    Model ourModel("./models/beach-ball/beachBall.obj");
-
+    // imported on a worker and streamed to the GPU a few MiB per frame, so the window draws right away;
+    // the ball joins the scene once every mesh of it is resident
+    ModelLoader& models = ModelLoader::instance();
+    ModelHandle ballHandle = models.load("./models/beach-ball/beachBall.obj", false, VertexFormat::forShader(shader), false);  //Upload only what modelLoading.vert reads, quantized, and drop the CPU copy
+    Model* ourModel = nullptr;
+    std::vector<Shader*> meshShaders;
+    SceneGraph scene;   //Moving the ball's node moves every mesh below it
+    uint32_t ballNode = 0, modelNode = 0;
+    auto addBall = [&](Model& model) {
+        // every mesh is drawn with the variant for the maps its material has, all compiled before its first frame
+        std::vector<ShaderVariant> meshVariants;
+        for (const Mesh& mesh : model.meshes)
+            meshVariants.push_back(ShaderVariant::forMesh(mesh));
+        shaders.prewarm(meshVariants);
+        for (const ShaderVariant& variant : meshVariants)
+            meshShaders.push_back(&shaders.get(variant));
+
+        // the ball's sphere comes from the model's bounds; it starts resting on the ground at the origin
+        BoundingBox ballBounds = model.bounds();
+        float ballRadius = ballBounds.empty() ? 0.5f : ballBounds.extent().y * BALL_SCALE;
+        physics.groundHeight = -ballRadius;
+        ball = physics.addBody(glm::vec3(0.0f), ballRadius);
+        ballLoaded = true;
+        ourModel = &model;
+
+        // in the scene graph the body's node follows the physics, a fixed pivot below it scales the model down and
+        // centers it on the body, and the model's own nodes hang off the pivot
+        ballNode = scene.add(glm::mat4(1.0f));
+        uint32_t pivot = scene.add(glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(BALL_SCALE)), -ballBounds.center()), ballNode);    //Rotate about the center of the ball
+        modelNode = scene.attach(model.nodes, pivot);
+    };
+
+    // camera state shared by every program through the Frame uniform block
+    UniformBuffer<FrameUBO> frameUniforms(FRAME_BLOCK_BINDING);
+
+    // draws are collected per frame, sorted by program/material/mesh and submitted without redundant binds
+    RenderQueue renderQueue;
+    FrustumCuller culler;   //Meshes outside the camera's view never reach the queue
+
+    // simulation, transforms and culling of the next frame run on worker threads while this one is drawn
+    FramePipeline<FrameData> pipeline;
+    pipeline.simulate = [](FrameData& frame) {
+        physics.update(frame.deltaTime);    //Fixed steps, decoupled from the frame rate
+    };
+    pipeline.transforms = [&](FrameData& frame) {
+        if (!ourModel)
+            return;
+        // the ball where the physics put it, blended between the last two steps; only its subtree is recomputed
+        scene.setLocal(ballNode, physics.transform(ball));
+        scene.update();
+        frame.meshModels.resize(ourModel->meshes.size());
+        for (size_t i = 0; i < ourModel->meshes.size(); i++)
+            frame.meshModels[i] = scene.world(modelNode + ourModel->meshNodes[i]);
+    };
+    pipeline.cull = [&](FrameData& frame) {
+        Frustum frustum = Frustum::fromMatrix(frame.camera.projection * frame.camera.view);
+        culler.clear();
+        if (ourModel)
+            for (size_t i = 0; i < ourModel->meshes.size(); i++)
+                culler.addBox(ourModel->meshes[i].bounds, frame.meshModels[i]);
+        frame.visible = culler.cull(frustum);
+    };
+    auto cameraState = []() {
+        FrameUBO state;
+        state.projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        //camera.Zoom: Adjusts the Field of View (FoV)
+        state.view = camera.GetViewMatrix();
+        state.viewPos = camera.Position;
+        return state;
+    };
+    pipeline.next().camera = cameraState();
+    pipeline.start();
+
+    // stage times shown in the title, averaged over a second
+    FramePipeline<FrameData>::Timings timingSum;
+    double submitSum = 0.0;
+    int timedFrames = 0;
+    float lastTitle = 0.0f;
 
     while (!glfwWindowShouldClose(window))  //glfwWindowShouldClose checks if GLFW told to close.
     {
+        PROFILE_ZONE("frame");
 
         // per-frame time logic
         // --------------------
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-        //input
+
+        FrameData& frame = pipeline.wait();     //Built on the workers while the last frame was drawn
+        //input: the workers are idle now, so it may touch the physics
         processInput(window);
+        TextureLoader::instance().pump();   //Upload the textures decoded since last frame
+        models.pump();                      //Copy the next few MiB of the models streaming in
+        if (!ourModel && models.state(ballHandle) == MODEL_GPU_RESIDENT)
+            addBall(*models.model(ballHandle));     //The workers are idle, so the scene may grow here
+
+        FrameData& next = pipeline.next();
+        next.deltaTime = deltaTime;
+        next.camera = cameraState();
+        pipeline.start();
 
         //rendering
+        double submitStart = glfwGetTime();
+        GPU_BEGIN_FRAME();
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);   //At the start of frame we want to clear the screen. 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);//Otherwise we would still see the results from the previous frame
                                                 //glClearColor: The color to be filled with glClear
                                                 //glClear: We pass in buffer bits to specify which buffer we would like to clear.
                                                 //We want to clear color and depth buffers before each frame is created
-     
-        // don't forget to enable shader before setting uniforms
-        shader.use();
-        // pass projection matrix to shader (note that in this case it could change every frame)
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f); 
-        //camera.Zoom: Adjusts the Field of View (FoV) 
-        glm::mat4 view = camera.GetViewMatrix();
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view);
-        
-        
-
-
-        // render the loaded model
-        glm::mat4 model = glm::mat4(1.0f);
-        
-        model = glm::translate(model, glm::vec3(moveX, moveY, moveZ));
-
-        model = glm::rotate(model, angleZ, glm::vec3(0.5f, rotateY, rotateZ)); // translate it down so it's at the center of the scene
-        model = glm::rotate(model, angleX, glm::vec3(rotateX, rotateY, 0.50f)); // translate it down so it's at the center of the scene
-        
-        model = glm::scale(model, glm::vec3(0.03f, 0.03f, 0.03f));	// it's a bit too big for our scene, so scale it down
-        
-        shader.setMat4("model", model);
-        ourModel.Draw(shader);
-
 
+        frameUniforms.data = frame.camera;
+        frameUniforms.update();     //One upload per frame, shared by every program
+
+        for (uint32_t index : frame.visible)
+            renderQueue.submit(*meshShaders[index], ourModel->meshes[index], frame.meshModels[index]);
+        renderQueue.flush(frame.camera.viewPos);
+        GPU_END_FRAME();
+
+        const FramePipeline<FrameData>::Timings& timings = pipeline.lastTimings();
+        timingSum.simulate += timings.simulate;
+        timingSum.transforms += timings.transforms;
+        timingSum.cull += timings.cull;
+        timingSum.wait += timings.wait;
+        submitSum += (glfwGetTime() - submitStart) * 1000.0;
+        timedFrames++;
+        if (currentFrame - lastTitle >= 1.0f)
+        {
+            char title[160];
+            snprintf(title, sizeof(title), "Rolling Ball 3D - simulate %.2f ms, transforms %.2f ms, cull %.2f ms, wait %.2f ms, submit %.2f ms",
+                timingSum.simulate / timedFrames, timingSum.transforms / timedFrames, timingSum.cull / timedFrames,
+                timingSum.wait / timedFrames, submitSum / timedFrames);
+            glfwSetWindowTitle(window, title);
+            timingSum = FramePipeline<FrameData>::Timings();
+            submitSum = 0.0;
+            timedFrames = 0;
+            lastTitle = currentFrame;
+        }
 
         //check and call events and swap the buffers
-        glfwSwapBuffers(window);
+        {
+            PROFILE_ZONE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
     }
 
+#ifdef PROFILER_ENABLED
+    GpuProfiler::instance().finish();     //The last frames' GPU scopes into the timeline
+    Profiler::instance().writeChromeTrace("profile.json");   //Open in chrome://tracing or ui.perfetto.dev
+    Profiler::instance().printSummary(std::cout);
+#endif
+
 
 
+    models.destroy();   //Its buffers and fences go while the context is still there
     glfwTerminate(); //As soon as the project finished we clean/delete all of the GLFW's resources
 	return 0;
 }
\ No newline at end of file
@@ -12,7 +12,6 @@ struct Material {
 }; 
 
 uniform Material material;
-uniform vec3 viewPos;
 //Directional light
   struct DirLight {
     vec3 direction;
@@ -21,7 +20,6 @@ uniform vec3 viewPos;
     vec3 diffuse;
     vec3 specular;
 };  
-uniform DirLight dirLight;
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir); //Pass the dirLight uniform to a function with the following prototype
 
@@ -42,19 +40,37 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 
 //Point light
 
+//Members are interleaved so that each float fills the padding after a vec3 (std140, see UniformBuffer.h)
 struct PointLight {    
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;  
-
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
 };  
 #define NR_POINT_LIGHTS 4  
-uniform PointLight pointLights[NR_POINT_LIGHTS];
+//Lights actually in use, the first ones of the block; ShaderLibrary variants set their own
+#ifndef POINT_LIGHTS
+#define POINT_LIGHTS NR_POINT_LIGHTS
+#endif
+#ifndef SHADER_VARIANT
+#define DIR_LIGHT
+#endif
+
+//Camera and lights are shared by every program and uploaded once per frame
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+};
 
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir); 
 
@@ -87,9 +103,12 @@ void main()
     vec3 viewDir = normalize(viewPos - FragPos);
 
     // phase 1: Directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    vec3 result = vec3(0.0);
+#ifdef DIR_LIGHT
+    result += CalcDirLight(dirLight, norm, viewDir);
+#endif
     // phase 2: Point lights
-    for(int i = 0; i < NR_POINT_LIGHTS; i++)
+    for(int i = 0; i < POINT_LIGHTS; i++)
         result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
     // phase 3: Spot light
     //result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
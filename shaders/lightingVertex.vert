@@ -9,8 +9,12 @@ out vec3 FragPos;
 out vec2 TexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
 
 
 
@@ -1,11 +1,168 @@
 #version 330 core
+// Variants are built by ShaderLibrary, which puts #defines in front of this file:
+//   DIFFUSE_MAP    base color from texture_diffuse1, otherwise diffuseColor
+//   SPECULAR_MAP   specular color from texture_specular1, otherwise specularColor
+//   POINT_LIGHTS n shades with the first n point lights of the Lights block (0 to NR_POINT_LIGHTS)
+//   DIR_LIGHT      shades with the directional light
+//   CLUSTERED      shades with the lights listed for the fragment's cluster (LightClusters.h)
+// With neither lights nor DIR_LIGHT the base color is written unlit. Built without ShaderLibrary
+// the file is the plain textured shader it always was.
+#ifndef SHADER_VARIANT
+#define DIFFUSE_MAP
+#endif
+#ifndef POINT_LIGHTS
+#define POINT_LIGHTS 0
+#endif
+#if !defined(LIT) && (POINT_LIGHTS > 0 || defined(DIR_LIGHT) || defined(CLUSTERED))
+#define LIT
+#endif
+
 out vec4 FragColor;
 
 in vec2 TexCoords;
+#ifdef LIT
+in vec3 Normal;
+in vec3 FragPos;
+#endif
 
+#ifdef DIFFUSE_MAP
 uniform sampler2D texture_diffuse1;
+#else
+uniform vec3 diffuseColor = vec3(1.0);
+#endif
+
+#ifdef LIT
+#ifdef SPECULAR_MAP
+uniform sampler2D texture_specular1;
+#else
+uniform vec3 specularColor = vec3(0.5);
+#endif
+uniform float shininess = 32.0;
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+//Members are interleaved so that each float fills the padding after a vec3 (std140, see UniformBuffer.h)
+struct PointLight {
+    vec3 position;
+    float constant;
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+};
+#define NR_POINT_LIGHTS 4
+
+//Same block as in lightingFragment.frag; a variant reads only the lights it was built for
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+};
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 base, vec3 specularBase)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    // combine results
+    return light.ambient * base + light.diffuse * diff * base + light.specular * spec * specularBase;
+}
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 base, vec3 specularBase)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    // attenuation
+    float distance    = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // combine results
+    return (light.ambient * base + light.diffuse * diff * base + light.specular * spec * specularBase) * attenuation;
+}
+
+#ifdef CLUSTERED
+uniform samplerBuffer clusterLights;    // two texels per light: position and radius, color
+uniform usamplerBuffer clusterRanges;   // per cluster: first entry in clusterIndices, count
+uniform usamplerBuffer clusterIndices;  // light numbers
+layout (std140) uniform Clusters
+{
+    uvec4 clusterDims;      // tiles across, tiles down, depth slices, lights
+    vec4 clusterParams;     // tile size in pixels, slice = log(depth) * z + w
+};
+
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 base, vec3 specularBase)
+{
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    uvec3 cell = uvec3(uvec2(gl_FragCoord.xy / clusterParams.xy), uint(max(log(depth) * clusterParams.z + clusterParams.w, 0.0)));
+    cell = min(cell, clusterDims.xyz - 1u);
+    uvec2 range = texelFetch(clusterRanges, int((cell.z * clusterDims.y + cell.y) * clusterDims.x + cell.x)).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(clusterLights, 2 * light);
+        vec3 color = texelFetch(clusterLights, 2 * light + 1).rgb;
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        // inverse square, windowed to reach zero at the radius so the cluster bounds are exact
+        float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+        vec3 lightDir = toLight / max(distance, 1e-4);
+        float diff = max(dot(normal, lightDir), 0.0);
+        float spec = pow(max(dot(viewDir, reflect(-lightDir, normal)), 0.0), shininess);
+        result += color * (diff * base + spec * specularBase) * attenuation;
+    }
+    return result;
+}
+#endif
+#endif
 
 void main()
-{    
-    FragColor = texture(texture_diffuse1, TexCoords);
-}
\ No newline at end of file
+{
+#ifdef DIFFUSE_MAP
+    vec4 base = texture(texture_diffuse1, TexCoords);
+#else
+    vec4 base = vec4(diffuseColor, 1.0);
+#endif
+#ifdef LIT
+#ifdef SPECULAR_MAP
+    vec3 specularBase = vec3(texture(texture_specular1, TexCoords));
+#else
+    vec3 specularBase = specularColor;
+#endif
+    vec3 norm = normalize(Normal);
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 result = vec3(0.0);
+#ifdef DIR_LIGHT
+    result += CalcDirLight(dirLight, norm, viewDir, base.rgb, specularBase);
+#endif
+    for (int i = 0; i < POINT_LIGHTS; i++)     // a constant per variant, so the compiler unrolls it
+        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, base.rgb, specularBase);
+#ifdef CLUSTERED
+    result += CalcClusteredLights(norm, FragPos, viewDir, base.rgb, specularBase);
+#endif
+    FragColor = vec4(result, base.a);
+#else
+    FragColor = base;
+#endif
+}
@@ -1,16 +1,115 @@
 #version 330 core
+// Variants are built by ShaderLibrary, which puts #defines in front of this file:
+//   INSTANCED      a mat4 per instance at locations 7-10 (InstanceBuffer, INSTANCE_LAYOUT_MATRIX)
+//   INSTANCED_TRS  position/scale and a rotation quaternion at 7-8 (INSTANCE_LAYOUT_TRS)
+//   SKINNED        up to 4 bones per vertex from the character's palette (BonePalettes in Animation.h): the
+//                  Bones block for a single draw, the bonePalettes texture buffer for an instanced one
+//   LIT            also passes the world position and normal on for lighting
+// Normals go through the inverse transpose of the model matrix, which the CPU computes once per draw
+// (normalMatrix, meshNormalMatrix); only the per-instance transforms are handled here.
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+#ifdef SKINNED
+layout (location = 5) in ivec4 aBoneIds;
+layout (location = 6) in vec4 aWeights;
+#if defined(INSTANCED) || defined(INSTANCED_TRS)
+// every character's palette in one RGBA32F texture buffer, a matrix in 4 texels; instance i is character paletteBase + i
+uniform samplerBuffer bonePalettes;
+uniform int paletteBase;
+uniform int paletteTexels;  // texels from one palette to the next
+mat4 bone(int id)
+{
+    int texel = (paletteBase + gl_InstanceID) * paletteTexels + id * 4;
+    return mat4(texelFetch(bonePalettes, texel), texelFetch(bonePalettes, texel + 1), texelFetch(bonePalettes, texel + 2), texelFetch(bonePalettes, texel + 3));
+}
+#else
+#ifndef MAX_BONES
+#define MAX_BONES 100
+#endif
+layout (std140) uniform Bones
+{
+    mat4 bones[MAX_BONES];
+};
+mat4 bone(int id)
+{
+    return bones[id];
+}
+#endif
+#endif
+#if defined(INSTANCED_TRS)
+layout (location = 7) in vec4 aInstancePositionScale;  // xyz position, w uniform scale
+layout (location = 8) in vec4 aInstanceRotation;       // unit quaternion
+#elif defined(INSTANCED)
+layout (location = 7) in mat4 aInstanceModel;   // locations 7-10, one matrix per instance
+// the normal matrix of an instance up to a positive factor, which the fragment shader normalizes away:
+// its cofactor matrix, three cross products instead of an inverse
+mat3 cofactor(mat4 m)
+{
+    mat3 c = mat3(cross(m[1].xyz, m[2].xyz), cross(m[2].xyz, m[0].xyz), cross(m[0].xyz, m[1].xyz));
+    return dot(m[0].xyz, c[0]) < 0.0 ? -c : c;     // a mirroring matrix has a negative determinant
+}
+#else
+uniform mat4 model;
+uniform mat3 normalMatrix = mat3(1.0);     // transpose(inverse(mat3(model))), see Shader::setModel
+#endif
+#if (defined(INSTANCED) || defined(INSTANCED_TRS)) && !defined(SKINNED)
+// where the mesh sits in its model (Model::meshTransform), under the instance transform; bones place skinned meshes
+uniform mat4 meshTransform = mat4(1.0);
+uniform mat3 meshNormalMatrix = mat3(1.0);
+#endif
 
 out vec2 TexCoords;
+#ifdef LIT
+out vec3 Normal;
+out vec3 FragPos;
+#endif
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+#ifdef INSTANCED_TRS
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+#endif
 
 void main()
 {
-    TexCoords = aTexCoords;    
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    vec4 position = vec4(aPos, 1.0);
+    vec3 normal = aNormal;
+#ifdef SKINNED
+    mat4 skin = mat4(0.0);
+    for (int i = 0; i < 4; i++)
+        skin += bone(aBoneIds[i]) * aWeights[i];
+    position = skin * position;
+    normal = mat3(skin) * normal;
+#elif defined(INSTANCED) || defined(INSTANCED_TRS)
+    position = meshTransform * position;
+    normal = meshNormalMatrix * normal;
+#endif
+
+#if defined(INSTANCED_TRS)
+    vec3 worldPos = rotate(aInstanceRotation, position.xyz * aInstancePositionScale.w) + aInstancePositionScale.xyz;
+    vec3 worldNormal = rotate(aInstanceRotation, normal);   // InstanceTRS scales uniformly
+#else
+#ifdef INSTANCED
+    mat4 model = aInstanceModel;
+    mat3 normalMatrix = cofactor(model);
+#endif
+    vec3 worldPos = vec3(model * position);
+    vec3 worldNormal = normalMatrix * normal;
+#endif
+
+    TexCoords = aTexCoords;
+#ifdef LIT
+    FragPos = worldPos;
+    Normal = worldNormal;
+#endif
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}